@@ -130,30 +130,18 @@ GSList *at_util_parse_clcc(GAtResult *result, unsigned int *ret_mpty_ids)
 		const char *str = "";
 		int number_type = 129;
 
-		if (!g_at_result_iter_next_number(&iter, &id))
+		/* Number and its type are optional */
+		if (g_at_result_iter_scan(&iter, "%d,%d,%d,%d,%d,%s,%d",
+						&id, &dir, &status, &type,
+						&mpty, &str, &number_type) < 5)
 			continue;
 
 		if (id == 0)
 			continue;
 
-		if (!g_at_result_iter_next_number(&iter, &dir))
-			continue;
-
-		if (!g_at_result_iter_next_number(&iter, &status))
-			continue;
-
 		if (status > 5)
 			continue;
 
-		if (!g_at_result_iter_next_number(&iter, &type))
-			continue;
-
-		if (!g_at_result_iter_next_number(&iter, &mpty))
-			continue;
-
-		if (g_at_result_iter_next_string(&iter, &str))
-			g_at_result_iter_next_number(&iter, &number_type);
-
 		call = g_try_new(struct ofono_call, 1);
 		if (call == NULL)
 			break;
@@ -98,6 +98,9 @@ static const char *setup_rawip(struct ofono_gprs_context *gc)
 	if (getenv("OFONO_IP_DEBUG"))
 		g_at_rawip_set_debug(gcd->rawip, rawip_debug, "IP");
 
+	if (getenv("OFONO_DATA_THREAD"))
+		g_at_rawip_set_threaded(gcd->rawip, TRUE);
+
 	g_at_rawip_open(gcd->rawip);
 
 	return g_at_rawip_get_interface(gcd->rawip);
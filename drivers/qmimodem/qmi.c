@@ -26,6 +26,7 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -36,6 +37,16 @@
 #include "qmi.h"
 #include "ctl.h"
 
+/* Requests written per G_IO_OUT wakeup before yielding to the main loop */
+#define QMI_WRITE_BUDGET	8
+
+/* Grown on demand up to the largest QMUX frame */
+#define QMI_RX_BUFFER_SIZE	4096
+
+/* Written requests are looked up by what the response echoes back */
+#define REQUEST_KEY(service, client, tid) \
+	GUINT_TO_POINTER((service) | (client) << 8 | (tid) << 16)
+
 typedef void (*qmi_message_func_t)(uint16_t message, uint16_t length,
 					const void *buffer, void *user_data);
 
@@ -46,9 +57,13 @@ struct qmi_device {
 	bool close_on_unref;
 	guint read_watch;
 	guint write_watch;
+	unsigned char *rx_buf;		/* Frames not yet handled */
+	size_t rx_len;
+	size_t rx_size;
 	GQueue *req_queue;
-	GQueue *control_queue;
-	GQueue *service_queue;
+	GHashTable *pending;		/* Written, waiting for a response */
+	GHashTable *queue_stats;	/* Per service type */
+	unsigned int default_window;
 	uint8_t next_control_tid;
 	uint16_t next_service_tid;
 	qmi_debug_func_t debug_func;
@@ -89,11 +104,13 @@ struct qmi_result {
 
 struct qmi_request {
 	uint16_t tid;
+	uint8_t service;
 	uint8_t client;
 	void *buf;
 	size_t len;
 	qmi_message_func_t callback;
 	void *user_data;
+	struct qmi_queue_stats *stats;
 };
 
 struct qmi_notify {
@@ -166,6 +183,7 @@ static struct qmi_request *__request_alloc(uint8_t service,
 		return NULL;
 	}
 
+	req->service = service;
 	req->client = client;
 
 	hdr = req->buf;
@@ -590,40 +608,143 @@ static void __debug_device(struct qmi_device *device,
 	device->debug_func(strbuf, device->debug_data);
 }
 
+static struct qmi_queue_stats *__queue_stats(struct qmi_device *device,
+								uint8_t type)
+{
+	struct qmi_queue_stats *stats;
+
+	stats = g_hash_table_lookup(device->queue_stats,
+						GUINT_TO_POINTER(type));
+	if (stats)
+		return stats;
+
+	stats = g_new0(struct qmi_queue_stats, 1);
+
+	/* Control requests are rare and needed to make progress */
+	if (type != QMI_SERVICE_CONTROL)
+		stats->window = device->default_window;
+
+	g_hash_table_insert(device->queue_stats, GUINT_TO_POINTER(type),
+								stats);
+
+	return stats;
+}
+
+static bool __request_writable(struct qmi_device *device,
+					const struct qmi_request *req)
+{
+	const struct qmi_queue_stats *stats = req->stats;
+
+	if (stats->window && stats->in_flight >= stats->window)
+		return false;
+
+	/*
+	 * After a wrap the transaction id may still belong to a request
+	 * waiting for its response, hold this one back until that is done.
+	 */
+	return !g_hash_table_contains(device->pending,
+			REQUEST_KEY(req->service, req->client, req->tid));
+}
+
+/* Skip transaction ids that are still waiting for a response */
+static uint8_t __next_control_tid(struct qmi_device *device)
+{
+	unsigned int tries;
+	uint8_t tid = 0;
+
+	for (tries = 0; tries < 255; tries++) {
+		if (device->next_control_tid < 1)
+			device->next_control_tid = 1;
+
+		tid = device->next_control_tid++;
+
+		if (!g_hash_table_contains(device->pending,
+				REQUEST_KEY(QMI_SERVICE_CONTROL, 0x00, tid)))
+			break;
+	}
+
+	return tid;
+}
+
+static uint16_t __next_service_tid(struct qmi_device *device,
+					uint8_t type, uint8_t client_id)
+{
+	unsigned int tries;
+	uint16_t tid = 0;
+
+	for (tries = 0; tries < 65280; tries++) {
+		if (device->next_service_tid < 256)
+			device->next_service_tid = 256;
+
+		tid = device->next_service_tid++;
+
+		if (!g_hash_table_contains(device->pending,
+				REQUEST_KEY(type, client_id, tid)))
+			break;
+	}
+
+	return tid;
+}
+
 static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
 	struct qmi_device *device = user_data;
-	struct qmi_mux_hdr *hdr;
+	unsigned int budget = QMI_WRITE_BUDGET;
+	struct qmi_queue_stats *stats;
 	struct qmi_request *req;
 	ssize_t bytes_written;
+	GList *list, *next;
+
+	list = g_queue_peek_head_link(device->req_queue);
+
+	/*
+	 * Each write is one QMI message, so keep writing them while the
+	 * device takes them.  Requests of a service with a full window, or
+	 * with a transaction id still in flight, are skipped and the ones
+	 * behind them go ahead.
+	 */
+	for (; list && budget > 0; list = next) {
+		next = list->next;
+		req = list->data;
 
-	req = g_queue_pop_head(device->req_queue);
-	if (!req)
-		return FALSE;
+		if (!__request_writable(device, req))
+			continue;
 
-	bytes_written = write(device->fd, req->buf, req->len);
-	if (bytes_written < 0)
-		return FALSE;
+		bytes_written = write(device->fd, req->buf, req->len);
+		if (bytes_written < 0)
+			return errno == EAGAIN;
 
-	__hexdump('>', req->buf, bytes_written,
+		__hexdump('>', req->buf, bytes_written,
 				device->debug_func, device->debug_data);
 
-	__debug_msg(' ', req->buf, bytes_written,
+		__debug_msg(' ', req->buf, bytes_written,
 				device->debug_func, device->debug_data);
 
-	hdr = req->buf;
+		g_queue_delete_link(device->req_queue, list);
 
-	if (hdr->service == QMI_SERVICE_CONTROL)
-		g_queue_push_tail(device->control_queue, req);
-	else
-		g_queue_push_tail(device->service_queue, req);
+		g_hash_table_insert(device->pending,
+				REQUEST_KEY(req->service, req->client, req->tid),
+				req);
 
-	g_free(req->buf);
-	req->buf = NULL;
+		stats = req->stats;
+		stats->queued -= 1;
+		stats->in_flight += 1;
+		stats->sent += 1;
 
-	if (g_queue_get_length(device->req_queue) > 0)
-		return TRUE;
+		if (stats->in_flight > stats->max_in_flight)
+			stats->max_in_flight = stats->in_flight;
+
+		g_free(req->buf);
+		req->buf = NULL;
+
+		budget -= 1;
+	}
+
+	/* Held back requests get written once a response frees a slot */
+	for (; list; list = list->next)
+		if (__request_writable(device, list->data))
+			return TRUE;
 
 	return FALSE;
 }
@@ -648,13 +769,43 @@ static void wakeup_writer(struct qmi_device *device)
 static void __request_submit(struct qmi_device *device,
 				struct qmi_request *req, uint16_t transaction)
 {
+	struct qmi_queue_stats *stats = __queue_stats(device, req->service);
+
 	req->tid = transaction;
+	req->stats = stats;
+
+	stats->queued += 1;
+
+	if (stats->queued > stats->max_queued)
+		stats->max_queued = stats->queued;
 
 	g_queue_push_tail(device->req_queue, req);
 
 	wakeup_writer(device);
 }
 
+static struct qmi_request *__request_complete(struct qmi_device *device,
+					uint8_t service, uint8_t client,
+					uint16_t tid)
+{
+	gpointer key = REQUEST_KEY(service, client, tid);
+	struct qmi_request *req;
+
+	req = g_hash_table_lookup(device->pending, key);
+	if (!req)
+		return NULL;
+
+	g_hash_table_steal(device->pending, key);
+
+	req->stats->in_flight -= 1;
+
+	/* A window slot or a transaction id opened up */
+	if (!g_queue_is_empty(device->req_queue))
+		wakeup_writer(device);
+
+	return req;
+}
+
 static void service_notify(gpointer key, gpointer value, gpointer user_data)
 {
 	struct qmi_service *service = value;
@@ -714,7 +865,6 @@ static void handle_packet(struct qmi_device *device,
 		const struct qmi_control_hdr *control = buf;
 		const struct qmi_message_hdr *msg;
 		unsigned int tid;
-		GList *list;
 
 		/* Ignore control messages with client identifier */
 		if (hdr->client != 0x00)
@@ -735,19 +885,14 @@ static void handle_packet(struct qmi_device *device,
 			return;
 		}
 
-		list = g_queue_find_custom(device->control_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-		if (!list)
+		req = __request_complete(device, hdr->service, hdr->client,
+									tid);
+		if (!req)
 			return;
-
-		req = list->data;
-
-		g_queue_delete_link(device->control_queue, list);
 	} else {
 		const struct qmi_service_hdr *service = buf;
 		const struct qmi_message_hdr *msg;
 		unsigned int tid;
-		GList *list;
 
 		msg = buf + QMI_SERVICE_HDR_SIZE;
 
@@ -764,14 +909,10 @@ static void handle_packet(struct qmi_device *device,
 			return;
 		}
 
-		list = g_queue_find_custom(device->service_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-		if (!list)
+		req = __request_complete(device, hdr->service, hdr->client,
+									tid);
+		if (!req)
 			return;
-
-		req = list->data;
-
-		g_queue_delete_link(device->service_queue, list);
 	}
 
 	if (req->callback)
@@ -780,44 +921,70 @@ static void handle_packet(struct qmi_device *device,
 	__request_free(req, NULL);
 }
 
+static size_t frame_length(const struct qmi_mux_hdr *hdr)
+{
+	size_t len;
+
+	/* Check for fixed frame and flags value */
+	if (hdr->frame != 0x01 || hdr->flags != 0x80)
+		return 0;
+
+	len = GUINT16_FROM_LE(hdr->length) + 1;
+
+	if (len < QMI_MUX_HDR_SIZE)
+		return 0;
+
+	return len;
+}
+
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
 	struct qmi_device *device = user_data;
 	struct qmi_mux_hdr *hdr;
-	unsigned char buf[2048];
+	unsigned char *buf;
 	ssize_t bytes_read;
-	uint16_t offset;
+	size_t offset;
+	size_t len = 0;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
 
-	bytes_read = read(device->fd, buf, sizeof(buf));
+	bytes_read = read(device->fd, device->rx_buf + device->rx_len,
+					device->rx_size - device->rx_len);
 	if (bytes_read < 0)
 		return TRUE;
 
-	__hexdump('<', buf, bytes_read,
+	__hexdump('<', device->rx_buf + device->rx_len, bytes_read,
 				device->debug_func, device->debug_data);
 
-	offset = 0;
+	device->rx_len += bytes_read;
 
-	while (offset < bytes_read) {
-		uint16_t len;
+	/* A callback might drop the last reference */
+	qmi_device_ref(device);
 
-		/* Check if QMI mux header fits into packet */
-		if (bytes_read - offset < QMI_MUX_HDR_SIZE)
-			break;
+	buf = device->rx_buf;
+	offset = 0;
 
-		hdr = (void *) (buf + offset);
+	/*
+	 * Frames are handed over straight from the receive buffer, a frame
+	 * split across reads waits there for the rest of it
+	 */
+	while (device->rx_len - offset >= QMI_MUX_HDR_SIZE) {
+		const unsigned char *next;
 
-		/* Check for fixed frame and flags value */
-		if (hdr->frame != 0x01 || hdr->flags != 0x80)
-			break;
+		hdr = (void *) (buf + offset);
 
-		len = GUINT16_FROM_LE(hdr->length) + 1;
+		len = frame_length(hdr);
+		if (!len) {
+			/* Lost sync, skip to the next frame marker */
+			next = memchr(buf + offset + 1, 0x01,
+					device->rx_len - offset - 1);
+			offset = next ? (size_t) (next - buf) : device->rx_len;
+			continue;
+		}
 
-		/* Check that packet size matches frame size */
-		if (bytes_read - offset < len)
+		if (device->rx_len - offset < len)
 			break;
 
 		__debug_msg(' ', buf + offset, len,
@@ -826,8 +993,22 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 		handle_packet(device, hdr, buf + offset + QMI_MUX_HDR_SIZE);
 
 		offset += len;
+		len = 0;
 	}
 
+	device->rx_len -= offset;
+
+	if (device->rx_len > 0 && offset > 0)
+		memmove(buf, buf + offset, device->rx_len);
+
+	/* Make room for a frame bigger than anything seen so far */
+	if (len > device->rx_size) {
+		device->rx_buf = g_realloc(device->rx_buf, len);
+		device->rx_size = len;
+	}
+
+	qmi_device_unref(device);
+
 	return TRUE;
 }
 
@@ -888,9 +1069,13 @@ struct qmi_device *qmi_device_new(int fd)
 
 	g_io_channel_unref(device->io);
 
+	device->rx_buf = g_malloc(QMI_RX_BUFFER_SIZE);
+	device->rx_size = QMI_RX_BUFFER_SIZE;
+
 	device->req_queue = g_queue_new();
-	device->control_queue = g_queue_new();
-	device->service_queue = g_queue_new();
+	device->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+	device->queue_stats = g_hash_table_new_full(g_direct_hash,
+						g_direct_equal, NULL, g_free);
 
 	device->service_list = g_hash_table_new_full(g_direct_hash,
 					g_direct_equal, NULL, service_destroy);
@@ -908,6 +1093,24 @@ struct qmi_device *qmi_device_ref(struct qmi_device *device)
 	return device;
 }
 
+static void __request_free_pending(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	__request_free(value, NULL);
+}
+
+static void __debug_queue_stats(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct qmi_queue_stats *stats = value;
+	struct qmi_device *device = user_data;
+
+	__debug_device(device, "%s: sent %" G_GUINT64_FORMAT
+			", max in flight %u, max queued %u",
+			__service_type_to_string(GPOINTER_TO_UINT(key)),
+			stats->sent, stats->max_in_flight, stats->max_queued);
+}
+
 void qmi_device_unref(struct qmi_device *device)
 {
 	if (!device)
@@ -918,11 +1121,12 @@ void qmi_device_unref(struct qmi_device *device)
 
 	__debug_device(device, "device %p free", device);
 
-	g_queue_foreach(device->control_queue, __request_free, NULL);
-	g_queue_free(device->control_queue);
+	g_hash_table_foreach(device->queue_stats, __debug_queue_stats,
+								device);
+	g_hash_table_destroy(device->queue_stats);
 
-	g_queue_foreach(device->service_queue, __request_free, NULL);
-	g_queue_free(device->service_queue);
+	g_hash_table_foreach(device->pending, __request_free_pending, NULL);
+	g_hash_table_destroy(device->pending);
 
 	g_queue_foreach(device->req_queue, __request_free, NULL);
 	g_queue_free(device->req_queue);
@@ -941,6 +1145,7 @@ void qmi_device_unref(struct qmi_device *device)
 	g_free(device->version_str);
 	g_free(device->version_list);
 
+	g_free(device->rx_buf);
 	g_free(device);
 }
 
@@ -962,6 +1167,46 @@ void qmi_device_set_close_on_unref(struct qmi_device *device, bool do_close)
 	device->close_on_unref = do_close;
 }
 
+bool qmi_device_set_window(struct qmi_device *device, uint8_t type,
+						unsigned int window)
+{
+	if (!device)
+		return false;
+
+	__queue_stats(device, type)->window = window;
+
+	wakeup_writer(device);
+
+	return true;
+}
+
+void qmi_device_set_default_window(struct qmi_device *device,
+						unsigned int window)
+{
+	if (!device)
+		return;
+
+	device->default_window = window;
+}
+
+bool qmi_device_get_queue_stats(struct qmi_device *device, uint8_t type,
+					struct qmi_queue_stats *stats)
+{
+	struct qmi_queue_stats *found;
+
+	if (!device || !stats)
+		return false;
+
+	found = g_hash_table_lookup(device->queue_stats,
+						GUINT_TO_POINTER(type));
+	if (!found)
+		return false;
+
+	*stats = *found;
+
+	return true;
+}
+
 static const void *tlv_get(const void *data, uint16_t size,
 					uint8_t type, uint16_t *length)
 {
@@ -1138,11 +1383,8 @@ bool qmi_device_discover(struct qmi_device *device, qmi_discover_func_t func,
 		return false;
 	}
 
-	if (device->next_control_tid < 1)
-		device->next_control_tid = 1;
-
 	hdr->type = 0x00;
-	hdr->transaction = device->next_control_tid++;
+	hdr->transaction = __next_control_tid(device);
 
 	__request_submit(device, req, hdr->transaction);
 
@@ -1168,11 +1410,8 @@ static void release_client(struct qmi_device *device,
 		return;
 	}
 
-	if (device->next_control_tid < 1)
-		device->next_control_tid = 1;
-
 	hdr->type = 0x00;
-	hdr->transaction = device->next_control_tid++;
+	hdr->transaction = __next_control_tid(device);
 
 	__request_submit(device, req, hdr->transaction);
 }
@@ -1621,11 +1860,8 @@ static void service_create_discover(uint8_t count,
 		return;
 	}
 
-	if (device->next_control_tid < 1)
-		device->next_control_tid = 1;
-
 	hdr->type = 0x00;
-	hdr->transaction = device->next_control_tid++;
+	hdr->transaction = __next_control_tid(device);
 
 	__request_submit(device, req, hdr->transaction);
 }
@@ -1898,11 +2134,9 @@ uint16_t qmi_service_send(struct qmi_service *service,
 		return 0;
 	}
 
-	if (device->next_service_tid < 256)
-		device->next_service_tid = 256;
-
 	hdr->type = 0x00;
-	hdr->transaction = device->next_service_tid++;
+	hdr->transaction = __next_service_tid(device, service->type,
+							service->client_id);
 
 	__request_submit(device, req, hdr->transaction);
 
@@ -1926,21 +2160,18 @@ bool qmi_service_cancel(struct qmi_service *service, uint16_t id)
 	if (!device)
 		return false;
 
-	list = g_queue_find_custom(device->req_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-	if (list) {
-		req = list->data;
-
-		g_queue_delete_link(device->req_queue, list);
-	} else {
-		list = g_queue_find_custom(device->service_queue,
+	req = __request_complete(device, service->type, service->client_id,
+									tid);
+	if (!req) {
+		list = g_queue_find_custom(device->req_queue,
 				GUINT_TO_POINTER(tid), __request_compare);
 		if (!list)
 			return false;
 
 		req = list->data;
 
-		g_queue_delete_link(device->service_queue, list);
+		g_queue_delete_link(device->req_queue, list);
+		req->stats->queued -= 1;
 	}
 
 	service_send_free(req->user_data);
@@ -1950,7 +2181,8 @@ bool qmi_service_cancel(struct qmi_service *service, uint16_t id)
 	return true;
 }
 
-static GQueue *remove_client(GQueue *queue, uint8_t client)
+static GQueue *remove_client(GQueue *queue, uint8_t service,
+							uint8_t client)
 {
 	GQueue *new_queue;
 	GList *list;
@@ -1966,11 +2198,14 @@ static GQueue *remove_client(GQueue *queue, uint8_t client)
 
 		req = list->data;
 
-		if (!req->client || req->client != client) {
+		if (!req->client || req->client != client ||
+						req->service != service) {
 			g_queue_push_tail_link(new_queue, list);
 			continue;
 		}
 
+		req->stats->queued -= 1;
+
 		service_send_free(req->user_data);
 
 		__request_free(req, NULL);
@@ -1981,6 +2216,25 @@ static GQueue *remove_client(GQueue *queue, uint8_t client)
 	return new_queue;
 }
 
+static gboolean remove_pending_client(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct qmi_service *service = user_data;
+	struct qmi_request *req = value;
+
+	if (req->service != service->type ||
+				req->client != service->client_id)
+		return FALSE;
+
+	req->stats->in_flight -= 1;
+
+	service_send_free(req->user_data);
+
+	__request_free(req, NULL);
+
+	return TRUE;
+}
+
 bool qmi_service_cancel_all(struct qmi_service *service)
 {
 	struct qmi_device *device;
@@ -1995,12 +2249,12 @@ bool qmi_service_cancel_all(struct qmi_service *service)
 	if (!device)
 		return false;
 
-	device->req_queue = remove_client(device->req_queue,
-						service->client_id);
-
-	device->service_queue = remove_client(device->service_queue,
+	device->req_queue = remove_client(device->req_queue, service->type,
 							service->client_id);
 
+	g_hash_table_foreach_remove(device->pending, remove_pending_client,
+								service);
+
 	return true;
 }
 
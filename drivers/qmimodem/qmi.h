@@ -77,6 +77,22 @@ void qmi_device_set_debug(struct qmi_device *device,
 
 void qmi_device_set_close_on_unref(struct qmi_device *device, bool do_close);
 
+struct qmi_queue_stats {
+	unsigned int queued;		/* Waiting to be written */
+	unsigned int max_queued;
+	unsigned int in_flight;		/* Written, waiting for a response */
+	unsigned int max_in_flight;
+	unsigned int window;		/* Limit on in_flight, 0 for none */
+	uint64_t sent;
+};
+
+bool qmi_device_set_window(struct qmi_device *device, uint8_t type,
+						unsigned int window);
+void qmi_device_set_default_window(struct qmi_device *device,
+						unsigned int window);
+bool qmi_device_get_queue_stats(struct qmi_device *device, uint8_t type,
+					struct qmi_queue_stats *stats);
+
 bool qmi_device_discover(struct qmi_device *device, qmi_discover_func_t func,
 				void *user_data, qmi_destroy_func_t destroy);
 bool qmi_device_shutdown(struct qmi_device *device, qmi_shutdown_func_t func,
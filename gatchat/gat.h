@@ -34,6 +34,13 @@ typedef void (*GAtReceiveFunc)(const unsigned char *data, gsize size,
 typedef void (*GAtDebugFunc)(const char *str, gpointer user_data);
 typedef void (*GAtSuspendFunc)(gpointer user_data);
 
+typedef struct _GAtBatchStats {
+	guint64 wakeups;	/* Main loop dispatches that moved data */
+	guint64 reads;		/* Reads or writes done, a packet each on tun */
+	guint64 bytes;		/* Bytes moved by those reads */
+	guint max_batch;	/* Most reads done in a single dispatch */
+} GAtBatchStats;
+
 #ifdef __cplusplus
 }
 #endif
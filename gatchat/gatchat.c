@@ -40,6 +40,7 @@
 
 #define COMMAND_FLAG_EXPECT_PDU			0x1
 #define COMMAND_FLAG_EXPECT_SHORT_PROMPT	0x2
+#define COMMAND_FLAG_PIPELINE			0x4
 
 struct at_chat;
 static void chat_wakeup_writer(struct at_chat *chat);
@@ -56,6 +57,7 @@ struct at_command {
 	GAtNotifyFunc listing;
 	gpointer user_data;
 	GDestroyNotify notify;
+	gint64 queued;
 };
 
 struct at_notify_node {
@@ -70,9 +72,34 @@ struct at_notify_node {
 typedef gboolean (*node_remove_func)(struct at_notify_node *node,
 					gpointer user_data);
 
+struct at_trie;
+
 struct at_notify {
 	GSList *nodes;
 	gboolean pdu;
+	struct at_trie *trie;
+};
+
+/*
+ * Registered notification prefixes and final responses, keyed one
+ * character per level.  Children are indexed directly by character
+ * within the range [first, first + count) so every step is O(1).
+ */
+struct at_trie {
+	struct at_trie **children;
+	unsigned char first;
+	guint16 count;
+	gint8 final;				/* terminator_table index */
+	struct terminator_info *custom;		/* Non-standard terminator */
+	struct at_notify *notify;		/* Unsolicited result */
+};
+
+/* What a line turned out to be, found in a single walk of the trie */
+struct line_class {
+	gint8 final;
+	struct terminator_info *custom;
+	struct at_notify *pdu;
+	gboolean notify;
 };
 
 struct at_chat {
@@ -83,6 +110,10 @@ struct at_chat {
 	GAtIO *io;				/* AT IO */
 	GQueue *command_queue;			/* Command queue */
 	guint cmd_bytes_written;		/* bytes written from cmd */
+	guint pipeline_depth;			/* Max commands in flight */
+	guint pipeline_sent;			/* Written behind the head */
+	guint pipeline_bytes;			/* bytes of next pipelined */
+	GHashTable *latency;			/* prefix -> GAtChatLatency */
 	GHashTable *notify_list;		/* List of notification reg */
 	GAtDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
@@ -102,6 +133,7 @@ struct at_chat {
 	gboolean in_read_handler;		/* Re-entrancy guard */
 	gboolean in_notify;
 	GSList *terminator_list;		/* Non-standard terminator */
+	struct at_trie *trie;			/* Prefixes and terminators */
 	guint16 terminator_blacklist;		/* Blacklisted terinators */
 };
 
@@ -118,6 +150,88 @@ struct terminator_info {
 	gboolean success;
 };
 
+static struct at_trie *at_trie_new(void)
+{
+	struct at_trie *trie = g_new0(struct at_trie, 1);
+
+	trie->final = -1;
+
+	return trie;
+}
+
+static void at_trie_free(struct at_trie *trie)
+{
+	guint i;
+
+	for (i = 0; i < trie->count; i++)
+		if (trie->children[i])
+			at_trie_free(trie->children[i]);
+
+	g_free(trie->children);
+	g_free(trie);
+}
+
+static inline struct at_trie *at_trie_child(struct at_trie *trie, char c)
+{
+	guint index = (unsigned char) c - trie->first;
+
+	if (index >= trie->count)
+		return NULL;
+
+	return trie->children[index];
+}
+
+static struct at_trie *at_trie_add_child(struct at_trie *trie, char c)
+{
+	unsigned char uc = c;
+	struct at_trie *child;
+	guint count;
+
+	child = at_trie_child(trie, c);
+	if (child)
+		return child;
+
+	if (trie->count == 0) {
+		trie->children = g_new0(struct at_trie *, 1);
+		trie->first = uc;
+		trie->count = 1;
+	} else if (uc < trie->first) {
+		guint shift = trie->first - uc;
+
+		count = trie->count + shift;
+		trie->children = g_renew(struct at_trie *, trie->children,
+						count);
+		memmove(trie->children + shift, trie->children,
+				trie->count * sizeof(struct at_trie *));
+		memset(trie->children, 0, shift * sizeof(struct at_trie *));
+		trie->first = uc;
+		trie->count = count;
+	} else if (uc >= trie->first + trie->count) {
+		count = uc - trie->first + 1;
+		trie->children = g_renew(struct at_trie *, trie->children,
+						count);
+		memset(trie->children + trie->count, 0,
+			(count - trie->count) * sizeof(struct at_trie *));
+		trie->count = count;
+	}
+
+	child = at_trie_new();
+	trie->children[uc - trie->first] = child;
+
+	return child;
+}
+
+static struct at_trie *at_trie_insert(struct at_trie *trie,
+					const char *key, gsize len)
+{
+	gsize i;
+
+	for (i = 0; i < len && trie; i++)
+		trie = at_trie_add_child(trie, key[i]);
+
+	return trie;
+}
+
 static gboolean node_is_destroyed(struct at_notify_node *node, gpointer user)
 {
 	return node->destroyed;
@@ -151,6 +265,9 @@ static void at_notify_destroy(gpointer user_data)
 {
 	struct at_notify *notify = user_data;
 
+	if (notify->trie)
+		notify->trie->notify = NULL;
+
 	g_slist_foreach(notify->nodes, at_notify_node_destroy, NULL);
 	g_slist_free(notify->nodes);
 	g_free(notify);
@@ -314,10 +431,130 @@ static void free_terminator(gpointer pointer)
 	info = NULL;
 }
 
+static void at_command_get_prefix(const char *cmd, char *buf, gsize size)
+{
+	gsize len;
+
+	if (g_ascii_strncasecmp(cmd, "AT", 2) == 0)
+		cmd += 2;
+
+	/*
+	 * Extended commands are keyed by their name, basic ones such as
+	 * ATD<number> only by the command letter(s)
+	 */
+	if (cmd[0] == '&')
+		len = strnlen(cmd, 2);
+	else if (g_ascii_isalpha(cmd[0]))
+		len = 1;
+	else
+		len = strcspn(cmd, "=?;\r\032");
+
+	if (len == 0) {
+		g_strlcpy(buf, "AT", size);
+		return;
+	}
+
+	if (len >= size)
+		len = size - 1;
+
+	memcpy(buf, cmd, len);
+	buf[len] = '\0';
+}
+
+static void at_chat_record_latency(struct at_chat *chat,
+					struct at_command *cmd)
+{
+	GAtChatLatency *latency;
+	char prefix[32];
+	guint64 usec;
+	guint bucket;
+
+	/* Wakeup commands are not interesting */
+	if (chat->latency == NULL || cmd->id == 0)
+		return;
+
+	usec = g_get_monotonic_time() - cmd->queued;
+
+	at_command_get_prefix(cmd->cmd, prefix, sizeof(prefix));
+
+	latency = g_hash_table_lookup(chat->latency, prefix);
+	if (latency == NULL) {
+		latency = g_new0(GAtChatLatency, 1);
+		g_hash_table_insert(chat->latency, g_strdup(prefix), latency);
+	}
+
+	latency->count += 1;
+	latency->total_us += usec;
+
+	if (usec > latency->max_us)
+		latency->max_us = usec;
+
+	for (bucket = 0; bucket < G_AT_CHAT_LATENCY_BUCKETS - 1; bucket++)
+		if (usec < (G_GUINT64_CONSTANT(1000) << bucket))
+			break;
+
+	latency->buckets[bucket] += 1;
+}
+
+static void at_chat_report_latency(struct at_chat *chat)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *str;
+
+	if (chat->debugf == NULL || chat->latency == NULL)
+		return;
+
+	str = g_string_sized_new(128);
+
+	g_hash_table_iter_init(&iter, chat->latency);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GAtChatLatency *latency = value;
+		guint i;
+
+		g_string_printf(str, "%s: %u commands, avg %" G_GUINT64_FORMAT
+				" us, max %" G_GUINT64_FORMAT " us,", (char *) key,
+				latency->count,
+				latency->total_us / latency->count,
+				latency->max_us);
+
+		for (i = 0; i < G_AT_CHAT_LATENCY_BUCKETS; i++) {
+			if (latency->buckets[i] == 0)
+				continue;
+
+			if (i == G_AT_CHAT_LATENCY_BUCKETS - 1)
+				g_string_append_printf(str, " >=%ums:%u",
+							1U << (i - 1),
+							latency->buckets[i]);
+			else
+				g_string_append_printf(str, " <%ums:%u",
+							1U << i,
+							latency->buckets[i]);
+		}
+
+		g_string_append_c(str, '\n');
+		chat->debugf(str->str, chat->debug_data);
+	}
+
+	g_string_free(str, TRUE);
+}
+
 static void chat_cleanup(struct at_chat *chat)
 {
 	struct at_command *c;
 
+	at_chat_report_latency(chat);
+
+	if (chat->latency) {
+		g_hash_table_destroy(chat->latency);
+		chat->latency = NULL;
+	}
+
+	chat->cmd_bytes_written = 0;
+	chat->pipeline_sent = 0;
+	chat->pipeline_bytes = 0;
+
 	/* Cleanup pending commands */
 	while ((c = g_queue_pop_head(chat->command_queue)))
 		at_command_destroy(c);
@@ -360,6 +597,11 @@ static void chat_cleanup(struct at_chat *chat)
 		g_slist_free_full(chat->terminator_list, free_terminator);
 		chat->terminator_list = NULL;
 	}
+
+	if (chat->trie) {
+		at_trie_free(chat->trie);
+		chat->trie = NULL;
+	}
 }
 
 static void io_disconnect(gpointer user_data)
@@ -382,53 +624,67 @@ static void at_notify_call_callback(gpointer data, gpointer user_data)
 	node->callback(result, node->user_data);
 }
 
-static gboolean at_chat_match_notify(struct at_chat *chat, char *line)
+/*
+ * Calls the handlers of every registered prefix of line, shortest first,
+ * by walking the trie along the line itself
+ */
+static gboolean at_chat_dispatch_notify(struct at_chat *chat,
+					const char *line, gboolean pdu,
+					GAtResult *result)
 {
-	GHashTableIter iter;
-	struct at_notify *notify;
-	gpointer key, value;
-	gboolean ret = FALSE;
-	GAtResult result;
-
-	g_hash_table_iter_init(&iter, chat->notify_list);
-	result.lines = 0;
-	result.final_or_pdu = 0;
+	struct at_trie *trie = chat->trie;
+	gboolean called = FALSE;
+	const char *c;
 
 	chat->in_notify = TRUE;
 
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		notify = value;
+	/* Bail out if a handler tore the chat down */
+	for (c = line; *c != '\0' && chat->trie != NULL; c++) {
+		trie = at_trie_child(trie, *c);
+		if (trie == NULL)
+			break;
 
-		if (!g_str_has_prefix(line, key))
+		if (trie->notify == NULL || trie->notify->pdu != pdu)
 			continue;
 
-		if (notify->pdu) {
-			chat->pdu_notify = line;
+		g_slist_foreach(trie->notify->nodes, at_notify_call_callback,
+					result);
+		called = TRUE;
+	}
 
-			if (chat->syntax->set_hint)
-				chat->syntax->set_hint(chat->syntax,
-							G_AT_SYNTAX_EXPECT_PDU);
-			return TRUE;
-		}
+	chat->in_notify = FALSE;
 
-		if (result.lines == NULL)
-			result.lines = g_slist_prepend(NULL, line);
+	return called;
+}
 
-		g_slist_foreach(notify->nodes, at_notify_call_callback,
-					&result);
-		ret = TRUE;
-	}
+static gboolean at_chat_match_notify(struct at_chat *chat, char *line,
+					const struct line_class *lc)
+{
+	GAtResult result;
 
-	chat->in_notify = FALSE;
+	if (lc->notify == FALSE)
+		return FALSE;
 
-	if (ret) {
-		g_slist_free(result.lines);
-		g_free(line);
+	if (lc->pdu) {
+		chat->pdu_notify = line;
 
-		at_chat_unregister_all(chat, FALSE, node_is_destroyed, NULL);
+		if (chat->syntax->set_hint)
+			chat->syntax->set_hint(chat->syntax,
+						G_AT_SYNTAX_EXPECT_PDU);
+		return TRUE;
 	}
 
-	return ret;
+	result.lines = g_slist_prepend(NULL, line);
+	result.final_or_pdu = 0;
+
+	at_chat_dispatch_notify(chat, line, FALSE, &result);
+
+	g_slist_free(result.lines);
+	g_free(line);
+
+	at_chat_unregister_all(chat, FALSE, node_is_destroyed, NULL);
+
+	return TRUE;
 }
 
 static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
@@ -440,7 +696,21 @@ static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
 	if (cmd == NULL)
 		return;
 
-	p->cmd_bytes_written = 0;
+	/*
+	 * Commands pipelined behind this one are already on the wire, so
+	 * the next of them becomes a fully written head
+	 */
+	if (p->pipeline_sent > 0) {
+		struct at_command *next = g_queue_peek_head(p->command_queue);
+
+		p->pipeline_sent -= 1;
+		p->cmd_bytes_written = strlen(next->cmd);
+	} else {
+		p->cmd_bytes_written = p->pipeline_bytes;
+		p->pipeline_bytes = 0;
+	}
+
+	at_chat_record_latency(p, cmd);
 
 	if (g_queue_peek_head(p->command_queue))
 		chat_wakeup_writer(p);
@@ -482,10 +752,27 @@ static void at_chat_add_terminator(struct at_chat *chat, char *terminator,
 					int len, gboolean success)
 {
 	struct terminator_info *info = g_new0(struct terminator_info, 1);
+	struct at_trie *trie;
+	int size = strlen(terminator);
+
+	/* Comparing past the end of the terminator is an exact match */
+	if (len > size)
+		len = -1;
+
 	info->terminator = g_strdup(terminator);
 	info->len = len;
 	info->success = success;
 	chat->terminator_list = g_slist_prepend(chat->terminator_list, info);
+
+	/* Zero or negative lengths other than -1 never match */
+	if (chat->trie == NULL || (len < 1 && len != -1))
+		return;
+
+	trie = at_trie_insert(chat->trie, terminator, len == -1 ? size : len);
+
+	/* The root would match everything */
+	if (trie != chat->trie)
+		trie->custom = info;
 }
 
 static void at_chat_blacklist_terminator(struct at_chat *chat,
@@ -494,41 +781,79 @@ static void at_chat_blacklist_terminator(struct at_chat *chat,
 	chat->terminator_blacklist |= 1 << terminator;
 }
 
-static gboolean check_terminator(struct terminator_info *info, char *line)
+static void at_chat_add_standard_terminators(struct at_chat *chat)
 {
-	if (info->len == -1 && !strcmp(line, info->terminator))
-		return TRUE;
+	int size = sizeof(terminator_table) / sizeof(struct terminator_info);
+	int i;
 
-	if (info->len > 0 && !strncmp(line, info->terminator, info->len))
-		return TRUE;
+	for (i = 0; i < size; i++) {
+		const char *terminator = terminator_table[i].terminator;
 
-	return FALSE;
+		at_trie_insert(chat->trie, terminator,
+				strlen(terminator))->final = i;
+	}
+}
+
+/*
+ * Finds the final response and the notifications matching line with a
+ * single walk of the trie.  A standard final response takes precedence,
+ * among non-standard ones the longest match wins.
+ */
+static void at_chat_classify_line(struct at_chat *chat, const char *line,
+					struct line_class *lc)
+{
+	struct at_trie *trie = chat->trie;
+	const char *c;
+
+	lc->final = -1;
+	lc->custom = NULL;
+	lc->pdu = NULL;
+	lc->notify = FALSE;
+
+	for (c = line; *c != '\0' && trie != NULL; c++) {
+		gboolean end;
+
+		trie = at_trie_child(trie, *c);
+		if (trie == NULL)
+			break;
+
+		end = c[1] == '\0';
+
+		if (trie->final >= 0 && lc->final < 0 &&
+				(terminator_table[trie->final].len > 0 || end) &&
+				(chat->terminator_blacklist &
+					1 << trie->final) == 0)
+			lc->final = trie->final;
+
+		if (trie->custom && (trie->custom->len > 0 || end))
+			lc->custom = trie->custom;
+
+		if (trie->notify == NULL)
+			continue;
+
+		lc->notify = TRUE;
+
+		if (trie->notify->pdu && lc->pdu == NULL)
+			lc->pdu = trie->notify;
+	}
 }
 
 static gboolean at_chat_handle_command_response(struct at_chat *p,
-							struct at_command *cmd,
-							char *line)
+						struct at_command *cmd,
+						char *line,
+						const struct line_class *lc)
 {
-	int i;
-	int size = sizeof(terminator_table) / sizeof(struct terminator_info);
 	int hint;
-	GSList *l;
 
-	for (i = 0; i < size; i++) {
-		struct terminator_info *info = &terminator_table[i];
-		if (check_terminator(info, line) &&
-				(p->terminator_blacklist & 1 << i) == 0) {
-			at_chat_finish_command(p, info->success, line);
-			return TRUE;
-		}
+	if (lc->final >= 0) {
+		at_chat_finish_command(p, terminator_table[lc->final].success,
+					line);
+		return TRUE;
 	}
 
-	for (l = p->terminator_list; l; l = l->next) {
-		struct terminator_info *info = l->data;
-		if (check_terminator(info, line)) {
-			at_chat_finish_command(p, info->success, line);
-			return TRUE;
-		}
+	if (lc->custom) {
+		at_chat_finish_command(p, lc->custom->success, line);
+		return TRUE;
 	}
 
 	if (cmd->prefixes) {
@@ -575,6 +900,7 @@ static void have_line(struct at_chat *p, char *str)
 {
 	/* We're not going to copy terminal <CR><LF> */
 	struct at_command *cmd;
+	struct line_class lc;
 
 	if (str == NULL)
 		return;
@@ -583,6 +909,8 @@ static void have_line(struct at_chat *p, char *str)
 	if (!strncmp(str, "AT", 2))
 		goto done;
 
+	at_chat_classify_line(p, str, &lc);
+
 	cmd = g_queue_peek_head(p->command_queue);
 
 	if (cmd && p->cmd_bytes_written > 0) {
@@ -597,11 +925,12 @@ static void have_line(struct at_chat *p, char *str)
 		 * final response from the modem, so we check this as well.
 		 */
 		if ((c == '\r' || c == 26) &&
-				at_chat_handle_command_response(p, cmd, str))
+				at_chat_handle_command_response(p, cmd,
+								str, &lc))
 			return;
 	}
 
-	if (at_chat_match_notify(p, str) == TRUE)
+	if (at_chat_match_notify(p, str, &lc) == TRUE)
 		return;
 
 done:
@@ -611,33 +940,7 @@ done:
 
 static void have_notify_pdu(struct at_chat *p, char *pdu, GAtResult *result)
 {
-	GHashTableIter iter;
-	struct at_notify *notify;
-	char *prefix;
-	gpointer key, value;
-	gboolean called = FALSE;
-
-	p->in_notify = TRUE;
-
-	g_hash_table_iter_init(&iter, p->notify_list);
-
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		prefix = key;
-		notify = value;
-
-		if (!g_str_has_prefix(p->pdu_notify, prefix))
-			continue;
-
-		if (!notify->pdu)
-			continue;
-
-		g_slist_foreach(notify->nodes, at_notify_call_callback, result);
-		called = TRUE;
-	}
-
-	p->in_notify = FALSE;
-
-	if (called)
+	if (at_chat_dispatch_notify(p, p->pdu_notify, TRUE, result))
 		at_chat_unregister_all(p, FALSE, node_is_destroyed, NULL);
 }
 
@@ -823,6 +1126,47 @@ static gboolean wakeup_no_response(gpointer user_data)
 	return TRUE;
 }
 
+static gboolean at_chat_write_pipelined(struct at_chat *chat)
+{
+	struct at_command *head = g_queue_peek_head(chat->command_queue);
+	struct at_command *cmd;
+	gsize bytes_written;
+	gsize len;
+
+	/* Anything not sent as pipelined keeps the strict ordering */
+	if (!(head->flags & COMMAND_FLAG_PIPELINE))
+		return FALSE;
+
+	if (chat->pipeline_sent + 1 >= chat->pipeline_depth)
+		return FALSE;
+
+	cmd = g_queue_peek_nth(chat->command_queue, chat->pipeline_sent + 1);
+	if (cmd == NULL || !(cmd->flags & COMMAND_FLAG_PIPELINE))
+		return FALSE;
+
+	len = strlen(cmd->cmd);
+
+	bytes_written = g_at_io_write(chat->io,
+					cmd->cmd + chat->pipeline_bytes,
+					len - chat->pipeline_bytes);
+	if (bytes_written == 0)
+		return FALSE;
+
+	chat->pipeline_bytes += bytes_written;
+
+	if (chat->pipeline_bytes < len)
+		return TRUE;
+
+	chat->pipeline_bytes = 0;
+	chat->pipeline_sent += 1;
+
+	if (chat->wakeup_timer)
+		g_timer_start(chat->wakeup_timer);
+
+	/* Come back for the next one, if there is room */
+	return TRUE;
+}
+
 static gboolean can_write_data(gpointer data)
 {
 	struct at_chat *chat = data;
@@ -847,12 +1191,11 @@ static gboolean can_write_data(gpointer data)
 
 	len = strlen(cmd->cmd);
 
-	/* For some reason write watcher fired, but we've already
-	 * written the entire command out to the io channel,
-	 * cancel write watcher
+	/* We've already written the entire command out to the io channel,
+	 * see whether anything can be pipelined behind it
 	 */
 	if (chat->cmd_bytes_written >= len)
-		return FALSE;
+		return at_chat_write_pipelined(chat);
 
 	if (chat->wakeup) {
 		if (chat->wakeup_timer == NULL) {
@@ -923,7 +1266,7 @@ static gboolean can_write_data(gpointer data)
 	if (chat->wakeup_timer)
 		g_timer_start(chat->wakeup_timer);
 
-	return FALSE;
+	return at_chat_write_pipelined(chat);
 }
 
 static void chat_wakeup_writer(struct at_chat *chat)
@@ -1038,11 +1381,19 @@ static guint at_chat_send_common(struct at_chat *chat, guint gid,
 		return 0;
 
 	c->id = chat->next_cmd_id++;
+	c->queued = g_get_monotonic_time();
 
 	g_queue_push_tail(chat->command_queue, c);
 
 	if (g_queue_get_length(chat->command_queue) == 1)
 		chat_wakeup_writer(chat);
+	else if ((flags & COMMAND_FLAG_PIPELINE) && chat->pipeline_depth > 1) {
+		struct at_command *head = g_queue_peek_head(chat->command_queue);
+
+		/* The head is only waiting for its response, slip this in */
+		if (chat->cmd_bytes_written >= strlen(head->cmd))
+			chat_wakeup_writer(chat);
+	}
 
 	return c->id;
 }
@@ -1065,12 +1416,29 @@ static struct at_notify *at_notify_create(struct at_chat *chat,
 	}
 
 	notify->pdu = pdu;
+	notify->trie = at_trie_insert(chat->trie, prefix, strlen(prefix));
+	notify->trie->notify = notify;
 
 	g_hash_table_insert(chat->notify_list, key, notify);
 
 	return notify;
 }
 
+/*
+ * The head and everything pipelined behind it has at least partially
+ * been written out and has to stay queued until its response arrives
+ */
+static gboolean at_chat_command_in_progress(struct at_chat *chat, guint n)
+{
+	if (n == 0)
+		return chat->cmd_bytes_written > 0;
+
+	if (n <= chat->pipeline_sent)
+		return TRUE;
+
+	return n == chat->pipeline_sent + 1 && chat->pipeline_bytes > 0;
+}
+
 static gboolean at_chat_cancel(struct at_chat *chat, guint group, guint id)
 {
 	GList *l;
@@ -1090,8 +1458,8 @@ static gboolean at_chat_cancel(struct at_chat *chat, guint group, guint id)
 	if (c->gid != group)
 		return FALSE;
 
-	if (c == g_queue_peek_head(chat->command_queue) &&
-			chat->cmd_bytes_written > 0) {
+	if (at_chat_command_in_progress(chat,
+				g_queue_link_index(chat->command_queue, l))) {
 		/* We can't actually remove it since it is most likely
 		 * already in progress, just null out the callback
 		 * so it won't be called
@@ -1119,7 +1487,7 @@ static gboolean at_chat_cancel_group(struct at_chat *chat, guint group)
 			continue;
 		}
 
-		if (n == 0 && chat->cmd_bytes_written > 0) {
+		if (at_chat_command_in_progress(chat, n)) {
 			c->callback = NULL;
 			n += 1;
 			continue;
@@ -1288,6 +1656,13 @@ static struct at_chat *create_chat(GIOChannel *channel, GIOFlags flags,
 	chat->notify_list = g_hash_table_new_full(g_str_hash, g_str_equal,
 						g_free, at_notify_destroy);
 
+	chat->pipeline_depth = 1;
+	chat->latency = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, g_free);
+
+	chat->trie = at_trie_new();
+	at_chat_add_standard_terminators(chat);
+
 	g_at_io_set_read_handler(chat->io, new_bytes, chat);
 
 	chat->syntax = g_at_syntax_ref(syntax);
@@ -1303,6 +1678,9 @@ error:
 	if (chat->notify_list)
 		g_hash_table_destroy(chat->notify_list);
 
+	if (chat->latency)
+		g_hash_table_destroy(chat->latency);
+
 	g_free(chat);
 	return NULL;
 }
@@ -1495,6 +1873,31 @@ gboolean g_at_chat_set_wakeup_command(GAtChat *chat, const char *cmd,
 	return at_chat_set_wakeup_command(chat->parent, cmd, timeout, msec);
 }
 
+gboolean g_at_chat_set_pipeline_depth(GAtChat *chat, guint depth)
+{
+	if (chat == NULL || chat->group != 0 || depth == 0)
+		return FALSE;
+
+	chat->parent->pipeline_depth = depth;
+
+	return TRUE;
+}
+
+void g_at_chat_foreach_latency(GAtChat *chat, GAtChatLatencyFunc func,
+				gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	if (chat == NULL || func == NULL || chat->parent->latency == NULL)
+		return;
+
+	g_hash_table_iter_init(&iter, chat->parent->latency);
+
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		func(key, value, user_data);
+}
+
 guint g_at_chat_send(GAtChat *chat, const char *cmd,
 			const char **prefix_list, GAtResultFunc func,
 			gpointer user_data, GDestroyNotify notify)
@@ -1543,6 +1946,20 @@ guint g_at_chat_send_and_expect_short_prompt(GAtChat *chat, const char *cmd,
 					NULL, func, user_data, notify);
 }
 
+guint g_at_chat_send_pipelined(GAtChat *chat, const char *cmd,
+				const char **prefix_list, GAtResultFunc func,
+				gpointer user_data, GDestroyNotify notify)
+{
+	/* Commands waiting for a prompt can't be pipelined */
+	if (strchr(cmd, '\r'))
+		return 0;
+
+	return at_chat_send_common(chat->parent, chat->group,
+					cmd, prefix_list,
+					COMMAND_FLAG_PIPELINE,
+					NULL, func, user_data, notify);
+}
+
 gboolean g_at_chat_cancel(GAtChat *chat, guint id)
 {
 	/* We use id 0 for wakeup commands */
@@ -54,6 +54,20 @@ enum _GAtChatTerminator {
 
 typedef enum _GAtChatTerminator GAtChatTerminator;
 
+#define G_AT_CHAT_LATENCY_BUCKETS 14
+
+typedef struct _GAtChatLatency {
+	guint count;		/* Commands completed */
+	guint64 total_us;	/* Sum of queued to final response times */
+	guint64 max_us;
+	/* [i] counts times below 2^i ms, the last bucket the rest */
+	guint buckets[G_AT_CHAT_LATENCY_BUCKETS];
+} GAtChatLatency;
+
+typedef void (*GAtChatLatencyFunc)(const char *prefix,
+					const GAtChatLatency *latency,
+					gpointer user_data);
+
 GAtChat *g_at_chat_new(GIOChannel *channel, GAtSyntax *syntax);
 GAtChat *g_at_chat_new_blocking(GIOChannel *channel, GAtSyntax *syntax);
 
@@ -147,6 +161,17 @@ guint g_at_chat_send_and_expect_short_prompt(GAtChat *chat, const char *cmd,
 				const char **valid_resp, GAtResultFunc func,
 				gpointer user_data, GDestroyNotify notify);
 
+/*!
+ * Same as g_at_chat_send except the command is independent of the commands
+ * around it.  If the modem allows it (see g_at_chat_set_pipeline_depth),
+ * it is written out without waiting for the final response of the command
+ * before it, as long as that one was sent pipelined as well.  Responses
+ * are still matched in order.  Commands expecting a prompt are refused.
+ */
+guint g_at_chat_send_pipelined(GAtChat *chat, const char *cmd,
+				const char **valid_resp, GAtResultFunc func,
+				gpointer user_data, GDestroyNotify notify);
+
 gboolean g_at_chat_cancel(GAtChat *chat, guint id);
 gboolean g_at_chat_cancel_all(GAtChat *chat);
 
@@ -162,6 +187,21 @@ gboolean g_at_chat_unregister_all(GAtChat *chat);
 gboolean g_at_chat_set_wakeup_command(GAtChat *chat, const char *cmd,
 					guint timeout, guint msec);
 
+/*!
+ * Maximum number of pipelined commands in flight at once, the default of
+ * one keeps every command waiting for the previous final response.  Only
+ * raise this for firmware known to queue commands on its side.
+ */
+gboolean g_at_chat_set_pipeline_depth(GAtChat *chat, guint depth);
+
+/*!
+ * Calls func for every command prefix seen so far with the histogram of
+ * times from queueing a command to its final response.  The same figures
+ * go to the debug function when the chat is torn down.
+ */
+void g_at_chat_foreach_latency(GAtChat *chat, GAtChatLatencyFunc func,
+				gpointer user_data);
+
 void g_at_chat_add_terminator(GAtChat *chat, char *terminator,
 				int len, gboolean success);
 void g_at_chat_blacklist_terminator(GAtChat *chat,
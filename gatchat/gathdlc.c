@@ -29,6 +29,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <glib.h>
 
@@ -40,6 +41,7 @@
 
 #define BUFFER_SIZE	(2 * 2048)
 #define MAX_BUFFERS	64	/* Maximum number of in-flight write buffers */
+#define MAX_SPARE	4	/* Drained write buffers kept for reuse */
 #define HDLC_OVERHEAD	256	/* Rough estimate of HDLC protocol overhead */
 
 #define HDLC_FLAG	0x7e	/* Flag sequence */
@@ -49,18 +51,19 @@
 #define HDLC_INITFCS	0xffff	/* Initial FCS value */
 #define HDLC_GOODFCS	0xf0b8	/* Good final FCS value */
 
-#define HDLC_FCS(fcs, c) crc_ccitt_byte(fcs, c)
-
 #define GUARD_TIMEOUT	1000	/* Pause time before and after '+++' sequence */
 
 struct _GAtHDLC {
 	gint ref_count;
 	GAtIO *io;
 	GQueue *write_queue;	/* Write buffer queue */
+	GSList *spare_buffers;	/* Drained write buffers kept for reuse */
+	guint num_spare;
 	unsigned char *decode_buffer;
 	guint decode_offset;
 	guint16 decode_fcs;
 	gboolean decode_escape;
+	gboolean decode_overflow;
 	guint32 xmit_accm[8];
 	guint32 recv_accm;
 	GAtReceiveFunc receive_func;
@@ -159,6 +162,32 @@ guint32 g_at_hdlc_get_recv_accm(GAtHDLC *hdlc)
 	return hdlc->recv_accm;
 }
 
+/* The guard timer lives on the same context as the IO it watches */
+static guint hdlc_timeout_add(GAtHDLC *hdlc, guint interval,
+					GSourceFunc function)
+{
+	GSource *source;
+	guint id;
+
+	source = g_timeout_source_new(interval);
+	g_source_set_callback(source, function, hdlc, NULL);
+
+	id = g_source_attach(source, g_at_io_get_context(hdlc->io));
+	g_source_unref(source);
+
+	return id;
+}
+
+static void hdlc_source_remove(GAtHDLC *hdlc, guint id)
+{
+	GSource *source;
+
+	source = g_main_context_find_source_by_id(
+					g_at_io_get_context(hdlc->io), id);
+	if (source)
+		g_source_destroy(source);
+}
+
 void g_at_hdlc_set_suspend_function(GAtHDLC *hdlc, GAtSuspendFunc func,
 							gpointer user_data)
 {
@@ -172,7 +201,7 @@ void g_at_hdlc_set_suspend_function(GAtHDLC *hdlc, GAtSuspendFunc func,
 		}
 
 		if (hdlc->suspend_source > 0) {
-			g_source_remove(hdlc->suspend_source);
+			hdlc_source_remove(hdlc, hdlc->suspend_source);
 			hdlc->suspend_source = 0;
 		}
 	} else
@@ -237,39 +266,107 @@ static gboolean check_escape(GAtHDLC *hdlc, struct ring_buffer *rbuf)
 	}
 
 	hdlc->num_plus = 0;
-	hdlc->suspend_source = g_timeout_add(GUARD_TIMEOUT, hdlc_suspend, hdlc);
+	hdlc->suspend_source = hdlc_timeout_add(hdlc, GUARD_TIMEOUT,
+							hdlc_suspend);
 
 	return TRUE;
 }
 
-static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
+/*
+ * Word-at-a-time helpers used to skip over runs of bytes which need no
+ * escaping.  Only 0x7d, 0x7e and the control characters below 0x20 can
+ * ever be escaped or filtered (xmit_accm[1..7] are fixed), so a word
+ * without any of those is always clean.
+ */
+#define ONES		0x0101010101010101ULL
+#define HIGHS		0x8080808080808080ULL
+#define HAS_ZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+#define HAS_LESS(w, n)	(((w) - ONES * (n)) & ~(w) & HIGHS)
+
+static inline gboolean word_is_clean(const unsigned char *buf,
+						gboolean ctrl)
+{
+	guint64 w;
+
+	memcpy(&w, buf, sizeof(w));
+
+	if (HAS_ZERO(w ^ (ONES * HDLC_FLAG)) ||
+			HAS_ZERO(w ^ (ONES * HDLC_ESCAPE)))
+		return FALSE;
+
+	if (ctrl && HAS_LESS(w, 0x20))
+		return FALSE;
+
+	return TRUE;
+}
+
+static inline gboolean recv_is_special(guint32 accm, unsigned char c)
+{
+	if (c == HDLC_FLAG || c == HDLC_ESCAPE)
+		return TRUE;
+
+	return c < 0x20 && (accm & (1 << c));
+}
+
+#define NEED_ESCAPE(xmit_accm, c) xmit_accm[c >> 5] & (1 << (c & 0x1f))
+
+/* Returns the number of leading bytes that can be decoded verbatim */
+static unsigned int recv_clean_run(const unsigned char *buf,
+					unsigned int len, guint32 accm)
 {
-	GAtHDLC *hdlc = user_data;
-	unsigned int len = ring_buffer_len(rbuf);
-	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
-	unsigned char *buf = ring_buffer_read_ptr(rbuf, 0);
 	unsigned int pos = 0;
 
-	/*
-	 * We delete the the paused_timeout_cb or hdlc_suspend as soons as
-	 * we read a data.
-	 */
-	if (hdlc->suspend_source > 0) {
-		g_source_remove(hdlc->suspend_source);
-		hdlc->suspend_source = 0;
-		g_timer_start(hdlc->timer);
-	} else if (hdlc->timer) {
-		gboolean escaping = check_escape(hdlc, rbuf);
+	while (pos + 8 <= len && word_is_clean(buf + pos, accm != 0))
+		pos += 8;
 
-		g_timer_start(hdlc->timer);
+	while (pos < len && !recv_is_special(accm, buf[pos]))
+		pos++;
 
-		if (escaping)
-			return;
+	return pos;
+}
+
+/* Returns the number of leading bytes that can be sent verbatim */
+static unsigned int xmit_clean_run(const unsigned char *buf,
+					unsigned int len, const guint32 *accm)
+{
+	unsigned int pos = 0;
+
+	while (pos + 8 <= len && word_is_clean(buf + pos, accm[0] != 0))
+		pos += 8;
+
+	while (pos < len && !(NEED_ESCAPE(accm, buf[pos])))
+		pos++;
+
+	return pos;
+}
+
+static inline void decode_append(GAtHDLC *hdlc, const unsigned char *data,
+					unsigned int len)
+{
+	if (hdlc->decode_overflow)
+		return;
+
+	/* Drop oversized frames, the next flag resynchronizes us */
+	if (hdlc->decode_offset + len > BUFFER_SIZE) {
+		hdlc->decode_overflow = TRUE;
+		return;
 	}
 
-	hdlc_record(hdlc, TRUE, buf, wrap);
+	memcpy(hdlc->decode_buffer + hdlc->decode_offset, data, len);
+	hdlc->decode_offset += len;
+	hdlc->decode_fcs = crc_ccitt(hdlc->decode_fcs, data, len);
+}
 
-	hdlc->in_read_handler = TRUE;
+/*
+ * Decodes a contiguous chunk of received data.  Returns the number of
+ * bytes consumed, which is less than len if decoding has to stop early.
+ */
+static unsigned int decode_chunk(GAtHDLC *hdlc, const unsigned char *buf,
+					unsigned int len, gboolean *stop)
+{
+	unsigned int pos = 0;
+	unsigned int run;
+	unsigned char c;
 
 	while (pos < len) {
 		/*
@@ -279,47 +376,94 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 		 * ACFC is enabled.
 		 */
 		if (hdlc->no_carrier_detect &&
-				hdlc->decode_offset == 0 && *buf == '\r')
+				hdlc->decode_offset == 0 && buf[pos] == '\r') {
+			*stop = TRUE;
 			break;
+		}
 
 		if (hdlc->decode_escape == TRUE) {
-			unsigned char val = *buf ^ HDLC_TRANS;
-
-			hdlc->decode_buffer[hdlc->decode_offset++] = val;
-			hdlc->decode_fcs = HDLC_FCS(hdlc->decode_fcs, val);
+			c = buf[pos++] ^ HDLC_TRANS;
 
+			decode_append(hdlc, &c, 1);
 			hdlc->decode_escape = FALSE;
-		} else if (*buf == HDLC_ESCAPE) {
+			continue;
+		}
+
+		run = recv_clean_run(buf + pos, len - pos, hdlc->recv_accm);
+		if (run > 0) {
+			decode_append(hdlc, buf + pos, run);
+			pos += run;
+			continue;
+		}
+
+		c = buf[pos];
+
+		if (c == HDLC_ESCAPE) {
 			hdlc->decode_escape = TRUE;
-		} else if (*buf == HDLC_FLAG) {
+		} else if (c == HDLC_FLAG) {
 			if (hdlc->receive_func && hdlc->decode_offset > 2 &&
+					hdlc->decode_overflow == FALSE &&
 					hdlc->decode_fcs == HDLC_GOODFCS) {
 				hdlc->receive_func(hdlc->decode_buffer,
 							hdlc->decode_offset - 2,
 							hdlc->receive_data);
 
-				if (hdlc->destroyed)
-					goto out;
+				if (hdlc->destroyed) {
+					*stop = TRUE;
+					break;
+				}
 			}
 
 			hdlc->decode_fcs = HDLC_INITFCS;
 			hdlc->decode_offset = 0;
-		} else if (*buf >= 0x20 ||
-					(hdlc->recv_accm & (1 << *buf)) == 0) {
-			hdlc->decode_buffer[hdlc->decode_offset++] = *buf;
-			hdlc->decode_fcs = HDLC_FCS(hdlc->decode_fcs, *buf);
+			hdlc->decode_overflow = FALSE;
 		}
 
-		buf++;
+		/* Anything else is a control character filtered by ACCM */
 		pos++;
+	}
 
-		if (pos == wrap) {
-			buf = ring_buffer_read_ptr(rbuf, pos);
-			hdlc_record(hdlc, TRUE, buf, len - wrap);
-		}
+	return pos;
+}
+
+static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
+{
+	GAtHDLC *hdlc = user_data;
+	unsigned int len = ring_buffer_len(rbuf);
+	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
+	unsigned char *buf;
+	unsigned int pos = 0;
+	unsigned int chunk;
+	gboolean stop = FALSE;
+
+	/*
+	 * We delete the the paused_timeout_cb or hdlc_suspend as soons as
+	 * we read a data.
+	 */
+	if (hdlc->suspend_source > 0) {
+		hdlc_source_remove(hdlc, hdlc->suspend_source);
+		hdlc->suspend_source = 0;
+		g_timer_start(hdlc->timer);
+	} else if (hdlc->timer) {
+		gboolean escaping = check_escape(hdlc, rbuf);
+
+		g_timer_start(hdlc->timer);
+
+		if (escaping)
+			return;
+	}
+
+	hdlc->in_read_handler = TRUE;
+
+	while (pos < len && stop == FALSE) {
+		chunk = pos < wrap ? wrap - pos : len - pos;
+		buf = ring_buffer_read_ptr(rbuf, pos);
+
+		hdlc_record(hdlc, TRUE, buf, chunk);
+
+		pos += decode_chunk(hdlc, buf, chunk, &stop);
 	}
 
-out:
 	ring_buffer_drain(rbuf, pos);
 
 	hdlc->in_read_handler = FALSE;
@@ -328,6 +472,33 @@ out:
 		g_free(hdlc);
 }
 
+static struct ring_buffer *hdlc_get_buffer(GAtHDLC *hdlc)
+{
+	struct ring_buffer *rbuf;
+
+	if (hdlc->spare_buffers == NULL)
+		return ring_buffer_new(BUFFER_SIZE);
+
+	rbuf = hdlc->spare_buffers->data;
+	hdlc->spare_buffers = g_slist_delete_link(hdlc->spare_buffers,
+							hdlc->spare_buffers);
+	hdlc->num_spare -= 1;
+
+	return rbuf;
+}
+
+static void hdlc_put_buffer(GAtHDLC *hdlc, struct ring_buffer *rbuf)
+{
+	if (hdlc->num_spare >= MAX_SPARE) {
+		ring_buffer_free(rbuf);
+		return;
+	}
+
+	ring_buffer_reset(rbuf);
+	hdlc->spare_buffers = g_slist_prepend(hdlc->spare_buffers, rbuf);
+	hdlc->num_spare += 1;
+}
+
 GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io)
 {
 	GAtHDLC *hdlc;
@@ -344,6 +515,7 @@ GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io)
 	hdlc->decode_fcs = HDLC_INITFCS;
 	hdlc->decode_offset = 0;
 	hdlc->decode_escape = FALSE;
+	hdlc->decode_overflow = FALSE;
 
 	hdlc->xmit_accm[0] = ~0U;
 	hdlc->xmit_accm[3] = 0x60000000; /* 0x7d, 0x7e */
@@ -428,7 +600,7 @@ void g_at_hdlc_unref(GAtHDLC *hdlc)
 	g_at_io_set_read_handler(hdlc->io, NULL, NULL);
 
 	if (hdlc->suspend_source > 0)
-		g_source_remove(hdlc->suspend_source);
+		hdlc_source_remove(hdlc, hdlc->suspend_source);
 
 	g_at_io_unref(hdlc->io);
 	hdlc->io = NULL;
@@ -438,6 +610,9 @@ void g_at_hdlc_unref(GAtHDLC *hdlc)
 
 	g_queue_free(hdlc->write_queue);
 
+	g_slist_free_full(hdlc->spare_buffers,
+				(GDestroyNotify) ring_buffer_free);
+
 	g_free(hdlc->decode_buffer);
 
 	g_timer_destroy(hdlc->timer);
@@ -475,33 +650,37 @@ static gboolean can_write_data(gpointer data)
 	gsize bytes_written;
 	struct ring_buffer* write_buffer;
 
-	/* Write data out from the head of the queue */
-	write_buffer = g_queue_peek_head(hdlc->write_queue);
+	/*
+	 * Write out as much of the queue as the device accepts, so that
+	 * several frames only cost a single wakeup
+	 */
+	while (TRUE) {
+		write_buffer = g_queue_peek_head(hdlc->write_queue);
 
-	len = ring_buffer_len_no_wrap(write_buffer);
-	buf = ring_buffer_read_ptr(write_buffer, 0);
+		len = ring_buffer_len_no_wrap(write_buffer);
+		if (len == 0) {
+			/*
+			 * All data in current buffer is written, recycle it
+			 * unless it's the last buffer in the queue.
+			 */
+			if (g_queue_get_length(hdlc->write_queue) == 1)
+				return FALSE;
+
+			g_queue_pop_head(hdlc->write_queue);
+			hdlc_put_buffer(hdlc, write_buffer);
+			continue;
+		}
 
-	bytes_written = g_at_io_write(hdlc->io, (gchar *) buf, len);
-	hdlc_record(hdlc, FALSE, buf, bytes_written);
-	ring_buffer_drain(write_buffer, bytes_written);
+		buf = ring_buffer_read_ptr(write_buffer, 0);
 
-	if (ring_buffer_len(write_buffer) > 0)
-		return TRUE;
+		bytes_written = g_at_io_write(hdlc->io, (gchar *) buf, len);
+		hdlc_record(hdlc, FALSE, buf, bytes_written);
+		ring_buffer_drain(write_buffer, bytes_written);
 
-	/* All data in current buffer is written, free it
-	 * unless it's the last buffer in the queue.
-	 */
-	if ((ring_buffer_len(write_buffer) == 0) &&
-			(g_queue_get_length(hdlc->write_queue) > 1)) {
-		write_buffer = g_queue_pop_head(hdlc->write_queue);
-		ring_buffer_free(write_buffer);
-		write_buffer = g_queue_peek_head(hdlc->write_queue);
+		/* The device is full, wait for the next wakeup */
+		if (bytes_written < len)
+			return TRUE;
 	}
-
-	if (ring_buffer_len(write_buffer) > 0)
-		return TRUE;
-
-	return FALSE;
 }
 
 void g_at_hdlc_set_xmit_accm(GAtHDLC *hdlc, guint32 accm)
@@ -528,7 +707,57 @@ GAtIO *g_at_hdlc_get_io(GAtHDLC *hdlc)
 	return hdlc->io;
 }
 
-#define NEED_ESCAPE(xmit_accm, c) xmit_accm[c >> 5] & (1 << (c & 0x1f))
+/* Copies len bytes into the write buffer at offset pos, handling wrap */
+static inline void encode_put(struct ring_buffer *rbuf, unsigned int pos,
+				unsigned int wrap, const unsigned char *data,
+				unsigned int len)
+{
+	unsigned int head = 0;
+
+	if (pos < wrap) {
+		head = MIN(len, wrap - pos);
+		memcpy(ring_buffer_write_ptr(rbuf, pos), data, head);
+	}
+
+	if (head < len)
+		memcpy(ring_buffer_write_ptr(rbuf, pos + head), data + head,
+								len - head);
+}
+
+static gboolean encode_escaped(GAtHDLC *hdlc, struct ring_buffer *rbuf,
+				unsigned int *pos, unsigned int avail,
+				unsigned int wrap, const unsigned char *data,
+				gsize size)
+{
+	unsigned char esc[2];
+	unsigned int run;
+	gsize i = 0;
+
+	while (i < size) {
+		run = xmit_clean_run(data + i, size - i, hdlc->xmit_accm);
+
+		if (*pos + run > avail)
+			return FALSE;
+
+		encode_put(rbuf, *pos, wrap, data + i, run);
+		*pos += run;
+		i += run;
+
+		if (i == size)
+			break;
+
+		if (*pos + 2 > avail)
+			return FALSE;
+
+		esc[0] = HDLC_ESCAPE;
+		esc[1] = data[i++] ^ HDLC_TRANS;
+
+		encode_put(rbuf, *pos, wrap, esc, 2);
+		*pos += 2;
+	}
+
+	return TRUE;
+}
 
 gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
 {
@@ -536,18 +765,16 @@ gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
 
 	unsigned int avail = ring_buffer_avail(write_buffer);
 	unsigned int wrap = ring_buffer_avail_no_wrap(write_buffer);
-	unsigned char *buf;
 	unsigned char tail[2];
-	unsigned int i = 0;
-	guint16 fcs = HDLC_INITFCS;
-	gboolean escape = FALSE;
-	gsize pos = 0;
+	unsigned char flag = HDLC_FLAG;
+	guint16 fcs;
+	unsigned int pos = 0;
 
 	if (avail < size + HDLC_OVERHEAD) {
 		if (g_queue_get_length(hdlc->write_queue) > MAX_BUFFERS)
 			return FALSE;	/* Too many pending buffers */
 
-		write_buffer = ring_buffer_new(BUFFER_SIZE);
+		write_buffer = hdlc_get_buffer(hdlc);
 		if (write_buffer == NULL)
 			return FALSE;
 
@@ -557,83 +784,36 @@ gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
 		wrap = ring_buffer_avail_no_wrap(write_buffer);
 	}
 
-	i = 0;
-	buf = ring_buffer_write_ptr(write_buffer, 0);
-
 	if (hdlc->start_frame_marker == TRUE) {
 		/* Protocol requires 0x7e as start marker */
 		if (pos + 1 > avail)
 			return FALSE;
 
-		*buf++ = HDLC_FLAG;
-		pos++;
-
-		if (pos == wrap)
-			buf = ring_buffer_write_ptr(write_buffer, pos);
+		encode_put(write_buffer, pos++, wrap, &flag, 1);
 	} else if (hdlc->wakeup_sent == FALSE) {
 		/* Write an initial 0x7e as wakeup character */
-		*buf++ = HDLC_FLAG;
-		pos++;
+		encode_put(write_buffer, pos++, wrap, &flag, 1);
 
 		hdlc->wakeup_sent = TRUE;
 	}
 
-	while (pos < avail && i < size) {
-		if (escape == TRUE) {
-			fcs = HDLC_FCS(fcs, data[i]);
-			*buf = data[i++] ^ HDLC_TRANS;
-			escape = FALSE;
-		} else if (NEED_ESCAPE(hdlc->xmit_accm, data[i])) {
-			*buf = HDLC_ESCAPE;
-			escape = TRUE;
-		} else {
-			fcs = HDLC_FCS(fcs, data[i]);
-			*buf = data[i++];
-		}
-
-		buf++;
-		pos++;
-
-		if (pos == wrap)
-			buf = ring_buffer_write_ptr(write_buffer, pos);
-	}
-
-	if (i < size)
+	if (encode_escaped(hdlc, write_buffer, &pos, avail, wrap,
+							data, size) == FALSE)
 		return FALSE;
 
-	fcs ^= HDLC_INITFCS;
+	fcs = crc_ccitt(HDLC_INITFCS, data, size) ^ HDLC_INITFCS;
 	tail[0] = fcs & 0xff;
 	tail[1] = fcs >> 8;
 
-	i = 0;
-
-	while (pos < avail && i < sizeof(tail)) {
-		if (escape == TRUE) {
-			*buf = tail[i++] ^ HDLC_TRANS;
-			escape = FALSE;
-		} else if (NEED_ESCAPE(hdlc->xmit_accm, tail[i])) {
-			*buf = HDLC_ESCAPE;
-			escape = TRUE;
-		} else {
-			*buf = tail[i++];
-		}
-
-		buf++;
-		pos++;
-
-		if (pos == wrap)
-			buf = ring_buffer_write_ptr(write_buffer, pos);
-	}
-
-	if (i < sizeof(tail))
+	if (encode_escaped(hdlc, write_buffer, &pos, avail, wrap,
+						tail, sizeof(tail)) == FALSE)
 		return FALSE;
 
 	if (pos + 1 > avail)
 		return FALSE;
 
 	/* Add 0x7e as end marker */
-	*buf = HDLC_FLAG;
-	pos++;
+	encode_put(write_buffer, pos++, wrap, &flag, 1);
 
 	ring_buffer_write_advance(write_buffer, pos);
 
@@ -34,8 +34,13 @@
 
 #include "ringbuffer.h"
 #include "gatio.h"
+#include "gatmux.h"
 #include "gatutil.h"
 
+#define IO_BUFFER_SIZE		8192
+#define IO_MAX_BUFFER_SIZE	65536
+#define IO_BACKLOG_WAKEUPS	4
+
 struct _GAtIO {
 	gint ref_count;				/* Ref count */
 	guint read_watch;			/* GSource read id, 0 if no */
@@ -45,6 +50,8 @@ struct _GAtIO {
 	gpointer user_disconnect_data;		/* user disconnect data */
 	struct ring_buffer *buf;		/* Current read buffer */
 	guint max_read_attempts;		/* max reads / select */
+	guint max_buffer_size;			/* Read buffer growth limit */
+	guint backlog;				/* Wakeups that filled buf */
 	GAtIOReadFunc read_handler;		/* Read callback */
 	gpointer read_data;			/* Read callback userdata */
 	gboolean use_write_watch;		/* Use write select */
@@ -55,15 +62,71 @@ struct _GAtIO {
 	GAtDisconnectFunc write_done_func;	/* tx empty notifier */
 	gpointer write_done_data;		/* tx empty data */
 	gboolean destroyed;			/* Re-entrancy guard */
+	GAtBatchStats read_stats;		/* Read batching counters */
+	GAtBatchStats write_stats;		/* Write batching counters */
+	GMainContext *context;			/* NULL for the default one */
+	gboolean moving_read;			/* Read watch being re-armed */
+	gboolean moving_write;			/* Write watch being re-armed */
+	gboolean throttle;			/* Pause reads when buf is full */
+	gboolean read_suspended;		/* Read watch paused by throttle */
+	unsigned char *packet;			/* Datagram being read, or NULL */
+	gsize packet_size;			/* Largest datagram */
+	gsize packet_len;			/* Datagram waiting for room */
 };
 
+static guint io_add_watch(GAtIO *io, gint priority, GIOCondition cond,
+				GIOFunc func, GDestroyNotify notify)
+{
+	GSource *source;
+	guint id;
+
+	source = g_io_create_watch(io->channel, cond);
+	g_source_set_priority(source, priority);
+	g_source_set_callback(source, (GSourceFunc) func, io, notify);
+
+	id = g_source_attach(source, io->context);
+	g_source_unref(source);
+
+	return id;
+}
+
+static void io_remove_source(GAtIO *io, guint id)
+{
+	GSource *source;
+
+	source = g_main_context_find_source_by_id(io->context, id);
+	if (source)
+		g_source_destroy(source);
+}
+
+static gboolean disconnect_idle(gpointer user_data)
+{
+	GAtIO *io = user_data;
+
+	if (io->user_disconnect)
+		io->user_disconnect(io->user_disconnect_data);
+
+	g_at_io_unref(io);
+
+	return FALSE;
+}
+
 static void read_watcher_destroy_notify(gpointer user_data)
 {
 	GAtIO *io = user_data;
 
+	if (io->moving_read) {
+		io->moving_read = FALSE;
+		return;
+	}
+
 	ring_buffer_free(io->buf);
 	io->buf = NULL;
 
+	g_free(io->packet);
+	io->packet = NULL;
+	io->packet_len = 0;
+
 	io->debugf = NULL;
 	io->debug_data = NULL;
 
@@ -73,12 +136,103 @@ static void read_watcher_destroy_notify(gpointer user_data)
 
 	io->channel = NULL;
 
-	if (io->destroyed)
+	if (io->destroyed) {
+		if (io->context)
+			g_main_context_unref(io->context);
+
 		g_free(io);
-	else if (io->user_disconnect)
+	} else if (io->user_disconnect && io->context) {
+		/* Users only expect to be called from the main loop */
+		g_idle_add(disconnect_idle, g_at_io_ref(io));
+	} else if (io->user_disconnect)
 		io->user_disconnect(io->user_disconnect_data);
 }
 
+/*
+ * Replaces the read buffer by one twice as large, keeping the unread data
+ * in order.  Consumers only see the buffer through the read handler, so
+ * this must happen right before the handler is called.
+ */
+static gboolean io_grow_buffer(GAtIO *io)
+{
+	unsigned int size = ring_buffer_capacity(io->buf);
+	struct ring_buffer *buf;
+	unsigned int len;
+
+	if (size * 2 > io->max_buffer_size)
+		return FALSE;
+
+	buf = ring_buffer_new(size * 2);
+	if (buf == NULL)
+		return FALSE;
+
+	while ((len = ring_buffer_len_no_wrap(io->buf)) > 0) {
+		ring_buffer_write(buf, ring_buffer_read_ptr(io->buf, 0), len);
+		ring_buffer_drain(io->buf, len);
+	}
+
+	ring_buffer_free(io->buf);
+	io->buf = buf;
+
+	return TRUE;
+}
+
+static gboolean received_data(GIOChannel *channel, GIOCondition cond,
+				gpointer data);
+
+/* Moves a datagram read earlier into the buffer once it fits */
+static gboolean io_flush_packet(GAtIO *io)
+{
+	if (io->packet_len == 0)
+		return TRUE;
+
+	if ((gsize) ring_buffer_avail(io->buf) < io->packet_len)
+		return FALSE;
+
+	ring_buffer_write(io->buf, io->packet, io->packet_len);
+	io->packet_len = 0;
+
+	return TRUE;
+}
+
+/*
+ * Drops the read watch while the buffer is full but keeps the buffer
+ * around, reading resumes from g_at_io_drain_ring_buffer.  The watch
+ * holds the only reference to the channel, so take one meanwhile.
+ * Meant to be returned from received_data.
+ */
+static gboolean io_suspend_read(GAtIO *io)
+{
+	g_io_channel_ref(io->channel);
+
+	io->read_suspended = TRUE;
+	io->moving_read = TRUE;
+	io->read_watch = 0;
+
+	return FALSE;
+}
+
+static void io_rearm_read(GAtIO *io)
+{
+	io->read_suspended = FALSE;
+	io->read_watch = io_add_watch(io, G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				received_data, read_watcher_destroy_notify);
+
+	g_io_channel_unref(io->channel);
+}
+
+static void io_resume_read(GAtIO *io)
+{
+	if (io->read_suspended == FALSE)
+		return;
+
+	if (io_flush_packet(io) == FALSE || ring_buffer_avail(io->buf) == 0)
+		return;
+
+	io_rearm_read(io);
+}
+
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 				gpointer data)
 {
@@ -95,13 +249,25 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 
 	/* Regardless of condition, try to read all the data available */
 	do {
-		toread = ring_buffer_avail_no_wrap(io->buf);
+		if (io->packet != NULL) {
+			/*
+			 * Datagrams are read whole into the side buffer, as
+			 * whatever does not fit a read is thrown away.
+			 */
+			if (io_flush_packet(io) == FALSE)
+				break;
+
+			toread = io->packet_size;
+			buf = io->packet;
+		} else {
+			toread = ring_buffer_avail_no_wrap(io->buf);
+			buf = ring_buffer_write_ptr(io->buf, 0);
+		}
 
 		if (toread == 0)
 			break;
 
 		rbytes = 0;
-		buf = ring_buffer_write_ptr(io->buf, 0);
 
 		status = g_io_channel_read_chars(channel, (char *) buf,
 							toread, &rbytes, NULL);
@@ -112,12 +278,44 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 
 		total_read += rbytes;
 
-		if (rbytes > 0)
+		if (rbytes > 0 && io->packet != NULL) {
+			io->packet_len = rbytes;
+			io_flush_packet(io);
+		} else if (rbytes > 0)
 			ring_buffer_write_advance(io->buf, rbytes);
 
 	} while (status == G_IO_STATUS_NORMAL && rbytes > 0 &&
 					read_count < io->max_read_attempts);
 
+	if (total_read > 0) {
+		guint batch = rbytes > 0 ? read_count : read_count - 1;
+
+		io->read_stats.wakeups += 1;
+		io->read_stats.reads += batch;
+		io->read_stats.bytes += total_read;
+
+		if (batch > io->read_stats.max_batch)
+			io->read_stats.max_batch = batch;
+
+		/*
+		 * The last read took all the room it was offered, so more
+		 * data is likely waiting.  Grow straight away if the buffer
+		 * is full, otherwise only once the backlog has persisted.
+		 */
+		if (rbytes > 0 && rbytes == toread)
+			io->backlog += 1;
+		else if (toread > 0)
+			io->backlog = 0;
+
+		if (ring_buffer_avail(io->buf) == 0 || io->packet_len > 0 ||
+				io->backlog >= IO_BACKLOG_WAKEUPS) {
+			if (io_grow_buffer(io))
+				io->backlog = 0;
+
+			io_flush_packet(io);
+		}
+	}
+
 	if (total_read > 0 && io->read_handler)
 		io->read_handler(io->buf, io->read_data);
 
@@ -127,9 +325,13 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	if (read_count > 0 && rbytes == 0 && status != G_IO_STATUS_AGAIN)
 		return FALSE;
 
-	/* We're overflowing the buffer, shutdown the socket */
-	if (ring_buffer_avail(io->buf) == 0)
+	if (io->packet_len > 0 || ring_buffer_avail(io->buf) == 0) {
+		if (io->throttle)
+			return io_suspend_read(io);
+
+		/* We're overflowing the buffer, shutdown the socket */
 		return FALSE;
+	}
 
 	return TRUE;
 }
@@ -142,14 +344,21 @@ gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count)
 	status = g_io_channel_write_chars(io->channel, data,
 						count, &bytes_written, NULL);
 
+	/* The device is full, the caller will retry on the next wakeup */
+	if (status == G_IO_STATUS_AGAIN)
+		return 0;
+
 	if (status != G_IO_STATUS_NORMAL) {
-		g_source_remove(io->read_watch);
+		io_remove_source(io, io->read_watch);
 		return 0;
 	}
 
 	g_at_util_debug_chat(FALSE, data, bytes_written,
 				io->debugf, io->debug_data);
 
+	io->write_stats.reads += 1;
+	io->write_stats.bytes += bytes_written;
+
 	return bytes_written;
 }
 
@@ -157,6 +366,11 @@ static void write_watcher_destroy_notify(gpointer user_data)
 {
 	GAtIO *io = user_data;
 
+	if (io->moving_write) {
+		io->moving_write = FALSE;
+		return;
+	}
+
 	io->write_watch = 0;
 	io->write_handler = NULL;
 	io->write_data = NULL;
@@ -172,6 +386,9 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 				gpointer data)
 {
 	GAtIO *io = data;
+	guint64 writes;
+	gboolean ret;
+	guint batch;
 
 	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
 		return FALSE;
@@ -179,7 +396,18 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 	if (io->write_handler == NULL)
 		return FALSE;
 
-	return io->write_handler(io->write_data);
+	writes = io->write_stats.reads;
+	ret = io->write_handler(io->write_data);
+	batch = io->write_stats.reads - writes;
+
+	if (batch > 0) {
+		io->write_stats.wakeups += 1;
+
+		if (batch > io->write_stats.max_batch)
+			io->write_stats.max_batch = batch;
+	}
+
+	return ret;
 }
 
 static GAtIO *create_io(GIOChannel *channel, GIOFlags flags)
@@ -204,7 +432,8 @@ static GAtIO *create_io(GIOChannel *channel, GIOFlags flags)
 		io->use_write_watch = FALSE;
 	}
 
-	io->buf = ring_buffer_new(8192);
+	io->max_buffer_size = IO_MAX_BUFFER_SIZE;
+	io->buf = ring_buffer_new(IO_BUFFER_SIZE);
 
 	if (!io->buf)
 		goto error;
@@ -213,10 +442,9 @@ static GAtIO *create_io(GIOChannel *channel, GIOFlags flags)
 		goto error;
 
 	io->channel = channel;
-	io->read_watch = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT,
+	io->read_watch = io_add_watch(io, G_PRIORITY_DEFAULT,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				received_data, io,
-				read_watcher_destroy_notify);
+				received_data, read_watcher_destroy_notify);
 
 	return io;
 
@@ -280,7 +508,7 @@ gboolean g_at_io_set_write_handler(GAtIO *io, GAtIOWriteFunc write_handler,
 
 	if (io->write_watch > 0) {
 		if (write_handler == NULL) {
-			g_source_remove(io->write_watch);
+			io_remove_source(io, io->write_watch);
 			return TRUE;
 		}
 
@@ -294,11 +522,9 @@ gboolean g_at_io_set_write_handler(GAtIO *io, GAtIOWriteFunc write_handler,
 	io->write_data = user_data;
 
 	if (io->use_write_watch == TRUE)
-		io->write_watch = g_io_add_watch_full(io->channel,
-				G_PRIORITY_HIGH,
+		io->write_watch = io_add_watch(io, G_PRIORITY_HIGH,
 				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				can_write_data, io,
-				write_watcher_destroy_notify);
+				can_write_data, write_watcher_destroy_notify);
 	else
 		io->write_watch = g_idle_add(call_blocking_read, io);
 
@@ -322,10 +548,10 @@ static gboolean io_shutdown(GAtIO *io)
 	io->user_disconnect_data = NULL;
 
 	if (io->read_watch > 0)
-		g_source_remove(io->read_watch);
+		io_remove_source(io, io->read_watch);
 
 	if (io->write_watch > 0)
-		g_source_remove(io->write_watch);
+		io_remove_source(io, io->write_watch);
 
 	return TRUE;
 }
@@ -349,10 +575,22 @@ void g_at_io_unref(GAtIO *io)
 	 * destroyed already.  We have to wait until the read_watcher
 	 * destroy function gets called
 	 */
-	if (io->read_watch > 0)
+	if (io->read_watch > 0) {
 		io->destroyed = TRUE;
-	else
-		g_free(io);
+		return;
+	}
+
+	/* Reading was suspended, the watch no longer owns the buffers */
+	if (io->read_suspended) {
+		ring_buffer_free(io->buf);
+		g_free(io->packet);
+		g_io_channel_unref(io->channel);
+	}
+
+	if (io->context)
+		g_main_context_unref(io->context);
+
+	g_free(io);
 }
 
 gboolean g_at_io_set_disconnect_function(GAtIO *io,
@@ -388,7 +626,164 @@ void g_at_io_set_write_done(GAtIO *io, GAtDisconnectFunc func,
 	io->write_done_data = user_data;
 }
 
+/*
+ * Moves the watches of io to context, NULL meaning the default one.  The
+ * caller must make sure nothing dispatches io while it is being moved,
+ * and from then on io may only be used from the thread running context.
+ */
+gboolean g_at_io_set_context(GAtIO *io, GMainContext *context)
+{
+	if (io == NULL)
+		return FALSE;
+
+	/* Blocking IO relies on idle sources of the default context */
+	if (io->use_write_watch == FALSE)
+		return FALSE;
+
+	if (context == io->context)
+		return TRUE;
+
+	/* Mux channel watches are dispatched by the mux, not by context */
+	if (io->channel && g_at_mux_is_channel(io->channel))
+		return FALSE;
+
+	/* The watches hold the only reference to the channel */
+	if (io->channel)
+		g_io_channel_ref(io->channel);
+
+	if (io->read_watch > 0) {
+		io->moving_read = TRUE;
+		io_remove_source(io, io->read_watch);
+		io->read_watch = 0;
+	}
+
+	if (io->write_watch > 0) {
+		io->moving_write = TRUE;
+		io_remove_source(io, io->write_watch);
+		io->write_watch = 0;
+	}
+
+	if (io->context)
+		g_main_context_unref(io->context);
+
+	io->context = context ? g_main_context_ref(context) : NULL;
+
+	if (io->buf && io->channel && io->read_suspended == FALSE)
+		io->read_watch = io_add_watch(io, G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				received_data, read_watcher_destroy_notify);
+
+	if (io->write_handler)
+		io->write_watch = io_add_watch(io, G_PRIORITY_HIGH,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				can_write_data, write_watcher_destroy_notify);
+
+	if (io->channel)
+		g_io_channel_unref(io->channel);
+
+	return TRUE;
+}
+
+GMainContext *g_at_io_get_context(GAtIO *io)
+{
+	if (io == NULL)
+		return NULL;
+
+	return io->context;
+}
+
+void g_at_io_set_read_budget(GAtIO *io, guint budget)
+{
+	if (io == NULL || budget == 0)
+		return;
+
+	io->max_read_attempts = budget;
+}
+
+void g_at_io_get_read_stats(GAtIO *io, GAtBatchStats *stats)
+{
+	if (io == NULL || stats == NULL)
+		return;
+
+	*stats = io->read_stats;
+}
+
+void g_at_io_get_write_stats(GAtIO *io, GAtBatchStats *stats)
+{
+	if (io == NULL || stats == NULL)
+		return;
+
+	*stats = io->write_stats;
+}
+
+/*
+ * Lets the read buffer grow up to size bytes when the peer keeps it full.
+ * The buffer never shrinks, so a limit below the current size only stops
+ * further growth.
+ */
+void g_at_io_set_max_buffer_size(GAtIO *io, gsize size)
+{
+	if (io == NULL)
+		return;
+
+	io->max_buffer_size = MIN(size, G_MAXUINT);
+}
+
+gsize g_at_io_get_buffer_size(GAtIO *io)
+{
+	if (io == NULL || io->buf == NULL)
+		return 0;
+
+	return ring_buffer_capacity(io->buf);
+}
+
 void g_at_io_drain_ring_buffer(GAtIO *io, guint len)
 {
 	ring_buffer_drain(io->buf, len);
+
+	io_resume_read(io);
+}
+
+/*
+ * With throttling a full read buffer pauses reading until the consumer
+ * frees some room through g_at_io_drain_ring_buffer, instead of being
+ * treated as an overflow that shuts the channel down.
+ */
+void g_at_io_set_throttle(GAtIO *io, gboolean throttle)
+{
+	if (io == NULL)
+		return;
+
+	io->throttle = throttle;
+
+	if (throttle || io->read_suspended == FALSE)
+		return;
+
+	/* Let received_data deal with the full buffer the old way */
+	io_rearm_read(io);
+}
+
+/*
+ * Switches io to datagram reads, as needed by a tun device: every read
+ * takes one whole packet of up to size bytes, which is only moved into
+ * the read buffer once it fits.  Implies throttling.
+ */
+gboolean g_at_io_set_packet_size(GAtIO *io, gsize size)
+{
+	if (io == NULL || io->buf == NULL || io->packet != NULL || size == 0)
+		return FALSE;
+
+	/* Must happen before anyone holds on to the buffer */
+	while ((gsize) ring_buffer_capacity(io->buf) < size)
+		if (io_grow_buffer(io) == FALSE)
+			return FALSE;
+
+	io->packet = g_try_malloc(size);
+	if (io->packet == NULL)
+		return FALSE;
+
+	io->packet_size = size;
+	io->throttle = TRUE;
+
+	return TRUE;
 }
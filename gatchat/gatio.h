@@ -53,6 +53,18 @@ void g_at_io_set_write_done(GAtIO *io, GAtDisconnectFunc func,
 				gpointer user_data);
 
 void g_at_io_drain_ring_buffer(GAtIO *io, guint len);
+void g_at_io_set_throttle(GAtIO *io, gboolean throttle);
+gboolean g_at_io_set_packet_size(GAtIO *io, gsize size);
+
+gboolean g_at_io_set_context(GAtIO *io, GMainContext *context);
+GMainContext *g_at_io_get_context(GAtIO *io);
+
+void g_at_io_set_read_budget(GAtIO *io, guint budget);
+void g_at_io_get_read_stats(GAtIO *io, GAtBatchStats *stats);
+void g_at_io_get_write_stats(GAtIO *io, GAtBatchStats *stats);
+
+void g_at_io_set_max_buffer_size(GAtIO *io, gsize size);
+gsize g_at_io_get_buffer_size(GAtIO *io);
 
 gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count);
 
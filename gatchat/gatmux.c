@@ -53,6 +53,18 @@ typedef void (*GAtMuxWriteFrame)(GAtMux *mux, guint8 dlc, guint8 control,
 #define BITMAP_SIZE 8
 #define MUX_CHANNEL_BUFFER_SIZE 4096
 #define MUX_BUFFER_SIZE 4096
+#define MUX_TX_BUFFER_SIZE 4096
+#define MUX_TX_QUEUE_LIMIT 4096
+#define MUX_TX_QUANTUM 256
+
+/* Outgoing frames of one DLC, stored back to back */
+struct mux_tx_queue {
+	GByteArray *data;			/* Frame bytes */
+	GArray *lengths;			/* Length of each frame */
+	guint head;				/* Index of the first frame */
+	guint offset;				/* Offset of the first frame */
+	GAtMuxStats stats;
+};
 
 struct _GAtMuxChannel
 {
@@ -63,6 +75,9 @@ struct _GAtMuxChannel
 	GSList *sources;
 	gboolean throttled;
 	guint dlc;
+	struct mux_tx_queue txq;		/* Pending data frames */
+	guint weight;				/* Round robin weight */
+	gsize deficit;				/* Round robin credit */
 };
 
 struct _GAtMuxWatch
@@ -87,6 +102,12 @@ struct _GAtMux {
 	void *driver_data;			/* Driver data */
 	char buf[MUX_BUFFER_SIZE];		/* Buffer on the main mux */
 	int buf_used;				/* Bytes of buf being used */
+	struct mux_tx_queue control;		/* DLC 0 and non-data frames */
+	guint8 *tx_buf;				/* Coalesced output */
+	guint tx_size;				/* Allocated size of tx_buf */
+	guint tx_len;				/* Bytes of tx_buf being used */
+	guint tx_sent;				/* Bytes of tx_buf written */
+	guint tx_next;				/* Next DLC in the round */
 	gboolean shutdown;
 	unsigned int vendor;			/* Specific vendor */
 };
@@ -116,6 +137,195 @@ static inline void debug(GAtMux *mux, const char *format, ...)
 	va_end(ap);
 }
 
+static void mux_tx_queue_init(struct mux_tx_queue *q)
+{
+	q->data = g_byte_array_new();
+	q->lengths = g_array_new(FALSE, FALSE, sizeof(guint));
+	q->head = 0;
+	q->offset = 0;
+	memset(&q->stats, 0, sizeof(q->stats));
+}
+
+static void mux_tx_queue_free(struct mux_tx_queue *q)
+{
+	g_byte_array_free(q->data, TRUE);
+	g_array_free(q->lengths, TRUE);
+}
+
+static inline gboolean mux_tx_queue_empty(struct mux_tx_queue *q)
+{
+	return q->head == q->lengths->len;
+}
+
+static inline guint mux_tx_queue_peek(struct mux_tx_queue *q)
+{
+	return g_array_index(q->lengths, guint, q->head);
+}
+
+static void mux_tx_queue_push(struct mux_tx_queue *q,
+				const guint8 *frame, guint len)
+{
+	/* Reclaim the consumed part before it dominates the queue */
+	if (q->offset > 0 && q->offset >= q->data->len / 2) {
+		g_byte_array_remove_range(q->data, 0, q->offset);
+		g_array_remove_range(q->lengths, 0, q->head);
+		q->offset = 0;
+		q->head = 0;
+	}
+
+	g_byte_array_append(q->data, frame, len);
+	g_array_append_val(q->lengths, len);
+
+	q->stats.queued_bytes += len;
+	q->stats.queued_frames += 1;
+
+	if (q->stats.queued_bytes > q->stats.max_queued_bytes)
+		q->stats.max_queued_bytes = q->stats.queued_bytes;
+}
+
+static void mux_tx_queue_pop(struct mux_tx_queue *q, guint8 *out)
+{
+	guint len = mux_tx_queue_peek(q);
+
+	memcpy(out, q->data->data + q->offset, len);
+
+	q->offset += len;
+	q->head += 1;
+
+	q->stats.queued_bytes -= len;
+	q->stats.queued_frames -= 1;
+	q->stats.tx_bytes += len;
+	q->stats.tx_frames += 1;
+
+	if (mux_tx_queue_empty(q)) {
+		g_byte_array_set_size(q->data, 0);
+		g_array_set_size(q->lengths, 0);
+		q->offset = 0;
+		q->head = 0;
+	}
+}
+
+static void mux_tx_queue_clear(struct mux_tx_queue *q)
+{
+	g_byte_array_set_size(q->data, 0);
+	g_array_set_size(q->lengths, 0);
+	q->offset = 0;
+	q->head = 0;
+	q->stats.queued_bytes = 0;
+	q->stats.queued_frames = 0;
+}
+
+/*
+ * Moves whole frames from q into tx_buf while they fit, and while their
+ * total stays within budget. Returns FALSE if tx_buf ran out of room.
+ */
+static gboolean mux_tx_take(GAtMux *mux, struct mux_tx_queue *q,
+				gsize *budget)
+{
+	while (!mux_tx_queue_empty(q)) {
+		guint len = mux_tx_queue_peek(q);
+
+		if (len > *budget)
+			return TRUE;
+
+		if (mux->tx_len + len > mux->tx_size) {
+			if (mux->tx_len > 0)
+				return FALSE;
+
+			/* A frame that does not fit on its own */
+			mux->tx_buf = g_realloc(mux->tx_buf, len);
+			mux->tx_size = len;
+		}
+
+		mux_tx_queue_pop(q, mux->tx_buf + mux->tx_len);
+		mux->tx_len += len;
+		*budget -= len;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Fills tx_buf with as many frames as fit. The control queue always goes
+ * first, data DLCs share the rest by deficit round robin so that a busy
+ * channel cannot starve the others.
+ */
+static void mux_tx_fill(GAtMux *mux)
+{
+	gsize unlimited = G_MAXSIZE;
+	gboolean progress = TRUE;
+	int i;
+
+	if (mux_tx_take(mux, &mux->control, &unlimited) == FALSE)
+		return;
+
+	while (progress) {
+		progress = FALSE;
+
+		for (i = 0; i < MAX_CHANNELS; i++) {
+			guint idx = (mux->tx_next + i) % MAX_CHANNELS;
+			GAtMuxChannel *channel = mux->dlcs[idx];
+
+			if (channel == NULL || channel->throttled)
+				continue;
+
+			if (mux_tx_queue_empty(&channel->txq)) {
+				channel->deficit = 0;
+				continue;
+			}
+
+			if (channel->deficit < mux_tx_queue_peek(&channel->txq))
+				channel->deficit +=
+					channel->weight * MUX_TX_QUANTUM;
+
+			if (mux_tx_take(mux, &channel->txq,
+						&channel->deficit) == FALSE) {
+				mux->tx_next = idx;
+				return;
+			}
+
+			if (mux_tx_queue_empty(&channel->txq))
+				channel->deficit = 0;
+			else
+				progress = TRUE;
+		}
+	}
+}
+
+/*
+ * Writes out as much queued data as the channel accepts. Returns TRUE if
+ * something is left over for the next G_IO_OUT.
+ */
+static gboolean mux_tx_flush(GAtMux *mux)
+{
+	GIOStatus status;
+	gsize written;
+
+	if (mux->channel == NULL)
+		return FALSE;
+
+	while (TRUE) {
+		if (mux->tx_sent == mux->tx_len) {
+			mux->tx_sent = 0;
+			mux->tx_len = 0;
+			mux_tx_fill(mux);
+
+			if (mux->tx_len == 0)
+				return FALSE;
+		}
+
+		written = 0;
+		status = g_io_channel_write_chars(mux->channel,
+				(gchar *) mux->tx_buf + mux->tx_sent,
+				mux->tx_len - mux->tx_sent, &written, NULL);
+
+		mux->tx_sent += written;
+
+		if (status != G_IO_STATUS_NORMAL || written == 0)
+			return TRUE;
+	}
+}
+
 static void dispatch_sources(GAtMuxChannel *channel, GIOCondition condition)
 {
 	GAtMuxWatch *source;
@@ -274,11 +484,18 @@ static gboolean can_write_data(GIOChannel *chan, GIOCondition cond,
 		if (channel->throttled)
 			continue;
 
+		/* Let the queue drain before accepting more */
+		if (channel->txq.stats.queued_bytes >= MUX_TX_QUEUE_LIMIT)
+			continue;
+
 		debug(mux, "dispatching write sources: %p", channel);
 
 		dispatch_sources(channel, G_IO_OUT);
 	}
 
+	if (mux_tx_flush(mux))
+		return TRUE;
+
 	for (dlc = 0; dlc < MAX_CHANNELS; dlc += 1) {
 		GAtMuxChannel *channel = mux->dlcs[dlc];
 		GSList *l;
@@ -315,15 +532,68 @@ static void wakeup_writer(GAtMux *mux)
 				write_watcher_destroy_notify);
 }
 
+/*
+ * Control frames are sent right away, after anything already queued, and
+ * are retried on G_IO_OUT if the channel is not ready.
+ */
 int g_at_mux_raw_write(GAtMux *mux, const void *data, int towrite)
 {
-	gssize count = towrite;
-	gsize bytes_written;
+	mux_tx_queue_push(&mux->control, data, towrite);
 
-	g_io_channel_write_chars(mux->channel, (gchar *) data,
-					count, &bytes_written, NULL);
+	if (mux_tx_flush(mux))
+		wakeup_writer(mux);
 
-	return bytes_written;
+	return towrite;
+}
+
+void g_at_mux_queue_frame(GAtMux *mux, guint8 dlc,
+				const void *frame, int len)
+{
+	GAtMuxChannel *channel = NULL;
+
+	if (dlc >= 1 && dlc <= MAX_CHANNELS)
+		channel = mux->dlcs[dlc - 1];
+
+	if (channel == NULL) {
+		g_at_mux_raw_write(mux, frame, len);
+		return;
+	}
+
+	mux_tx_queue_push(&channel->txq, frame, len);
+
+	if (channel->throttled == FALSE)
+		wakeup_writer(mux);
+}
+
+gboolean g_at_mux_set_dlc_weight(GAtMux *mux, guint8 dlc, guint weight)
+{
+	if (mux == NULL || dlc < 1 || dlc > MAX_CHANNELS || weight == 0)
+		return FALSE;
+
+	if (mux->dlcs[dlc - 1] == NULL)
+		return FALSE;
+
+	mux->dlcs[dlc - 1]->weight = weight;
+
+	return TRUE;
+}
+
+gboolean g_at_mux_get_dlc_stats(GAtMux *mux, guint8 dlc, GAtMuxStats *stats)
+{
+	if (mux == NULL || stats == NULL || dlc > MAX_CHANNELS)
+		return FALSE;
+
+	if (dlc == 0) {
+		*stats = mux->control.stats;
+		return TRUE;
+	}
+
+	if (mux->dlcs[dlc - 1] == NULL)
+		return FALSE;
+
+	*stats = mux->dlcs[dlc - 1]->txq.stats;
+
+	return TRUE;
 }
 
 void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
@@ -376,6 +646,9 @@ void g_at_mux_set_dlc_status(GAtMux *mux, guint8 dlc, int status)
 		mux->dlcs[dlc-1]->throttled = FALSE;
 		debug(mux, "setting throttled to FALSE");
 
+		if (!mux_tx_queue_empty(&channel->txq))
+			wakeup_writer(mux);
+
 		for (l = mux->dlcs[dlc-1]->sources; l; l = l->next) {
 			GAtMuxWatch *source = l->data;
 
@@ -488,6 +761,17 @@ static GIOStatus channel_close(GIOChannel *channel, GError **err)
 
 	dispatch_sources(mux_channel, G_IO_NVAL);
 
+	/* Get pending data out ahead of the close request if we can */
+	mux_tx_flush(mux);
+
+	if (!mux_tx_queue_empty(&mux_channel->txq))
+		debug(mux, "dropping %u queued bytes on dlc %d",
+				(unsigned int)
+				mux_channel->txq.stats.queued_bytes,
+				mux_channel->dlc);
+
+	mux_tx_queue_clear(&mux_channel->txq);
+
 	if (mux->driver->close_dlc)
 		mux->driver->close_dlc(mux, mux_channel->dlc);
 
@@ -501,6 +785,7 @@ static void channel_free(GIOChannel *channel)
 	GAtMuxChannel *mux_channel = (GAtMuxChannel *) channel;
 
 	ring_buffer_free(mux_channel->buffer);
+	mux_tx_queue_free(&mux_channel->txq);
 
 	g_free(channel);
 }
@@ -578,6 +863,10 @@ GAtMux *g_at_mux_new(GIOChannel *channel, const GAtMuxDriver *driver)
 
 	mux->vendor = OFONO_VENDOR_GENERIC;
 
+	mux_tx_queue_init(&mux->control);
+	mux->tx_buf = g_malloc(MUX_TX_BUFFER_SIZE);
+	mux->tx_size = MUX_TX_BUFFER_SIZE;
+
 	g_io_channel_set_close_on_unref(channel, TRUE);
 
 	return mux;
@@ -601,11 +890,17 @@ void g_at_mux_unref(GAtMux *mux)
 	if (g_atomic_int_dec_and_test(&mux->ref_count)) {
 		g_at_mux_shutdown(mux);
 
+		if (mux->write_watch > 0)
+			g_source_remove(mux->write_watch);
+
 		g_io_channel_unref(mux->channel);
 
 		if (mux->driver->remove)
 			mux->driver->remove(mux);
 
+		mux_tx_queue_free(&mux->control);
+		g_free(mux->tx_buf);
+
 		g_free(mux);
 	}
 }
@@ -728,6 +1023,8 @@ GIOChannel *g_at_mux_create_channel(GAtMux *mux)
 	mux_channel->dlc = i+1;
 	mux_channel->buffer = ring_buffer_new(MUX_CHANNEL_BUFFER_SIZE);
 	mux_channel->throttled = FALSE;
+	mux_tx_queue_init(&mux_channel->txq);
+	mux_channel->weight = 1;
 
 	mux->dlcs[i] = mux_channel;
 
@@ -736,6 +1033,14 @@ GIOChannel *g_at_mux_create_channel(GAtMux *mux)
 	return channel;
 }
 
+gboolean g_at_mux_is_channel(GIOChannel *channel)
+{
+	if (channel == NULL)
+		return FALSE;
+
+	return channel->funcs == &channel_funcs;
+}
+
 static void msd_free(gpointer user_data)
 {
 	struct mux_setup_data *msd = user_data;
@@ -1114,7 +1419,7 @@ static void gsm0710_basic_write(GAtMux *mux, guint8 dlc,
 		max = MIN(towrite, gd->frame_size);
 		frame_size = gsm0710_basic_fill_frame(frame, dlc,
 						GSM0710_DATA, data, max);
-		g_at_mux_raw_write(mux, frame, frame_size);
+		g_at_mux_queue_frame(mux, dlc, frame, frame_size);
 		data = data + max;
 		towrite -= max;
 	}
@@ -1269,7 +1574,7 @@ static void gsm0710_advanced_write(GAtMux *mux, guint8 dlc,
 		max = MIN(towrite, gd->frame_size);
 		frame_size = gsm0710_advanced_fill_frame(frame, dlc,
 						GSM0710_DATA, data, max);
-		g_at_mux_raw_write(mux, frame, frame_size);
+		g_at_mux_queue_frame(mux, dlc, frame, frame_size);
 		data = data + max;
 		towrite -= max;
 	}
@@ -36,6 +36,15 @@ typedef struct _GAtMuxDriver GAtMuxDriver;
 typedef enum _GAtMuxChannelStatus GAtMuxChannelStatus;
 typedef void (*GAtMuxSetupFunc)(GAtMux *mux, gpointer user_data);
 
+/* Transmit queue statistics of a DLC, DLC 0 covers all control frames */
+typedef struct _GAtMuxStats {
+	gsize queued_bytes;
+	guint queued_frames;
+	gsize max_queued_bytes;
+	guint64 tx_bytes;
+	guint64 tx_frames;
+} GAtMuxStats;
+
 enum _GAtMuxDlcStatus {
 	G_AT_MUX_DLC_STATUS_RTC = 0x02,
 	G_AT_MUX_DLC_STATUS_RTR = 0x04,
@@ -72,6 +81,14 @@ gboolean g_at_mux_set_debug(GAtMux *mux, GAtDebugFunc func, gpointer user_data);
 gboolean g_at_mux_set_vendor(GAtMux *mux, unsigned int vendor);
 
 GIOChannel *g_at_mux_create_channel(GAtMux *mux);
+gboolean g_at_mux_is_channel(GIOChannel *channel);
+
+/*!
+ * Data DLCs share the link by weighted round robin, control frames always
+ * go first. The weight defaults to 1.
+ */
+gboolean g_at_mux_set_dlc_weight(GAtMux *mux, guint8 dlc, guint weight);
+gboolean g_at_mux_get_dlc_stats(GAtMux *mux, guint8 dlc, GAtMuxStats *stats);
 
 /*!
  * Multiplexer driver integration functions
@@ -81,6 +98,8 @@ void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
 				const void *data, int tofeed);
 
 int g_at_mux_raw_write(GAtMux *mux, const void *data, int towrite);
+void g_at_mux_queue_frame(GAtMux *mux, guint8 dlc,
+				const void *frame, int len);
 
 void g_at_mux_set_data(GAtMux *mux, void *data);
 void *g_at_mux_get_data(GAtMux *mux);
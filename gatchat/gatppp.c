@@ -87,6 +87,36 @@ struct _GAtPPP {
 	gboolean suspended;
 	gboolean xmit_acfc;
 	gboolean xmit_pfc;
+	gboolean threaded;
+	guint thread_source;
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	GAtIO *io;
+	GAsyncQueue *events;
+	GSource *event_source;
+};
+
+enum ppp_event_type {
+	PPP_EVENT_CONNECT,
+	PPP_EVENT_DEAD,
+	PPP_EVENT_SUSPEND,
+};
+
+/* Control event handed from the data thread to the main loop */
+struct ppp_event {
+	enum ppp_event_type type;
+	GAtPPPDisconnectReason reason;
+	char *iface;
+	char *local;
+	char *peer;
+	char *dns1;
+	char *dns2;
+};
+
+struct ppp_event_source {
+	GSource source;
+	GAtPPP *ppp;
 };
 
 void ppp_debug(GAtPPP *ppp, const char *str)
@@ -97,14 +127,163 @@ void ppp_debug(GAtPPP *ppp, const char *str)
 	ppp->debugf(str, ppp->debug_data);
 }
 
+static guint ppp_attach(GAtPPP *ppp, GSource *source,
+				GSourceFunc function, gpointer data)
+{
+	guint id;
+
+	g_source_set_callback(source, function, data, NULL);
+
+	id = g_source_attach(source, ppp->context);
+	g_source_unref(source);
+
+	return id;
+}
+
+/*
+ * All timers and watches of the engine are attached to the context it
+ * runs on, which is the default one unless the data thread drives it.
+ */
+static guint ppp_timeout_add(GAtPPP *ppp, guint interval,
+				GSourceFunc function, gpointer data)
+{
+	return ppp_attach(ppp, g_timeout_source_new(interval), function, data);
+}
+
+static guint ppp_idle_add(GAtPPP *ppp, GSourceFunc function, gpointer data)
+{
+	return ppp_attach(ppp, g_idle_source_new(), function, data);
+}
+
+guint ppp_timeout_add_seconds(GAtPPP *ppp, guint interval,
+					GSourceFunc function, gpointer data)
+{
+	return ppp_attach(ppp, g_timeout_source_new_seconds(interval),
+							function, data);
+}
+
+guint ppp_io_add_watch(GAtPPP *ppp, GIOChannel *channel,
+				GIOCondition condition, GIOFunc function,
+				gpointer data)
+{
+	return ppp_attach(ppp, g_io_create_watch(channel, condition),
+						(GSourceFunc) function, data);
+}
+
+void ppp_source_remove(GAtPPP *ppp, guint id)
+{
+	GSource *source;
+
+	source = g_main_context_find_source_by_id(ppp->context, id);
+	if (source)
+		g_source_destroy(source);
+}
+
+static struct ppp_event *ppp_event_new(enum ppp_event_type type)
+{
+	struct ppp_event *event = g_new0(struct ppp_event, 1);
+
+	event->type = type;
+
+	return event;
+}
+
+static void ppp_event_free(gpointer data)
+{
+	struct ppp_event *event = data;
+
+	g_free(event->iface);
+	g_free(event->local);
+	g_free(event->peer);
+	g_free(event->dns1);
+	g_free(event->dns2);
+	g_free(event);
+}
+
+static void ppp_post_event(GAtPPP *ppp, struct ppp_event *event)
+{
+	g_async_queue_push(ppp->events, event);
+	g_main_context_wakeup(NULL);
+}
+
+static gboolean event_prepare(GSource *source, gint *timeout)
+{
+	struct ppp_event_source *es = (struct ppp_event_source *) source;
+
+	*timeout = -1;
+
+	return g_async_queue_length(es->ppp->events) > 0;
+}
+
+static gboolean event_check(GSource *source)
+{
+	struct ppp_event_source *es = (struct ppp_event_source *) source;
+
+	return g_async_queue_length(es->ppp->events) > 0;
+}
+
+/*
+ * One event per dispatch: the callback may well drop the last reference
+ * to the GAtPPP, which destroys this source, so it must not be touched
+ * once the callback has been called.
+ */
+static gboolean event_dispatch(GSource *source, GSourceFunc callback,
+							gpointer user_data)
+{
+	struct ppp_event_source *es = (struct ppp_event_source *) source;
+	GAtPPP *ppp = es->ppp;
+	struct ppp_event *event;
+
+	event = g_async_queue_try_pop(ppp->events);
+	if (event == NULL)
+		return TRUE;
+
+	switch (event->type) {
+	case PPP_EVENT_CONNECT:
+		if (ppp->connect_cb)
+			ppp->connect_cb(event->iface, event->local,
+					event->peer, event->dns1,
+					event->dns2, ppp->connect_data);
+		break;
+	case PPP_EVENT_DEAD:
+		if (ppp->disconnect_cb)
+			ppp->disconnect_cb(event->reason,
+						ppp->disconnect_data);
+		break;
+	case PPP_EVENT_SUSPEND:
+		if (ppp->suspend_func)
+			ppp->suspend_func(ppp->suspend_data);
+		break;
+	}
+
+	ppp_event_free(event);
+
+	return TRUE;
+}
+
+static GSourceFuncs event_funcs = {
+	event_prepare,
+	event_check,
+	event_dispatch,
+	NULL,
+};
+
 static gboolean ppp_dead(gpointer userdata)
 {
 	GAtPPP *ppp = userdata;
+	struct ppp_event *event;
 
 	DBG(ppp, "");
 
 	ppp->ppp_dead_source = 0;
 
+	if (ppp->events) {
+		event = ppp_event_new(PPP_EVENT_DEAD);
+		event->reason = ppp->disconnect_reason;
+		ppp_post_event(ppp, event);
+		return FALSE;
+	}
+
 	/* notify interested parties */
 	if (ppp->disconnect_cb)
 		ppp->disconnect_cb(ppp->disconnect_reason,
@@ -362,7 +541,7 @@ static inline void ppp_enter_phase(GAtPPP *ppp, enum ppp_phase phase)
 	ppp->phase = phase;
 
 	if (phase == PPP_PHASE_DEAD && ppp->sta_pending == FALSE)
-		ppp->ppp_dead_source = g_idle_add(ppp_dead, ppp);
+		ppp->ppp_dead_source = ppp_idle_add(ppp, ppp_dead, ppp);
 }
 
 void ppp_set_auth(GAtPPP *ppp, const guint8* auth_data)
@@ -425,6 +604,18 @@ void ppp_ipcp_up_notify(GAtPPP *ppp, const char *local, const char *peer,
 
 	ppp_enter_phase(ppp, PPP_PHASE_LINK_UP);
 
+	if (ppp->events) {
+		struct ppp_event *event = ppp_event_new(PPP_EVENT_CONNECT);
+
+		event->iface = g_strdup(ppp_net_get_interface(ppp->net));
+		event->local = g_strdup(local);
+		event->peer = g_strdup(peer);
+		event->dns1 = g_strdup(dns1);
+		event->dns2 = g_strdup(dns2);
+		ppp_post_event(ppp, event);
+		return;
+	}
+
 	if (ppp->connect_cb)
 		ppp->connect_cb(ppp_net_get_interface(ppp->net),
 					local, peer, dns1, dns2,
@@ -433,10 +624,17 @@ void ppp_ipcp_up_notify(GAtPPP *ppp, const char *local, const char *peer,
 
 void ppp_ipcp_down_notify(GAtPPP *ppp)
 {
+	GAtBatchStats stats;
+
 	/* Most likely we failed to create the interface */
 	if (ppp->net == NULL)
 		return;
 
+	ppp_net_get_stats(ppp->net, &stats);
+	DBG(ppp, "tun: %" G_GUINT64_FORMAT " packets in %" G_GUINT64_FORMAT
+			" wakeups, max batch %u", stats.reads,
+			stats.wakeups, stats.max_batch);
+
 	ppp_net_free(ppp->net);
 	ppp->net = NULL;
 }
@@ -520,10 +718,157 @@ void ppp_set_xmit_pfc(GAtPPP *ppp, gboolean pfc)
 	ppp->xmit_pfc = pfc;
 }
 
-static void io_disconnect(gpointer user_data)
+static void ppp_suspend_notify(GAtPPP *ppp)
+{
+	if (ppp->events) {
+		ppp_post_event(ppp, ppp_event_new(PPP_EVENT_SUSPEND));
+		return;
+	}
+
+	if (ppp->suspend_func)
+		ppp->suspend_func(ppp->suspend_data);
+}
+
+static void ppp_start(GAtPPP *ppp)
+{
+	g_at_hdlc_set_receive(ppp->hdlc, ppp_receive, ppp);
+
+	/* send an UP & OPEN events to the lcp layer */
+	pppcp_signal_up(ppp->lcp);
+	pppcp_signal_open(ppp->lcp);
+
+	ppp_enter_phase(ppp, PPP_PHASE_ESTABLISHMENT);
+}
+
+static gpointer data_thread(gpointer user_data)
 {
 	GAtPPP *ppp = user_data;
 
+	g_main_context_push_thread_default(ppp->context);
+
+	ppp_start(ppp);
+	g_main_loop_run(ppp->loop);
+
+	g_main_context_pop_thread_default(ppp->context);
+
+	return NULL;
+}
+
+static void release_context(GAtPPP *ppp)
+{
+	if (ppp->event_source) {
+		g_source_destroy(ppp->event_source);
+		g_source_unref(ppp->event_source);
+		ppp->event_source = NULL;
+	}
+
+	if (ppp->events) {
+		g_async_queue_unref(ppp->events);
+		ppp->events = NULL;
+	}
+
+	if (ppp->io) {
+		g_at_io_set_context(ppp->io, NULL);
+		g_at_io_unref(ppp->io);
+		ppp->io = NULL;
+	}
+
+	if (ppp->loop) {
+		g_main_loop_unref(ppp->loop);
+		ppp->loop = NULL;
+	}
+
+	if (ppp->context) {
+		g_main_context_unref(ppp->context);
+		ppp->context = NULL;
+	}
+}
+
+/*
+ * Runs from the main loop once we are out of the callback which opened
+ * us, so that nothing dispatches the IO while it is being moved.
+ */
+static gboolean start_thread(gpointer user_data)
+{
+	GAtPPP *ppp = user_data;
+	GAtIO *io = g_at_hdlc_get_io(ppp->hdlc);
+	struct ppp_event_source *es;
+
+	ppp->thread_source = 0;
+
+	ppp->context = g_main_context_new();
+
+	if (g_at_io_set_context(io, ppp->context) == FALSE)
+		goto unthreaded;
+
+	ppp->io = g_at_io_ref(io);
+	ppp->loop = g_main_loop_new(ppp->context, FALSE);
+	ppp->events = g_async_queue_new_full(ppp_event_free);
+
+	ppp->event_source = g_source_new(&event_funcs,
+					sizeof(struct ppp_event_source));
+	es = (struct ppp_event_source *) ppp->event_source;
+	es->ppp = ppp;
+	g_source_attach(ppp->event_source, NULL);
+
+	ppp->thread = g_thread_try_new("ppp", data_thread, ppp, NULL);
+	if (ppp->thread != NULL)
+		return FALSE;
+
+unthreaded:
+	/* Keep on running from the main loop */
+	release_context(ppp);
+	ppp_start(ppp);
+
+	return FALSE;
+}
+
+static gboolean quit_loop(gpointer user_data)
+{
+	GMainLoop *loop = user_data;
+
+	g_main_loop_quit(loop);
+
+	return FALSE;
+}
+
+static void stop_thread(GAtPPP *ppp)
+{
+	GSource *source;
+
+	if (ppp->thread == NULL)
+		return;
+
+	/* Quitting from the loop itself cannot race with it starting up */
+	source = g_idle_source_new();
+	g_source_set_callback(source, quit_loop, ppp->loop, NULL);
+	g_source_attach(source, ppp->context);
+	g_source_unref(source);
+
+	g_thread_join(ppp->thread);
+	ppp->thread = NULL;
+}
+
+/* Runs function on whichever thread drives the engine */
+static void ppp_invoke(GAtPPP *ppp, GSourceFunc function)
+{
+	/* Not moved yet: fall back to running from the main loop */
+	if (ppp->thread_source > 0) {
+		g_source_remove(ppp->thread_source);
+		ppp->thread_source = 0;
+		ppp_start(ppp);
+	}
+
+	if (ppp->thread == NULL) {
+		function(ppp);
+		return;
+	}
+
+	ppp_idle_add(ppp, function, ppp);
+}
+
+static void ppp_link_dead(GAtPPP *ppp)
+{
 	if (ppp->phase == PPP_PHASE_DEAD)
 		return;
 
@@ -532,6 +877,18 @@ static void io_disconnect(gpointer user_data)
 	pppcp_signal_close(ppp->lcp);
 }
 
+static gboolean link_dead_cb(gpointer user_data)
+{
+	ppp_link_dead(user_data);
+
+	return FALSE;
+}
+
+static void io_disconnect(gpointer user_data)
+{
+	ppp_invoke(user_data, link_dead_cb);
+}
+
 static void ppp_proxy_suspend_net_interface(gpointer user_data)
 {
 	GAtPPP *ppp = user_data;
@@ -539,8 +896,7 @@ static void ppp_proxy_suspend_net_interface(gpointer user_data)
 	ppp->suspended = TRUE;
 	ppp_net_suspend_interface(ppp->net);
 
-	if (ppp->suspend_func)
-		ppp->suspend_func(ppp->suspend_data);
+	ppp_suspend_notify(ppp);
 }
 
 gboolean g_at_ppp_listen(GAtPPP *ppp, GAtIO *io)
@@ -568,17 +924,18 @@ gboolean g_at_ppp_open(GAtPPP *ppp, GAtIO *io)
 		return FALSE;
 
 	ppp->suspended = FALSE;
-	g_at_hdlc_set_receive(ppp->hdlc, ppp_receive, ppp);
 	g_at_hdlc_set_suspend_function(ppp->hdlc,
 					ppp_proxy_suspend_net_interface, ppp);
 	g_at_hdlc_set_no_carrier_detect(ppp->hdlc, TRUE);
 	g_at_io_set_disconnect_function(io, io_disconnect, ppp);
 
-	/* send an UP & OPEN events to the lcp layer */
-	pppcp_signal_up(ppp->lcp);
-	pppcp_signal_open(ppp->lcp);
+	/* Negotiation starts on the data thread once it is up */
+	if (ppp->threaded) {
+		ppp->thread_source = g_idle_add(start_thread, ppp);
+		return TRUE;
+	}
 
-	ppp_enter_phase(ppp, PPP_PHASE_ESTABLISHMENT);
+	ppp_start(ppp);
 
 	return TRUE;
 }
@@ -681,13 +1038,30 @@ void g_at_ppp_set_suspend_function(GAtPPP *ppp, GAtSuspendFunc func,
 					ppp_proxy_suspend_net_interface, ppp);
 }
 
-void g_at_ppp_shutdown(GAtPPP *ppp)
+void g_at_ppp_set_threaded(GAtPPP *ppp, gboolean threaded)
 {
-	if (ppp->phase == PPP_PHASE_DEAD || ppp->phase == PPP_PHASE_TERMINATION)
+	if (ppp == NULL)
 		return;
 
+	ppp->threaded = threaded;
+}
+
+static gboolean shutdown_cb(gpointer user_data)
+{
+	GAtPPP *ppp = user_data;
+
+	if (ppp->phase == PPP_PHASE_DEAD || ppp->phase == PPP_PHASE_TERMINATION)
+		return FALSE;
+
 	ppp->disconnect_reason = G_AT_PPP_REASON_LOCAL_CLOSE;
 	pppcp_signal_close(ppp->lcp);
+
+	return FALSE;
+}
+
+void g_at_ppp_shutdown(GAtPPP *ppp)
+{
+	ppp_invoke(ppp, shutdown_cb);
 }
 
 static gboolean call_suspend_cb(gpointer user_data)
@@ -696,8 +1070,7 @@ static gboolean call_suspend_cb(gpointer user_data)
 
 	ppp->guard_timeout_source = 0;
 
-	if (ppp->suspend_func)
-		ppp->suspend_func(ppp->suspend_data);
+	ppp_suspend_notify(ppp);
 
 	return FALSE;
 }
@@ -708,32 +1081,40 @@ static gboolean send_escape_sequence(gpointer user_data)
 	GAtIO *io = g_at_hdlc_get_io(ppp->hdlc);
 
 	g_at_io_write(io, "+++", 3);
-	ppp->guard_timeout_source  = g_timeout_add(GUARD_TIMEOUTS,
+	ppp->guard_timeout_source  = ppp_timeout_add(ppp, GUARD_TIMEOUTS,
 						call_suspend_cb, ppp);
 
 	return FALSE;
 }
 
-void g_at_ppp_suspend(GAtPPP *ppp)
+static gboolean suspend_cb(gpointer user_data)
 {
-	if (ppp == NULL)
-		return;
+	GAtPPP *ppp = user_data;
 
 	ppp->suspended = TRUE;
 	ppp_net_suspend_interface(ppp->net);
 	g_at_hdlc_suspend(ppp->hdlc);
-	ppp->guard_timeout_source = g_timeout_add(GUARD_TIMEOUTS,
+	ppp->guard_timeout_source = ppp_timeout_add(ppp, GUARD_TIMEOUTS,
 						send_escape_sequence, ppp);
+
+	return FALSE;
 }
 
-void g_at_ppp_resume(GAtPPP *ppp)
+void g_at_ppp_suspend(GAtPPP *ppp)
 {
 	if (ppp == NULL)
 		return;
 
+	ppp_invoke(ppp, suspend_cb);
+}
+
+static gboolean resume_cb(gpointer user_data)
+{
+	GAtPPP *ppp = user_data;
+
 	if (g_at_hdlc_get_io(ppp->hdlc) == NULL) {
-		io_disconnect(ppp);
-		return;
+		ppp_link_dead(ppp);
+		return FALSE;
 	}
 
 	ppp->suspended = FALSE;
@@ -741,6 +1122,16 @@ void g_at_ppp_resume(GAtPPP *ppp)
 							io_disconnect, ppp);
 	ppp_net_resume_interface(ppp->net);
 	g_at_hdlc_resume(ppp->hdlc);
+
+	return FALSE;
+}
+
+void g_at_ppp_resume(GAtPPP *ppp)
+{
+	if (ppp == NULL)
+		return;
+
+	ppp_invoke(ppp, resume_cb);
 }
 
 void g_at_ppp_ref(GAtPPP *ppp)
@@ -760,6 +1151,13 @@ void g_at_ppp_unref(GAtPPP *ppp)
 	if (is_zero == FALSE)
 		return;
 
+	if (ppp->thread_source > 0) {
+		g_source_remove(ppp->thread_source);
+		ppp->thread_source = 0;
+	}
+
+	stop_thread(ppp);
+
 	if (ppp->suspended == FALSE)
 		g_at_io_set_disconnect_function(g_at_hdlc_get_io(ppp->hdlc),
 							NULL, NULL);
@@ -779,17 +1177,19 @@ void g_at_ppp_unref(GAtPPP *ppp)
 	ipcp_free(ppp->ipcp);
 
 	if (ppp->ppp_dead_source) {
-		g_source_remove(ppp->ppp_dead_source);
+		ppp_source_remove(ppp, ppp->ppp_dead_source);
 		ppp->ppp_dead_source = 0;
 	}
 
 	if (ppp->guard_timeout_source) {
-		g_source_remove(ppp->guard_timeout_source);
+		ppp_source_remove(ppp, ppp->guard_timeout_source);
 		ppp->guard_timeout_source = 0;
 	}
 
 	g_at_hdlc_unref(ppp->hdlc);
 
+	release_context(ppp);
+
 	g_free(ppp);
 }
 
@@ -807,6 +1207,20 @@ void g_at_ppp_set_server_info(GAtPPP *ppp, const char *remote,
 	ipcp_set_server_info(ppp->ipcp, r, d1, d2);
 }
 
+gboolean g_at_ppp_get_net_stats(GAtPPP *ppp, GAtBatchStats *stats)
+{
+	if (ppp == NULL || ppp->net == NULL || stats == NULL)
+		return FALSE;
+
+	/* The data thread owns the interface */
+	if (ppp->thread != NULL)
+		return FALSE;
+
+	ppp_net_get_stats(ppp->net, stats);
+
+	return TRUE;
+}
+
 void g_at_ppp_set_acfc_enabled(GAtPPP *ppp, gboolean enabled)
 {
 	lcp_set_acfc_enabled(ppp->lcp, enabled);
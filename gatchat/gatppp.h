@@ -59,6 +59,13 @@ GAtPPP *g_at_ppp_new(void);
 GAtPPP *g_at_ppp_server_new(const char *local);
 GAtPPP *g_at_ppp_server_new_full(const char *local, int fd);
 
+/*
+ * Run the link on a dedicated thread once g_at_ppp_open is called.  The
+ * connect, disconnect and suspend callbacks are still called from the
+ * main loop, the debug function is called from the data thread.  Stays
+ * on the main loop if the GAtIO cannot be moved, e.g. a GAtMux channel.
+ */
+void g_at_ppp_set_threaded(GAtPPP *ppp, gboolean threaded);
 gboolean g_at_ppp_open(GAtPPP *ppp, GAtIO *io);
 gboolean g_at_ppp_listen(GAtPPP *ppp, GAtIO *io);
 void g_at_ppp_set_connect_function(GAtPPP *ppp, GAtPPPConnectFunc callback,
@@ -90,6 +97,8 @@ void g_at_ppp_set_server_info(GAtPPP *ppp, const char *remote_ip,
 void g_at_ppp_set_acfc_enabled(GAtPPP *ppp, gboolean enabled);
 void g_at_ppp_set_pfc_enabled(GAtPPP *ppp, gboolean enabled);
 
+gboolean g_at_ppp_get_net_stats(GAtPPP *ppp, GAtBatchStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
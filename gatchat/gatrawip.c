@@ -35,6 +35,9 @@
 #include "ringbuffer.h"
 #include "gatrawip.h"
 
+#define TUN_READ_BUDGET	16	/* Maximum packets read from tun per wakeup */
+#define TUN_MAX_PACKET	65535	/* Largest IP packet tun can hand us */
+
 struct _GAtRawIP {
 	gint ref_count;
 	GAtIO *io;
@@ -44,6 +47,11 @@ struct _GAtRawIP {
 	struct ring_buffer *tun_write_buffer;
 	GAtDebugFunc debugf;
 	gpointer debug_data;
+	gboolean threaded;
+	guint thread_source;
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
 };
 
 GAtRawIP *g_at_rawip_new(GIOChannel *channel)
@@ -109,23 +117,39 @@ void g_at_rawip_unref(GAtRawIP *rawip)
 	g_free(rawip);
 }
 
-static gboolean can_write_data(gpointer data)
+/*
+ * Write out everything queued in rbuf, the read buffer of src, across
+ * the ring wrap until the device stops accepting data.  Draining through
+ * src lets it resume reading if it paused on a full buffer.  Returns
+ * TRUE if data is left over.
+ */
+static gboolean drain_to_io(GAtIO *io, GAtIO *src, struct ring_buffer *rbuf)
 {
-	GAtRawIP *rawip = data;
 	unsigned int len;
 	unsigned char *buf;
 	gsize bytes_written;
 
-	if (rawip->write_buffer == NULL)
-		return FALSE;
+	while ((len = ring_buffer_len_no_wrap(rbuf)) > 0) {
+		buf = ring_buffer_read_ptr(rbuf, 0);
+
+		bytes_written = g_at_io_write(io, (gchar *) buf, len);
+		g_at_io_drain_ring_buffer(src, bytes_written);
+
+		if (bytes_written < len)
+			return TRUE;
+	}
+
+	return FALSE;
+}
 
-	len = ring_buffer_len_no_wrap(rawip->write_buffer);
-	buf = ring_buffer_read_ptr(rawip->write_buffer, 0);
+static gboolean can_write_data(gpointer data)
+{
+	GAtRawIP *rawip = data;
 
-	bytes_written = g_at_io_write(rawip->io, (gchar *) buf, len);
-	ring_buffer_drain(rawip->write_buffer, bytes_written);
+	if (rawip->write_buffer == NULL)
+		return FALSE;
 
-	if (ring_buffer_len(rawip->write_buffer) > 0)
+	if (drain_to_io(rawip->io, rawip->tun_io, rawip->write_buffer) == TRUE)
 		return TRUE;
 
 	rawip->write_buffer = NULL;
@@ -136,20 +160,12 @@ static gboolean can_write_data(gpointer data)
 static gboolean tun_write_data(gpointer data)
 {
 	GAtRawIP *rawip = data;
-	unsigned int len;
-	unsigned char *buf;
-	gsize bytes_written;
 
 	if (rawip->tun_write_buffer == NULL)
 		return FALSE;
 
-	len = ring_buffer_len_no_wrap(rawip->tun_write_buffer);
-	buf = ring_buffer_read_ptr(rawip->tun_write_buffer, 0);
-
-	bytes_written = g_at_io_write(rawip->tun_io, (gchar *) buf, len);
-	ring_buffer_drain(rawip->tun_write_buffer, bytes_written);
-
-	if (ring_buffer_len(rawip->tun_write_buffer) > 0)
+	if (drain_to_io(rawip->tun_io, rawip->io,
+				rawip->tun_write_buffer) == TRUE)
 		return TRUE;
 
 	rawip->tun_write_buffer = NULL;
@@ -204,8 +220,115 @@ static void create_tun(GAtRawIP *rawip)
 	}
 
 	rawip->tun_io = g_at_io_new(channel);
-
 	g_io_channel_unref(channel);
+
+	if (rawip->tun_io == NULL)
+		return;
+
+	/* One read per packet, a short read would truncate it */
+	if (g_at_io_set_packet_size(rawip->tun_io, TUN_MAX_PACKET) == FALSE) {
+		g_at_io_unref(rawip->tun_io);
+		rawip->tun_io = NULL;
+		return;
+	}
+
+	g_at_io_set_read_budget(rawip->tun_io, TUN_READ_BUDGET);
+}
+
+static gpointer data_thread(gpointer user_data)
+{
+	GAtRawIP *rawip = user_data;
+
+	g_main_context_push_thread_default(rawip->context);
+	g_main_loop_run(rawip->loop);
+	g_main_context_pop_thread_default(rawip->context);
+
+	return NULL;
+}
+
+/*
+ * Runs from the main loop once we are out of any GAtIO callback, so
+ * that nothing dispatches the channels while they are being moved.
+ */
+static gboolean start_thread(gpointer user_data)
+{
+	GAtRawIP *rawip = user_data;
+
+	rawip->thread_source = 0;
+
+	rawip->context = g_main_context_new();
+	rawip->loop = g_main_loop_new(rawip->context, FALSE);
+
+	if (g_at_io_set_context(rawip->io, rawip->context) == FALSE)
+		goto unthreaded;
+
+	if (g_at_io_set_context(rawip->tun_io, rawip->context) == FALSE)
+		goto unthreaded;
+
+	rawip->thread = g_thread_try_new("rawip", data_thread, rawip, NULL);
+	if (rawip->thread != NULL)
+		return FALSE;
+
+unthreaded:
+	/* Keep on pumping from the main loop */
+	g_at_io_set_context(rawip->io, NULL);
+	g_at_io_set_context(rawip->tun_io, NULL);
+
+	g_main_loop_unref(rawip->loop);
+	rawip->loop = NULL;
+
+	g_main_context_unref(rawip->context);
+	rawip->context = NULL;
+
+	return FALSE;
+}
+
+static gboolean quit_loop(gpointer user_data)
+{
+	GMainLoop *loop = user_data;
+
+	g_main_loop_quit(loop);
+
+	return FALSE;
+}
+
+static void stop_thread(GAtRawIP *rawip)
+{
+	GSource *source;
+
+	if (rawip->thread_source > 0) {
+		g_source_remove(rawip->thread_source);
+		rawip->thread_source = 0;
+	}
+
+	if (rawip->thread == NULL)
+		return;
+
+	/* Quitting from the loop itself cannot race with it starting up */
+	source = g_idle_source_new();
+	g_source_set_callback(source, quit_loop, rawip->loop, NULL);
+	g_source_attach(source, rawip->context);
+	g_source_unref(source);
+
+	g_thread_join(rawip->thread);
+	rawip->thread = NULL;
+
+	g_at_io_set_context(rawip->io, NULL);
+	g_at_io_set_context(rawip->tun_io, NULL);
+
+	g_main_loop_unref(rawip->loop);
+	rawip->loop = NULL;
+
+	g_main_context_unref(rawip->context);
+	rawip->context = NULL;
+}
+
+void g_at_rawip_set_threaded(GAtRawIP *rawip, gboolean threaded)
+{
+	if (rawip == NULL)
+		return;
+
+	rawip->threaded = threaded;
 }
 
 void g_at_rawip_open(GAtRawIP *rawip)
@@ -218,8 +341,14 @@ void g_at_rawip_open(GAtRawIP *rawip)
 	if (rawip->tun_io == NULL)
 		return;
 
+	/* Wait for tun to catch up rather than dropping the link */
+	g_at_io_set_throttle(rawip->io, TRUE);
+
 	g_at_io_set_read_handler(rawip->io, new_bytes, rawip);
 	g_at_io_set_read_handler(rawip->tun_io, tun_bytes, rawip);
+
+	if (rawip->threaded)
+		rawip->thread_source = g_idle_add(start_thread, rawip);
 }
 
 void g_at_rawip_shutdown(GAtRawIP *rawip)
@@ -230,8 +359,11 @@ void g_at_rawip_shutdown(GAtRawIP *rawip)
 	if (rawip->tun_io == NULL)
 		return;
 
+	stop_thread(rawip);
+
 	g_at_io_set_read_handler(rawip->io, NULL, NULL);
 	g_at_io_set_read_handler(rawip->tun_io, NULL, NULL);
+	g_at_io_set_throttle(rawip->io, FALSE);
 
 	rawip->write_buffer = NULL;
 	rawip->tun_write_buffer = NULL;
@@ -248,6 +380,16 @@ const char *g_at_rawip_get_interface(GAtRawIP *rawip)
 	return rawip->ifname;
 }
 
+gboolean g_at_rawip_get_net_stats(GAtRawIP *rawip, GAtBatchStats *stats)
+{
+	if (rawip == NULL || rawip->tun_io == NULL || stats == NULL)
+		return FALSE;
+
+	g_at_io_get_read_stats(rawip->tun_io, stats);
+
+	return TRUE;
+}
+
 void g_at_rawip_set_debug(GAtRawIP *rawip, GAtDebugFunc func,
 						gpointer user_data)
 {
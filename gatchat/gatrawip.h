@@ -39,11 +39,20 @@ GAtRawIP *g_at_rawip_new_from_io(GAtIO *io);
 GAtRawIP *g_at_rawip_ref(GAtRawIP *rawip);
 void g_at_rawip_unref(GAtRawIP *rawip);
 
+/*
+ * Pump packets between the modem and tun on a dedicated thread.  Must be
+ * set before g_at_rawip_open.  Stays on the main loop if the modem GAtIO
+ * cannot be moved, e.g. when it is a GAtMux channel.
+ */
+void g_at_rawip_set_threaded(GAtRawIP *rawip, gboolean threaded);
+
 void g_at_rawip_open(GAtRawIP *rawip);
 void g_at_rawip_shutdown(GAtRawIP *rawip);
 
 const char *g_at_rawip_get_interface(GAtRawIP *rawip);
 
+gboolean g_at_rawip_get_net_stats(GAtRawIP *rawip, GAtBatchStats *stats);
+
 void g_at_rawip_set_debug(GAtRawIP *rawip, GAtDebugFunc func,
 						gpointer user_data);
 
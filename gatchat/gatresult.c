@@ -25,6 +25,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 #include <glib.h>
 
@@ -37,6 +38,7 @@ void g_at_result_iter_init(GAtResultIter *iter, GAtResult *result)
 	iter->pre.data = NULL;
 	iter->l = &iter->pre;
 	iter->line_pos = 0;
+	iter->line_len = 0;
 }
 
 gboolean g_at_result_iter_next(GAtResultIter *iter, const char *prefix)
@@ -62,7 +64,7 @@ gboolean g_at_result_iter_next(GAtResultIter *iter, const char *prefix)
 
 		iter->line_pos = prefix_len;
 
-		while (iter->line_pos < strlen(line) &&
+		while (iter->line_pos < (unsigned int) linelen &&
 			line[iter->line_pos] == ' ')
 			iter->line_pos += 1;
 
@@ -72,8 +74,13 @@ gboolean g_at_result_iter_next(GAtResultIter *iter, const char *prefix)
 	return FALSE;
 
 out:
-	/* Already checked the length to be no more than buflen */
-	strcpy(iter->buf, line);
+	/*
+	 * Already checked the length to be no more than buflen.  The field
+	 * parsers below rely on line_len instead of measuring the line again
+	 * for every field.
+	 */
+	memcpy(iter->buf, line, linelen + 1);
+	iter->line_len = linelen;
 	return TRUE;
 }
 
@@ -120,7 +127,7 @@ gboolean g_at_result_iter_next_unquoted_string(GAtResultIter *iter,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -164,7 +171,7 @@ gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -216,7 +223,7 @@ gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 	bufpos = iter->buf + pos;
@@ -271,7 +278,7 @@ gboolean g_at_result_iter_next_number(GAtResultIter *iter, gint *number)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 	end = pos;
@@ -306,7 +313,7 @@ gboolean g_at_result_iter_next_number_default(GAtResultIter *iter, gint dflt,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = skip_to_next_field(line, iter->line_pos, len);
 
@@ -338,7 +345,7 @@ gboolean g_at_result_iter_next_range(GAtResultIter *iter, gint *min, gint *max)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -382,9 +389,9 @@ out:
 	return TRUE;
 }
 
-static gint skip_until(const char *line, int start, const char delim)
+static gint skip_until(const char *line, int start, int len,
+							const char delim)
 {
-	int len = strlen(line);
 	int i = start;
 
 	while (i < len) {
@@ -407,7 +414,7 @@ static gint skip_until(const char *line, int start, const char delim)
 			continue;
 		}
 
-		i = skip_until(line, i+1, ')');
+		i = skip_until(line, i+1, len, ')');
 
 		if (i < len)
 			i += 1;
@@ -429,12 +436,12 @@ gboolean g_at_result_iter_skip_next(GAtResultIter *iter)
 
 	line = iter->l->data;
 
-	skipped_to = skip_until(line, iter->line_pos, ',');
+	skipped_to = skip_until(line, iter->line_pos, iter->line_len, ',');
 
 	if (skipped_to == iter->line_pos && line[skipped_to] != ',')
 		return FALSE;
 
-	iter->line_pos = skip_to_next_field(line, skipped_to, strlen(line));
+	iter->line_pos = skip_to_next_field(line, skipped_to, iter->line_len);
 
 	return TRUE;
 }
@@ -451,7 +458,7 @@ gboolean g_at_result_iter_open_list(GAtResultIter *iter)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	if (iter->line_pos >= len)
 		return FALSE;
@@ -461,8 +468,7 @@ gboolean g_at_result_iter_open_list(GAtResultIter *iter)
 
 	iter->line_pos += 1;
 
-	while (iter->line_pos < strlen(line) &&
-		line[iter->line_pos] == ' ')
+	while (iter->line_pos < len && line[iter->line_pos] == ' ')
 		iter->line_pos += 1;
 
 	return TRUE;
@@ -480,7 +486,7 @@ gboolean g_at_result_iter_close_list(GAtResultIter *iter)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	if (iter->line_pos >= len)
 		return FALSE;
@@ -495,6 +501,120 @@ gboolean g_at_result_iter_close_list(GAtResultIter *iter)
 	return TRUE;
 }
 
+static gboolean scan_prefix(GAtResultIter *iter, const char *format,
+				unsigned int len)
+{
+	char prefix[32];
+
+	while (len > 0 && format[len - 1] == ' ')
+		len -= 1;
+
+	if (len >= sizeof(prefix))
+		return FALSE;
+
+	memcpy(prefix, format, len);
+	prefix[len] = '\0';
+
+	return g_at_result_iter_next(iter, prefix);
+}
+
+/*
+ * Parses several fields in one call, in the spirit of sscanf.  Text in
+ * front of the first conversion is taken as a line prefix and moves the
+ * iterator to the next line carrying it, as g_at_result_iter_next does.
+ * The conversions are:
+ *
+ *	%d	number, gint *
+ *	%s	quoted string, const char **
+ *	%t	unquoted string, const char **
+ *	%r	range, gint * and gint *
+ *	%x	hex string, const guint8 ** and gint *
+ *	%_	skip the field
+ *	( )	open and close a list
+ *
+ * Commas and spaces in the format are ignored, the parsers already step
+ * over the separators.  Returns the number of conversions done, which stops
+ * short at the first field that does not match, or -1 if no line with
+ * the prefix was found.
+ */
+gint g_at_result_iter_scan(GAtResultIter *iter, const char *format, ...)
+{
+	const char *p = format;
+	const guint8 **hex;
+	gint *min, *max;
+	gint count = 0;
+	va_list args;
+	gboolean ok = TRUE;
+
+	if (iter == NULL || format == NULL)
+		return -1;
+
+	while (*p != '\0' && *p != '%' && *p != '(')
+		p += 1;
+
+	if (p != format && !scan_prefix(iter, format, p - format))
+		return -1;
+
+	va_start(args, format);
+
+	for (; ok && *p != '\0'; p++) {
+		switch (*p) {
+		case ' ':
+		case ',':
+			continue;
+		case '(':
+			ok = g_at_result_iter_open_list(iter);
+			continue;
+		case ')':
+			ok = g_at_result_iter_close_list(iter);
+			continue;
+		case '%':
+			break;
+		default:
+			ok = FALSE;
+			continue;
+		}
+
+		switch (*++p) {
+		case 'd':
+			ok = g_at_result_iter_next_number(iter,
+						va_arg(args, gint *));
+			break;
+		case 's':
+			ok = g_at_result_iter_next_string(iter,
+						va_arg(args, const char **));
+			break;
+		case 't':
+			ok = g_at_result_iter_next_unquoted_string(iter,
+						va_arg(args, const char **));
+			break;
+		case 'r':
+			min = va_arg(args, gint *);
+			max = va_arg(args, gint *);
+			ok = g_at_result_iter_next_range(iter, min, max);
+			break;
+		case 'x':
+			hex = va_arg(args, const guint8 **);
+			max = va_arg(args, gint *);
+			ok = g_at_result_iter_next_hexstring(iter, hex, max);
+			break;
+		case '_':
+			ok = g_at_result_iter_skip_next(iter);
+			continue;
+		default:
+			ok = FALSE;
+			continue;
+		}
+
+		if (ok)
+			count += 1;
+	}
+
+	va_end(args);
+
+	return count;
+}
+
 const char *g_at_result_final_response(GAtResult *result)
 {
 	if (result == NULL)
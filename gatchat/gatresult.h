@@ -40,6 +40,7 @@ struct _GAtResultIter {
 	GSList *l;
 	char buf[G_AT_RESULT_LINE_LENGTH_MAX + 1];
 	unsigned int line_pos;
+	unsigned int line_len;
 	GSList pre;
 };
 
@@ -63,6 +64,8 @@ gboolean g_at_result_iter_next_number_default(GAtResultIter *iter, gint dflt,
 gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
 		const guint8 **str, gint *length);
 
+gint g_at_result_iter_scan(GAtResultIter *iter, const char *format, ...);
+
 const char *g_at_result_iter_raw_line(GAtResultIter *iter);
 
 const char *g_at_result_final_response(GAtResult *result);
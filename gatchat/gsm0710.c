@@ -101,12 +101,14 @@ int gsm0710_advanced_extract_frame(guint8 *buf, int len,
 	int posn = 0;
 	int posn2;
 	int framelen;
+	guint8 *flag;
 	guint8 dlc;
 	guint8 control;
 
 	while (posn < len) {
 		if (buf[posn] != 0x7E) {
-			posn += 1;
+			flag = memchr(buf + posn, 0x7E, len - posn);
+			posn = flag ? flag - buf : len;
 			continue;
 		}
 
@@ -115,34 +117,43 @@ int gsm0710_advanced_extract_frame(guint8 *buf, int len,
 			posn += 1;
 
 		/* Search for the end of the packet (the next 0x7E byte) */
-		framelen = posn + 1;
-		while (framelen < len && buf[framelen] != 0x7E)
-			framelen += 1;
-
-		if (framelen >= len)
+		flag = memchr(buf + posn + 1, 0x7E, len - posn - 1);
+		if (flag == NULL)
 			break;
 
+		framelen = flag - buf;
+
 		if (framelen < 4) {
 			posn = framelen;
 			continue;
 		}
 
-		/* Undo control byte quoting in the packet */
+		/* Undo control byte quoting in the packet, a run at a time */
 		posn2 = 0;
 		++posn;
 		while (posn < framelen) {
-			if (buf[posn] == 0x7D) {
-				++posn;
+			guint8 *esc = memchr(buf + posn, 0x7D, framelen - posn);
+			int run = (esc ? esc - buf : framelen) - posn;
+
+			memmove(buf + posn2, buf + posn, run);
+			posn2 += run;
+			posn += run;
+
+			if (esc == NULL)
+				break;
 
-				if (posn >= framelen)
-					break;
+			++posn;
+
+			if (posn >= framelen)
+				break;
 
-				buf[posn2++] = buf[posn++] ^ 0x20;
-			} else {
-				buf[posn2++] = buf[posn++];
-			}
+			buf[posn2++] = buf[posn++] ^ 0x20;
 		}
 
+		/* Address, control and FCS at the very least */
+		if (posn2 < 3)
+			continue;
+
 		/* Validate the checksum on the packet header */
 		if (!gsm0710_check_fcs(buf, 2, buf[posn2 - 1]))
 			continue;
@@ -225,13 +236,15 @@ int gsm0710_basic_extract_frame(guint8 *buf, int len,
 	int posn = 0;
 	int framelen;
 	int header_size;
+	guint8 *flag;
 	guint8 fcs;
 	guint8 dlc;
 	guint8 type;
 
 	while (posn < len) {
 		if (buf[posn] != 0xF9) {
-			posn += 1;
+			flag = memchr(buf + posn, 0xF9, len - posn);
+			posn = flag ? flag - buf : len;
 			continue;
 		}
 
@@ -127,6 +127,7 @@ void ppp_net_free(struct ppp_net *net);
 gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu);
 void ppp_net_suspend_interface(struct ppp_net *net);
 void ppp_net_resume_interface(struct ppp_net *net);
+void ppp_net_get_stats(struct ppp_net *net, GAtBatchStats *stats);
 
 /* PPP functions related to main GAtPPP object */
 void ppp_debug(GAtPPP *ppp, const char *str);
@@ -146,3 +147,9 @@ void ppp_set_mtu(GAtPPP *ppp, const guint8 *data);
 void ppp_set_xmit_acfc(GAtPPP *ppp, gboolean acfc);
 void ppp_set_xmit_pfc(GAtPPP *ppp, gboolean pfc);
 struct ppp_header *ppp_packet_new(gsize infolen, guint16 protocol);
+guint ppp_timeout_add_seconds(GAtPPP *ppp, guint interval,
+					GSourceFunc function, gpointer data);
+guint ppp_io_add_watch(GAtPPP *ppp, GIOChannel *channel,
+				GIOCondition condition, GIOFunc function,
+				gpointer data);
+void ppp_source_remove(GAtPPP *ppp, guint id);
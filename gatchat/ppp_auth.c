@@ -211,12 +211,12 @@ void ppp_pap_process_packet(struct ppp_pap *pap, const guint8 *new_packet,
 
 	switch (code) {
 	case PAP_ACK:
-		g_source_remove(pap->retry_timer);
+		ppp_source_remove(pap->ppp, pap->retry_timer);
 		pap->retry_timer = 0;
 		ppp_auth_notify(pap->ppp, TRUE);
 		break;
 	case PAP_NAK:
-		g_source_remove(pap->retry_timer);
+		ppp_source_remove(pap->ppp, pap->retry_timer);
 		pap->retry_timer = 0;
 		ppp_auth_notify(pap->ppp, FALSE);
 		break;
@@ -280,7 +280,7 @@ gboolean ppp_pap_start(struct ppp_pap *pap)
 	/* Transmit the packet and schedule a retry. */
 	ppp_transmit(pap->ppp, (guint8 *)packet, length);
 	pap->retries = 0;
-	pap->retry_timer = g_timeout_add_seconds(PAP_TIMEOUT,
+	pap->retry_timer = ppp_timeout_add_seconds(pap->ppp, PAP_TIMEOUT,
 							ppp_pap_timeout, pap);
 
 	return TRUE;
@@ -289,7 +289,7 @@ gboolean ppp_pap_start(struct ppp_pap *pap)
 void ppp_pap_free(struct ppp_pap *pap)
 {
 	if (pap->retry_timer != 0)
-		g_source_remove(pap->retry_timer);
+		ppp_source_remove(pap->ppp, pap->retry_timer);
 
 	if (pap->authreq != NULL)
 		g_free(pap->authreq);
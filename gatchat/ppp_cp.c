@@ -289,7 +289,8 @@ static gboolean pppcp_timeout(gpointer user_data)
 static void pppcp_stop_timer(struct pppcp_timer_data *timer_data)
 {
 	if (timer_data->restart_timer > 0) {
-		g_source_remove(timer_data->restart_timer);
+		ppp_source_remove(timer_data->data->ppp,
+					timer_data->restart_timer);
 		timer_data->restart_timer = 0;
 	}
 }
@@ -299,7 +300,8 @@ static void pppcp_start_timer(struct pppcp_timer_data *timer_data)
 	pppcp_stop_timer(timer_data);
 
 	timer_data->restart_timer =
-		g_timeout_add_seconds(timer_data->restart_interval,
+		ppp_timeout_add_seconds(timer_data->data->ppp,
+				timer_data->restart_interval,
 				pppcp_timeout, timer_data);
 }
 
@@ -24,6 +24,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
@@ -39,14 +40,17 @@
 #include "ppp.h"
 
 #define MAX_PACKET 1500
+#define READ_BUDGET 32	/* Maximum packets read from tun per wakeup */
 
 struct ppp_net {
 	GAtPPP *ppp;
 	char *if_name;
 	GIOChannel *channel;
+	int fd;
 	guint watch;
 	gint mtu;
 	struct ppp_header *ppp_packet;
+	GAtBatchStats stats;
 };
 
 gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu)
@@ -80,52 +84,79 @@ gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu)
 void ppp_net_process_packet(struct ppp_net *net, const guint8 *packet,
 				gsize plen)
 {
-	GIOStatus status;
-	gsize bytes_written;
 	guint16 len;
 
 	if (plen < 4)
 		return;
 
-	/* find the length of the packet to transmit */
+	/*
+	 * The packet points straight into the HDLC decode buffer, hand it
+	 * to the tun device without going through the GIOChannel layer
+	 */
 	len = get_host_short(&packet[2]);
-	status = g_io_channel_write_chars(net->channel, (gchar *) packet,
-						MIN(len, plen),
-						&bytes_written, NULL);
 
-	if (status != G_IO_STATUS_NORMAL)
+	if (write(net->fd, packet, MIN(len, plen)) < 0)
 		return;
 }
 
 /*
  * packets received by the tun interface need to be written to
- * the modem.  So, just read a packet, write out to the modem
+ * the modem.  So, just read a packet, write out to the modem.  The
+ * packet is read in place behind the reserved PPP header so that it
+ * can be framed without any further copy.
+ *
+ * All packets already queued on tun are drained in one go, up to
+ * READ_BUDGET, and the resulting frames leave in as few tty writes as
+ * the HDLC layer can manage.
  */
 static gboolean ppp_net_callback(GIOChannel *channel, GIOCondition cond,
 				gpointer userdata)
 {
 	struct ppp_net *net = (struct ppp_net *) userdata;
-	GIOStatus status;
-	gsize bytes_read;
-	gchar *buf = (gchar *) net->ppp_packet->info;
+	guint8 *buf = net->ppp_packet->info;
+	ssize_t bytes_read = 0;
+	guint count = 0;
 
 	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
 		return FALSE;
 
-	if (cond & G_IO_IN) {
-		/* leave space to add PPP protocol field */
-		status = g_io_channel_read_chars(channel, buf, net->mtu,
-							&bytes_read, NULL);
-		if (bytes_read > 0)
-			ppp_transmit(net->ppp, (guint8 *) net->ppp_packet,
+	if (!(cond & G_IO_IN))
+		return TRUE;
+
+	while (count < READ_BUDGET) {
+		bytes_read = read(net->fd, buf, net->mtu);
+		if (bytes_read <= 0)
+			break;
+
+		count += 1;
+		net->stats.bytes += bytes_read;
+
+		ppp_transmit(net->ppp, (guint8 *) net->ppp_packet,
 					bytes_read);
+	}
 
-		if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN)
-			return FALSE;
+	if (count > 0) {
+		net->stats.wakeups += 1;
+		net->stats.reads += count;
+
+		if (count > net->stats.max_batch)
+			net->stats.max_batch = count;
 	}
+
+	if (bytes_read == 0)
+		return FALSE;
+
+	if (bytes_read < 0 && errno != EAGAIN && errno != EINTR)
+		return FALSE;
+
 	return TRUE;
 }
 
+void ppp_net_get_stats(struct ppp_net *net, GAtBatchStats *stats)
+{
+	*stats = net->stats;
+}
+
 const char *ppp_net_get_interface(struct ppp_net *net)
 {
 	return net->if_name;
@@ -181,16 +212,18 @@ struct ppp_net *ppp_net_new(GAtPPP *ppp, int fd)
 	if (channel == NULL)
 		goto error;
 
-	if (!g_at_util_setup_io(channel, 0))
+	/* The read loop relies on EAGAIN to know the tun is drained */
+	if (!g_at_util_setup_io(channel, G_IO_FLAG_NONBLOCK))
 		goto error;
 
 	g_io_channel_set_buffered(channel, FALSE);
 
 	net->channel = channel;
-	net->watch = g_io_add_watch(channel,
+	net->fd = fd;
+	net->ppp = ppp;
+	net->watch = ppp_io_add_watch(ppp, channel,
 			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 			ppp_net_callback, net);
-	net->ppp = ppp;
 
 	net->mtu = MAX_PACKET;
 	return net;
@@ -213,7 +246,7 @@ badalloc:
 void ppp_net_free(struct ppp_net *net)
 {
 	if (net->watch) {
-		g_source_remove(net->watch);
+		ppp_source_remove(net->ppp, net->watch);
 		net->watch = 0;
 	}
 
@@ -232,7 +265,7 @@ void ppp_net_suspend_interface(struct ppp_net *net)
 	if (net->watch == 0)
 		return;
 
-	g_source_remove(net->watch);
+	ppp_source_remove(net->ppp, net->watch);
 	net->watch = 0;
 }
 
@@ -241,7 +274,7 @@ void ppp_net_resume_interface(struct ppp_net *net)
 	if (net == NULL || net->channel == NULL)
 		return;
 
-	net->watch = g_io_add_watch(net->channel,
+	net->watch = ppp_io_add_watch(net->ppp, net->channel,
 			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 			ppp_net_callback, net);
 }
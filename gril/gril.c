@@ -86,7 +86,6 @@ struct ril_s {
 	GHashTable *notify_list;		/* List of notification reg */
 	GRilDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
-	guint read_so_far;			/* Number of bytes processed */
 	gboolean suspended;			/* Are we suspended? */
 	gboolean debug;
 	gboolean trace;
@@ -94,6 +93,13 @@ struct ril_s {
 	gboolean destroyed;			/* Re-entrancy guard */
 	gboolean in_read_handler;		/* Re-entrancy guard */
 	gboolean in_notify;
+	guchar *record_buf;			/* Split or oversize records */
+	gsize record_size;			/* Allocated size of record_buf */
+	gsize record_len;			/* Oversize record bytes so far */
+	gsize record_plen;			/* Oversize record length or 0 */
+	gboolean record_drop;			/* Oversize record is dropped */
+	int32_t record_hdr[2];			/* Type and serial of dropped */
+	gsize max_parcel_size;			/* Hard cap on parcel length */
 	enum ofono_ril_vendor vendor;
 	int slot;
 	GRilMsgIdToStrFunc req_to_string;
@@ -302,6 +308,12 @@ static void ril_request_destroy(struct ril_request *req)
 	g_free(req);
 }
 
+static void ril_free(struct ril_s *p)
+{
+	g_free(p->record_buf);
+	g_free(p);
+}
+
 static void ril_cleanup(struct ril_s *p)
 {
 	/* Cleanup pending commands */
@@ -454,188 +466,213 @@ static void handle_unsol_req(struct ril_s *p, struct ril_msg *message)
 					GUINT_TO_POINTER(TRUE));
 }
 
-static void dispatch(struct ril_s *p, struct ril_msg *message)
+static void dispatch(struct ril_s *p, guchar *bytes, gsize len)
 {
-	int32_t *unsolicited_field, *id_num_field;
-	gchar *bufp = message->buf;
-	gchar *datap;
-	gsize data_len;
-
-	/* This could be done with a struct/union... */
-	unsolicited_field = (int32_t *) (void *) bufp;
-	if (*unsolicited_field)
-		message->unsolicited = TRUE;
-	else
-		message->unsolicited = FALSE;
+	struct ril_msg message;
+	const int32_t *fields = (const int32_t *) (const void *) bytes;
+	gsize hdr_len;
 
-	bufp += 4;
+	memset(&message, 0, sizeof(message));
 
-	id_num_field = (int32_t *) (void *) bufp;
-	if (message->unsolicited) {
-		message->req = (int) *id_num_field;
+	/*
+	 * A RIL Unsolicited Event is two UINT32 fields ( unsolicited,
+	 * and req/ev ), a RIL Solicited Response is three UINT32 fields
+	 * ( unsolicited, serial_no and error ).
+	 */
+	message.unsolicited = fields[0] ? TRUE : FALSE;
+	hdr_len = message.unsolicited ? 8 : 12;
 
-		/*
-		 * A RIL Unsolicited Event is two UINT32 fields ( unsolicited,
-		 * and req/ev ), so subtract the length of the header from the
-		 * overall length to calculate the length of the Event Data.
-		 */
-		data_len = message->buf_len - 8;
-	} else {
-		message->serial_no = (int) *id_num_field;
-
-		bufp += 4;
-		message->error = *((int32_t *) (void *) bufp);
-
-		/*
-		 * A RIL Solicited Response is three UINT32 fields ( unsolicied,
-		 * serial_no and error ), so subtract the length of the header
-		 * from the overall length to calculate the length of the Event
-		 * Data.
-		 */
-		data_len = message->buf_len - 12;
+	if (len < hdr_len) {
+		ofono_error("RIL parcel too short (%u), dropping",
+				(unsigned int) len);
+		return;
 	}
 
-	/* advance to start of data.. */
-	bufp += 4;
+	if (message.unsolicited)
+		message.req = (int) fields[1];
+	else {
+		message.serial_no = (int) fields[1];
+		message.error = fields[2];
+	}
 
 	/*
-	 * Now, use buffer for event data if present
+	 * The event data is handed out in place, the caller keeps it valid
+	 * until we return. NULL tells the parser there was no data.
 	 */
-	if (data_len) {
-		datap = g_try_malloc(data_len);
-		if (datap == NULL)
-			goto error;
+	if (len > hdr_len) {
+		message.buf = (gchar *) bytes + hdr_len;
+		message.buf_len = len - hdr_len;
+	}
 
-		/* Copy event bytes from message->buf into new buffer */
-		memcpy(datap, bufp, data_len);
+	if (message.unsolicited == TRUE)
+		handle_unsol_req(p, &message);
+	else
+		handle_response(p, &message);
+}
 
-		/* Free buffer that includes header */
-		g_free(message->buf);
+static void ril_record_reserve(struct ril_s *p, gsize size)
+{
+	if (p->record_size >= size)
+		return;
 
-		/* ...and replace with new buffer */
-		message->buf = datap;
-		message->buf_len = data_len;
-	} else {
-		/* Free buffer that includes header */
-		g_free(message->buf);
+	p->record_size = MAX(size, GRIL_BUFFER_SIZE);
+	p->record_buf = g_realloc(p->record_buf, p->record_size);
+}
 
-		/* To know if there was no data when parsing */
-		message->buf = NULL;
-		message->buf_len = 0;
-	}
+/*
+ * Returns a contiguous, aligned view of len bytes starting at offset in the
+ * ring buffer. Records that do not wrap are parsed in place, the rest are
+ * copied into a scratch buffer that is kept for the lifetime of the channel.
+ */
+static guchar *ril_record_ptr(struct ril_s *p, struct ring_buffer *rbuf,
+				unsigned int offset, unsigned int len)
+{
+	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
+	guchar *ptr = ring_buffer_read_ptr(rbuf, offset);
+	unsigned int first;
 
-	if (message->unsolicited == TRUE)
-		handle_unsol_req(p, message);
-	else
-		handle_response(p, message);
+	if ((wrap <= offset || wrap - offset >= len) &&
+			((gsize) ptr & (sizeof(int32_t) - 1)) == 0)
+		return ptr;
 
-error:
-	g_free(message->buf);
-	g_free(message);
+	ril_record_reserve(p, len);
+
+	first = wrap > offset ? MIN(wrap - offset, len) : len;
+
+	memcpy(p->record_buf, ptr, first);
+
+	if (first < len)
+		memcpy(p->record_buf + first,
+			ring_buffer_read_ptr(rbuf, offset + first),
+			len - first);
+
+	return p->record_buf;
 }
 
-static struct ril_msg *read_fixed_record(struct ril_s *p,
-						const guchar *bytes, gsize *len)
+/*
+ * Parcels that do not fit the ring buffer are streamed into record_buf as
+ * they arrive. Those over max_parcel_size are consumed without being stored
+ * so that the stream stays in sync and the channel keeps working. Only
+ * their type and serial are kept, so that a dropped response still
+ * completes its request.
+ */
+static void ril_begin_record(struct ril_s *p, uint32_t plen)
 {
-	struct ril_msg *message;
-	unsigned message_len, plen;
+	p->record_plen = plen;
+	p->record_len = 0;
+	p->record_drop = plen > p->max_parcel_size;
 
-	/* First four bytes are length in TCP byte order (Big Endian) */
-	plen = ntohl(*((uint32_t *) (void *) bytes));
-	bytes += 4;
+	if (p->record_drop)
+		ofono_error("RIL parcel too big (%u > %u), dropping", plen,
+				(unsigned int) p->max_parcel_size);
+	else
+		ril_record_reserve(p, plen);
+}
 
-	/*
-	 * TODO: Verify that 8k is the max message size from rild.
-	 *
-	 * This condition shouldn't happen.  If it does
-	 * there are three options:
-	 *
-	 * 1) Exit; ofono will restart via DBus (this is what we do now)
-	 * 2) Consume the bytes & continue
-	 * 3) force a disconnect
-	 */
-	if (plen > GRIL_BUFFER_SIZE - 4) {
-		ofono_error("ERROR RIL parcel bigger than buffer (%u), exiting",
-				plen);
-		exit(1);
-	}
+/*
+ * The caller of a request whose response was too big to keep is told
+ * it failed instead of waiting forever
+ */
+static void ril_drop_record(struct ril_s *p)
+{
+	struct ril_msg message;
 
-	/*
-	 * If we don't have the whole fixed record in the ringbuffer
-	 * then return NULL & leave ringbuffer as is.
-	 */
+	if (p->record_plen < sizeof(p->record_hdr) || p->record_hdr[0] != 0)
+		return;
 
-	message_len = *len - 4;
-	if (message_len < plen)
-		return NULL;
+	memset(&message, 0, sizeof(message));
+	message.serial_no = (int) p->record_hdr[1];
+	message.error = RIL_E_GENERIC_FAILURE;
+
+	handle_response(p, &message);
+}
 
-	message = g_malloc(sizeof(struct ril_msg));
+static void ril_stream_record(struct ril_s *p, struct ring_buffer *rbuf)
+{
+	gsize chunk = MIN(p->record_plen - p->record_len,
+				(gsize) ring_buffer_len_no_wrap(rbuf));
+
+	if (p->record_drop == FALSE)
+		memcpy(p->record_buf + p->record_len,
+				ring_buffer_read_ptr(rbuf, 0), chunk);
+	else if (p->record_len < sizeof(p->record_hdr))
+		memcpy((guchar *) p->record_hdr + p->record_len,
+				ring_buffer_read_ptr(rbuf, 0),
+				MIN(chunk, sizeof(p->record_hdr) -
+						p->record_len));
+
+	p->record_len += chunk;
+	ring_buffer_drain(rbuf, chunk);
+
+	if (p->record_len < p->record_plen)
+		return;
 
-	/* allocate ril_msg->buffer */
-	message->buf_len = plen;
-	message->buf = g_malloc(plen);
+	if (p->record_drop == FALSE)
+		dispatch(p, p->record_buf, p->record_plen);
+	else
+		ril_drop_record(p);
 
-	/* Copy bytes into message buffer */
-	memmove(message->buf, (const void *) bytes, plen);
+	p->record_plen = 0;
+	p->record_len = 0;
+	p->record_drop = FALSE;
 
-	/* Indicate to caller size of record we extracted */
-	*len = plen + 4;
-	return message;
+	/* Do not hold on to the memory of a one-off large parcel */
+	if (p->record_size > GRIL_BUFFER_SIZE) {
+		g_free(p->record_buf);
+		p->record_buf = NULL;
+		p->record_size = 0;
+	}
 }
 
 static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 {
-	struct ril_msg *message;
 	struct ril_s *p = user_data;
-	unsigned int len = ring_buffer_len(rbuf);
-	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
-	guchar *buf = ring_buffer_read_ptr(rbuf, p->read_so_far);
+	unsigned int len;
+	uint32_t plen;
+	guchar *buf;
+	unsigned int i;
 
 	p->in_read_handler = TRUE;
 
-	while (p->suspended == FALSE && (p->read_so_far < len)) {
-		gsize rbytes = MIN(len - p->read_so_far, wrap - p->read_so_far);
+	while (p->suspended == FALSE) {
+		len = ring_buffer_len(rbuf);
 
-		if (rbytes < 4) {
-			DBG("Not enough bytes for header length: len: %d", len);
-			return;
-		}
+		if (p->record_plen > 0) {
+			if (len == 0)
+				break;
 
-		/*
-		 * This function attempts to read the next full length
-		 * fixed message from the stream.  if not all bytes are
-		 * available, it returns NULL.  otherwise it allocates
-		 * and returns a ril_message with the copied bytes, and
-		 * drains those bytes from the ring_buffer
-		 */
-		message = read_fixed_record(p, buf, &rbytes);
+			ril_stream_record(p, rbuf);
+			continue;
+		}
 
-		/* wait for the rest of the record... */
-		if (message == NULL)
+		if (len < 4)
 			break;
 
-		buf += rbytes;
-		p->read_so_far += rbytes;
+		/* First four bytes are length in TCP byte order (Big Endian) */
+		for (plen = 0, i = 0; i < 4; i++)
+			plen = (plen << 8) | *ring_buffer_read_ptr(rbuf, i);
 
-		/* TODO: need to better understand how wrap works! */
-		if (p->read_so_far == wrap) {
-			buf = ring_buffer_read_ptr(rbuf, p->read_so_far);
-			wrap = len;
+		if (plen > GRIL_BUFFER_SIZE - 4 || plen > p->max_parcel_size) {
+			ring_buffer_drain(rbuf, 4);
+			ril_begin_record(p, plen);
+			continue;
 		}
 
-		dispatch(p, message);
+		/* wait for the rest of the record... */
+		if (len - 4 < plen)
+			break;
+
+		buf = ril_record_ptr(p, rbuf, 4, plen);
 
-		ring_buffer_drain(rbuf, p->read_so_far);
+		dispatch(p, buf, plen);
 
-		len -= p->read_so_far;
-		wrap -= p->read_so_far;
-		p->read_so_far = 0;
+		ring_buffer_drain(rbuf, plen + 4);
 	}
 
 	p->in_read_handler = FALSE;
 
 	if (p->destroyed)
-		g_free(p);
+		ril_free(p);
 }
 
 /*
@@ -780,7 +817,7 @@ static void ril_unref(struct ril_s *ril)
 	if (ril->in_read_handler)
 		ril->destroyed = TRUE;
 	else
-		g_free(ril);
+		ril_free(ril);
 }
 
 static gboolean node_compare_by_group(struct ril_notify_node *node,
@@ -794,6 +831,28 @@ static gboolean node_compare_by_group(struct ril_notify_node *node,
 	return FALSE;
 }
 
+/* OFONO_RIL_MAX_PARCEL overrides the cap if a parcel header fits in it */
+static gsize max_parcel_size_from_env(void)
+{
+	const char *str = getenv("OFONO_RIL_MAX_PARCEL");
+	unsigned long size;
+	char *end;
+
+	if (str == NULL)
+		return GRIL_MAX_PARCEL_SIZE;
+
+	errno = 0;
+	size = strtoul(str, &end, 10);
+
+	if (!g_ascii_isdigit(str[0]) || errno != 0 || *end != '\0' ||
+			size < GRIL_PARCEL_HEADER_SIZE) {
+		ofono_warn("Ignoring OFONO_RIL_MAX_PARCEL=%s", str);
+		return GRIL_MAX_PARCEL_SIZE;
+	}
+
+	return size;
+}
+
 static struct ril_s *create_ril(const char *sock_path, unsigned int uid,
 					unsigned int gid)
 
@@ -814,6 +873,7 @@ static struct ril_s *create_ril(const char *sock_path, unsigned int uid,
 	ril->next_gid = 0;
 	ril->req_bytes_written = 0;
 	ril->trace = FALSE;
+	ril->max_parcel_size = max_parcel_size_from_env();
 
 	/* sock_path is allowed to be NULL for unit tests */
 	if (sock_path == NULL)
@@ -1208,6 +1268,18 @@ gboolean g_ril_set_slot(GRil *ril, int slot)
 	return TRUE;
 }
 
+gboolean g_ril_set_max_parcel_size(GRil *ril, gsize size)
+{
+	if (ril == NULL || ril->parent == NULL)
+		return FALSE;
+
+	if (size < GRIL_PARCEL_HEADER_SIZE)
+		return FALSE;
+
+	ril->parent->max_parcel_size = size;
+	return TRUE;
+}
+
 int g_ril_get_slot(GRil *ril)
 {
 	if (ril == NULL)
@@ -33,6 +33,12 @@ extern "C" {
 #include "ril_constants.h"
 #include "drivers/rilmodem/vendor.h"
 
+/* Default hard limit on the size of a parcel received from rild */
+#define GRIL_MAX_PARCEL_SIZE (1024 * 1024)
+
+/* Type, serial and error of a solicited response, the largest header */
+#define GRIL_PARCEL_HEADER_SIZE 12
+
 struct _GRil;
 
 typedef struct _GRil GRil;
@@ -131,6 +137,13 @@ gboolean g_ril_set_trace(GRil *ril, gboolean trace);
 int g_ril_get_slot(GRil *ril);
 gboolean g_ril_set_slot(GRil *ril, int slot);
 
+/*!
+ * Parcels longer than size bytes are skipped instead of being delivered,
+ * GRIL_MAX_PARCEL_SIZE or OFONO_RIL_MAX_PARCEL by default.  Sizes that
+ * can't hold a parcel header are refused.
+ */
+gboolean g_ril_set_max_parcel_size(GRil *ril, gsize size);
+
 /*!
  * If the function is not NULL, then on every read/write from the GIOChannel
  * provided to GRil the logging function will be called with the
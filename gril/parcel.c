@@ -47,25 +47,96 @@
 
 typedef uint16_t char16_t;
 
+/*
+ * Parcels are built and thrown away for every request, so their buffers are
+ * taken from a few size classes and recycled instead of going back to the
+ * heap. Anything bigger than the largest class is allocated directly.
+ */
+#define PARCEL_POOL_CLASSES	4
+#define PARCEL_POOL_DEPTH	8
+
+static const size_t parcel_pool_size[PARCEL_POOL_CLASSES] = {
+	64, 256, 1024, 4096
+};
+
+static char *parcel_pool[PARCEL_POOL_CLASSES][PARCEL_POOL_DEPTH];
+static unsigned int parcel_pool_len[PARCEL_POOL_CLASSES];
+
+static int parcel_pool_class(size_t size)
+{
+	int i;
+
+	for (i = 0; i < PARCEL_POOL_CLASSES; i++)
+		if (size <= parcel_pool_size[i])
+			return i;
+
+	return -1;
+}
+
+static char *parcel_buffer_get(size_t *size)
+{
+	int i = parcel_pool_class(*size);
+
+	if (i < 0)
+		return g_malloc(*size);
+
+	*size = parcel_pool_size[i];
+
+	if (parcel_pool_len[i] > 0)
+		return parcel_pool[i][--parcel_pool_len[i]];
+
+	return g_malloc(*size);
+}
+
+static void parcel_buffer_put(char *data, size_t size)
+{
+	int i = parcel_pool_class(size);
+
+	if (data == NULL)
+		return;
+
+	if (i < 0 || parcel_pool_size[i] != size ||
+			parcel_pool_len[i] == PARCEL_POOL_DEPTH) {
+		g_free(data);
+		return;
+	}
+
+	parcel_pool[i][parcel_pool_len[i]++] = data;
+}
+
 void parcel_init(struct parcel *p)
 {
-	p->data = g_malloc0(sizeof(int32_t));
-	p->size = 0;
 	p->capacity = sizeof(int32_t);
+	p->data = parcel_buffer_get(&p->capacity);
+	p->size = 0;
 	p->offset = 0;
 	p->malformed = 0;
 }
 
 void parcel_grow(struct parcel *p, size_t size)
 {
-	char *new = g_realloc(p->data, p->capacity + size);
+	size_t capacity = MAX(p->capacity + size, p->capacity * 2);
+	char *new;
+
+	if (parcel_pool_class(capacity) < 0 &&
+			parcel_pool_class(p->capacity) < 0) {
+		p->data = g_realloc(p->data, capacity);
+		p->capacity = capacity;
+		return;
+	}
+
+	new = parcel_buffer_get(&capacity);
+	memcpy(new, p->data, p->size);
+	parcel_buffer_put(p->data, p->capacity);
+
 	p->data = new;
-	p->capacity += size;
+	p->capacity = capacity;
 }
 
 void parcel_free(struct parcel *p)
 {
-	g_free(p->data);
+	parcel_buffer_put(p->data, p->capacity);
+	p->data = NULL;
 	p->size = 0;
 	p->capacity = 0;
 	p->offset = 0;
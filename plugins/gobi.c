@@ -28,6 +28,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #define OFONO_API_SUBJECT_TO_CHANGE
 #include <ofono/plugin.h>
@@ -61,6 +63,22 @@
 #define GOBI_CAT_OLD	(1 << 8)
 #define GOBI_VOICE	(1 << 9)
 
+static const struct {
+	const char *name;
+	uint8_t type;
+} gobi_services[] = {
+	{ "wds",	QMI_SERVICE_WDS		},
+	{ "dms",	QMI_SERVICE_DMS		},
+	{ "nas",	QMI_SERVICE_NAS		},
+	{ "wms",	QMI_SERVICE_WMS		},
+	{ "pds",	QMI_SERVICE_PDS		},
+	{ "voice",	QMI_SERVICE_VOICE	},
+	{ "cat",	QMI_SERVICE_CAT		},
+	{ "uim",	QMI_SERVICE_UIM		},
+	{ "pbm",	QMI_SERVICE_PBM		},
+	{ "cat-old",	QMI_SERVICE_CAT_OLD	},
+};
+
 struct gobi_data {
 	struct qmi_device *device;
 	struct qmi_service *dms;
@@ -121,12 +139,32 @@ static void shutdown_cb(void *user_data)
 	ofono_modem_set_powered(modem, FALSE);
 }
 
+static void debug_queue_stats(struct qmi_device *device)
+{
+	struct qmi_queue_stats stats;
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(gobi_services); i++) {
+		if (!qmi_device_get_queue_stats(device, gobi_services[i].type,
+								&stats))
+			continue;
+
+		DBG("%s sent %llu max queued %u max in flight %u window %u",
+				gobi_services[i].name,
+				(unsigned long long) stats.sent,
+				stats.max_queued, stats.max_in_flight,
+				stats.window);
+	}
+}
+
 static void shutdown_device(struct ofono_modem *modem)
 {
 	struct gobi_data *data = ofono_modem_get_data(modem);
 
 	DBG("%p", modem);
 
+	debug_queue_stats(data->device);
+
 	qmi_service_unref(data->dms);
 	data->dms = NULL;
 
@@ -302,10 +340,74 @@ static void discover_cb(uint8_t count, const struct qmi_version *list,
 						create_dms_cb, modem, NULL);
 }
 
+static bool parse_window(const char *str, unsigned int *window)
+{
+	unsigned long value;
+	char *end;
+
+	if (!g_ascii_isdigit(str[0]))
+		return false;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+
+	if (errno != 0 || *end != '\0' || value > UINT_MAX)
+		return false;
+
+	*window = value;
+
+	return true;
+}
+
+/*
+ * OFONO_QMI_WINDOW limits the requests in flight per service.  It is a
+ * comma separated list of either a number for all services, or of
+ * service=number for one of them, e.g. "4,wms=1".  0 means no limit.
+ */
+static void setup_windows(struct qmi_device *device, const char *str)
+{
+	char **entries = g_strsplit(str, ",", 0);
+	unsigned int window;
+	unsigned int i, j;
+	char *value;
+
+	for (i = 0; entries[i]; i++) {
+		value = strchr(entries[i], '=');
+
+		if (value == NULL) {
+			if (parse_window(entries[i], &window))
+				qmi_device_set_default_window(device, window);
+			else
+				ofono_warn("Ignoring QMI window '%s'",
+								entries[i]);
+
+			continue;
+		}
+
+		*value++ = '\0';
+
+		for (j = 0; j < G_N_ELEMENTS(gobi_services); j++)
+			if (!strcmp(entries[i], gobi_services[j].name))
+				break;
+
+		if (j == G_N_ELEMENTS(gobi_services) ||
+				!parse_window(value, &window)) {
+			ofono_warn("Ignoring QMI window '%s=%s'",
+							entries[i], value);
+			continue;
+		}
+
+		qmi_device_set_window(device, gobi_services[j].type, window);
+	}
+
+	g_strfreev(entries);
+}
+
 static int gobi_enable(struct ofono_modem *modem)
 {
 	struct gobi_data *data = ofono_modem_get_data(modem);
 	const char *device;
+	const char *window;
 	int fd;
 
 	DBG("%p", modem);
@@ -327,6 +429,10 @@ static int gobi_enable(struct ofono_modem *modem)
 	if (getenv("OFONO_QMI_DEBUG"))
 		qmi_device_set_debug(data->device, gobi_debug, "QMI: ");
 
+	window = getenv("OFONO_QMI_WINDOW");
+	if (window)
+		setup_windows(data->device, window);
+
 	qmi_device_set_close_on_unref(data->device, true);
 
 	qmi_device_discover(data->device, discover_cb, modem, NULL);
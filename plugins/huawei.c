@@ -89,6 +89,7 @@ struct huawei_data {
 	gboolean have_cdma;
 	gboolean have_ndis;
 	gboolean have_ussdmode;
+	gboolean pipeline_queries;
 };
 
 static int huawei_probe(struct ofono_modem *modem)
@@ -380,6 +381,189 @@ static void cfun_offline(gboolean ok, GAtResult *result, gpointer user_data)
 	ofono_modem_set_powered(modem, TRUE);
 }
 
+static void enable_finish(struct ofono_modem *modem)
+{
+	struct huawei_data *data = ofono_modem_get_data(modem);
+
+	/* For CDMA we use AlwaysOnline so we leave the modem online. */
+	if (data->have_gsm == FALSE && data->have_cdma == TRUE) {
+		ofono_modem_set_boolean(modem, "AlwaysOnline", TRUE);
+		ofono_modem_set_powered(modem, TRUE);
+		return;
+	}
+
+	if (g_at_chat_send(data->pcui, data->offline_command, none_prefix,
+					cfun_offline, modem, NULL) > 0)
+		return;
+
+	shutdown_device(data);
+	ofono_modem_set_powered(modem, FALSE);
+}
+
+struct pcui_group {
+	struct ofono_modem *modem;
+	unsigned int pending;
+	gboolean cancelled;
+};
+
+struct pcui_query {
+	struct pcui_group *group;
+	const char *cmd;
+	const char **prefix;
+	GAtResultFunc func;
+	gpointer user_data;
+	gboolean retry;
+	gboolean answered;
+};
+
+static void pcui_query_cb(gboolean ok, GAtResult *result,
+						gpointer user_data);
+
+static void pcui_group_unref(struct pcui_group *group)
+{
+	struct huawei_data *data;
+
+	if (--group->pending > 0)
+		return;
+
+	/* The whole group is done, let the modem go on with powering up */
+	if (group->cancelled == FALSE) {
+		data = ofono_modem_get_data(group->modem);
+		g_at_chat_set_pipeline_depth(data->pcui, 1);
+
+		enable_finish(group->modem);
+	}
+
+	g_free(group);
+}
+
+static void pcui_query_destroy(gpointer user_data)
+{
+	struct pcui_query *query = user_data;
+	struct pcui_group *group = query->group;
+
+	if (query->answered == FALSE)
+		group->cancelled = TRUE;
+
+	g_free(query);
+
+	pcui_group_unref(group);
+}
+
+static gboolean pcui_query_send(struct huawei_data *data,
+				struct pcui_query *query)
+{
+	guint id;
+
+	query->group->pending += 1;
+
+	if (query->retry)
+		id = g_at_chat_send(data->pcui, query->cmd, query->prefix,
+					pcui_query_cb, query,
+					pcui_query_destroy);
+	else
+		id = g_at_chat_send_pipelined(data->pcui, query->cmd,
+					query->prefix, pcui_query_cb,
+					query, pcui_query_destroy);
+
+	if (id > 0)
+		return TRUE;
+
+	query->group->pending -= 1;
+	g_free(query);
+
+	return FALSE;
+}
+
+static void pcui_query_cb(gboolean ok, GAtResult *result,
+						gpointer user_data)
+{
+	struct pcui_query *query = user_data;
+	struct huawei_data *data = ofono_modem_get_data(query->group->modem);
+	struct pcui_query *retry;
+
+	query->answered = TRUE;
+
+	/*
+	 * A support check failing pipelined may just be the firmware not
+	 * coping, so it goes again on its own and everything after it is
+	 * serialized.  The group only completes once the retry is in, so
+	 * the result is still known before the modem is powered.  Plain
+	 * probes without a callback are often unsupported, don't repeat
+	 * those.
+	 */
+	if (!ok && query->func && query->retry == FALSE) {
+		DBG("%s failed pipelined, retrying", query->cmd);
+
+		g_at_chat_set_pipeline_depth(data->pcui, 1);
+
+		retry = g_memdup(query, sizeof(struct pcui_query));
+		retry->retry = TRUE;
+		retry->answered = FALSE;
+
+		if (pcui_query_send(data, retry))
+			return;
+	}
+
+	if (query->func)
+		query->func(ok, result, query->user_data);
+}
+
+static void pcui_query_support(struct ofono_modem *modem)
+{
+	struct huawei_data *data = ofono_modem_get_data(modem);
+	const struct pcui_query queries[] = {
+		/* Query current device settings */
+		{ NULL, "AT^U2DIAG?", none_prefix, NULL, NULL },
+		/* Query current port settings */
+		{ NULL, "AT^GETPORTMODE", none_prefix, NULL, NULL },
+		/* Check USSD mode support */
+		{ NULL, "AT^USSDMODE=?", ussdmode_prefix,
+					ussdmode_support_cb, data },
+		/* Check NDIS mode support */
+		{ NULL, "AT^DIALMODE=?", dialmode_prefix,
+					dialmode_support_cb, data },
+		/* Check for voice support */
+		{ NULL, "AT^CVOICE=?", cvoice_prefix,
+					cvoice_support_cb, modem },
+	};
+	struct pcui_group *group;
+	struct pcui_query *query;
+	unsigned int i;
+
+	if (data->pipeline_queries == FALSE) {
+		for (i = 0; i < G_N_ELEMENTS(queries); i++)
+			g_at_chat_send(data->pcui, queries[i].cmd,
+					queries[i].prefix, queries[i].func,
+					queries[i].user_data, NULL);
+
+		enable_finish(modem);
+		return;
+	}
+
+	/*
+	 * None of these depend on each other, so don't wait in between.
+	 * Powering up is chained off the last of them instead of being
+	 * queued behind them.
+	 */
+	g_at_chat_set_pipeline_depth(data->pcui, G_N_ELEMENTS(queries));
+
+	group = g_new0(struct pcui_group, 1);
+	group->modem = modem;
+
+	/* Hold the group until all queries are queued */
+	group->pending = 1;
+
+	for (i = 0; i < G_N_ELEMENTS(queries); i++) {
+		query = g_memdup(&queries[i], sizeof(struct pcui_query));
+		query->group = group;
+
+		pcui_query_send(data, query);
+	}
+
+	pcui_group_unref(group);
+}
+
 static gboolean sysinfo_enable_check(gpointer user_data);
 
 static void sysinfo_enable_cb(gboolean ok, GAtResult *result,
@@ -427,36 +611,12 @@ static void sysinfo_enable_cb(gboolean ok, GAtResult *result,
 	g_at_chat_send(data->pcui, "AT+CSCS=\"GSM\"", none_prefix,
 							NULL, NULL, NULL);
 
-	/* Query current device settings */
-	g_at_chat_send(data->pcui, "AT^U2DIAG?", none_prefix,
-						NULL, NULL, NULL);
-
-	/* Query current port settings */
-	g_at_chat_send(data->pcui, "AT^GETPORTMODE", none_prefix,
-						NULL, NULL, NULL);
-
-	/* Check USSD mode support */
-	g_at_chat_send(data->pcui, "AT^USSDMODE=?", ussdmode_prefix,
-					ussdmode_support_cb, data, NULL);
-
-	/* Check NDIS mode support */
-	g_at_chat_send(data->pcui, "AT^DIALMODE=?", dialmode_prefix,
-					dialmode_support_cb, data, NULL);
-
-	/* Check for voice support */
-	g_at_chat_send(data->pcui, "AT^CVOICE=?", cvoice_prefix,
-					cvoice_support_cb, modem, NULL);
-
-	/* For CDMA we use AlwaysOnline so we leave the modem online. */
-	if (data->have_gsm == FALSE && data->have_cdma == TRUE) {
-		ofono_modem_set_boolean(modem, "AlwaysOnline", TRUE);
-		ofono_modem_set_powered(modem, TRUE);
-		return;
-	}
-
-	if (g_at_chat_send(data->pcui, data->offline_command, none_prefix,
-					cfun_offline, modem, NULL) > 0)
-		return;
+	/*
+	 * Query device and port settings and supported features, the
+	 * modem is taken offline once they are all answered
+	 */
+	pcui_query_support(modem);
+	return;
 
 failure:
 	shutdown_device(data);
@@ -603,6 +763,10 @@ static int huawei_enable(struct ofono_modem *modem)
 
 	g_at_chat_set_slave(data->modem, data->pcui);
 
+	/* Only for firmware known to queue commands on the PCUI port */
+	if (getenv("OFONO_AT_PIPELINE"))
+		data->pipeline_queries = TRUE;
+
 	g_at_chat_send(data->modem, "ATE0 +CMEE=1", NULL, NULL, NULL, NULL);
 	g_at_chat_send(data->pcui, "ATE0 +CMEE=1", NULL, NULL, NULL, NULL);
 
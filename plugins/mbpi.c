@@ -42,6 +42,10 @@
 							"serviceproviders.xml"
 #endif
 
+#ifndef MBPI_INDEX
+#define MBPI_INDEX STORAGEDIR "/serviceproviders.idx"
+#endif
+
 #include "mbpi.h"
 
 #define _(x) case x: return (#x)
@@ -607,12 +611,904 @@ static gboolean mbpi_parse(const GMarkupParser *parser, gpointer userdata,
 	return ret;
 }
 
+/*
+ * Compiled index of the database, so that lookups don't need to parse
+ * the whole XML file.  The index is rebuilt whenever the database
+ * changes and is mmap'd on later runs.  All multi-byte fields use host
+ * byte order, the index is a local cache and never leaves the machine.
+ */
+#define MBPI_INDEX_MAGIC	0x5849424d	/* "MBIX" */
+#define MBPI_INDEX_VERSION	1
+#define MBPI_INDEX_NO_STRING	0xffffffff
+
+struct mbpi_index_header {
+	guint32 magic;
+	guint32 version;
+	gint64 db_mtime;		/* Database mtime in nanoseconds */
+	gint64 db_size;
+	guint32 n_networks;
+	guint32 networks_offset;
+	guint32 n_refs;
+	guint32 refs_offset;
+	guint32 n_apns;
+	guint32 apns_offset;
+	guint32 n_sids;
+	guint32 sids_offset;
+	guint32 strings_size;
+	guint32 strings_offset;
+};
+
+/* Sorted by mcc, then mnc.  APNs are refs[first] to refs[first + count] */
+struct mbpi_index_network {
+	guint32 mcc;
+	guint32 mnc;
+	guint32 first;
+	guint32 count;
+};
+
+struct mbpi_index_apn {
+	guint32 apn;
+	guint32 name;
+	guint32 username;
+	guint32 password;
+	guint32 message_proxy;
+	guint32 message_center;
+	guint32 type;
+	guint32 auth_method;
+	guint32 line;			/* For error reporting */
+};
+
+/* Sorted by sid */
+struct mbpi_index_sid {
+	guint32 sid;
+	guint32 name;
+};
+
+struct mbpi_index {
+	const guint8 *data;
+	gsize size;
+	gboolean mapped;
+	const struct mbpi_index_header *header;
+	const struct mbpi_index_network *networks;
+	const guint32 *refs;
+	const struct mbpi_index_apn *apns;
+	const struct mbpi_index_sid *sids;
+	const char *strings;
+};
+
+struct index_builder {
+	GByteArray *strings;
+	GHashTable *string_offsets;
+	GArray *apns;
+	GHashTable *networks;		/* "mcc\nmnc" -> GArray of apn index */
+	GHashTable *sids;		/* sid -> name offset */
+	GSList *block_keys;		/* Networks of the current <gsm> */
+	GSList *provider_sids;		/* Sids of the current <provider> */
+	char *provider_name;
+	struct ofono_gprs_provision_data *ap;
+	char **text;
+};
+
+static struct mbpi_index *mbpi_index_cache;
+static gboolean mbpi_index_enabled = TRUE;
+
+/* Database the index could not be built for, so it isn't retried */
+static gboolean mbpi_index_failed;
+static gint64 mbpi_index_failed_mtime;
+static gint64 mbpi_index_failed_size;
+
+static gint64 database_mtime(const struct stat *st)
+{
+	return st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+				st->st_mtim.tv_nsec;
+}
+
+static guint32 builder_string(struct index_builder *b, const char *str)
+{
+	gpointer value;
+	guint32 offset;
+
+	if (str == NULL)
+		return MBPI_INDEX_NO_STRING;
+
+	if (g_hash_table_lookup_extended(b->string_offsets, str,
+						NULL, &value))
+		return GPOINTER_TO_UINT(value);
+
+	offset = b->strings->len;
+	g_byte_array_append(b->strings, (const guint8 *) str,
+				strlen(str) + 1);
+	g_hash_table_insert(b->string_offsets, g_strdup(str),
+				GUINT_TO_POINTER(offset));
+
+	return offset;
+}
+
+static const char *element_parent(GMarkupParseContext *context)
+{
+	const GSList *stack = g_markup_parse_context_get_element_stack(context);
+
+	if (stack == NULL || stack->next == NULL)
+		return "";
+
+	return stack->next->data;
+}
+
+static gboolean element_inside(GMarkupParseContext *context,
+					const char *ancestor)
+{
+	const GSList *l = g_markup_parse_context_get_element_stack(context);
+
+	for (; l; l = l->next)
+		if (g_str_equal(l->data, ancestor))
+			return TRUE;
+
+	return FALSE;
+}
+
+static const char *find_attribute(const gchar **attribute_names,
+					const gchar **attribute_values,
+					const char *name)
+{
+	int i;
+
+	for (i = 0; attribute_names[i]; i++)
+		if (g_str_equal(attribute_names[i], name) == TRUE)
+			return attribute_values[i];
+
+	return NULL;
+}
+
+static void builder_network_id(GMarkupParseContext *context,
+				struct index_builder *b,
+				const gchar **attribute_names,
+				const gchar **attribute_values,
+				GError **error)
+{
+	const char *mcc, *mnc;
+	char *key;
+
+	mcc = find_attribute(attribute_names, attribute_values, "mcc");
+	mnc = find_attribute(attribute_names, attribute_values, "mnc");
+
+	if (mcc == NULL || mnc == NULL) {
+		mbpi_g_set_error(context, error, G_MARKUP_ERROR,
+					G_MARKUP_ERROR_MISSING_ATTRIBUTE,
+					"Missing attribute: %s",
+					mcc == NULL ? "mcc" : "mnc");
+		return;
+	}
+
+	key = g_strconcat(mcc, "\n", mnc, NULL);
+
+	if (g_slist_find_custom(b->block_keys, key,
+				(GCompareFunc) strcmp) != NULL) {
+		g_free(key);
+		return;
+	}
+
+	b->block_keys = g_slist_prepend(b->block_keys, key);
+}
+
+static void builder_start(GMarkupParseContext *context,
+				const gchar *element_name,
+				const gchar **attribute_names,
+				const gchar **attribute_values,
+				gpointer userdata, GError **error)
+{
+	struct index_builder *b = userdata;
+	const char *parent = element_parent(context);
+	const char *value;
+
+	if (b->ap != NULL) {
+		if (g_str_equal(element_name, "name"))
+			b->text = &b->ap->name;
+		else if (g_str_equal(element_name, "username"))
+			b->text = &b->ap->username;
+		else if (g_str_equal(element_name, "password"))
+			b->text = &b->ap->password;
+		else if (g_str_equal(element_name, "mmsc"))
+			b->text = &b->ap->message_center;
+		else if (g_str_equal(element_name, "mmsproxy"))
+			b->text = &b->ap->message_proxy;
+		else if (g_str_equal(element_name, "authentication"))
+			authentication_start(context, attribute_names,
+						attribute_values,
+						&b->ap->auth_method, error);
+		else if (g_str_equal(element_name, "usage"))
+			usage_start(context, attribute_names,
+					attribute_values, &b->ap->type, error);
+
+		return;
+	}
+
+	if (g_str_equal(element_name, "provider")) {
+		g_slist_free_full(b->provider_sids, g_free);
+		b->provider_sids = NULL;
+	} else if (g_str_equal(element_name, "name") &&
+			g_str_equal(parent, "provider")) {
+		g_free(b->provider_name);
+		b->provider_name = NULL;
+		b->text = &b->provider_name;
+	} else if (g_str_equal(element_name, "gsm")) {
+		g_slist_free_full(b->block_keys, g_free);
+		b->block_keys = NULL;
+	} else if (g_str_equal(element_name, "network-id") &&
+			element_inside(context, "gsm")) {
+		builder_network_id(context, b, attribute_names,
+					attribute_values, error);
+	} else if (g_str_equal(element_name, "apn") &&
+			element_inside(context, "gsm")) {
+		/* APNs before any network-id can never be returned */
+		if (b->block_keys == NULL)
+			return;
+
+		value = find_attribute(attribute_names, attribute_values,
+					"value");
+		if (value == NULL) {
+			mbpi_g_set_error(context, error, G_MARKUP_ERROR,
+					G_MARKUP_ERROR_MISSING_ATTRIBUTE,
+					"APN attribute missing");
+			return;
+		}
+
+		b->ap = g_new0(struct ofono_gprs_provision_data, 1);
+		b->ap->apn = g_strdup(value);
+		b->ap->type = OFONO_GPRS_CONTEXT_TYPE_INTERNET;
+		b->ap->proto = OFONO_GPRS_PROTO_IP;
+		b->ap->auth_method = OFONO_GPRS_AUTH_METHOD_CHAP;
+	} else if (g_str_equal(element_name, "sid") &&
+			element_inside(context, "cdma")) {
+		value = find_attribute(attribute_names, attribute_values,
+					"value");
+		if (value == NULL) {
+			mbpi_g_set_error(context, error, G_MARKUP_ERROR,
+					G_MARKUP_ERROR_MISSING_ATTRIBUTE,
+					"Missing attribute: sid");
+			return;
+		}
+
+		b->provider_sids = g_slist_prepend(b->provider_sids,
+							g_strdup(value));
+	}
+}
+
+static void builder_add_apn(GMarkupParseContext *context,
+				struct index_builder *b)
+{
+	struct mbpi_index_apn entry;
+	guint32 index = b->apns->len;
+	int line, column;
+	GSList *l;
+
+	g_markup_parse_context_get_position(context, &line, &column);
+
+	entry.apn = builder_string(b, b->ap->apn);
+	entry.name = builder_string(b, b->ap->name);
+	entry.username = builder_string(b, b->ap->username);
+	entry.password = builder_string(b, b->ap->password);
+	entry.message_proxy = builder_string(b, b->ap->message_proxy);
+	entry.message_center = builder_string(b, b->ap->message_center);
+	entry.type = b->ap->type;
+	entry.auth_method = b->ap->auth_method;
+	entry.line = line;
+
+	g_array_append_val(b->apns, entry);
+
+	for (l = b->block_keys; l; l = l->next) {
+		GArray *refs = g_hash_table_lookup(b->networks, l->data);
+
+		if (refs == NULL) {
+			refs = g_array_new(FALSE, FALSE, sizeof(guint32));
+			g_hash_table_insert(b->networks, g_strdup(l->data),
+						refs);
+		}
+
+		g_array_append_val(refs, index);
+	}
+}
+
+static void builder_end(GMarkupParseContext *context,
+				const gchar *element_name,
+				gpointer userdata, GError **error)
+{
+	struct index_builder *b = userdata;
+	GSList *l;
+
+	b->text = NULL;
+
+	if (g_str_equal(element_name, "apn") && b->ap != NULL) {
+		builder_add_apn(context, b);
+		mbpi_ap_free(b->ap);
+		b->ap = NULL;
+	} else if (g_str_equal(element_name, "gsm")) {
+		g_slist_free_full(b->block_keys, g_free);
+		b->block_keys = NULL;
+	} else if (g_str_equal(element_name, "provider")) {
+		/*
+		 * The first provider listing a sid wins, with whatever name
+		 * was current when that provider ended
+		 */
+		for (l = b->provider_sids; l; l = l->next) {
+			if (g_hash_table_contains(b->sids, l->data))
+				continue;
+
+			g_hash_table_insert(b->sids, g_strdup(l->data),
+				GUINT_TO_POINTER(builder_string(b,
+							b->provider_name)));
+		}
+
+		g_slist_free_full(b->provider_sids, g_free);
+		b->provider_sids = NULL;
+	}
+}
+
+static void builder_text(GMarkupParseContext *context,
+				const gchar *text, gsize text_len,
+				gpointer userdata, GError **error)
+{
+	struct index_builder *b = userdata;
+
+	if (b->text == NULL)
+		return;
+
+	g_free(*b->text);
+	*b->text = g_strndup(text, text_len);
+}
+
+static const GMarkupParser builder_parser = {
+	builder_start,
+	builder_end,
+	builder_text,
+	NULL,
+	NULL,
+};
+
+static int compare_network_keys(gconstpointer a, gconstpointer b)
+{
+	const char *ka = *(const char **) a;
+	const char *kb = *(const char **) b;
+
+	return strcmp(ka, kb);
+}
+
+static GByteArray *builder_serialize(struct index_builder *b,
+					const struct stat *st)
+{
+	struct mbpi_index_header header;
+	GByteArray *out = g_byte_array_new();
+	GPtrArray *keys = g_ptr_array_new();
+	GArray *networks;
+	GArray *refs;
+	GArray *sids;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i;
+
+	g_hash_table_iter_init(&iter, b->networks);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_ptr_array_add(keys, key);
+
+	/* '\n' sorts before any digit, so this orders by mcc, then mnc */
+	g_ptr_array_sort(keys, compare_network_keys);
+
+	networks = g_array_new(FALSE, FALSE,
+				sizeof(struct mbpi_index_network));
+	refs = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	for (i = 0; i < keys->len; i++) {
+		struct mbpi_index_network network;
+		char **mccmnc = g_strsplit(keys->pdata[i], "\n", 2);
+		GArray *apns = g_hash_table_lookup(b->networks,
+							keys->pdata[i]);
+
+		network.mcc = builder_string(b, mccmnc[0]);
+		network.mnc = builder_string(b, mccmnc[1]);
+		network.first = refs->len;
+		network.count = apns->len;
+
+		g_array_append_vals(refs, apns->data, apns->len);
+		g_array_append_val(networks, network);
+		g_strfreev(mccmnc);
+	}
+
+	g_ptr_array_set_size(keys, 0);
+
+	g_hash_table_iter_init(&iter, b->sids);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_ptr_array_add(keys, key);
+
+	g_ptr_array_sort(keys, compare_network_keys);
+
+	sids = g_array_new(FALSE, FALSE, sizeof(struct mbpi_index_sid));
+
+	for (i = 0; i < keys->len; i++) {
+		struct mbpi_index_sid sid;
+
+		sid.sid = builder_string(b, keys->pdata[i]);
+		sid.name = GPOINTER_TO_UINT(g_hash_table_lookup(b->sids,
+							keys->pdata[i]));
+		g_array_append_val(sids, sid);
+	}
+
+	g_ptr_array_free(keys, TRUE);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = MBPI_INDEX_MAGIC;
+	header.version = MBPI_INDEX_VERSION;
+	header.db_mtime = database_mtime(st);
+	header.db_size = st->st_size;
+
+	header.n_networks = networks->len;
+	header.networks_offset = sizeof(header);
+
+	header.n_refs = refs->len;
+	header.refs_offset = header.networks_offset +
+		networks->len * sizeof(struct mbpi_index_network);
+
+	header.n_apns = b->apns->len;
+	header.apns_offset = header.refs_offset + refs->len * sizeof(guint32);
+
+	header.n_sids = sids->len;
+	header.sids_offset = header.apns_offset +
+		b->apns->len * sizeof(struct mbpi_index_apn);
+
+	header.strings_size = b->strings->len;
+	header.strings_offset = header.sids_offset +
+		sids->len * sizeof(struct mbpi_index_sid);
+
+	g_byte_array_append(out, (guint8 *) &header, sizeof(header));
+	g_byte_array_append(out, (guint8 *) networks->data,
+		networks->len * sizeof(struct mbpi_index_network));
+	g_byte_array_append(out, (guint8 *) refs->data,
+		refs->len * sizeof(guint32));
+	g_byte_array_append(out, (guint8 *) b->apns->data,
+		b->apns->len * sizeof(struct mbpi_index_apn));
+	g_byte_array_append(out, (guint8 *) sids->data,
+		sids->len * sizeof(struct mbpi_index_sid));
+	g_byte_array_append(out, b->strings->data, b->strings->len);
+
+	g_array_free(networks, TRUE);
+	g_array_free(refs, TRUE);
+	g_array_free(sids, TRUE);
+
+	return out;
+}
+
+static void free_refs(gpointer data)
+{
+	g_array_free(data, TRUE);
+}
+
+static GByteArray *mbpi_index_compile(const struct stat *st, GError **error)
+{
+	struct index_builder b;
+	GByteArray *out = NULL;
+	GError *err = NULL;
+
+	memset(&b, 0, sizeof(b));
+	b.strings = g_byte_array_new();
+	b.string_offsets = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, NULL);
+	b.apns = g_array_new(FALSE, FALSE, sizeof(struct mbpi_index_apn));
+	b.networks = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, free_refs);
+	b.sids = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, NULL);
+
+	/* Offset 0 is an empty string, which keeps the table non-empty */
+	builder_string(&b, "");
+
+	/* The element handlers always want somewhere to put their errors */
+	if (mbpi_parse(&builder_parser, &b, &err) == TRUE)
+		out = builder_serialize(&b, st);
+	else
+		g_propagate_error(error, err);
+
+	if (b.ap)
+		mbpi_ap_free(b.ap);
+
+	g_free(b.provider_name);
+	g_slist_free_full(b.block_keys, g_free);
+	g_slist_free_full(b.provider_sids, g_free);
+	g_hash_table_destroy(b.sids);
+	g_hash_table_destroy(b.networks);
+	g_array_free(b.apns, TRUE);
+	g_hash_table_destroy(b.string_offsets);
+	g_byte_array_free(b.strings, TRUE);
+
+	return out;
+}
+
+static gboolean table_fits(const struct mbpi_index *index, guint32 offset,
+				guint32 count, gsize entry_size)
+{
+	if (offset > index->size)
+		return FALSE;
+
+	return count <= (index->size - offset) / entry_size;
+}
+
+static struct mbpi_index *mbpi_index_new(const guint8 *data, gsize size,
+						gboolean mapped)
+{
+	const struct mbpi_index_header *header = (const void *) data;
+	struct mbpi_index *index;
+
+	if (size < sizeof(*header))
+		return NULL;
+
+	if (header->magic != MBPI_INDEX_MAGIC ||
+			header->version != MBPI_INDEX_VERSION)
+		return NULL;
+
+	index = g_new0(struct mbpi_index, 1);
+	index->data = data;
+	index->size = size;
+	index->mapped = mapped;
+	index->header = header;
+
+	if (!table_fits(index, header->networks_offset, header->n_networks,
+				sizeof(struct mbpi_index_network)) ||
+			!table_fits(index, header->refs_offset,
+					header->n_refs, sizeof(guint32)) ||
+			!table_fits(index, header->apns_offset,
+					header->n_apns,
+					sizeof(struct mbpi_index_apn)) ||
+			!table_fits(index, header->sids_offset,
+					header->n_sids,
+					sizeof(struct mbpi_index_sid)) ||
+			!table_fits(index, header->strings_offset,
+					header->strings_size, 1) ||
+			header->strings_size == 0 ||
+			data[header->strings_offset +
+				header->strings_size - 1] != '\0') {
+		g_free(index);
+		return NULL;
+	}
+
+	index->networks = (const void *) (data + header->networks_offset);
+	index->refs = (const void *) (data + header->refs_offset);
+	index->apns = (const void *) (data + header->apns_offset);
+	index->sids = (const void *) (data + header->sids_offset);
+	index->strings = (const char *) data + header->strings_offset;
+
+	return index;
+}
+
+static void mbpi_index_free(struct mbpi_index *index)
+{
+	if (index == NULL)
+		return;
+
+	if (index->mapped)
+		munmap((void *) index->data, index->size);
+	else
+		g_free((void *) index->data);
+
+	g_free(index);
+}
+
+static gboolean mbpi_index_matches(const struct mbpi_index *index,
+					const struct stat *st)
+{
+	return index->header->db_mtime == database_mtime(st) &&
+				index->header->db_size == st->st_size;
+}
+
+static void mbpi_index_set_failed(const struct stat *st)
+{
+	mbpi_index_failed = st != NULL;
+
+	if (st == NULL)
+		return;
+
+	mbpi_index_failed_mtime = database_mtime(st);
+	mbpi_index_failed_size = st->st_size;
+}
+
+static gboolean mbpi_index_has_failed(const struct stat *st)
+{
+	return mbpi_index_failed &&
+			mbpi_index_failed_mtime == database_mtime(st) &&
+			mbpi_index_failed_size == st->st_size;
+}
+
+static struct mbpi_index *mbpi_index_load(const struct stat *st)
+{
+	struct mbpi_index *index;
+	struct stat ist;
+	void *data;
+	int fd;
+
+	fd = open(MBPI_INDEX, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &ist) < 0 || ist.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	index = mbpi_index_new(data, ist.st_size, TRUE);
+	if (index == NULL) {
+		munmap(data, ist.st_size);
+		return NULL;
+	}
+
+	if (mbpi_index_matches(index, st) == FALSE) {
+		mbpi_index_free(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+static struct mbpi_index *mbpi_index_build(const struct stat *st,
+						GError **error)
+{
+	struct mbpi_index *index;
+	GByteArray *compiled;
+	gsize size;
+	guint8 *data;
+
+	compiled = mbpi_index_compile(st, error);
+	if (compiled == NULL)
+		return NULL;
+
+	/* Not being able to store the index only costs us the next parse */
+	g_file_set_contents(MBPI_INDEX, (const char *) compiled->data,
+				compiled->len, NULL);
+
+	size = compiled->len;
+	data = g_byte_array_free(compiled, FALSE);
+
+	index = mbpi_index_new(data, size, FALSE);
+	if (index == NULL)
+		g_free(data);
+
+	return index;
+}
+
+/*
+ * Returns an index that is up to date with the database, or NULL if the
+ * XML has to be parsed instead.  Errors are left to the XML parser to
+ * report, so that lookups fail exactly the way they always did.  A
+ * database the index can't be built for is not tried again until it
+ * changes, otherwise every lookup would parse it twice.
+ */
+static struct mbpi_index *mbpi_index_get(void)
+{
+	struct stat st;
+
+	if (stat(MBPI_DATABASE, &st) < 0)
+		return NULL;
+
+	if (mbpi_index_cache && mbpi_index_matches(mbpi_index_cache, &st))
+		return mbpi_index_cache;
+
+	mbpi_index_free(mbpi_index_cache);
+	mbpi_index_cache = NULL;
+
+	if (mbpi_index_has_failed(&st))
+		return NULL;
+
+	mbpi_index_cache = mbpi_index_load(&st);
+	if (mbpi_index_cache == NULL)
+		mbpi_index_cache = mbpi_index_build(&st, NULL);
+
+	mbpi_index_set_failed(mbpi_index_cache ? NULL : &st);
+
+	return mbpi_index_cache;
+}
+
+static char *index_strdup(const struct mbpi_index *index, guint32 offset)
+{
+	if (offset == MBPI_INDEX_NO_STRING ||
+			offset >= index->header->strings_size)
+		return NULL;
+
+	return g_strdup(index->strings + offset);
+}
+
+static const char *index_string(const struct mbpi_index *index,
+					guint32 offset)
+{
+	if (offset >= index->header->strings_size)
+		return "";
+
+	return index->strings + offset;
+}
+
+static const struct mbpi_index_network *index_find_network(
+					const struct mbpi_index *index,
+					const char *mcc, const char *mnc)
+{
+	guint32 lo = 0;
+	guint32 hi = index->header->n_networks;
+
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+		const struct mbpi_index_network *n = &index->networks[mid];
+		int r = strcmp(mcc, index_string(index, n->mcc));
+
+		if (r == 0)
+			r = strcmp(mnc, index_string(index, n->mnc));
+
+		if (r == 0)
+			return n;
+
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+static GSList *index_lookup_apn(const struct mbpi_index *index,
+				const char *mcc, const char *mnc,
+				gboolean allow_duplicates, GError **error)
+{
+	const struct mbpi_index_network *network;
+	GSList *apns = NULL;
+	GSList *l;
+	guint32 i;
+
+	network = index_find_network(index, mcc, mnc);
+	if (network == NULL)
+		return NULL;
+
+	if (network->first > index->header->n_refs ||
+			network->count > index->header->n_refs - network->first)
+		return NULL;
+
+	for (i = 0; i < network->count; i++) {
+		guint32 ref = index->refs[network->first + i];
+		const struct mbpi_index_apn *entry;
+		struct ofono_gprs_provision_data *ap;
+
+		if (ref >= index->header->n_apns)
+			continue;
+
+		entry = &index->apns[ref];
+
+		if (allow_duplicates == FALSE) {
+			for (l = apns; l; l = l->next) {
+				struct ofono_gprs_provision_data *pd = l->data;
+
+				if (pd->type == entry->type)
+					break;
+			}
+
+			if (l != NULL) {
+				g_set_error(error, mbpi_error_quark(),
+						MBPI_ERROR_DUPLICATE,
+						"%s:%d Duplicate context "
+						"detected", MBPI_DATABASE,
+						entry->line);
+
+				for (l = apns; l; l = l->next)
+					mbpi_ap_free(l->data);
+
+				g_slist_free(apns);
+
+				return NULL;
+			}
+		}
+
+		ap = g_new0(struct ofono_gprs_provision_data, 1);
+		ap->apn = index_strdup(index, entry->apn);
+		ap->name = index_strdup(index, entry->name);
+		ap->username = index_strdup(index, entry->username);
+		ap->password = index_strdup(index, entry->password);
+		ap->message_proxy = index_strdup(index, entry->message_proxy);
+		ap->message_center = index_strdup(index,
+							entry->message_center);
+		ap->type = entry->type;
+		ap->proto = OFONO_GPRS_PROTO_IP;
+		ap->auth_method = entry->auth_method;
+
+		apns = g_slist_prepend(apns, ap);
+	}
+
+	return g_slist_reverse(apns);
+}
+
+static char *index_lookup_cdma_provider_name(const struct mbpi_index *index,
+						const char *sid)
+{
+	guint32 lo = 0;
+	guint32 hi = index->header->n_sids;
+
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+		int r = strcmp(sid, index_string(index, index->sids[mid].sid));
+
+		if (r == 0)
+			return index_strdup(index, index->sids[mid].name);
+
+		if (r < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+gboolean mbpi_index_rebuild(GError **error)
+{
+	struct stat st;
+
+	if (stat(MBPI_DATABASE, &st) < 0) {
+		g_set_error(error, G_FILE_ERROR,
+				g_file_error_from_errno(errno),
+				"stat(%s) failed: %s", MBPI_DATABASE,
+				g_strerror(errno));
+		return FALSE;
+	}
+
+	mbpi_index_free(mbpi_index_cache);
+	mbpi_index_cache = mbpi_index_build(&st, error);
+
+	mbpi_index_set_failed(mbpi_index_cache ? NULL : &st);
+
+	return mbpi_index_cache != NULL;
+}
+
+void mbpi_index_set_enabled(gboolean enabled)
+{
+	mbpi_index_enabled = enabled;
+}
+
+void mbpi_index_foreach_network(mbpi_network_func_t func, gpointer user_data)
+{
+	struct mbpi_index *index = mbpi_index_get();
+	guint32 i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->header->n_networks; i++)
+		func(index_string(index, index->networks[i].mcc),
+			index_string(index, index->networks[i].mnc),
+			user_data);
+}
+
+void mbpi_index_foreach_sid(mbpi_sid_func_t func, gpointer user_data)
+{
+	struct mbpi_index *index = mbpi_index_get();
+	guint32 i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->header->n_sids; i++)
+		func(index_string(index, index->sids[i].sid), user_data);
+}
+
 GSList *mbpi_lookup_apn(const char *mcc, const char *mnc,
 			gboolean allow_duplicates, GError **error)
 {
+	struct mbpi_index *index = NULL;
 	struct gsm_data gsm;
 	GSList *l;
 
+	if (mbpi_index_enabled == TRUE)
+		index = mbpi_index_get();
+
+	if (index != NULL)
+		return index_lookup_apn(index, mcc, mnc, allow_duplicates,
+						error);
+
 	memset(&gsm, 0, sizeof(gsm));
 	gsm.match_mcc = mcc;
 	gsm.match_mnc = mnc;
@@ -631,8 +1527,15 @@ GSList *mbpi_lookup_apn(const char *mcc, const char *mnc,
 
 char *mbpi_lookup_cdma_provider_name(const char *sid, GError **error)
 {
+	struct mbpi_index *index = NULL;
 	struct cdma_data cdma;
 
+	if (mbpi_index_enabled == TRUE)
+		index = mbpi_index_get();
+
+	if (index != NULL)
+		return index_lookup_cdma_provider_name(index, sid);
+
 	memset(&cdma, 0, sizeof(cdma));
 	cdma.match_sid = sid;
 
@@ -27,3 +27,13 @@ GSList *mbpi_lookup_apn(const char *mcc, const char *mnc,
 			gboolean allow_duplicates, GError **error);
 
 char *mbpi_lookup_cdma_provider_name(const char *sid, GError **error);
+
+typedef void (*mbpi_network_func_t)(const char *mcc, const char *mnc,
+					gpointer user_data);
+typedef void (*mbpi_sid_func_t)(const char *sid, gpointer user_data);
+
+gboolean mbpi_index_rebuild(GError **error);
+void mbpi_index_set_enabled(gboolean enabled);
+void mbpi_index_foreach_network(mbpi_network_func_t func,
+					gpointer user_data);
+void mbpi_index_foreach_sid(mbpi_sid_func_t func, gpointer user_data);
@@ -37,6 +37,18 @@
 #include <ofono/modem.h>
 #include <ofono/log.h>
 
+/*
+ * One interface a driver expects to see before its setup function can
+ * pick up every port it uses.  Entries sharing the same port number are
+ * alternatives, NULL fields match anything.
+ */
+struct port_match {
+	unsigned int port;
+	const char *interface;
+	const char *number;
+	const char *label;
+};
+
 struct modem_info {
 	char *syspath;
 	char *devname;
@@ -46,6 +58,8 @@ struct modem_info {
 	GSList *devices;
 	struct ofono_modem *modem;
 	const char *sysattr;
+	const struct port_match *ports;
+	gint64 hotplug_time;
 };
 
 struct device_info {
@@ -912,31 +926,113 @@ static gboolean setup_ublox(struct modem_info *modem)
 	return TRUE;
 }
 
+static const struct port_match ports_option[] = {
+	{ 0,	"255/255/255",	"00"		},
+	{ 1,	"255/255/255",	"01"		},
+	{ 2,	"255/255/255",	"02"		},
+	{ }
+};
+
+static const struct port_match ports_speedup[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ }
+};
+
+static const struct port_match ports_linktop[] = {
+	{ 0,	"2/2/1",	"01"		},
+	{ 1,	"2/2/1",	"03"		},
+	{ }
+};
+
+static const struct port_match ports_alcatel[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 0,	"255/255/255",	"03"		},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ 1,	"255/255/255",	"05"		},
+	{ }
+};
+
+static const struct port_match ports_novatel[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 0,	"255/255/255",	"00"		},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ 1,	"255/255/255",	"01"		},
+	{ }
+};
+
+static const struct port_match ports_nokia[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 0,	"10/0/0",	"04"		},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ 1,	"10/0/0",	"02"		},
+	{ }
+};
+
+static const struct port_match ports_telit[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 0,	"255/255/255",	"03"		},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ 1,	"255/255/255",	"00"		},
+	{ 2,	"255/255/255",	"02"		},
+	{ }
+};
+
+static const struct port_match ports_he910[] = {
+	{ 0,	"2/2/1",	"00"		},
+	{ 1,	"2/2/1",	"06"		},
+	{ 2,	"2/2/1",	"0a"		},
+	{ }
+};
+
+static const struct port_match ports_simcom[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 0,	"255/255/255",	"02"		},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ 1,	"255/255/255",	"03"		},
+	{ 2,	"255/255/255",	"01"		},
+	{ }
+};
+
+static const struct port_match ports_quectel[] = {
+	{ 0,	NULL,		NULL,	"aux"	},
+	{ 0,	"255/255/255",	"02"		},
+	{ 1,	NULL,		NULL,	"modem"	},
+	{ 1,	"255/255/255",	"03"		},
+	{ }
+};
+
+/*
+ * Drivers with a port list get their modem created as soon as all of
+ * those ports have shown up.  Everything else, and devices that never
+ * complete their list, is picked up by the udev_delay timer instead.
+ */
 static struct {
 	const char *name;
 	gboolean (*setup)(struct modem_info *modem);
 	const char *sysattr;
+	const struct port_match *ports;
 } driver_list[] = {
 	{ "isiusb",	setup_isi,	"type"			},
 	{ "mbm",	setup_mbm,	"device/interface"	},
 	{ "hso",	setup_hso,	"hsotype"		},
 	{ "gobi",	setup_gobi	},
 	{ "sierra",	setup_sierra	},
-	{ "option",	setup_option	},
+	{ "option",	setup_option,	NULL,	ports_option	},
 	{ "huawei",	setup_huawei	},
-	{ "speedupcdma",setup_speedup	},
-	{ "speedup",	setup_speedup	},
-	{ "linktop",	setup_linktop	},
-	{ "alcatel",	setup_alcatel	},
-	{ "novatel",	setup_novatel	},
-	{ "nokia",	setup_nokia	},
-	{ "telit",	setup_telit	},
-	{ "he910",	setup_he910	},
-	{ "simcom",	setup_simcom	},
+	{ "speedupcdma",setup_speedup,	NULL,	ports_speedup	},
+	{ "speedup",	setup_speedup,	NULL,	ports_speedup	},
+	{ "linktop",	setup_linktop,	NULL,	ports_linktop	},
+	{ "alcatel",	setup_alcatel,	NULL,	ports_alcatel	},
+	{ "novatel",	setup_novatel,	NULL,	ports_novatel	},
+	{ "nokia",	setup_nokia,	NULL,	ports_nokia	},
+	{ "telit",	setup_telit,	NULL,	ports_telit	},
+	{ "he910",	setup_he910,	NULL,	ports_he910	},
+	{ "simcom",	setup_simcom,	NULL,	ports_simcom	},
 	{ "zte",	setup_zte	},
 	{ "icera",	setup_icera	},
 	{ "samsung",	setup_samsung	},
-	{ "quectel",	setup_quectel	},
+	{ "quectel",	setup_quectel,	NULL,	ports_quectel	},
 	{ "ublox",	setup_ublox	},
 	{ }
 };
@@ -955,6 +1051,62 @@ static const char *get_sysattr(const char *driver)
 	return NULL;
 }
 
+static const struct port_match *get_ports(const char *driver)
+{
+	unsigned int i;
+
+	for (i = 0; driver_list[i].name; i++) {
+		if (g_str_equal(driver_list[i].name, driver) == TRUE)
+			return driver_list[i].ports;
+	}
+
+	return NULL;
+}
+
+static gboolean match_port(const struct port_match *match,
+					const struct device_info *info)
+{
+	if (match->interface != NULL &&
+			g_strcmp0(match->interface, info->interface) != 0)
+		return FALSE;
+
+	if (match->number != NULL &&
+			g_strcmp0(match->number, info->number) != 0)
+		return FALSE;
+
+	if (match->label != NULL && g_strcmp0(match->label, info->label) != 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static gboolean modem_ready(struct modem_info *modem)
+{
+	const struct port_match *match;
+	unsigned int required = 0;
+	unsigned int found = 0;
+	GSList *list;
+
+	if (modem->ports == NULL || modem->modem != NULL)
+		return FALSE;
+
+	for (match = modem->ports; match->interface || match->label; match++) {
+		required |= 1 << match->port;
+
+		if (found & (1 << match->port))
+			continue;
+
+		for (list = modem->devices; list; list = list->next) {
+			if (match_port(match, list->data) == TRUE) {
+				found |= 1 << match->port;
+				break;
+			}
+		}
+	}
+
+	return found == required;
+}
+
 static void destroy_modem(gpointer data)
 {
 	struct modem_info *modem = data;
@@ -1029,9 +1181,10 @@ static gint compare_device(gconstpointer a, gconstpointer b)
 	return g_strcmp0(info1->number, info2->number);
 }
 
-static void add_device(const char *syspath, const char *devname,
-			const char *driver, const char *vendor,
-			const char *model, struct udev_device *device)
+static struct modem_info *add_device(const char *syspath,
+			const char *devname, const char *driver,
+			const char *vendor, const char *model,
+			struct udev_device *device)
 {
 	struct udev_device *intf;
 	const char *devpath, *devnode, *interface, *number;
@@ -1042,25 +1195,25 @@ static void add_device(const char *syspath, const char *devname,
 
 	devpath = udev_device_get_syspath(device);
 	if (devpath == NULL)
-		return;
+		return NULL;
 
 	devnode = udev_device_get_devnode(device);
 	if (devnode == NULL) {
 		devnode = udev_device_get_property_value(device, "INTERFACE");
 		if (devnode == NULL)
-			return;
+			return NULL;
 	}
 
 	intf = udev_device_get_parent_with_subsystem_devtype(device,
 						"usb", "usb_interface");
 	if (intf == NULL)
-		return;
+		return NULL;
 
 	modem = g_hash_table_lookup(modem_list, syspath);
 	if (modem == NULL) {
 		modem = g_try_new0(struct modem_info, 1);
 		if (modem == NULL)
-			return;
+			return NULL;
 
 		modem->syspath = g_strdup(syspath);
 		modem->devname = g_strdup(devname);
@@ -1069,6 +1222,8 @@ static void add_device(const char *syspath, const char *devname,
 		modem->model = g_strdup(model);
 
 		modem->sysattr = get_sysattr(driver);
+		modem->ports = get_ports(driver);
+		modem->hotplug_time = g_get_monotonic_time();
 
 		g_hash_table_replace(modem_list, modem->syspath, modem);
 	}
@@ -1103,7 +1258,7 @@ static void add_device(const char *syspath, const char *devname,
 
 	info = g_try_new0(struct device_info, 1);
 	if (info == NULL)
-		return;
+		return NULL;
 
 	info->devpath = g_strdup(devpath);
 	info->devnode = g_strdup(devnode);
@@ -1115,6 +1270,8 @@ static void add_device(const char *syspath, const char *devname,
 
 	modem->devices = g_slist_insert_sorted(modem->devices, info,
 							compare_device);
+
+	return modem;
 }
 
 static struct {
@@ -1180,7 +1337,7 @@ static struct {
 	{ }
 };
 
-static void check_usb_device(struct udev_device *device)
+static struct modem_info *check_usb_device(struct udev_device *device)
 {
 	struct udev_device *usb_device;
 	const char *syspath, *devname, *driver;
@@ -1189,15 +1346,15 @@ static void check_usb_device(struct udev_device *device)
 	usb_device = udev_device_get_parent_with_subsystem_devtype(device,
 							"usb", "usb_device");
 	if (usb_device == NULL)
-		return;
+		return NULL;
 
 	syspath = udev_device_get_syspath(usb_device);
 	if (syspath == NULL)
-		return;
+		return NULL;
 
 	devname = udev_device_get_devnode(usb_device);
 	if (devname == NULL)
-		return;
+		return NULL;
 
 	driver = udev_device_get_property_value(usb_device, "OFONO_DRIVER");
 	if (driver == NULL) {
@@ -1212,11 +1369,11 @@ static void check_usb_device(struct udev_device *device)
 
 				parent = udev_device_get_parent(device);
 				if (parent == NULL)
-					return;
+					return NULL;
 
 				drv = udev_device_get_driver(parent);
 				if (drv == NULL)
-					return;
+					return NULL;
 			}
 		}
 
@@ -1257,13 +1414,13 @@ static void check_usb_device(struct udev_device *device)
 		}
 
 		if (driver == NULL)
-			return;
+			return NULL;
 	}
 
-	add_device(syspath, devname, driver, vendor, model, device);
+	return add_device(syspath, devname, driver, vendor, model, device);
 }
 
-static void check_device(struct udev_device *device)
+static struct modem_info *check_device(struct udev_device *device)
 {
 	const char *bus;
 
@@ -1271,12 +1428,14 @@ static void check_device(struct udev_device *device)
 	if (bus == NULL) {
 		bus = udev_device_get_subsystem(device);
 		if (bus == NULL)
-			return;
+			return NULL;
 	}
 
 	if ((g_str_equal(bus, "usb") == TRUE) ||
 			(g_str_equal(bus, "usbmisc") == TRUE))
-		check_usb_device(device);
+		return check_usb_device(device);
+
+	return NULL;
 }
 
 static gboolean create_modem(gpointer key, gpointer value, gpointer user_data)
@@ -1305,6 +1464,10 @@ static gboolean create_modem(gpointer key, gpointer value, gpointer user_data)
 
 		if (driver_list[i].setup(modem) == TRUE) {
 			ofono_modem_register(modem->modem);
+
+			DBG("%s registered %" G_GINT64_FORMAT " ms after hotplug",
+				syspath, (g_get_monotonic_time() -
+						modem->hotplug_time) / 1000);
 			return FALSE;
 		}
 	}
@@ -1365,10 +1528,19 @@ static gboolean check_modem_list(gpointer user_data)
 	return FALSE;
 }
 
+static gboolean check_pending(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct modem_info *modem = value;
+
+	return modem->modem == NULL;
+}
+
 static gboolean udev_event(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
 	struct udev_device *device;
+	struct modem_info *modem;
 	const char *action;
 
 	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
@@ -1386,12 +1558,22 @@ static gboolean udev_event(GIOChannel *channel, GIOCondition cond,
 		return TRUE;
 
 	if (g_str_equal(action, "add") == TRUE) {
-		if (udev_delay > 0)
+		if (udev_delay > 0) {
 			g_source_remove(udev_delay);
+			udev_delay = 0;
+		}
 
-		check_device(device);
+		modem = check_device(device);
+
+		if (modem != NULL && modem_ready(modem) == TRUE) {
+			if (create_modem(modem->syspath, modem, NULL) == TRUE)
+				g_hash_table_remove(modem_list, modem->syspath);
+		}
 
-		udev_delay = g_timeout_add_seconds(1, check_modem_list, NULL);
+		/* Fall back to waiting for the interfaces to settle */
+		if (g_hash_table_find(modem_list, check_pending, NULL) != NULL)
+			udev_delay = g_timeout_add_seconds(1, check_modem_list,
+									NULL);
 	} else if (g_str_equal(action, "remove") == TRUE)
 		remove_device(device);
 
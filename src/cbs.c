@@ -68,6 +68,7 @@ struct ofono_cbs {
 	GSList *efcbmir_contents;
 	unsigned short efcbmid_length;
 	GSList *efcbmid_contents;
+	unsigned char *efcbmid_topics;
 	gboolean efcbmid_update;
 	guint reset_source;
 	int lac;
@@ -191,7 +192,7 @@ void ofono_cbs_notify(struct ofono_cbs *cbs, const unsigned char *pdu,
 		return;
 	}
 
-	if (cbs_topic_in_range(c.message_identifier, cbs->efcbmid_contents)) {
+	if (cbs_topic_in_bitmap(cbs->efcbmid_topics, c.message_identifier)) {
 		if (cbs->sim == NULL)
 			return;
 
@@ -600,6 +601,8 @@ static void cbs_unregister(struct ofono_atom *atom)
 		cbs->efcbmid_length = 0;
 		g_slist_free_full(cbs->efcbmid_contents, g_free);
 		cbs->efcbmid_contents = NULL;
+		g_free(cbs->efcbmid_topics);
+		cbs->efcbmid_topics = NULL;
 	}
 
 	if (cbs->sim_context) {
@@ -874,6 +877,7 @@ static void sim_cbmid_read_cb(int ok, int length, int record,
 		goto done;
 
 	cbs->efcbmid_contents = g_slist_reverse(contents);
+	cbs->efcbmid_topics = cbs_topic_bitmap_new(cbs->efcbmid_contents);
 
 	str = cbs_topic_ranges_to_string(cbs->efcbmid_contents);
 	DBG("Got cbmid: %s", str);
@@ -901,6 +905,8 @@ static void cbs_efcbmid_changed(int id, void *userdata)
 		cbs->efcbmid_length = 0;
 		g_slist_free_full(cbs->efcbmid_contents, g_free);
 		cbs->efcbmid_contents = NULL;
+		g_free(cbs->efcbmid_topics);
+		cbs->efcbmid_topics = NULL;
 	}
 
 	cbs->efcbmid_update = TRUE;
@@ -23,6 +23,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <glib.h>
 #include <gdbus.h>
 
@@ -32,6 +34,47 @@
 
 static DBusConnection *g_connection;
 
+/*
+ * Property changes are also collected per object and interface while
+ * any client has asked for PropertiesChanged.  The collected changes
+ * are sent as one a{sv} signal from an idle callback, so a burst of
+ * updates costs a single message for those clients.
+ */
+struct property_change {
+	char *name;
+	DBusMessage *signal;
+};
+
+struct property_batch {
+	char *path;
+	char *interface;
+	GSList *changes;
+};
+
+static GSList *property_batches;
+static guint property_batch_source;
+static unsigned int property_batch_listeners;
+
+/*
+ * Pre-marshalled replies of property getters, keyed by object path.
+ * A reply is dropped as soon as a property of its interface changes,
+ * until then answering the same call again only copies the template.
+ */
+struct cached_reply {
+	char *interface;
+	char *member;
+	gboolean children;
+	DBusMessage *reply;
+};
+
+struct cached_object {
+	GSList *replies;
+};
+
+static GHashTable *reply_cache;
+static unsigned int reply_cache_hits;
+static unsigned int reply_cache_misses;
+
 struct error_mapping_entry {
 	int error;
 	DBusMessage *(*ofono_error_func)(DBusMessage *);
@@ -198,6 +241,360 @@ void ofono_dbus_dict_append_dict(DBusMessageIter *dict, const char *key,
 	dbus_message_iter_close_container(dict, &entry);
 }
 
+static void copy_iter(DBusMessageIter *from, DBusMessageIter *to)
+{
+	int type;
+
+	while ((type = dbus_message_iter_get_arg_type(from)) !=
+							DBUS_TYPE_INVALID) {
+		DBusMessageIter sub_from, sub_to;
+		const char *contained = NULL;
+		char *sig = NULL;
+
+		if (dbus_type_is_basic(type) == TRUE) {
+			union {
+				dbus_uint64_t u64;
+				double dbl;
+				const char *str;
+			} value;
+
+			dbus_message_iter_get_basic(from, &value);
+			dbus_message_iter_append_basic(to, type, &value);
+			dbus_message_iter_next(from);
+			continue;
+		}
+
+		dbus_message_iter_recurse(from, &sub_from);
+
+		if (type == DBUS_TYPE_VARIANT) {
+			sig = dbus_message_iter_get_signature(&sub_from);
+			contained = sig;
+		} else if (type == DBUS_TYPE_ARRAY) {
+			/* Element signature, without the leading 'a' */
+			sig = dbus_message_iter_get_signature(from);
+			contained = sig + 1;
+		}
+
+		dbus_message_iter_open_container(to, type, contained, &sub_to);
+		copy_iter(&sub_from, &sub_to);
+		dbus_message_iter_close_container(to, &sub_to);
+
+		dbus_free(sig);
+
+		dbus_message_iter_next(from);
+	}
+}
+
+static void property_change_free(gpointer data)
+{
+	struct property_change *change = data;
+
+	dbus_message_unref(change->signal);
+	g_free(change->name);
+	g_free(change);
+}
+
+static void property_batch_free(gpointer data)
+{
+	struct property_batch *batch = data;
+
+	g_slist_free_full(batch->changes, property_change_free);
+	g_free(batch->path);
+	g_free(batch->interface);
+	g_free(batch);
+}
+
+static void property_batch_send(DBusConnection *conn,
+					struct property_batch *batch)
+{
+	DBusMessage *signal;
+	DBusMessageIter iter, dict;
+	void *data = NULL;
+	GSList *l;
+
+	/* Nothing to report if the object went away in the meantime */
+	if (dbus_connection_get_object_path_data(conn, batch->path,
+							&data) == FALSE ||
+			data == NULL)
+		return;
+
+	signal = dbus_message_new_signal(batch->path, batch->interface,
+							"PropertiesChanged");
+	if (signal == NULL) {
+		ofono_error("Unable to allocate new %s.PropertiesChanged"
+				" signal", batch->interface);
+		return;
+	}
+
+	dbus_message_iter_init_append(signal, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					OFONO_PROPERTIES_ARRAY_SIGNATURE,
+					&dict);
+
+	for (l = batch->changes; l; l = l->next) {
+		struct property_change *change = l->data;
+		DBusMessageIter value, entry;
+
+		/* The value is the variant following the property name */
+		dbus_message_iter_init(change->signal, &value);
+		dbus_message_iter_next(&value);
+
+		dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY,
+							NULL, &entry);
+		dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING,
+							&change->name);
+		copy_iter(&value, &entry);
+		dbus_message_iter_close_container(&dict, &entry);
+	}
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	/*
+	 * PropertiesChanged is not part of the per interface signal
+	 * tables, so bypass the check done by g_dbus_send_message
+	 */
+	dbus_connection_send(conn, signal, NULL);
+	dbus_message_unref(signal);
+}
+
+static gboolean property_batch_flush(gpointer user_data)
+{
+	DBusConnection *conn = ofono_dbus_get_connection();
+	GSList *batches = property_batches;
+	GSList *l;
+
+	property_batch_source = 0;
+	property_batches = NULL;
+
+	for (l = batches; l; l = l->next) {
+		struct property_batch *batch = l->data;
+
+		batch->changes = g_slist_reverse(batch->changes);
+
+		if (conn != NULL)
+			property_batch_send(conn, batch);
+	}
+
+	g_slist_free_full(batches, property_batch_free);
+
+	return FALSE;
+}
+
+static void property_batch_add(DBusMessage *signal, const char *path,
+				const char *interface, const char *name)
+{
+	struct property_batch *batch = NULL;
+	struct property_change *change;
+	GSList *l;
+
+	for (l = property_batches; l; l = l->next) {
+		batch = l->data;
+
+		if (g_str_equal(batch->path, path) &&
+				g_str_equal(batch->interface, interface))
+			break;
+	}
+
+	if (l == NULL) {
+		batch = g_new0(struct property_batch, 1);
+		batch->path = g_strdup(path);
+		batch->interface = g_strdup(interface);
+		property_batches = g_slist_prepend(property_batches, batch);
+	}
+
+	/* Only the latest value of a property is of interest */
+	for (l = batch->changes; l; l = l->next) {
+		change = l->data;
+
+		if (g_str_equal(change->name, name)) {
+			dbus_message_unref(change->signal);
+			change->signal = dbus_message_ref(signal);
+			goto done;
+		}
+	}
+
+	change = g_new0(struct property_change, 1);
+	change->name = g_strdup(name);
+	change->signal = dbus_message_ref(signal);
+	batch->changes = g_slist_prepend(batch->changes, change);
+
+done:
+	if (property_batch_source == 0)
+		property_batch_source = g_idle_add(property_batch_flush, NULL);
+}
+
+static void cached_reply_free(gpointer data)
+{
+	struct cached_reply *cached = data;
+
+	dbus_message_unref(cached->reply);
+	g_free(cached->interface);
+	g_free(cached->member);
+	g_free(cached);
+}
+
+static void cached_object_free(gpointer data)
+{
+	struct cached_object *object = data;
+
+	g_slist_free_full(object->replies, cached_reply_free);
+	g_free(object);
+}
+
+static void reply_cache_drop(const char *path, const char *interface,
+							gboolean children)
+{
+	struct cached_object *object;
+	GSList *l, *next;
+
+	object = g_hash_table_lookup(reply_cache, path);
+	if (object == NULL)
+		return;
+
+	for (l = object->replies; l; l = next) {
+		struct cached_reply *cached = l->data;
+
+		next = l->next;
+
+		if (children == TRUE && cached->children == FALSE)
+			continue;
+
+		if (interface != NULL &&
+				!g_str_equal(cached->interface, interface))
+			continue;
+
+		object->replies = g_slist_delete_link(object->replies, l);
+		cached_reply_free(cached);
+	}
+
+	if (object->replies == NULL)
+		g_hash_table_remove(reply_cache, path);
+}
+
+void __ofono_dbus_invalidate_reply(const char *path, const char *interface)
+{
+	const char *slash;
+	char *parent;
+
+	if (reply_cache == NULL || g_hash_table_size(reply_cache) == 0)
+		return;
+
+	reply_cache_drop(path, interface, FALSE);
+
+	/* Replies that describe child objects are stale as well */
+	slash = strrchr(path, '/');
+	if (slash == NULL || slash == path)
+		return;
+
+	parent = g_strndup(path, slash - path);
+	reply_cache_drop(parent, NULL, TRUE);
+	g_free(parent);
+}
+
+DBusMessage *__ofono_dbus_cached_reply(DBusMessage *msg)
+{
+	const char *path = dbus_message_get_path(msg);
+	const char *interface = dbus_message_get_interface(msg);
+	const char *member = dbus_message_get_member(msg);
+	struct cached_object *object;
+	DBusMessage *reply;
+	GSList *l;
+
+	if (reply_cache == NULL || interface == NULL)
+		return NULL;
+
+	object = g_hash_table_lookup(reply_cache, path);
+	if (object == NULL)
+		goto miss;
+
+	for (l = object->replies; l; l = l->next) {
+		struct cached_reply *cached = l->data;
+
+		if (!g_str_equal(cached->interface, interface) ||
+				!g_str_equal(cached->member, member))
+			continue;
+
+		reply = dbus_message_copy(cached->reply);
+		if (reply == NULL)
+			return NULL;
+
+		dbus_message_set_reply_serial(reply,
+					dbus_message_get_serial(msg));
+		dbus_message_set_destination(reply,
+					dbus_message_get_sender(msg));
+
+		reply_cache_hits += 1;
+
+		return reply;
+	}
+
+miss:
+	reply_cache_misses += 1;
+
+	DBG("%s %s.%s hits %u misses %u", path, interface, member,
+				reply_cache_hits, reply_cache_misses);
+
+	return NULL;
+}
+
+DBusMessage *__ofono_dbus_cache_reply(DBusMessage *msg, DBusMessage *reply,
+							gboolean children)
+{
+	const char *path = dbus_message_get_path(msg);
+	const char *interface = dbus_message_get_interface(msg);
+	struct cached_object *object;
+	struct cached_reply *cached;
+	DBusMessage *copy;
+
+	if (reply_cache == NULL || interface == NULL || reply == NULL)
+		return reply;
+
+	copy = dbus_message_copy(reply);
+	if (copy == NULL)
+		return reply;
+
+	object = g_hash_table_lookup(reply_cache, path);
+	if (object == NULL) {
+		object = g_new0(struct cached_object, 1);
+		g_hash_table_insert(reply_cache, g_strdup(path), object);
+	}
+
+	cached = g_new0(struct cached_reply, 1);
+	cached->interface = g_strdup(interface);
+	cached->member = g_strdup(dbus_message_get_member(msg));
+	cached->children = children;
+	cached->reply = copy;
+
+	object->replies = g_slist_prepend(object->replies, cached);
+
+	return reply;
+}
+
+static int send_property_changed(DBusConnection *conn, DBusMessage *signal,
+					const char *path, const char *interface,
+					const char *name)
+{
+	__ofono_dbus_invalidate_reply(path, interface);
+
+	if (property_batch_listeners > 0)
+		property_batch_add(signal, path, interface, name);
+
+	return g_dbus_send_message(conn, signal);
+}
+
+void __ofono_dbus_batch_listener_add(void)
+{
+	property_batch_listeners += 1;
+}
+
+void __ofono_dbus_batch_listener_remove(void)
+{
+	if (property_batch_listeners == 0)
+		return;
+
+	property_batch_listeners -= 1;
+}
+
 int ofono_dbus_signal_property_changed(DBusConnection *conn,
 					const char *path,
 					const char *interface,
@@ -220,7 +617,7 @@ int ofono_dbus_signal_property_changed(DBusConnection *conn,
 
 	append_variant(&iter, type, value);
 
-	return g_dbus_send_message(conn, signal);
+	return send_property_changed(conn, signal, path, interface, name);
 }
 
 int ofono_dbus_signal_array_property_changed(DBusConnection *conn,
@@ -246,7 +643,7 @@ int ofono_dbus_signal_array_property_changed(DBusConnection *conn,
 
 	append_array_variant(&iter, type, value);
 
-	return g_dbus_send_message(conn, signal);
+	return send_property_changed(conn, signal, path, interface, name);
 }
 
 int ofono_dbus_signal_dict_property_changed(DBusConnection *conn,
@@ -272,7 +669,7 @@ int ofono_dbus_signal_dict_property_changed(DBusConnection *conn,
 
 	append_dict_variant(&iter, type, value);
 
-	return g_dbus_send_message(conn, signal);
+	return send_property_changed(conn, signal, path, interface, name);
 }
 
 DBusMessage *__ofono_error_invalid_args(DBusMessage *msg)
@@ -517,6 +914,9 @@ int __ofono_dbus_init(DBusConnection *conn)
 {
 	dbus_gsm_set_connection(conn);
 
+	reply_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, cached_object_free);
+
 	return 0;
 }
 
@@ -524,6 +924,19 @@ void __ofono_dbus_cleanup(void)
 {
 	DBusConnection *conn = ofono_dbus_get_connection();
 
+	if (property_batch_source > 0) {
+		g_source_remove(property_batch_source);
+		property_batch_source = 0;
+	}
+
+	g_slist_free_full(property_batches, property_batch_free);
+	property_batches = NULL;
+
+	if (reply_cache != NULL) {
+		g_hash_table_destroy(reply_cache);
+		reply_cache = NULL;
+	}
+
 	if (conn == NULL || !dbus_connection_get_is_connected(conn))
 		return;
 
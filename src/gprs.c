@@ -1748,6 +1748,10 @@ static DBusMessage *gprs_get_properties(DBusConnection *conn,
 	DBusMessageIter dict;
 	dbus_bool_t value;
 
+	reply = __ofono_dbus_cached_reply(msg);
+	if (reply != NULL)
+		return reply;
+
 	reply = dbus_message_new_method_return(msg);
 	if (reply == NULL)
 		return NULL;
@@ -1783,7 +1787,7 @@ static DBusMessage *gprs_get_properties(DBusConnection *conn,
 
 	dbus_message_iter_close_container(&iter, &dict);
 
-	return reply;
+	return __ofono_dbus_cache_reply(msg, reply, FALSE);
 }
 
 static DBusMessage *gprs_set_property(DBusConnection *conn,
@@ -3010,6 +3014,7 @@ static void gprs_unregister(struct ofono_atom *atom)
 
 	ofono_modem_remove_interface(modem,
 					OFONO_CONNECTION_MANAGER_INTERFACE);
+	__ofono_dbus_invalidate_reply(path, OFONO_CONNECTION_MANAGER_INTERFACE);
 	g_dbus_unregister_interface(conn, path,
 					OFONO_CONNECTION_MANAGER_INTERFACE);
 }
@@ -33,6 +33,7 @@
 #include <gdbus.h>
 
 #include "ofono.h"
+#include "storage.h"
 
 #define SHUTDOWN_GRACE_SECONDS 10
 
@@ -133,6 +134,7 @@ static gchar *option_plugin = NULL;
 static gchar *option_noplugin = NULL;
 static gboolean option_detach = TRUE;
 static gboolean option_version = FALSE;
+static gint option_sync_interval = -1;
 
 static gboolean parse_debug(const char *key, const char *value,
 					gpointer user_data, GError **error)
@@ -156,6 +158,9 @@ static GOptionEntry options[] = {
 	{ "nodetach", 'n', G_OPTION_FLAG_REVERSE,
 				G_OPTION_ARG_NONE, &option_detach,
 				"Don't run as daemon in background" },
+	{ "sync-interval", 0, 0, G_OPTION_ARG_INT, &option_sync_interval,
+				"Seconds to hold back settings writes, "
+				"0 writes immediately", "SECONDS" },
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
 				"Show version information and exit" },
 	{ NULL },
@@ -215,6 +220,9 @@ int main(int argc, char **argv)
 
 	__ofono_log_init(argv[0], option_debug, option_detach);
 
+	if (option_sync_interval >= 0)
+		storage_set_sync_interval(option_sync_interval);
+
 	dbus_error_init(&error);
 
 	conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, OFONO_SERVICE, &error);
@@ -252,6 +260,9 @@ int main(int argc, char **argv)
 
 	__ofono_modemwatch_cleanup();
 
+	storage_flush();
+	DBG("%u settings writes coalesced", storage_get_coalesced_writes());
+
 	__ofono_dbus_cleanup();
 	dbus_connection_unref(conn);
 
@@ -29,6 +29,9 @@
 
 #include "ofono.h"
 
+/* Clients that asked for PropertiesChanged, sender => disconnect watch */
+static GHashTable *batch_listeners;
+
 static void append_modem(struct ofono_modem *modem, void *userdata)
 {
 	DBusMessageIter *array = userdata;
@@ -80,10 +83,72 @@ static DBusMessage *manager_get_modems(DBusConnection *conn,
 	return reply;
 }
 
+static void batch_listener_exit(DBusConnection *conn, void *user_data)
+{
+	char *sender = user_data;
+
+	DBG("%s", sender);
+
+	/* gdbus drops the watch itself once this returns */
+	g_hash_table_steal(batch_listeners, sender);
+	__ofono_dbus_batch_listener_remove();
+
+	g_free(sender);
+}
+
+static void batch_listener_free(gpointer data)
+{
+	DBusConnection *conn = ofono_dbus_get_connection();
+	guint watch = GPOINTER_TO_UINT(data);
+
+	g_dbus_remove_watch(conn, watch);
+	__ofono_dbus_batch_listener_remove();
+}
+
+static DBusMessage *manager_enable_properties_changed(DBusConnection *conn,
+						DBusMessage *msg, void *data)
+{
+	const char *sender = dbus_message_get_sender(msg);
+	char *key;
+	guint watch;
+
+	if (g_hash_table_lookup_extended(batch_listeners, sender,
+						NULL, NULL) == TRUE)
+		return __ofono_error_in_use(msg);
+
+	key = g_strdup(sender);
+	watch = g_dbus_add_disconnect_watch(conn, sender, batch_listener_exit,
+								key, NULL);
+	if (watch == 0) {
+		g_free(key);
+		return __ofono_error_failed(msg);
+	}
+
+	g_hash_table_insert(batch_listeners, key, GUINT_TO_POINTER(watch));
+	__ofono_dbus_batch_listener_add();
+
+	return dbus_message_new_method_return(msg);
+}
+
+static DBusMessage *manager_disable_properties_changed(DBusConnection *conn,
+						DBusMessage *msg, void *data)
+{
+	const char *sender = dbus_message_get_sender(msg);
+
+	if (g_hash_table_remove(batch_listeners, sender) == FALSE)
+		return __ofono_error_not_found(msg);
+
+	return dbus_message_new_method_return(msg);
+}
+
 static const GDBusMethodTable manager_methods[] = {
 	{ GDBUS_METHOD("GetModems",
 				NULL, GDBUS_ARGS({ "modems", "a(oa{sv})" }),
 				manager_get_modems) },
+	{ GDBUS_METHOD("EnablePropertiesChanged", NULL, NULL,
+				manager_enable_properties_changed) },
+	{ GDBUS_METHOD("DisablePropertiesChanged", NULL, NULL,
+				manager_disable_properties_changed) },
 	{ }
 };
 
@@ -108,6 +173,9 @@ int __ofono_manager_init(void)
 	if (ret == FALSE)
 		return -1;
 
+	batch_listeners = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, batch_listener_free);
+
 	return 0;
 }
 
@@ -115,6 +183,9 @@ void __ofono_manager_cleanup(void)
 {
 	DBusConnection *conn = ofono_dbus_get_connection();
 
+	g_hash_table_destroy(batch_listeners);
+	batch_listeners = NULL;
+
 	g_dbus_unregister_interface(conn, OFONO_MANAGER_PATH,
 					OFONO_MANAGER_INTERFACE);
 }
@@ -33,6 +33,7 @@
 #include "ofono.h"
 
 #include "common.h"
+#include "storage.h"
 
 static GSList *g_devinfo_drivers = NULL;
 static GSList *g_driver_list = NULL;
@@ -507,6 +508,7 @@ static void modem_change_state(struct ofono_modem *modem,
 	switch (new_state) {
 	case MODEM_STATE_POWER_OFF:
 		modem->call_ids = 0;
+		storage_flush();
 		break;
 
 	case MODEM_STATE_PRE_SIM:
@@ -853,6 +855,10 @@ static DBusMessage *modem_get_properties(DBusConnection *conn,
 	DBusMessageIter iter;
 	DBusMessageIter dict;
 
+	reply = __ofono_dbus_cached_reply(msg);
+	if (reply != NULL)
+		return reply;
+
 	reply = dbus_message_new_method_return(msg);
 	if (reply == NULL)
 		return NULL;
@@ -865,7 +871,7 @@ static DBusMessage *modem_get_properties(DBusConnection *conn,
 	__ofono_modem_append_properties(modem, &dict);
 	dbus_message_iter_close_container(&iter, &dict);
 
-	return reply;
+	return __ofono_dbus_cache_reply(msg, reply, FALSE);
 }
 
 static int set_powered(struct ofono_modem *modem, ofono_bool_t powered)
@@ -1656,6 +1662,10 @@ static void devinfo_unregister(struct ofono_atom *atom)
 
 	g_free(info->svn);
 	info->svn = NULL;
+
+	/* The modem properties no longer include the device information */
+	__ofono_dbus_invalidate_reply(__ofono_atom_get_path(atom),
+						OFONO_MODEM_INTERFACE);
 }
 
 void ofono_devinfo_register(struct ofono_devinfo *info)
@@ -2115,6 +2125,7 @@ static void modem_unregister(struct ofono_modem *modem)
 					&modem->lockdown);
 	}
 
+	__ofono_dbus_invalidate_reply(modem->path, NULL);
 	g_dbus_unregister_interface(conn, modem->path, OFONO_MODEM_INTERFACE);
 
 	if (modem->driver && modem->driver->remove)
@@ -787,6 +787,10 @@ static DBusMessage *network_get_properties(DBusConnection *conn,
 	const char *operator;
 	const char *mode = registration_mode_to_string(netreg->mode);
 
+	reply = __ofono_dbus_cached_reply(msg);
+	if (reply != NULL)
+		return reply;
+
 	reply = dbus_message_new_method_return(msg);
 	if (reply == NULL)
 		return NULL;
@@ -850,7 +854,7 @@ static DBusMessage *network_get_properties(DBusConnection *conn,
 
 	dbus_message_iter_close_container(&iter, &dict);
 
-	return reply;
+	return __ofono_dbus_cache_reply(msg, reply, FALSE);
 }
 
 static DBusMessage *network_register(DBusConnection *conn,
@@ -1826,6 +1830,8 @@ static void netreg_unregister(struct ofono_atom *atom)
 
 	netreg->sim = NULL;
 
+	__ofono_dbus_invalidate_reply(path,
+					OFONO_NETWORK_REGISTRATION_INTERFACE);
 	g_dbus_unregister_interface(conn, path,
 					OFONO_NETWORK_REGISTRATION_INTERFACE);
 	ofono_modem_remove_interface(modem,
@@ -48,6 +48,14 @@ void __ofono_log_enable(struct ofono_debug_desc *start,
 int __ofono_dbus_init(DBusConnection *conn);
 void __ofono_dbus_cleanup(void);
 
+void __ofono_dbus_batch_listener_add(void);
+void __ofono_dbus_batch_listener_remove(void);
+
+DBusMessage *__ofono_dbus_cached_reply(DBusMessage *msg);
+DBusMessage *__ofono_dbus_cache_reply(DBusMessage *msg, DBusMessage *reply,
+							gboolean children);
+void __ofono_dbus_invalidate_reply(const char *path, const char *interface);
+
 DBusMessage *__ofono_error_invalid_args(DBusMessage *msg);
 DBusMessage *__ofono_error_invalid_format(DBusMessage *msg);
 DBusMessage *__ofono_error_not_implemented(DBusMessage *msg);
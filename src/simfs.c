@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/mman.h>
 
 #include "ofono.h"
 
@@ -81,16 +82,93 @@ static void sim_fs_op_free(gpointer pointer)
 	g_free(node);
 }
 
+/*
+ * A cached EF, mapped for the lifetime of the sim_fs.  The mapping
+ * covers the header followed by the whole EF body, so reads from and
+ * writes to the cache are plain memory accesses.
+ */
+struct sim_fs_cache_entry {
+	unsigned char *map;
+	size_t size;
+};
+
 struct sim_fs {
 	GQueue *op_q;
 	gint op_source;
-	unsigned char bitmap[32];
-	int fd;
+	GHashTable *cache;		/* cache file path -> entry */
+	struct sim_fs_cache_entry *cached;	/* EF of the current op */
 	struct ofono_sim *sim;
 	const struct ofono_sim_driver *driver;
 	GSList *contexts;
 };
 
+static void sim_fs_cache_entry_free(gpointer data)
+{
+	struct sim_fs_cache_entry *entry = data;
+
+	munmap(entry->map, entry->size);
+	g_free(entry);
+}
+
+/* Maps an open cache file, growing it to hold the whole EF if needed */
+static struct sim_fs_cache_entry *sim_fs_cache_map(int fd)
+{
+	struct sim_fs_cache_entry *entry;
+	unsigned char fileinfo[SIM_CACHE_HEADER_SIZE];
+	struct stat st;
+	size_t size;
+	void *map;
+
+	if (TFR(pread(fd, fileinfo, SIM_CACHE_HEADER_SIZE, 0)) !=
+			SIM_CACHE_HEADER_SIZE)
+		return NULL;
+
+	size = SIM_CACHE_HEADER_SIZE + ((fileinfo[1] << 8) | fileinfo[2]);
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	/* Blocks past the end were never cached, their bits are clear */
+	if ((size_t) st.st_size < size && ftruncate(fd, size) < 0)
+		return NULL;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	entry = g_new0(struct sim_fs_cache_entry, 1);
+	entry->map = map;
+	entry->size = size;
+
+	return entry;
+}
+
+static void sim_fs_cache_remove(struct sim_fs *fs, const char *path)
+{
+	struct sim_fs_cache_entry *entry;
+
+	entry = g_hash_table_lookup(fs->cache, path);
+	if (entry == NULL)
+		return;
+
+	if (fs->cached == entry)
+		fs->cached = NULL;
+
+	g_hash_table_remove(fs->cache, path);
+}
+
+static gboolean sim_fs_cache_has_block(struct sim_fs_cache_entry *entry,
+					int block)
+{
+	const unsigned char *bitmap = entry->map + SIM_FILE_INFO_SIZE;
+
+	if (block < 0 || block >= (SIM_CACHE_HEADER_SIZE -
+					SIM_FILE_INFO_SIZE) * 8)
+		return FALSE;
+
+	return (bitmap[block / 8] & (1 << block % 8)) != 0;
+}
+
 void sim_fs_free(struct sim_fs *fs)
 {
 	if (fs == NULL)
@@ -113,6 +191,8 @@ void sim_fs_free(struct sim_fs *fs)
 	while (fs->contexts)
 		sim_fs_context_free(fs->contexts->data);
 
+	g_hash_table_destroy(fs->cache);
+
 	g_free(fs);
 }
 
@@ -137,7 +217,8 @@ struct sim_fs *sim_fs_new(struct ofono_sim *sim,
 
 	fs->sim = sim;
 	fs->driver = driver;
-	fs->fd = -1;
+	fs->cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, sim_fs_cache_entry_free);
 
 	return fs;
 }
@@ -244,12 +325,7 @@ static void sim_fs_end_current(struct sim_fs *fs)
 	if (g_queue_get_length(fs->op_q) > 0)
 		fs->op_source = g_idle_add(sim_fs_op_next, fs);
 
-	if (fs->fd != -1) {
-		TFR(close(fs->fd));
-		fs->fd = -1;
-	}
-
-	memset(fs->bitmap, 0, sizeof(fs->bitmap));
+	fs->cached = NULL;
 
 	sim_fs_op_free(op);
 }
@@ -279,39 +355,23 @@ static void sim_fs_op_error(struct sim_fs *fs)
 static gboolean cache_block(struct sim_fs *fs, int block, int block_len,
 				const unsigned char *data, int num_bytes)
 {
-	int offset;
-	int bit;
-	ssize_t r;
-	unsigned char b;
+	struct sim_fs_cache_entry *entry = fs->cached;
+	size_t start = SIM_CACHE_HEADER_SIZE + (size_t) block * block_len;
 
-	if (fs->fd == -1)
+	if (entry == NULL)
 		return FALSE;
 
-	if (lseek(fs->fd, block * block_len +
-				SIM_CACHE_HEADER_SIZE, SEEK_SET) == (off_t) -1)
+	if (block >= (SIM_CACHE_HEADER_SIZE - SIM_FILE_INFO_SIZE) * 8)
 		return FALSE;
 
-	r = TFR(write(fs->fd, data, num_bytes));
-
-	if (r != num_bytes)
+	if (num_bytes < 0 || start + num_bytes > entry->size)
 		return FALSE;
 
-	/* update present bit for this block */
-	offset = block / 8;
-	bit = block % 8;
-
-	/* lseek to correct byte (skip file info) */
-	lseek(fs->fd, offset + SIM_FILE_INFO_SIZE, SEEK_SET);
-
-	b = fs->bitmap[offset];
-	b |= 1 << bit;
-
-	r = TFR(write(fs->fd, &b, sizeof(b)));
+	/* Only the pages holding the block and the bitmap get dirty */
+	memcpy(entry->map + start, data, num_bytes);
 
-	if (r != sizeof(b))
-		return FALSE;
-
-	fs->bitmap[offset] = b;
+	/* update present bit for this block */
+	entry->map[SIM_FILE_INFO_SIZE + block / 8] |= 1 << block % 8;
 
 	return TRUE;
 }
@@ -419,14 +479,12 @@ static gboolean sim_fs_op_read_block(gpointer user_data)
 		}
 	}
 
-	while (fs->fd != -1 && op->current <= end_block) {
-		int offset = op->current / 8;
-		int bit = 1 << op->current % 8;
+	while (fs->cached != NULL && op->current <= end_block) {
 		int bufoff;
 		int seekoff;
 		int toread;
 
-		if ((fs->bitmap[offset] & bit) == 0)
+		if (sim_fs_cache_has_block(fs->cached, op->current) == FALSE)
 			break;
 
 		if (op->current == start_block) {
@@ -445,11 +503,10 @@ static gboolean sim_fs_op_read_block(gpointer user_data)
 		DBG("bufoff: %d, seekoff: %d, toread: %d",
 				bufoff, seekoff, toread);
 
-		if (lseek(fs->fd, seekoff, SEEK_SET) == (off_t) -1)
+		if (seekoff + toread > (int) fs->cached->size)
 			break;
 
-		if (TFR(read(fs->fd, op->buffer + bufoff, toread)) != toread)
-			break;
+		memcpy(op->buffer + bufoff, fs->cached->map + seekoff, toread);
 
 		op->current += 1;
 	}
@@ -528,21 +585,24 @@ static gboolean sim_fs_op_read_record(gpointer user)
 		return FALSE;
 	}
 
-	while (fs->fd != -1 && op->current <= total) {
-		int offset = (op->current - 1) / 8;
-		int bit = 1 << ((op->current - 1) % 8);
+	while (fs->cached != NULL && op->current <= total) {
 		ofono_sim_file_read_cb_t cb = op->cb;
+		size_t seekoff = SIM_CACHE_HEADER_SIZE +
+				(size_t) (op->current - 1) * op->record_length;
 
-		if ((fs->bitmap[offset] & bit) == 0)
+		if (sim_fs_cache_has_block(fs->cached,
+						op->current - 1) == FALSE)
 			break;
 
-		if (lseek(fs->fd, (op->current - 1) * op->record_length +
-				SIM_CACHE_HEADER_SIZE, SEEK_SET) == (off_t) -1)
+		if (op->record_length > (int) sizeof(buf) ||
+				seekoff + op->record_length > fs->cached->size)
 			break;
 
-		if (TFR(read(fs->fd, buf, op->record_length)) !=
-				op->record_length)
-			break;
+		/*
+		 * The callback may flush the cache, so don't hand out
+		 * pointers into the mapping
+		 */
+		memcpy(buf, fs->cached->map + seekoff, op->record_length);
 
 		cb(1, op->length, op->current,
 				buf, op->record_length, op->userdata);
@@ -603,6 +663,7 @@ static void sim_fs_op_cache_fileinfo(struct sim_fs *fs,
 	unsigned char fileinfo[SIM_CACHE_HEADER_SIZE];
 	gboolean cache;
 	char *path;
+	int fd;
 
 	/* TS 11.11, Section 9.3 */
 	update = file_access_condition_decode(access[0] & 0xf);
@@ -631,18 +692,25 @@ static void sim_fs_op_cache_fileinfo(struct sim_fs *fs,
 	fileinfo[6] = file_status;
 
 	path = g_strdup_printf(SIM_CACHE_PATH, imsi, phase, op->id);
-	fs->fd = TFR(open(path, O_WRONLY | O_CREAT | O_TRUNC, SIM_CACHE_MODE));
-	g_free(path);
+	sim_fs_cache_remove(fs, path);
 
-	if (fs->fd == -1)
-		return;
+	fd = TFR(open(path, O_RDWR | O_CREAT | O_TRUNC, SIM_CACHE_MODE));
+	if (fd == -1)
+		goto out;
 
-	if (TFR(write(fs->fd, fileinfo, SIM_CACHE_HEADER_SIZE)) ==
+	if (TFR(write(fd, fileinfo, SIM_CACHE_HEADER_SIZE)) ==
 			SIM_CACHE_HEADER_SIZE)
+		fs->cached = sim_fs_cache_map(fd);
+
+	TFR(close(fd));
+
+	if (fs->cached != NULL) {
+		g_hash_table_insert(fs->cache, path, fs->cached);
 		return;
+	}
 
-	TFR(close(fs->fd));
-	fs->fd = -1;
+out:
+	g_free(path);
 }
 
 static void sim_fs_op_info_cb(const struct ofono_error *error, int length,
@@ -709,45 +777,69 @@ static void sim_fs_op_info_cb(const struct ofono_error *error, int length,
 	}
 }
 
-static gboolean sim_fs_op_check_cached(struct sim_fs *fs)
+static struct sim_fs_cache_entry *sim_fs_cache_lookup(struct sim_fs *fs,
+							const char *imsi,
+							enum ofono_sim_phase phase,
+							int id)
 {
-	const char *imsi = ofono_sim_get_imsi(fs->sim);
-	enum ofono_sim_phase phase = ofono_sim_get_phase(fs->sim);
-	struct sim_fs_op *op = g_queue_peek_head(fs->op_q);
+	struct sim_fs_cache_entry *entry;
 	char *path;
 	int fd;
-	ssize_t len;
-	unsigned char fileinfo[SIM_CACHE_HEADER_SIZE];
-	int error_type;
-	int file_length;
-	enum ofono_sim_file_structure structure;
-	int record_length;
-	unsigned char file_status;
 
-	if (imsi == NULL || phase == OFONO_SIM_PHASE_UNKNOWN)
-		return FALSE;
-
-	path = g_strdup_printf(SIM_CACHE_PATH, imsi, phase, op->id);
+	path = g_strdup_printf(SIM_CACHE_PATH, imsi, phase, id);
 
-	if (path == NULL)
-		return FALSE;
+	entry = g_hash_table_lookup(fs->cache, path);
+	if (entry != NULL) {
+		g_free(path);
+		return entry;
+	}
 
 	fd = TFR(open(path, O_RDWR));
-	g_free(path);
 
 	if (fd == -1) {
 		if (errno != ENOENT)
 			DBG("Error %i opening cache file for "
 					"fileid %04x, IMSI %s",
-					errno, op->id, imsi);
+					errno, id, imsi);
 
-		return FALSE;
+		g_free(path);
+		return NULL;
+	}
+
+	entry = sim_fs_cache_map(fd);
+	TFR(close(fd));
+
+	if (entry == NULL) {
+		g_free(path);
+		return NULL;
 	}
 
-	len = TFR(read(fd, fileinfo, SIM_CACHE_HEADER_SIZE));
+	g_hash_table_insert(fs->cache, path, entry);
 
-	if (len != SIM_CACHE_HEADER_SIZE)
-		goto error;
+	return entry;
+}
+
+static gboolean sim_fs_op_check_cached(struct sim_fs *fs)
+{
+	const char *imsi = ofono_sim_get_imsi(fs->sim);
+	enum ofono_sim_phase phase = ofono_sim_get_phase(fs->sim);
+	struct sim_fs_op *op = g_queue_peek_head(fs->op_q);
+	struct sim_fs_cache_entry *entry;
+	const unsigned char *fileinfo;
+	int error_type;
+	int file_length;
+	enum ofono_sim_file_structure structure;
+	int record_length;
+	unsigned char file_status;
+
+	if (imsi == NULL || phase == OFONO_SIM_PHASE_UNKNOWN)
+		return FALSE;
+
+	entry = sim_fs_cache_lookup(fs, imsi, phase, op->id);
+	if (entry == NULL)
+		return FALSE;
+
+	fileinfo = entry->map;
 
 	error_type = fileinfo[0];
 	file_length = (fileinfo[1] << 8) | fileinfo[2];
@@ -759,13 +851,11 @@ static gboolean sim_fs_op_check_cached(struct sim_fs *fs)
 		record_length = file_length;
 
 	if (record_length == 0 || file_length < record_length)
-		goto error;
+		return FALSE;
 
 	op->length = file_length;
 	op->record_length = record_length;
-	memcpy(fs->bitmap, fileinfo + SIM_FILE_INFO_SIZE,
-			SIM_CACHE_HEADER_SIZE - SIM_FILE_INFO_SIZE);
-	fs->fd = fd;
+	fs->cached = entry;
 
 	if (error_type != OFONO_ERROR_TYPE_NO_ERROR ||
 			structure != op->structure) {
@@ -796,10 +886,6 @@ static gboolean sim_fs_op_check_cached(struct sim_fs *fs)
 	}
 
 	return TRUE;
-
-error:
-	TFR(close(fd));
-	return FALSE;
 }
 
 static gboolean sim_fs_op_next(gpointer user_data)
@@ -1134,6 +1220,9 @@ void sim_fs_cache_flush(struct sim_fs *fs)
 
 	g_free(path);
 
+	fs->cached = NULL;
+	g_hash_table_remove_all(fs->cache);
+
 	if (len > 0) {
 		/* Remove all file ids */
 		while (len--) {
@@ -1153,6 +1242,7 @@ void sim_fs_cache_flush_file(struct sim_fs *fs, int id)
 	enum ofono_sim_phase phase = ofono_sim_get_phase(fs->sim);
 	char *path = g_strdup_printf(SIM_CACHE_PATH, imsi, phase, id);
 
+	sim_fs_cache_remove(fs, path);
 	remove(path);
 	g_free(path);
 }
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -41,16 +42,6 @@
 #define uninitialized_var(x) x = x
 
 #define SMS_BACKUP_MODE 0600
-#define SMS_BACKUP_PATH STORAGEDIR "/%s/sms_assembly"
-#define SMS_BACKUP_PATH_DIR SMS_BACKUP_PATH "/%s-%i-%i"
-#define SMS_BACKUP_PATH_FILE SMS_BACKUP_PATH_DIR "/%03i"
-
-#define SMS_SR_BACKUP_PATH STORAGEDIR "/%s/sms_sr"
-#define SMS_SR_BACKUP_PATH_FILE SMS_SR_BACKUP_PATH "/%s-%s"
-
-#define SMS_TX_BACKUP_PATH STORAGEDIR "/%s/tx_queue"
-#define SMS_TX_BACKUP_PATH_DIR SMS_TX_BACKUP_PATH "/%lu-%lu-%s"
-#define SMS_TX_BACKUP_PATH_FILE SMS_TX_BACKUP_PATH_DIR "/%03i"
 
 #define SMS_ADDR_FMT "%24[0-9A-F]"
 #define SMS_MSGID_FMT "%40[0-9A-F]"
@@ -2373,79 +2364,515 @@ gboolean sms_address_to_hex_string(const struct sms_address *in, char *straddr)
 	return TRUE;
 }
 
+/*
+ * All SMS backups of a SIM live in a single append-only journal.  Each
+ * record either stores the contents of a backup entry or removes one.
+ * The entries are named after the files of the old one-file-per-PDU
+ * layout, relative to the IMSI directory.  The live entries are kept
+ * in memory, and the journal is rewritten when it contains more dead
+ * records than live ones.
+ */
+#define SMS_JOURNAL_PATH STORAGEDIR "/%s/sms_journal"
+#define SMS_JOURNAL_COMPACT_MIN (32 * 1024)
+
+#define SMS_BACKUP_KEY "sms_assembly/%s-%i-%i/%03i"
+#define SMS_SR_BACKUP_KEY "sms_sr/%s-%s"
+#define SMS_TX_BACKUP_KEY_DIR "tx_queue/%lu-%lu-%s"
+#define SMS_TX_BACKUP_KEY SMS_TX_BACKUP_KEY_DIR "/%03i"
+
+enum sms_journal_op {
+	SMS_JOURNAL_OP_PUT =	1,
+	SMS_JOURNAL_OP_REMOVE =	2,
+};
+
+struct sms_journal_header {
+	guint32 checksum;
+	guint32 data_len;
+	gint64 mtime;
+	guint16 key_len;
+	guint8 op;
+	guint8 reserved[5];
+};
+
+struct sms_journal_entry {
+	time_t mtime;
+	gsize len;
+	unsigned char data[];
+};
+
+struct sms_journal {
+	char *imsi;
+	char *path;
+	int fd;
+	int refcount;
+	GHashTable *entries;
+	gsize size;
+	gsize live;
+	gboolean tx_held;		/* Reference held by the tx queue */
+};
+
+static GHashTable *sms_journals;
+
+static gsize sms_journal_record_size(const char *key, gsize len)
+{
+	return sizeof(struct sms_journal_header) + strlen(key) + len;
+}
+
+static guint32 sms_journal_checksum(const struct sms_journal_header *hdr,
+					const char *key,
+					const unsigned char *data)
+{
+	const unsigned char *p = (const unsigned char *) hdr;
+	guint32 hash = 2166136261U;
+	gsize i;
+
+	/* FNV-1a over everything following the checksum itself */
+	for (i = sizeof(hdr->checksum); i < sizeof(*hdr); i++)
+		hash = (hash ^ p[i]) * 16777619U;
+
+	for (i = 0; i < hdr->key_len; i++)
+		hash = (hash ^ (unsigned char) key[i]) * 16777619U;
+
+	for (i = 0; i < hdr->data_len; i++)
+		hash = (hash ^ data[i]) * 16777619U;
+
+	return hash;
+}
+
+static void sms_journal_apply(struct sms_journal *journal,
+				enum sms_journal_op op, const char *key,
+				const unsigned char *data, gsize len,
+				time_t mtime)
+{
+	struct sms_journal_entry *entry;
+
+	entry = g_hash_table_lookup(journal->entries, key);
+	if (entry != NULL) {
+		journal->live -= sms_journal_record_size(key, entry->len);
+		g_hash_table_remove(journal->entries, key);
+	}
+
+	if (op != SMS_JOURNAL_OP_PUT)
+		return;
+
+	entry = g_malloc(sizeof(*entry) + len);
+	entry->mtime = mtime;
+	entry->len = len;
+
+	if (len > 0)
+		memcpy(entry->data, data, len);
+
+	g_hash_table_insert(journal->entries, g_strdup(key), entry);
+	journal->live += sms_journal_record_size(key, len);
+}
+
+static unsigned char *sms_journal_record(enum sms_journal_op op,
+						const char *key,
+						const unsigned char *data,
+						gsize len, time_t mtime,
+						gsize *out_size)
+{
+	struct sms_journal_header hdr;
+	gsize key_len = strlen(key);
+	unsigned char *record;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.data_len = len;
+	hdr.mtime = mtime;
+	hdr.key_len = key_len;
+	hdr.op = op;
+	hdr.checksum = sms_journal_checksum(&hdr, key, data);
+
+	*out_size = sizeof(hdr) + key_len + len;
+	record = g_malloc(*out_size);
+
+	memcpy(record, &hdr, sizeof(hdr));
+	memcpy(record + sizeof(hdr), key, key_len);
+
+	if (len > 0)
+		memcpy(record + sizeof(hdr) + key_len, data, len);
+
+	return record;
+}
+
+static int sms_journal_reopen(struct sms_journal *journal)
+{
+	if (journal->fd >= 0)
+		TFR(close(journal->fd));
+
+	journal->fd = TFR(open(journal->path, O_WRONLY | O_APPEND | O_CREAT,
+				SMS_BACKUP_MODE));
+
+	return journal->fd;
+}
+
+/*
+ * Writes the live entries to a new file and renames it over the
+ * journal, a crash in between leaves the old journal in place.
+ */
+static void sms_journal_compact(struct sms_journal *journal)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	char *tmp_path;
+	gsize written = 0;
+	int fd;
+
+	tmp_path = g_strdup_printf("%s.tmp", journal->path);
+
+	fd = TFR(open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC,
+			SMS_BACKUP_MODE));
+	if (fd < 0)
+		goto out;
+
+	g_hash_table_iter_init(&iter, journal->entries);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct sms_journal_entry *entry = value;
+		unsigned char *record;
+		gsize size;
+		ssize_t r;
+
+		record = sms_journal_record(SMS_JOURNAL_OP_PUT, key,
+						entry->data, entry->len,
+						entry->mtime, &size);
+		r = TFR(write(fd, record, size));
+		g_free(record);
+
+		if (r != (ssize_t) size)
+			goto error;
+
+		written += size;
+	}
+
+	if (fdatasync(fd) < 0)
+		goto error;
+
+	TFR(close(fd));
+
+	if (rename(tmp_path, journal->path) < 0) {
+		unlink(tmp_path);
+		goto out;
+	}
+
+	journal->size = written;
+	sms_journal_reopen(journal);
+	goto out;
+
+error:
+	TFR(close(fd));
+	unlink(tmp_path);
+out:
+	g_free(tmp_path);
+}
+
+static void sms_journal_maybe_compact(struct sms_journal *journal)
+{
+	gsize dead = journal->size - journal->live;
+
+	if (dead < SMS_JOURNAL_COMPACT_MIN || dead < journal->live)
+		return;
+
+	sms_journal_compact(journal);
+}
+
+static gboolean sms_journal_append(struct sms_journal *journal,
+					enum sms_journal_op op,
+					const char *key,
+					const unsigned char *data, gsize len,
+					time_t mtime)
+{
+	unsigned char *record;
+	gsize size;
+	ssize_t r;
+
+	if (journal->fd < 0)
+		return FALSE;
+
+	record = sms_journal_record(op, key, data, len, mtime, &size);
+	r = TFR(write(journal->fd, record, size));
+	g_free(record);
+
+	if (r != (ssize_t) size) {
+		/* Don't leave a torn record for the next append to follow */
+		if (r > 0 && ftruncate(journal->fd, journal->size) < 0)
+			sms_journal_reopen(journal);
+
+		return FALSE;
+	}
+
+	journal->size += size;
+	sms_journal_apply(journal, op, key, data, len, mtime);
+	sms_journal_maybe_compact(journal);
+
+	return TRUE;
+}
+
+static gboolean sms_journal_put(struct sms_journal *journal, const char *key,
+				const unsigned char *data, gsize len)
+{
+	return sms_journal_append(journal, SMS_JOURNAL_OP_PUT, key, data, len,
+					time(NULL));
+}
+
+static void sms_journal_remove(struct sms_journal *journal, const char *key)
+{
+	if (g_hash_table_lookup(journal->entries, key) == NULL)
+		return;
+
+	sms_journal_append(journal, SMS_JOURNAL_OP_REMOVE, key, NULL, 0, 0);
+}
+
+static void sms_journal_replay(struct sms_journal *journal)
+{
+	struct sms_journal_header hdr;
+	gchar *contents;
+	gsize length;
+	gsize offset = 0;
+
+	if (g_file_get_contents(journal->path, &contents, &length,
+					NULL) == FALSE)
+		return;
+
+	while (length - offset >= sizeof(hdr)) {
+		const char *key;
+		const unsigned char *data;
+		char *keydup;
+
+		memcpy(&hdr, contents + offset, sizeof(hdr));
+
+		if (hdr.op != SMS_JOURNAL_OP_PUT &&
+				hdr.op != SMS_JOURNAL_OP_REMOVE)
+			break;
+
+		if (hdr.key_len == 0 || length - offset - sizeof(hdr) <
+				(gsize) hdr.key_len + hdr.data_len)
+			break;
+
+		key = contents + offset + sizeof(hdr);
+		data = (const unsigned char *) key + hdr.key_len;
+
+		if (sms_journal_checksum(&hdr, key, data) != hdr.checksum)
+			break;
+
+		if (memchr(key, '\0', hdr.key_len) != NULL)
+			break;
+
+		keydup = g_strndup(key, hdr.key_len);
+		sms_journal_apply(journal, hdr.op, keydup, data, hdr.data_len,
+					hdr.mtime);
+		g_free(keydup);
+
+		offset += sizeof(hdr) + hdr.key_len + hdr.data_len;
+	}
+
+	/* Drop whatever a crash left half written at the end */
+	if (offset < length && truncate(journal->path, offset) < 0)
+		offset = length;
+
+	journal->size = offset;
+
+	g_free(contents);
+}
+
+/*
+ * Imports the files of the one-file-per-PDU layout below @dir, relative
+ * to @base, and removes each of them once it is in the journal.  Temporary
+ * files of writes that never completed are removed without importing.
+ */
+static void sms_journal_migrate_dir(struct sms_journal *journal,
+					const char *base, const char *dir)
+{
+	struct dirent **entries;
+	char *path;
+	int len;
+	int i;
+
+	path = g_strdup_printf("%s/%s", base, dir);
+	len = scandir(path, &entries, NULL, versionsort);
+
+	if (len < 0) {
+		g_free(path);
+		return;
+	}
+
+	for (i = 0; i < len; i++) {
+		struct dirent *dent = entries[i];
+		char *key = g_strdup_printf("%s/%s", dir, dent->d_name);
+		char *file = g_strdup_printf("%s/%s", base, key);
+		unsigned char buf[177];
+		struct stat st;
+		ssize_t r;
+
+		if (dent->d_type == DT_DIR && strcmp(dent->d_name, ".") &&
+				strcmp(dent->d_name, ".."))
+			sms_journal_migrate_dir(journal, base, key);
+		else if (dent->d_type == DT_REG &&
+				g_str_has_suffix(dent->d_name, ".tmp"))
+			/* Left behind by an interrupted write_file() */
+			unlink(file);
+		else if (dent->d_type == DT_REG && stat(file, &st) == 0) {
+			r = read_file(buf, sizeof(buf), "%s", file);
+
+			if (r >= 0 && sms_journal_append(journal,
+						SMS_JOURNAL_OP_PUT, key,
+						buf, r, st.st_mtime) == TRUE)
+				unlink(file);
+		}
+
+		g_free(file);
+		g_free(key);
+		free(dent);
+	}
+
+	free(entries);
+
+	rmdir(path);
+	g_free(path);
+}
+
+static void sms_journal_migrate(struct sms_journal *journal)
+{
+	char *base = g_strdup_printf(STORAGEDIR "/%s", journal->imsi);
+
+	sms_journal_migrate_dir(journal, base, "sms_assembly");
+	sms_journal_migrate_dir(journal, base, "sms_sr");
+	sms_journal_migrate_dir(journal, base, "tx_queue");
+
+	g_free(base);
+}
+
+static struct sms_journal *sms_journal_ref(const char *imsi)
+{
+	struct sms_journal *journal;
+
+	if (imsi == NULL)
+		return NULL;
+
+	if (sms_journals == NULL)
+		sms_journals = g_hash_table_new(g_str_hash, g_str_equal);
+
+	journal = g_hash_table_lookup(sms_journals, imsi);
+	if (journal != NULL) {
+		journal->refcount += 1;
+		return journal;
+	}
+
+	journal = g_new0(struct sms_journal, 1);
+	journal->imsi = g_strdup(imsi);
+	journal->path = g_strdup_printf(SMS_JOURNAL_PATH, imsi);
+	journal->fd = -1;
+	journal->refcount = 1;
+	journal->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, g_free);
+
+	g_hash_table_insert(sms_journals, journal->imsi, journal);
+
+	if (create_dirs(journal->path, SMS_BACKUP_MODE | S_IXUSR) != 0)
+		return journal;
+
+	sms_journal_replay(journal);
+
+	if (sms_journal_reopen(journal) < 0)
+		return journal;
+
+	sms_journal_migrate(journal);
+	sms_journal_maybe_compact(journal);
+
+	return journal;
+}
+
+static void sms_journal_unref(struct sms_journal *journal)
+{
+	if (journal == NULL)
+		return;
+
+	if (--journal->refcount > 0)
+		return;
+
+	g_hash_table_remove(sms_journals, journal->imsi);
+
+	if (g_hash_table_size(sms_journals) == 0) {
+		g_hash_table_destroy(sms_journals);
+		sms_journals = NULL;
+	}
+
+	if (journal->fd >= 0)
+		TFR(close(journal->fd));
+
+	g_hash_table_destroy(journal->entries);
+	g_free(journal->path);
+	g_free(journal->imsi);
+	g_free(journal);
+}
+
+static int sms_journal_key_compare(gconstpointer a, gconstpointer b)
+{
+	return strverscmp(a, b);
+}
+
+/* Returns copies of the live keys starting with @prefix, in version order */
+static GSList *sms_journal_list(struct sms_journal *journal,
+				const char *prefix)
+{
+	GHashTableIter iter;
+	gpointer key;
+	GSList *keys = NULL;
+
+	g_hash_table_iter_init(&iter, journal->entries);
+
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		if (g_str_has_prefix(key, prefix))
+			keys = g_slist_prepend(keys, g_strdup(key));
+
+	return g_slist_sort(keys, sms_journal_key_compare);
+}
+
+static const struct sms_journal_entry *sms_journal_get(
+						struct sms_journal *journal,
+						const char *key)
+{
+	return g_hash_table_lookup(journal->entries, key);
+}
+
 static void sms_assembly_load(struct sms_assembly *assembly,
-				const struct dirent *dir)
+				const char *key)
 {
+	const struct sms_journal_entry *entry;
 	struct sms_address addr;
 	DECLARE_SMS_ADDR_STR(straddr);
 	guint16 ref;
 	guint8 max;
+	const char *seqstr;
 	guint8 seq;
-	char *path;
-	int len;
-	struct stat segment_stat;
-	struct dirent **segments;
 	char *endp;
-	int r;
-	int i;
-	unsigned char buf[177];
 	struct sms segment;
 
-	if (dir->d_type != DT_DIR)
-		return;
-
 	/* Max of SMS address size is 12 bytes, hex encoded */
-	if (sscanf(dir->d_name, SMS_ADDR_FMT "-%hi-%hhi",
+	if (sscanf(key, "sms_assembly/" SMS_ADDR_FMT "-%hi-%hhi",
 				straddr, &ref, &max) < 3)
 		return;
 
 	if (sms_assembly_extract_address(straddr, &addr) == FALSE)
 		return;
 
-	path = g_strdup_printf(SMS_BACKUP_PATH "/%s",
-			assembly->imsi, dir->d_name);
-	len = scandir(path, &segments, NULL, versionsort);
-	g_free(path);
+	seqstr = strrchr(key, '/') + 1;
 
-	if (len < 0)
+	seq = strtol(seqstr, &endp, 10);
+	if (seqstr == endp || *endp != '\0')
 		return;
 
-	for (i = 0; i < len; i++) {
-		if (segments[i]->d_type != DT_REG)
-			continue;
-
-		seq = strtol(segments[i]->d_name, &endp, 10);
-		if (*endp != '\0')
-			continue;
-
-		r = read_file(buf, sizeof(buf), SMS_BACKUP_PATH "/%s/%s",
-				assembly->imsi,
-				dir->d_name, segments[i]->d_name);
-		if (r < 0)
-			continue;
-
-		if (!sms_deserialize(buf, &segment, r))
-			continue;
-
-		path = g_strdup_printf(SMS_BACKUP_PATH "/%s/%s",
-				assembly->imsi,
-				dir->d_name, segments[i]->d_name);
-		r = stat(path, &segment_stat);
-		g_free(path);
+	/* Completing a message on the way removes its other fragments */
+	entry = sms_journal_get(assembly->journal, key);
+	if (entry == NULL)
+		return;
 
-		if (r != 0)
-			continue;
+	if (!sms_deserialize(entry->data, &segment, entry->len))
+		return;
 
-		/* Errors cannot occur here */
-		sms_assembly_add_fragment_backup(assembly, &segment,
-						segment_stat.st_mtime,
+	/* Errors cannot occur here */
+	sms_assembly_add_fragment_backup(assembly, &segment, entry->mtime,
 						&addr, ref, max, seq, FALSE);
-	}
-
-	for (i = 0; i < len; i++)
-		free(segments[i]);
-
-	free(segments);
 }
 
 static gboolean sms_assembly_store(struct sms_assembly *assembly,
@@ -2455,8 +2882,10 @@ static gboolean sms_assembly_store(struct sms_assembly *assembly,
 	unsigned char buf[177];
 	int len;
 	DECLARE_SMS_ADDR_STR(straddr);
+	char *key;
+	gboolean ret;
 
-	if (assembly->imsi == NULL)
+	if (assembly->journal == NULL)
 		return FALSE;
 
 	if (sms_address_to_hex_string(&node->addr, straddr) == FALSE)
@@ -2464,22 +2893,22 @@ static gboolean sms_assembly_store(struct sms_assembly *assembly,
 
 	len = sms_serialize(buf, sms);
 
-	if (write_file(buf, len, SMS_BACKUP_MODE,
-				SMS_BACKUP_PATH_FILE, assembly->imsi, straddr,
-				node->ref, node->max_fragments, seq) != len)
-		return FALSE;
+	key = g_strdup_printf(SMS_BACKUP_KEY, straddr, node->ref,
+				node->max_fragments, seq);
+	ret = sms_journal_put(assembly->journal, key, buf, len);
+	g_free(key);
 
-	return TRUE;
+	return ret;
 }
 
 static void sms_assembly_backup_free(struct sms_assembly *assembly,
 					struct sms_assembly_node *node)
 {
-	char *path;
+	char *key;
 	int seq;
 	DECLARE_SMS_ADDR_STR(straddr);
 
-	if (assembly->imsi == NULL)
+	if (assembly->journal == NULL)
 		return;
 
 	if (sms_address_to_hex_string(&node->addr, straddr) == FALSE)
@@ -2490,45 +2919,31 @@ static void sms_assembly_backup_free(struct sms_assembly *assembly,
 		int bit = 1 << (seq % 32);
 
 		if (node->bitmap[offset] & bit) {
-			path = g_strdup_printf(SMS_BACKUP_PATH_FILE,
-					assembly->imsi, straddr,
+			key = g_strdup_printf(SMS_BACKUP_KEY, straddr,
 					node->ref, node->max_fragments, seq);
-			unlink(path);
-			g_free(path);
+			sms_journal_remove(assembly->journal, key);
+			g_free(key);
 		}
 	}
-
-	path = g_strdup_printf(SMS_BACKUP_PATH_DIR, assembly->imsi, straddr,
-				node->ref, node->max_fragments);
-	rmdir(path);
-	g_free(path);
 }
 
 struct sms_assembly *sms_assembly_new(const char *imsi)
 {
 	struct sms_assembly *ret = g_new0(struct sms_assembly, 1);
-	char *path;
-	struct dirent **entries;
-	int len;
+	GSList *keys;
+	GSList *l;
 
 	if (imsi) {
 		ret->imsi = imsi;
+		ret->journal = sms_journal_ref(imsi);
 
 		/* Restore state from backup */
+		keys = sms_journal_list(ret->journal, "sms_assembly/");
 
-		path = g_strdup_printf(SMS_BACKUP_PATH, imsi);
-		len = scandir(path, &entries, NULL, alphasort);
-		g_free(path);
-
-		if (len < 0)
-			return ret;
+		for (l = keys; l; l = l->next)
+			sms_assembly_load(ret, l->data);
 
-		while (len--) {
-			sms_assembly_load(ret, entries[len]);
-			free(entries[len]);
-		}
-
-		free(entries);
+		g_slist_free_full(keys, g_free);
 	}
 
 	return ret;
@@ -2538,6 +2953,8 @@ void sms_assembly_free(struct sms_assembly *assembly)
 {
 	GSList *l;
 
+	sms_journal_unref(assembly->journal);
+
 	for (l = assembly->assembly_list; l; l = l->next) {
 		struct sms_assembly_node *node = l->data;
 
@@ -2719,32 +3136,28 @@ static guint sha1_hash(gconstpointer v)
 	return h;
 }
 
-static void sr_assembly_load_backup(GHashTable *assembly_table,
-					const char *imsi,
-					const struct dirent *addr_dir)
+static void sr_assembly_load_backup(struct status_report_assembly *assembly,
+					const char *key)
 {
+	const struct sms_journal_entry *entry;
 	struct sms_address addr;
 	DECLARE_SMS_ADDR_STR(straddr);
 	struct id_table_node *node;
 	GHashTable *id_table;
-	int r;
 	char *assembly_table_key;
 	unsigned int *id_table_key;
 	char msgid_str[SMS_MSGID_LEN * 2 + 1];
 	unsigned char msgid[SMS_MSGID_LEN];
 	char endc;
 
-	if (addr_dir->d_type != DT_REG)
-		return;
-
 	/*
 	 * All SMS-messages under the same IMSI-code are
 	 * included in the same directory.
-	 * So, SMS-address and message ID are included in the same file name
+	 * So, SMS-address and message ID are included in the same key
 	 * Max of SMS address size is 12 bytes, hex encoded
 	 * Max of SMS SHA1 hash is 20 bytes, hex encoded
 	 */
-	if (sscanf(addr_dir->d_name, SMS_ADDR_FMT "-" SMS_MSGID_FMT "%c",
+	if (sscanf(key, "sms_sr/" SMS_ADDR_FMT "-" SMS_MSGID_FMT "%c",
 				straddr, msgid_str, &endc) != 2)
 		return;
 
@@ -2758,19 +3171,12 @@ static void sr_assembly_load_backup(GHashTable *assembly_table,
 				NULL, 0, msgid) == NULL)
 		return;
 
-	node = g_new0(struct id_table_node, 1);
-
-	r = read_file((unsigned char *) node,
-			sizeof(struct id_table_node),
-			SMS_SR_BACKUP_PATH "/%s",
-			imsi, addr_dir->d_name);
+	entry = sms_journal_get(assembly->journal, key);
 
-	if (r < 0) {
-		g_free(node);
-		return;
-	}
+	node = g_new0(struct id_table_node, 1);
+	memcpy(node, entry->data, MIN(entry->len, sizeof(*node)));
 
-	id_table = g_hash_table_lookup(assembly_table,
+	id_table = g_hash_table_lookup(assembly->assembly_table,
 					sms_address_to_string(&addr));
 
 	/* Create hashtable keyed by the to address if required */
@@ -2779,8 +3185,8 @@ static void sr_assembly_load_backup(GHashTable *assembly_table,
 							g_free, g_free);
 
 		assembly_table_key = g_strdup(sms_address_to_string(&addr));
-		g_hash_table_insert(assembly_table, assembly_table_key,
-					id_table);
+		g_hash_table_insert(assembly->assembly_table,
+					assembly_table_key, id_table);
 	}
 
 	/* Node ready, create key and add them to the table */
@@ -2791,9 +3197,8 @@ static void sr_assembly_load_backup(GHashTable *assembly_table,
 
 struct status_report_assembly *status_report_assembly_new(const char *imsi)
 {
-	char *path;
-	int len;
-	struct dirent **addresses;
+	GSList *keys;
+	GSList *l;
 	struct status_report_assembly *ret =
 				g_new0(struct status_report_assembly, 1);
 
@@ -2802,43 +3207,35 @@ struct status_report_assembly *status_report_assembly_new(const char *imsi)
 
 	if (imsi) {
 		ret->imsi = imsi;
-
-		/* Restore state from backup */
-		path = g_strdup_printf(SMS_SR_BACKUP_PATH, imsi);
-		len = scandir(path, &addresses, NULL, alphasort);
-
-		g_free(path);
-
-		if (len < 0)
-			return ret;
+		ret->journal = sms_journal_ref(imsi);
 
 		/*
-		 * Go through different addresses. Each address can relate to
+		 * Restore state from backup.  Each address can relate to
 		 * 1-n msg_ids.
 		 */
+		keys = sms_journal_list(ret->journal, "sms_sr/");
 
-		while (len--) {
-			sr_assembly_load_backup(ret->assembly_table, imsi,
-								addresses[len]);
-			g_free(addresses[len]);
-		}
+		for (l = keys; l; l = l->next)
+			sr_assembly_load_backup(ret, l->data);
 
-		g_free(addresses);
+		g_slist_free_full(keys, g_free);
 	}
 
 	return ret;
 }
 
-static gboolean sr_assembly_add_fragment_backup(const char *imsi,
-					const struct id_table_node *node,
-					const struct sms_address *addr,
-					const unsigned char *msgid)
+static gboolean sr_assembly_add_fragment_backup(
+				struct status_report_assembly *assembly,
+				const struct id_table_node *node,
+				const struct sms_address *addr,
+				const unsigned char *msgid)
 {
-	int len = sizeof(struct id_table_node);
 	DECLARE_SMS_ADDR_STR(straddr);
 	char msgid_str[SMS_MSGID_LEN * 2 + 1];
+	char *key;
+	gboolean ret;
 
-	if (imsi == NULL)
+	if (assembly->journal == NULL)
 		return FALSE;
 
 	if (sms_address_to_hex_string(addr, straddr) == FALSE)
@@ -2847,24 +3244,24 @@ static gboolean sr_assembly_add_fragment_backup(const char *imsi,
 	if (encode_hex_own_buf(msgid, SMS_MSGID_LEN, 0, msgid_str) == NULL)
 		return FALSE;
 
-	/* storagedir/%s/sms_sr/%s-%s */
-	if (write_file((unsigned char *) node, len, SMS_BACKUP_MODE,
-			SMS_SR_BACKUP_PATH_FILE, imsi,
-			straddr, msgid_str) != len)
-		return FALSE;
+	key = g_strdup_printf(SMS_SR_BACKUP_KEY, straddr, msgid_str);
+	ret = sms_journal_put(assembly->journal, key,
+				(const unsigned char *) node, sizeof(*node));
+	g_free(key);
 
-	return TRUE;
+	return ret;
 }
 
-static gboolean sr_assembly_remove_fragment_backup(const char *imsi,
-					const struct sms_address *addr,
-					const unsigned char *sha1)
+static gboolean sr_assembly_remove_fragment_backup(
+				struct status_report_assembly *assembly,
+				const struct sms_address *addr,
+				const unsigned char *sha1)
 {
-	char *path;
+	char *key;
 	DECLARE_SMS_ADDR_STR(straddr);
 	char msgid_str[SMS_MSGID_LEN * 2 + 1];
 
-	if (imsi == NULL)
+	if (assembly->journal == NULL)
 		return FALSE;
 
 	if (sms_address_to_hex_string(addr, straddr) == FALSE)
@@ -2873,17 +3270,16 @@ static gboolean sr_assembly_remove_fragment_backup(const char *imsi,
 	if (encode_hex_own_buf(sha1, SMS_MSGID_LEN, 0, msgid_str) == FALSE)
 		return FALSE;
 
-	path = g_strdup_printf(SMS_SR_BACKUP_PATH_FILE,
-					imsi, straddr, msgid_str);
-
-	unlink(path);
-	g_free(path);
+	key = g_strdup_printf(SMS_SR_BACKUP_KEY, straddr, msgid_str);
+	sms_journal_remove(assembly->journal, key);
+	g_free(key);
 
 	return TRUE;
 }
 
 void status_report_assembly_free(struct status_report_assembly *assembly)
 {
+	sms_journal_unref(assembly->journal);
 	g_hash_table_destroy(assembly->assembly_table);
 	g_free(assembly);
 }
@@ -3048,8 +3444,7 @@ gboolean status_report_assembly_report(struct status_report_assembly *assembly,
 		 * More status reports expected, and already received
 		 * reports completed. Update backup file.
 		 */
-		sr_assembly_add_fragment_backup(assembly->imsi, node,
-						&addr, msgid);
+		sr_assembly_add_fragment_backup(assembly, node, &addr, msgid);
 
 		return FALSE;
 	}
@@ -3060,7 +3455,7 @@ gboolean status_report_assembly_report(struct status_report_assembly *assembly,
 	if (out_msgid)
 		memcpy(out_msgid, msgid, SMS_MSGID_LEN);
 
-	sr_assembly_remove_fragment_backup(assembly->imsi, &addr, msgid);
+	sr_assembly_remove_fragment_backup(assembly, &addr, msgid);
 	id_table = g_hash_table_iter_get_hash_table(&iter);
 	g_hash_table_iter_remove(&iter);
 
@@ -3112,7 +3507,7 @@ void status_report_assembly_add_fragment(
 	node->mrs[offset] |= bit;
 	node->expiration = expiration;
 	node->sent_mrs++;
-	sr_assembly_add_fragment_backup(assembly->imsi, node, to, msgid);
+	sr_assembly_add_fragment_backup(assembly, node, to, msgid);
 }
 
 void status_report_assembly_expire(struct status_report_assembly *assembly,
@@ -3147,10 +3542,8 @@ void status_report_assembly_expire(struct status_report_assembly *assembly,
 			if (node->expiration <= before) {
 				g_hash_table_iter_remove(&iter_node);
 
-				sr_assembly_remove_fragment_backup(
-								assembly->imsi,
-								&addr,
-								key);
+				sr_assembly_remove_fragment_backup(assembly,
+								&addr, key);
 			}
 		}
 
@@ -3163,73 +3556,111 @@ void status_report_assembly_expire(struct status_report_assembly *assembly,
 	}
 }
 
-static int sms_tx_load_filter(const struct dirent *dent)
+/*
+ * Each queue entry has a key per pdu, tx_queue/order-flags-uuid/seq.
+ * @keys is sorted, so all pdus of an entry are next to each other.
+ */
+static GSList *sms_tx_load(struct sms_journal *journal, GSList **keys)
 {
-	char *endp;
-	guint8 seq __attribute__ ((unused));
+	GSList *list = NULL;
+	GSList *l = *keys;
+	const char *dir = l->data;
+	gsize dir_len = strrchr(dir, '/') - dir + 1;
+	struct sms s;
 
-	if (dent->d_type != DT_REG)
-		return 0;
+	for (; l && strncmp(l->data, dir, dir_len) == 0; l = l->next) {
+		const struct sms_journal_entry *entry;
 
-	seq = strtol(dent->d_name, &endp, 10);
-	if (*endp != '\0')
-		return 0;
+		entry = sms_journal_get(journal, l->data);
 
-	return 1;
+		if (sms_deserialize_outgoing(entry->data, &s,
+						entry->len) == FALSE)
+			continue;
+
+		list = g_slist_prepend(list, g_memdup(&s, sizeof(s)));
+	}
+
+	*keys = l;
+
+	return g_slist_reverse(list);
 }
 
 /*
- * Each directory contains a file per pdu.
+ * The tx queue keeps the journal of a SIM open from its first use until
+ * sms_tx_queue_unload(), the tx backup functions only borrow it.
  */
-static GSList *sms_tx_load(const char *imsi, const struct dirent *dir)
+static struct sms_journal *sms_tx_journal(const char *imsi)
 {
-	GSList *list = NULL;
-	struct dirent **pdus;
-	char *path;
-	int len, r;
-	unsigned char buf[177];
-	struct sms s;
+	struct sms_journal *journal = NULL;
 
-	if (dir->d_type != DT_DIR)
-		return NULL;
+	if (sms_journals != NULL)
+		journal = g_hash_table_lookup(sms_journals, imsi);
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH "/%s", imsi, dir->d_name);
-	len = scandir(path, &pdus, sms_tx_load_filter, versionsort);
-	g_free(path);
+	if (journal != NULL && journal->tx_held)
+		return journal;
 
-	if (len < 0)
-		return NULL;
+	journal = sms_journal_ref(imsi);
+	journal->tx_held = TRUE;
+
+	return journal;
+}
 
-	while (len--) {
-		r = read_file(buf, sizeof(buf), SMS_TX_BACKUP_PATH "/%s/%s",
-					imsi, dir->d_name, pdus[len]->d_name);
+void sms_tx_queue_unload(const char *imsi)
+{
+	struct sms_journal *journal;
 
-		if (r < 0)
-			goto free_pdu;
+	if (imsi == NULL || sms_journals == NULL)
+		return;
 
-		if (sms_deserialize_outgoing(buf, &s, r) == FALSE)
-			goto free_pdu;
+	journal = g_hash_table_lookup(sms_journals, imsi);
+	if (journal == NULL || journal->tx_held == FALSE)
+		return;
 
-		list = g_slist_prepend(list, g_memdup(&s, sizeof(s)));
+	journal->tx_held = FALSE;
+	sms_journal_unref(journal);
+}
 
-free_pdu:
-		g_free(pdus[len]);
-	}
+/* Queue entries are stored as tx_queue/<order>-<flags>-<uuid>/<seq> */
+static gboolean sms_tx_key_valid(const char *key)
+{
+	const char *dir = key + strlen("tx_queue/");
+	const char *seq = strchr(dir, '/');
+	char *endp;
+
+	if (seq == NULL || seq == dir)
+		return FALSE;
 
-	g_free(pdus);
+	seq += 1;
+	strtol(seq, &endp, 10);
 
-	return list;
+	return seq != endp && *endp == '\0';
 }
 
-static int sms_tx_queue_filter(const struct dirent *dirent)
+/* Moves all pdus of a queue entry from @olddir to @newdir */
+static void sms_tx_rename(struct sms_journal *journal, const char *olddir,
+				const char *newdir)
 {
-	if (dirent->d_type != DT_DIR)
-		return 0;
+	char *prefix = g_strdup_printf("%s/", olddir);
+	GSList *keys = sms_journal_list(journal, prefix);
+	GSList *l;
 
-	if (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))
-		return 0;
+	for (l = keys; l; l = l->next) {
+		const struct sms_journal_entry *entry;
+		char *newkey;
 
-	return 1;
+		entry = sms_journal_get(journal, l->data);
+		newkey = g_strdup_printf("%s/%s", newdir,
+				(const char *) l->data + strlen(prefix));
+
+		if (sms_journal_put(journal, newkey, entry->data,
+					entry->len) == TRUE)
+			sms_journal_remove(journal, l->data);
+
+		g_free(newkey);
+	}
+
+	g_slist_free_full(keys, g_free);
+	g_free(prefix);
 }
 
 /*
@@ -3238,44 +3669,54 @@ static int sms_tx_queue_filter(const struct dirent *dirent)
  */
 GQueue *sms_tx_queue_load(const char *imsi)
 {
+	struct sms_journal *journal;
 	GQueue *retq = 0;
-	char *path;
-	struct dirent **entries;
-	int len;
-	int i;
+	GSList *keys;
+	GSList *l, *next;
 	unsigned long id;
 
 	if (imsi == NULL)
 		return NULL;
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH, imsi);
+	journal = sms_tx_journal(imsi);
+	keys = sms_journal_list(journal, "tx_queue/");
+
+	/* Stray keys would otherwise be grouped with real entries */
+	for (l = keys; l; l = next) {
+		next = l->next;
 
-	len = scandir(path, &entries, sms_tx_queue_filter, versionsort);
-	if (len < 0)
-		goto nodir_exit;
+		if (sms_tx_key_valid(l->data))
+			continue;
+
+		sms_journal_remove(journal, l->data);
+		g_free(l->data);
+		keys = g_slist_delete_link(keys, l);
+	}
 
 	retq = g_queue_new();
 
-	for (i = 0, id = 0; i < len; i++) {
+	for (l = keys, id = 0; l;) {
 		char uuid[SMS_MSGID_LEN * 2 + 1];
 		GSList *msg_list;
 		unsigned long oldid;
 		unsigned long flags;
-		char *oldpath, *newpath;
+		char *olddir, *newdir;
 		struct txq_backup_entry *entry;
-		struct dirent *dir = entries[i];
 		char endc;
 
-		if (sscanf(dir->d_name, "%lu-%lu-" SMS_MSGID_FMT "%c",
-					&oldid, &flags, uuid, &endc) != 3)
-			continue;
+		olddir = g_strndup(l->data, strrchr(l->data, '/') -
+						(char *) l->data);
 
-		if (strlen(uuid) !=  2 * SMS_MSGID_LEN)
-			continue;
+		msg_list = sms_tx_load(journal, &l);
 
-		msg_list = sms_tx_load(imsi, dir);
-		if (msg_list == NULL)
+		if (sscanf(olddir, "tx_queue/%lu-%lu-" SMS_MSGID_FMT "%c",
+					&oldid, &flags, uuid, &endc) != 3 ||
+				strlen(uuid) != 2 * SMS_MSGID_LEN ||
+				msg_list == NULL) {
+			g_slist_free_full(msg_list, g_free);
+			g_free(olddir);
 			continue;
+		}
 
 		entry = g_new0(struct txq_backup_entry, 1);
 		entry->msg_list = msg_list;
@@ -3287,27 +3728,21 @@ GQueue *sms_tx_queue_load(const char *imsi)
 		/* Don't bother re-shuffling the ids if they are the same */
 		if (oldid == id) {
 			id++;
+			g_free(olddir);
 			continue;
 		}
 
-		oldpath = g_strdup_printf("%s/%s", path, dir->d_name);
-		newpath = g_strdup_printf(SMS_TX_BACKUP_PATH_DIR,
-						imsi, id++, flags, uuid);
-
-		/* rename directory to reflect new position in queue */
-		rename(oldpath, newpath);
+		/* rename entry to reflect new position in queue */
+		newdir = g_strdup_printf(SMS_TX_BACKUP_KEY_DIR,
+						id++, flags, uuid);
+		sms_tx_rename(journal, olddir, newdir);
 
-		g_free(newpath);
-		g_free(oldpath);
+		g_free(newdir);
+		g_free(olddir);
 	}
 
-	for (i = 0; i < len; i++)
-		g_free(entries[i]);
+	g_slist_free_full(keys, g_free);
 
-	g_free(entries);
-
-nodir_exit:
-	g_free(path);
 	return retq;
 }
 
@@ -3316,7 +3751,10 @@ gboolean sms_tx_backup_store(const char *imsi, unsigned long id,
 				guint8 seq, const unsigned char *pdu,
 				int pdu_len, int tpdu_len)
 {
+	struct sms_journal *journal;
 	unsigned char buf[177];
+	char *key;
+	gboolean ret;
 	int len;
 
 	if (!imsi)
@@ -3326,63 +3764,56 @@ gboolean sms_tx_backup_store(const char *imsi, unsigned long id,
 	buf[0] = tpdu_len;
 	len = pdu_len + 1;
 
+	journal = sms_tx_journal(imsi);
+
 	/*
-	 * file name is: imsi/tx_queue/order-flags-uuid/pdu
+	 * key is: tx_queue/order-flags-uuid/pdu
 	 */
-	if (write_file(buf, len, SMS_BACKUP_MODE, SMS_TX_BACKUP_PATH_FILE,
-					imsi, id, flags, uuid, seq) != len)
-		return FALSE;
+	key = g_strdup_printf(SMS_TX_BACKUP_KEY, id, flags, uuid, seq);
+	ret = sms_journal_put(journal, key, buf, len);
+	g_free(key);
 
-	return TRUE;
+	return ret;
 }
 
 void sms_tx_backup_free(const char *imsi, unsigned long id,
 				unsigned long flags, const char *uuid)
 {
-	char *path;
-	struct dirent **entries;
-	int len;
-
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH_DIR,
-					imsi, id, flags, uuid);
-
-	len = scandir(path, &entries, NULL, versionsort);
-
-	if (len < 0)
-		goto nodir_exit;
-
-	/* skip '..' and '.' entries */
-	while (len-- > 2) {
-		struct dirent *dir = entries[len];
-		char *file = g_strdup_printf("%s/%s", path, dir->d_name);
+	struct sms_journal *journal;
+	char *prefix;
+	GSList *keys;
+	GSList *l;
 
-		unlink(file);
-		g_free(file);
+	if (!imsi)
+		return;
 
-		g_free(entries[len]);
-	}
+	journal = sms_tx_journal(imsi);
 
-	g_free(entries[1]);
-	g_free(entries[0]);
-	g_free(entries);
+	prefix = g_strdup_printf(SMS_TX_BACKUP_KEY_DIR "/", id, flags, uuid);
+	keys = sms_journal_list(journal, prefix);
 
-	rmdir(path);
+	for (l = keys; l; l = l->next)
+		sms_journal_remove(journal, l->data);
 
-nodir_exit:
-	g_free(path);
+	g_slist_free_full(keys, g_free);
+	g_free(prefix);
 }
 
 void sms_tx_backup_remove(const char *imsi, unsigned long id,
 				unsigned long flags, const char *uuid,
 				guint8 seq)
 {
-	char *path;
+	struct sms_journal *journal;
+	char *key;
 
-	path = g_strdup_printf(SMS_TX_BACKUP_PATH_FILE,
-					imsi, id, flags, uuid, seq);
-	unlink(path);
+	if (!imsi)
+		return;
 
-	g_free(path);
+	journal = sms_tx_journal(imsi);
+
+	key = g_strdup_printf(SMS_TX_BACKUP_KEY, id, flags, uuid, seq);
+	sms_journal_remove(journal, key);
+	g_free(key);
 }
 
 static inline GSList *sms_list_append(GSList *l, const struct sms *in)
@@ -4198,102 +4629,73 @@ static inline gboolean cbs_is_update_newer(unsigned int n, unsigned int o)
 	return FALSE;
 }
 
-struct cbs_assembly *cbs_assembly_new(void)
+static void cbs_assembly_node_free(gpointer data)
 {
-	return g_new0(struct cbs_assembly, 1);
+	struct cbs_assembly_node *node = data;
+
+	g_slist_free_full(node->pages, g_free);
+	g_free(node);
 }
 
-void cbs_assembly_free(struct cbs_assembly *assembly)
+struct cbs_assembly *cbs_assembly_new(void)
 {
-	GSList *l;
-
-	for (l = assembly->assembly_list; l; l = l->next) {
-		struct cbs_assembly_node *node = l->data;
+	struct cbs_assembly *assembly = g_new0(struct cbs_assembly, 1);
 
-		g_slist_free_full(node->pages, g_free);
-		g_free(node);
-	}
+	assembly->nodes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, cbs_assembly_node_free);
+	assembly->recv_plmn = g_hash_table_new(g_direct_hash, g_direct_equal);
+	assembly->recv_loc = g_hash_table_new(g_direct_hash, g_direct_equal);
+	assembly->recv_cell = g_hash_table_new(g_direct_hash, g_direct_equal);
 
-	g_slist_free(assembly->assembly_list);
-	g_slist_free(assembly->recv_plmn);
-	g_slist_free(assembly->recv_loc);
-	g_slist_free(assembly->recv_cell);
-
-	g_free(assembly);
+	return assembly;
 }
 
-static gint cbs_compare_node_by_gs(gconstpointer a, gconstpointer b)
+void cbs_assembly_free(struct cbs_assembly *assembly)
 {
-	const struct cbs_assembly_node *node = a;
-	unsigned int gs = GPOINTER_TO_UINT(b);
+	g_hash_table_destroy(assembly->nodes);
+	g_hash_table_destroy(assembly->recv_plmn);
+	g_hash_table_destroy(assembly->recv_loc);
+	g_hash_table_destroy(assembly->recv_cell);
 
-	if (((node->serial >> 14) & 0x3) == gs)
-		return 0;
-
-	return 1;
+	g_free(assembly);
 }
 
-static gint cbs_compare_node_by_update(gconstpointer a, gconstpointer b)
+static gboolean cbs_node_has_gs(gpointer key, gpointer value,
+				gpointer user_data)
 {
-	const struct cbs_assembly_node *node = a;
-	unsigned int serial = GPOINTER_TO_UINT(b);
-
-	if ((serial & (~0xf)) != (node->serial & (~0xf)))
-		return 1;
+	const struct cbs_assembly_node *node = value;
+	unsigned int gs = GPOINTER_TO_UINT(user_data);
 
-	if (cbs_is_update_newer(node->serial, serial))
-		return 1;
-
-	return 0;
+	return ((node->serial >> 14) & 0x3) == gs;
 }
 
-static gint cbs_compare_recv_by_serial(gconstpointer a, gconstpointer b)
+static void cbs_assembly_expire(struct cbs_assembly *assembly,
+				GHRFunc func, gpointer userdata)
 {
-	unsigned int old_serial = GPOINTER_TO_UINT(a);
-	unsigned int new_serial = GPOINTER_TO_UINT(b);
-
-	if ((old_serial & (~0xf)) == (new_serial & (~0xf)))
-		return 0;
-
-	return 1;
+	g_hash_table_foreach_remove(assembly->nodes, func, userdata);
 }
 
-static void cbs_assembly_expire(struct cbs_assembly *assembly,
-				GCompareFunc func, gconstpointer *userdata)
+static void cbs_assembly_expire_updates(struct cbs_assembly *assembly,
+					unsigned int serial)
 {
-	GSList *l;
-	GSList *prev;
-	GSList *tmp;
+	unsigned int update;
+	unsigned int old;
 
 	/*
 	 * Take care of the case where several updates are being
 	 * reassembled at the same time. If the newer one is assembled
 	 * first, then the subsequent old update is discarded, make
 	 * sure that we're also discarding the assembly node for the
-	 * partially assembled ones
+	 * partially assembled ones.  Only the 16 possible update numbers
+	 * of this message can be affected.
 	 */
-	prev = NULL;
-	l = assembly->assembly_list;
-
-	while (l) {
-		struct cbs_assembly_node *node = l->data;
+	for (update = 0; update < 16; update++) {
+		old = (serial & (~0xf)) | update;
 
-		if (func(node, userdata) != 0) {
-			prev = l;
-			l = l->next;
+		if (cbs_is_update_newer(old, serial))
 			continue;
-		}
 
-		if (prev)
-			prev->next = l->next;
-		else
-			assembly->assembly_list = l->next;
-
-		g_slist_free_full(node->pages, g_free);
-		g_free(node->pages);
-		tmp = l;
-		l = l->next;
-		g_slist_free_1(tmp);
+		g_hash_table_remove(assembly->nodes, GUINT_TO_POINTER(old));
 	}
 }
 
@@ -4311,35 +4713,32 @@ void cbs_assembly_location_changed(struct cbs_assembly *assembly, gboolean plmn,
 	 * next cell according to whether the next cell is in the same Service
 	 * Area as the current cell)
 	 *
-	 * NOTE 4: According to 3GPP TS 23.003 [2] a Service Area consists of
+	 * NOTE 4: According to 3GPP TS 23.003 [2] a Service Area consists of
 	 * one cell only.
 	 */
 
 	if (plmn) {
 		lac = TRUE;
-		g_slist_free(assembly->recv_plmn);
-		assembly->recv_plmn = NULL;
+		g_hash_table_remove_all(assembly->recv_plmn);
 
-		cbs_assembly_expire(assembly, cbs_compare_node_by_gs,
+		cbs_assembly_expire(assembly, cbs_node_has_gs,
 				GUINT_TO_POINTER(CBS_GEO_SCOPE_PLMN));
 	}
 
 	if (lac) {
 		/* If LAC changed, then cell id has changed */
 		ci = TRUE;
-		g_slist_free(assembly->recv_loc);
-		assembly->recv_loc = NULL;
+		g_hash_table_remove_all(assembly->recv_loc);
 
-		cbs_assembly_expire(assembly, cbs_compare_node_by_gs,
+		cbs_assembly_expire(assembly, cbs_node_has_gs,
 				GUINT_TO_POINTER(CBS_GEO_SCOPE_SERVICE_AREA));
 	}
 
 	if (ci) {
-		g_slist_free(assembly->recv_cell);
-		assembly->recv_cell = NULL;
-		cbs_assembly_expire(assembly, cbs_compare_node_by_gs,
+		g_hash_table_remove_all(assembly->recv_cell);
+		cbs_assembly_expire(assembly, cbs_node_has_gs,
 				GUINT_TO_POINTER(CBS_GEO_SCOPE_CELL_IMMEDIATE));
-		cbs_assembly_expire(assembly, cbs_compare_node_by_gs,
+		cbs_assembly_expire(assembly, cbs_node_has_gs,
 				GUINT_TO_POINTER(CBS_GEO_SCOPE_CELL_NORMAL));
 	}
 }
@@ -4351,10 +4750,11 @@ GSList *cbs_assembly_add_page(struct cbs_assembly *assembly,
 	struct cbs_assembly_node *node;
 	GSList *completed;
 	unsigned int new_serial;
-	GSList **recv;
-	GSList *l;
-	GSList *prev;
+	GHashTable *recv;
+	gpointer recv_key;
+	gpointer old_serial;
 	int position;
+	int j;
 
 	new_serial = cbs->gs << 14;
 	new_serial |= cbs->message_code << 4;
@@ -4362,27 +4762,24 @@ GSList *cbs_assembly_add_page(struct cbs_assembly *assembly,
 	new_serial |= cbs->message_identifier << 16;
 
 	if (cbs->gs == CBS_GEO_SCOPE_PLMN)
-		recv = &assembly->recv_plmn;
+		recv = assembly->recv_plmn;
 	else if (cbs->gs == CBS_GEO_SCOPE_SERVICE_AREA)
-		recv = &assembly->recv_loc;
+		recv = assembly->recv_loc;
 	else
-		recv = &assembly->recv_cell;
+		recv = assembly->recv_cell;
 
-	/* Have we seen this message before? */
-	l = g_slist_find_custom(*recv, GUINT_TO_POINTER(new_serial),
-				cbs_compare_recv_by_serial);
+	recv_key = GUINT_TO_POINTER(new_serial & (~0xf));
 
-	/* If we have, is the message newer? */
-	if (l && !cbs_is_update_newer(new_serial, GPOINTER_TO_UINT(l->data)))
+	/* Have we seen this message before?  If we have, is it newer? */
+	if (g_hash_table_lookup_extended(recv, recv_key, NULL, &old_serial) &&
+			!cbs_is_update_newer(new_serial,
+						GPOINTER_TO_UINT(old_serial)))
 		return NULL;
 
 	/* Easy case first, page 1 of 1 */
 	if (cbs->max_pages == 1 && cbs->page == 1) {
-		if (l)
-			l->data = GUINT_TO_POINTER(new_serial);
-		else
-			*recv = g_slist_prepend(*recv,
-						GUINT_TO_POINTER(new_serial));
+		g_hash_table_replace(recv, recv_key,
+					GUINT_TO_POINTER(new_serial));
 
 		newcbs = g_new(struct cbs, 1);
 		memcpy(newcbs, cbs, sizeof(struct cbs));
@@ -4391,37 +4788,25 @@ GSList *cbs_assembly_add_page(struct cbs_assembly *assembly,
 		return completed;
 	}
 
-	prev = NULL;
 	position = 0;
+	node = g_hash_table_lookup(assembly->nodes,
+					GUINT_TO_POINTER(new_serial));
 
-	for (l = assembly->assembly_list; l; prev = l, l = l->next) {
-		int j;
-		node = l->data;
-
-		if (new_serial != node->serial)
-			continue;
-
+	if (node != NULL) {
 		if (node->bitmap & (1 << cbs->page))
 			return NULL;
 
 		for (j = 1; j < cbs->page; j++)
 			if (node->bitmap & (1 << j))
 				position += 1;
+	} else {
+		node = g_new0(struct cbs_assembly_node, 1);
+		node->serial = new_serial;
 
-		goto out;
+		g_hash_table_insert(assembly->nodes,
+					GUINT_TO_POINTER(new_serial), node);
 	}
 
-	node = g_new0(struct cbs_assembly_node, 1);
-	node->serial = new_serial;
-
-	assembly->assembly_list = g_slist_prepend(assembly->assembly_list,
-							node);
-
-	prev = NULL;
-	l = assembly->assembly_list;
-	position = 0;
-
-out:
 	newcbs = g_new(struct cbs, 1);
 	memcpy(newcbs, cbs, sizeof(struct cbs));
 	node->pages = g_slist_insert(node->pages, newcbs, position);
@@ -4431,18 +4816,12 @@ out:
 		return NULL;
 
 	completed = node->pages;
+	node->pages = NULL;
 
-	if (prev)
-		prev->next = l->next;
-	else
-		assembly->assembly_list = l->next;
-
-	g_free(node);
-	g_slist_free_1(l);
+	g_hash_table_remove(assembly->nodes, GUINT_TO_POINTER(new_serial));
 
-	cbs_assembly_expire(assembly, cbs_compare_node_by_update,
-				GUINT_TO_POINTER(new_serial));
-	*recv = g_slist_prepend(*recv, GUINT_TO_POINTER(new_serial));
+	cbs_assembly_expire_updates(assembly, new_serial);
+	g_hash_table_replace(recv, recv_key, GUINT_TO_POINTER(new_serial));
 
 	return completed;
 }
@@ -4687,6 +5066,42 @@ gboolean cbs_topic_in_range(unsigned int topic, GSList *ranges)
 					cbs_topic_compare) != NULL;
 }
 
+#define CBS_TOPIC_BITMAP_SIZE (65536 / 8)
+
+/*
+ * Expands the ranges into one bit per message identifier, so that pages
+ * can be filtered without walking the ranges.  Returns NULL for an empty
+ * list, the result must be freed with g_free.
+ */
+unsigned char *cbs_topic_bitmap_new(GSList *ranges)
+{
+	unsigned char *bitmap;
+	unsigned int topic;
+	GSList *l;
+
+	if (ranges == NULL)
+		return NULL;
+
+	bitmap = g_new0(unsigned char, CBS_TOPIC_BITMAP_SIZE);
+
+	for (l = ranges; l; l = l->next) {
+		struct cbs_topic_range *range = l->data;
+
+		for (topic = range->min; topic <= range->max; topic++)
+			bitmap[topic / 8] |= 1 << (topic % 8);
+	}
+
+	return bitmap;
+}
+
+gboolean cbs_topic_in_bitmap(const unsigned char *bitmap, unsigned int topic)
+{
+	if (bitmap == NULL || topic >= CBS_TOPIC_BITMAP_SIZE * 8)
+		return FALSE;
+
+	return (bitmap[topic / 8] >> (topic % 8)) & 1;
+}
+
 char *ussd_decode(int dcs, int len, const unsigned char *data)
 {
 	gboolean udhi;
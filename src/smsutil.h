@@ -372,8 +372,11 @@ struct sms_assembly_node {
 	unsigned int bitmap[8];
 };
 
+struct sms_journal;
+
 struct sms_assembly {
 	const char *imsi;
+	struct sms_journal *journal;
 	GSList *assembly_list;
 };
 
@@ -387,6 +390,7 @@ struct id_table_node {
 
 struct status_report_assembly {
 	const char *imsi;
+	struct sms_journal *journal;
 	GHashTable *assembly_table;
 };
 
@@ -407,11 +411,16 @@ struct cbs_assembly_node {
 	GSList *pages;
 };
 
+/*
+ * Nodes are keyed by serial, which includes the message identifier.  The
+ * recv tables map a serial without its update number to the last update
+ * received for it.
+ */
 struct cbs_assembly {
-	GSList *assembly_list;
-	GSList *recv_plmn;
-	GSList *recv_loc;
-	GSList *recv_cell;
+	GHashTable *nodes;
+	GHashTable *recv_plmn;
+	GHashTable *recv_loc;
+	GHashTable *recv_cell;
 };
 
 struct cbs_topic_range {
@@ -544,6 +553,7 @@ void sms_tx_backup_remove(const char *imsi, unsigned long id,
 void sms_tx_backup_free(const char *imsi, unsigned long id,
 				unsigned long flags, const char *uuid);
 GQueue *sms_tx_queue_load(const char *imsi);
+void sms_tx_queue_unload(const char *imsi);
 
 GSList *sms_text_prepare(const char *to, const char *utf8, guint16 ref,
 				gboolean use_16bit,
@@ -584,6 +594,8 @@ char *cbs_topic_ranges_to_string(GSList *ranges);
 GSList *cbs_extract_topic_ranges(const char *ranges);
 GSList *cbs_optimize_ranges(GSList *ranges);
 gboolean cbs_topic_in_range(unsigned int topic, GSList *ranges);
+unsigned char *cbs_topic_bitmap_new(GSList *ranges);
+gboolean cbs_topic_in_bitmap(const unsigned char *bitmap, unsigned int topic);
 
 char *ussd_decode(int dcs, int len, const unsigned char *data);
 gboolean ussd_encode(const char *str, long *items_written, unsigned char *pdu);
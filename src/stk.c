@@ -2272,10 +2272,17 @@ static gboolean handle_command_refresh(const struct stk_command *cmd,
 	 */
 	if (cmd->qualifier < 4 || rsp == NULL) {
 		int qualifier = stk->pending_cmd->qualifier;
-		GSList *file_list = stk->pending_cmd->refresh.file_list;
+		GSList *file_list = NULL;
 
-		/* Don't free the list yet */
-		stk->pending_cmd->refresh.file_list = NULL;
+		/*
+		 * The list belongs to the command, which may be freed once
+		 * the response is sent, so work on a copy.
+		 */
+		for (l = stk->pending_cmd->refresh.file_list; l; l = l->next)
+			file_list = g_slist_prepend(file_list,
+					g_memdup(l->data, sizeof(struct stk_file)));
+
+		file_list = g_slist_reverse(file_list);
 
 		/*
 		 * Queue the TERMINAL RESPONSE before triggering potential
@@ -81,6 +81,108 @@ struct gsm_sms_tpdu {
 	if ((text == NULL || text[0] == '\0') && icon_id != 0)	\
 		status = STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;	\
 
+/*
+ * Everything a proactive command points to is carved out of a chain of
+ * blocks owned by the command, so a menu with dozens of items costs a
+ * couple of allocations and stk_command_free only releases the blocks.
+ */
+#define STK_ARENA_BLOCK_SIZE	1024
+#define STK_ARENA_ALIGN(n)	(((n) + 7) & ~((gsize) 7))
+
+struct stk_arena {
+	struct stk_arena *next;
+	gsize used;
+	gsize size;
+};
+
+#define STK_ARENA_HEADER	STK_ARENA_ALIGN(sizeof(struct stk_arena))
+
+/* Blocks of the command being decoded by stk_command_new_from_pdu */
+static struct stk_arena *decode_arena;
+
+static void *stk_arena_alloc(gsize size)
+{
+	struct stk_arena *arena = decode_arena;
+	void *ret;
+
+	size = STK_ARENA_ALIGN(size);
+
+	if (arena == NULL || arena->size - arena->used < size) {
+		gsize block = MAX(size, STK_ARENA_BLOCK_SIZE);
+
+		arena = g_try_malloc(STK_ARENA_HEADER + block);
+		if (arena == NULL)
+			return NULL;
+
+		arena->next = decode_arena;
+		arena->used = 0;
+		arena->size = block;
+		decode_arena = arena;
+	}
+
+	ret = (unsigned char *) arena + STK_ARENA_HEADER + arena->used;
+	arena->used += size;
+
+	return ret;
+}
+
+static void *stk_arena_alloc0(gsize size)
+{
+	void *ret = stk_arena_alloc(size);
+
+	if (ret != NULL)
+		memset(ret, 0, size);
+
+	return ret;
+}
+
+static void *stk_arena_memdup(const void *mem, gsize size)
+{
+	void *ret = stk_arena_alloc(size);
+
+	if (ret != NULL)
+		memcpy(ret, mem, size);
+
+	return ret;
+}
+
+/* Moves a string returned by one of the charset converters */
+static char *stk_arena_take_string(char *str)
+{
+	char *ret;
+
+	if (str == NULL)
+		return NULL;
+
+	ret = stk_arena_memdup(str, strlen(str) + 1);
+	g_free(str);
+
+	return ret;
+}
+
+static GSList *stk_arena_slist_prepend(GSList *list, void *data)
+{
+	GSList *node = stk_arena_alloc(sizeof(GSList));
+
+	if (node == NULL)
+		return list;
+
+	node->data = data;
+	node->next = list;
+
+	return node;
+}
+
+static void stk_arena_free(struct stk_arena *arena)
+{
+	while (arena) {
+		struct stk_arena *next = arena->next;
+
+		g_free(arena);
+		arena = next;
+	}
+}
+
 static char *decode_text(unsigned char dcs, int len, const unsigned char *data)
 {
 	char *utf8;
@@ -117,7 +219,7 @@ static char *decode_text(unsigned char dcs, int len, const unsigned char *data)
 		utf8 = NULL;
 	}
 
-	return utf8;
+	return stk_arena_take_string(utf8);
 }
 
 /* For data object only to indicate its existence */
@@ -159,7 +261,7 @@ static gboolean parse_dataobj_common_text(struct comprehension_tlv_iter *iter,
 
 	data = comprehension_tlv_iter_get_data(iter);
 
-	*text = g_try_malloc(len + 1);
+	*text = stk_arena_alloc(len + 1);
 	if (*text == NULL)
 		return FALSE;
 
@@ -183,7 +285,7 @@ static gboolean parse_dataobj_common_byte_array(
 	data = comprehension_tlv_iter_get_data(iter);
 	array->len = len;
 
-	array->array = g_try_malloc(len);
+	array->array = stk_arena_alloc(len);
 	if (array->array == NULL)
 		return FALSE;
 
@@ -287,7 +389,7 @@ static gboolean parse_dataobj_address(struct comprehension_tlv_iter *iter,
 
 	data = comprehension_tlv_iter_get_data(iter);
 
-	number = g_try_malloc(len * 2 - 1);
+	number = stk_arena_alloc(len * 2 - 1);
 	if (number == NULL)
 		return FALSE;
 
@@ -314,7 +416,7 @@ static gboolean parse_dataobj_alpha_id(struct comprehension_tlv_iter *iter,
 	}
 
 	data = comprehension_tlv_iter_get_data(iter);
-	utf8 = sim_string_to_utf8(data, len);
+	utf8 = stk_arena_take_string(sim_string_to_utf8(data, len));
 
 	if (utf8 == NULL)
 		return FALSE;
@@ -439,7 +541,7 @@ static gboolean parse_dataobj_item(struct comprehension_tlv_iter *iter,
 	if (data[0] == 0)
 		return FALSE;
 
-	utf8 = sim_string_to_utf8(data + 1, len - 1);
+	utf8 = stk_arena_take_string(sim_string_to_utf8(data + 1, len - 1));
 
 	if (utf8 == NULL)
 		return FALSE;
@@ -505,7 +607,7 @@ static gboolean parse_dataobj_result(struct comprehension_tlv_iter *iter,
 				(data[0] == 0x3c) || (data[0] == 0x3d)))
 		return FALSE;
 
-	additional = g_try_malloc(len - 1);
+	additional = stk_arena_alloc(len - 1);
 	if (additional == NULL)
 		return FALSE;
 
@@ -552,7 +654,7 @@ static gboolean parse_dataobj_ss(struct comprehension_tlv_iter *iter,
 
 	data = comprehension_tlv_iter_get_data(iter);
 
-	s = g_try_malloc(len * 2 - 1);
+	s = stk_arena_alloc(len * 2 - 1);
 	if (s == NULL)
 		return FALSE;
 
@@ -573,7 +675,7 @@ static gboolean parse_dataobj_text(struct comprehension_tlv_iter *iter,
 	char *utf8;
 
 	if (len <= 1) {
-		*text = g_try_malloc0(1);
+		*text = stk_arena_alloc0(1);
 		return TRUE;
 	}
 
@@ -633,13 +735,13 @@ static gboolean parse_dataobj_file_list(struct comprehension_tlv_iter *iter,
 	stk_file_iter_init(&sf_iter, data + 1, len - 1);
 
 	while (stk_file_iter_next(&sf_iter)) {
-		sf = g_try_new0(struct stk_file, 1);
+		sf = stk_arena_alloc0(sizeof(struct stk_file));
 		if (sf == NULL)
 			goto error;
 
 		sf->len = sf_iter.len;
 		memcpy(sf->file, sf_iter.file, sf_iter.len);
-		*fl = g_slist_prepend(*fl, sf);
+		*fl = stk_arena_slist_prepend(*fl, sf);
 	}
 
 	if (sf_iter.pos != sf_iter.max)
@@ -649,7 +751,8 @@ static gboolean parse_dataobj_file_list(struct comprehension_tlv_iter *iter,
 	return TRUE;
 
 error:
-	g_slist_free_full(*fl, g_free);
+	/* The entries go away with the command */
+	*fl = NULL;
 	return FALSE;
 }
 
@@ -1127,7 +1230,7 @@ static gboolean parse_dataobj_dtmf_string(struct comprehension_tlv_iter *iter,
 
 	data = comprehension_tlv_iter_get_data(iter);
 
-	*dtmf = g_try_malloc(len * 2 + 1);
+	*dtmf = stk_arena_alloc(len * 2 + 1);
 	if (*dtmf == NULL)
 		return FALSE;
 
@@ -1463,7 +1566,7 @@ static gboolean parse_dataobj_service_record(
 	sr->serv_id = data[1];
 	sr->len = len - 2;
 
-	sr->serv_rec = g_try_malloc(sr->len);
+	sr->serv_rec = stk_arena_alloc(sr->len);
 	if (sr->serv_rec == NULL)
 		return FALSE;
 
@@ -1493,7 +1596,7 @@ static gboolean parse_dataobj_device_filter(struct comprehension_tlv_iter *iter,
 	df->tech_id = data[0];
 	df->len = len - 1;
 
-	df->dev_filter = g_try_malloc(df->len);
+	df->dev_filter = stk_arena_alloc(df->len);
 	if (df->dev_filter == NULL)
 		return FALSE;
 
@@ -1523,7 +1626,7 @@ static gboolean parse_dataobj_service_search(
 	ss->tech_id = data[0];
 	ss->len = len - 1;
 
-	ss->ser_search = g_try_malloc(ss->len);
+	ss->ser_search = stk_arena_alloc(ss->len);
 	if (ss->ser_search == NULL)
 		return FALSE;
 
@@ -1553,7 +1656,7 @@ static gboolean parse_dataobj_attribute_info(
 	ai->tech_id = data[0];
 	ai->len = len - 1;
 
-	ai->attr_info = g_try_malloc(ai->len);
+	ai->attr_info = stk_arena_alloc(ai->len);
 	if (ai->attr_info == NULL)
 		return FALSE;
 
@@ -1659,7 +1762,7 @@ static gboolean parse_dataobj_network_access_name(
 	}
 
 	decoded_apn[offset] = '\0';
-	*apn = g_strdup(decoded_apn);
+	*apn = stk_arena_memdup(decoded_apn, offset + 1);
 
 	return TRUE;
 }
@@ -2064,199 +2167,133 @@ static gboolean parse_dataobj_broadcast_network_info(
 	return TRUE;
 }
 
+/* Indexed by tag, every tag in TS 102.223 Section 9.3 fits in 7 bits */
+static const dataobj_handler dataobj_handlers[0x80] = {
+	[STK_DATA_OBJECT_TYPE_ADDRESS] = parse_dataobj_address,
+	[STK_DATA_OBJECT_TYPE_ALPHA_ID] = parse_dataobj_alpha_id,
+	[STK_DATA_OBJECT_TYPE_SUBADDRESS] = parse_dataobj_subaddress,
+	[STK_DATA_OBJECT_TYPE_CCP] = parse_dataobj_ccp,
+	[STK_DATA_OBJECT_TYPE_CBS_PAGE] = parse_dataobj_cbs_page,
+	[STK_DATA_OBJECT_TYPE_DURATION] = parse_dataobj_duration,
+	[STK_DATA_OBJECT_TYPE_ITEM] = parse_dataobj_item,
+	[STK_DATA_OBJECT_TYPE_ITEM_ID] = parse_dataobj_item_id,
+	[STK_DATA_OBJECT_TYPE_RESPONSE_LENGTH] = parse_dataobj_response_len,
+	[STK_DATA_OBJECT_TYPE_RESULT] = parse_dataobj_result,
+	[STK_DATA_OBJECT_TYPE_GSM_SMS_TPDU] = parse_dataobj_gsm_sms_tpdu,
+	[STK_DATA_OBJECT_TYPE_SS_STRING] = parse_dataobj_ss,
+	[STK_DATA_OBJECT_TYPE_TEXT] = parse_dataobj_text,
+	[STK_DATA_OBJECT_TYPE_TONE] = parse_dataobj_tone,
+	[STK_DATA_OBJECT_TYPE_USSD_STRING] = parse_dataobj_ussd,
+	[STK_DATA_OBJECT_TYPE_FILE_LIST] = parse_dataobj_file_list,
+	[STK_DATA_OBJECT_TYPE_LOCATION_INFO] = parse_dataobj_location_info,
+	[STK_DATA_OBJECT_TYPE_IMEI] = parse_dataobj_imei,
+	[STK_DATA_OBJECT_TYPE_HELP_REQUEST] = parse_dataobj_help_request,
+	[STK_DATA_OBJECT_TYPE_NETWORK_MEASUREMENT_RESULTS] =
+				parse_dataobj_network_measurement_results,
+	[STK_DATA_OBJECT_TYPE_DEFAULT_TEXT] = parse_dataobj_default_text,
+	[STK_DATA_OBJECT_TYPE_ITEMS_NEXT_ACTION_INDICATOR] =
+				parse_dataobj_items_next_action_indicator,
+	[STK_DATA_OBJECT_TYPE_EVENT_LIST] = parse_dataobj_event_list,
+	[STK_DATA_OBJECT_TYPE_CAUSE] = parse_dataobj_cause,
+	[STK_DATA_OBJECT_TYPE_LOCATION_STATUS] = parse_dataobj_location_status,
+	[STK_DATA_OBJECT_TYPE_TRANSACTION_ID] = parse_dataobj_transaction_id,
+	[STK_DATA_OBJECT_TYPE_BCCH_CHANNEL_LIST] =
+				parse_dataobj_bcch_channel_list,
+	[STK_DATA_OBJECT_TYPE_CALL_CONTROL_REQUESTED_ACTION] =
+				parse_dataobj_call_control_requested_action,
+	[STK_DATA_OBJECT_TYPE_ICON_ID] = parse_dataobj_icon_id,
+	[STK_DATA_OBJECT_TYPE_ITEM_ICON_ID_LIST] =
+				parse_dataobj_item_icon_id_list,
+	[STK_DATA_OBJECT_TYPE_CARD_READER_STATUS] =
+				parse_dataobj_card_reader_status,
+	[STK_DATA_OBJECT_TYPE_CARD_ATR] = parse_dataobj_card_atr,
+	[STK_DATA_OBJECT_TYPE_C_APDU] = parse_dataobj_c_apdu,
+	[STK_DATA_OBJECT_TYPE_R_APDU] = parse_dataobj_r_apdu,
+	[STK_DATA_OBJECT_TYPE_TIMER_ID] = parse_dataobj_timer_id,
+	[STK_DATA_OBJECT_TYPE_TIMER_VALUE] = parse_dataobj_timer_value,
+	[STK_DATA_OBJECT_TYPE_DATETIME_TIMEZONE] =
+				parse_dataobj_datetime_timezone,
+	[STK_DATA_OBJECT_TYPE_AT_COMMAND] = parse_dataobj_at_command,
+	[STK_DATA_OBJECT_TYPE_AT_RESPONSE] = parse_dataobj_at_response,
+	[STK_DATA_OBJECT_TYPE_BC_REPEAT_INDICATOR] =
+				parse_dataobj_bc_repeat_indicator,
+	[STK_DATA_OBJECT_TYPE_IMMEDIATE_RESPONSE] = parse_dataobj_imm_resp,
+	[STK_DATA_OBJECT_TYPE_DTMF_STRING] = parse_dataobj_dtmf_string,
+	[STK_DATA_OBJECT_TYPE_LANGUAGE] = parse_dataobj_language,
+	[STK_DATA_OBJECT_TYPE_BROWSER_ID] = parse_dataobj_browser_id,
+	[STK_DATA_OBJECT_TYPE_TIMING_ADVANCE] = parse_dataobj_timing_advance,
+	[STK_DATA_OBJECT_TYPE_URL] = parse_dataobj_url,
+	[STK_DATA_OBJECT_TYPE_BEARER] = parse_dataobj_bearer,
+	[STK_DATA_OBJECT_TYPE_PROVISIONING_FILE_REF] =
+				parse_dataobj_provisioning_file_reference,
+	[STK_DATA_OBJECT_TYPE_BROWSER_TERMINATION_CAUSE] =
+				parse_dataobj_browser_termination_cause,
+	[STK_DATA_OBJECT_TYPE_BEARER_DESCRIPTION] =
+				parse_dataobj_bearer_description,
+	[STK_DATA_OBJECT_TYPE_CHANNEL_DATA] = parse_dataobj_channel_data,
+	[STK_DATA_OBJECT_TYPE_CHANNEL_DATA_LENGTH] =
+				parse_dataobj_channel_data_length,
+	[STK_DATA_OBJECT_TYPE_BUFFER_SIZE] = parse_dataobj_buffer_size,
+	[STK_DATA_OBJECT_TYPE_CHANNEL_STATUS] = parse_dataobj_channel_status,
+	[STK_DATA_OBJECT_TYPE_CARD_READER_ID] = parse_dataobj_card_reader_id,
+	[STK_DATA_OBJECT_TYPE_OTHER_ADDRESS] = parse_dataobj_other_address,
+	[STK_DATA_OBJECT_TYPE_UICC_TE_INTERFACE] =
+				parse_dataobj_uicc_te_interface,
+	[STK_DATA_OBJECT_TYPE_AID] = parse_dataobj_aid,
+	[STK_DATA_OBJECT_TYPE_ACCESS_TECHNOLOGY] =
+				parse_dataobj_access_technology,
+	[STK_DATA_OBJECT_TYPE_DISPLAY_PARAMETERS] =
+				parse_dataobj_display_parameters,
+	[STK_DATA_OBJECT_TYPE_SERVICE_RECORD] = parse_dataobj_service_record,
+	[STK_DATA_OBJECT_TYPE_DEVICE_FILTER] = parse_dataobj_device_filter,
+	[STK_DATA_OBJECT_TYPE_SERVICE_SEARCH] = parse_dataobj_service_search,
+	[STK_DATA_OBJECT_TYPE_ATTRIBUTE_INFO] = parse_dataobj_attribute_info,
+	[STK_DATA_OBJECT_TYPE_SERVICE_AVAILABILITY] =
+				parse_dataobj_service_availability,
+	[STK_DATA_OBJECT_TYPE_REMOTE_ENTITY_ADDRESS] =
+				parse_dataobj_remote_entity_address,
+	[STK_DATA_OBJECT_TYPE_ESN] = parse_dataobj_esn,
+	[STK_DATA_OBJECT_TYPE_NETWORK_ACCESS_NAME] =
+				parse_dataobj_network_access_name,
+	[STK_DATA_OBJECT_TYPE_CDMA_SMS_TPDU] = parse_dataobj_cdma_sms_tpdu,
+	[STK_DATA_OBJECT_TYPE_TEXT_ATTRIBUTE] = parse_dataobj_text_attr,
+	[STK_DATA_OBJECT_TYPE_PDP_ACTIVATION_PARAMETER] =
+				parse_dataobj_pdp_act_par,
+	[STK_DATA_OBJECT_TYPE_ITEM_TEXT_ATTRIBUTE_LIST] =
+				parse_dataobj_item_text_attribute_list,
+	[STK_DATA_OBJECT_TYPE_UTRAN_MEASUREMENT_QUALIFIER] =
+				parse_dataobj_utran_meas_qualifier,
+	[STK_DATA_OBJECT_TYPE_IMEISV] = parse_dataobj_imeisv,
+	[STK_DATA_OBJECT_TYPE_NETWORK_SEARCH_MODE] =
+				parse_dataobj_network_search_mode,
+	[STK_DATA_OBJECT_TYPE_BATTERY_STATE] = parse_dataobj_battery_state,
+	[STK_DATA_OBJECT_TYPE_BROWSING_STATUS] = parse_dataobj_browsing_status,
+	[STK_DATA_OBJECT_TYPE_FRAME_LAYOUT] = parse_dataobj_frame_layout,
+	[STK_DATA_OBJECT_TYPE_FRAMES_INFO] = parse_dataobj_frames_info,
+	[STK_DATA_OBJECT_TYPE_FRAME_ID] = parse_dataobj_frame_id,
+	[STK_DATA_OBJECT_TYPE_MEID] = parse_dataobj_meid,
+	[STK_DATA_OBJECT_TYPE_MMS_REFERENCE] = parse_dataobj_mms_reference,
+	[STK_DATA_OBJECT_TYPE_MMS_ID] = parse_dataobj_mms_id,
+	[STK_DATA_OBJECT_TYPE_MMS_TRANSFER_STATUS] =
+				parse_dataobj_mms_transfer_status,
+	[STK_DATA_OBJECT_TYPE_MMS_CONTENT_ID] = parse_dataobj_mms_content_id,
+	[STK_DATA_OBJECT_TYPE_MMS_NOTIFICATION] =
+				parse_dataobj_mms_notification,
+	[STK_DATA_OBJECT_TYPE_LAST_ENVELOPE] = parse_dataobj_last_envelope,
+	[STK_DATA_OBJECT_TYPE_REGISTRY_APPLICATION_DATA] =
+				parse_dataobj_registry_application_data,
+	[STK_DATA_OBJECT_TYPE_ACTIVATE_DESCRIPTOR] =
+				parse_dataobj_activate_descriptor,
+	[STK_DATA_OBJECT_TYPE_BROADCAST_NETWORK_INFO] =
+				parse_dataobj_broadcast_network_info,
+};
+
 static dataobj_handler handler_for_type(enum stk_data_object_type type)
 {
-	switch (type) {
-	case STK_DATA_OBJECT_TYPE_ADDRESS:
-		return parse_dataobj_address;
-	case STK_DATA_OBJECT_TYPE_ALPHA_ID:
-		return parse_dataobj_alpha_id;
-	case STK_DATA_OBJECT_TYPE_SUBADDRESS:
-		return parse_dataobj_subaddress;
-	case STK_DATA_OBJECT_TYPE_CCP:
-		return parse_dataobj_ccp;
-	case STK_DATA_OBJECT_TYPE_CBS_PAGE:
-		return parse_dataobj_cbs_page;
-	case STK_DATA_OBJECT_TYPE_DURATION:
-		return parse_dataobj_duration;
-	case STK_DATA_OBJECT_TYPE_ITEM:
-		return parse_dataobj_item;
-	case STK_DATA_OBJECT_TYPE_ITEM_ID:
-		return parse_dataobj_item_id;
-	case STK_DATA_OBJECT_TYPE_RESPONSE_LENGTH:
-		return parse_dataobj_response_len;
-	case STK_DATA_OBJECT_TYPE_RESULT:
-		return parse_dataobj_result;
-	case STK_DATA_OBJECT_TYPE_GSM_SMS_TPDU:
-		return parse_dataobj_gsm_sms_tpdu;
-	case STK_DATA_OBJECT_TYPE_SS_STRING:
-		return parse_dataobj_ss;
-	case STK_DATA_OBJECT_TYPE_TEXT:
-		return parse_dataobj_text;
-	case STK_DATA_OBJECT_TYPE_TONE:
-		return parse_dataobj_tone;
-	case STK_DATA_OBJECT_TYPE_USSD_STRING:
-		return parse_dataobj_ussd;
-	case STK_DATA_OBJECT_TYPE_FILE_LIST:
-		return parse_dataobj_file_list;
-	case STK_DATA_OBJECT_TYPE_LOCATION_INFO:
-		return parse_dataobj_location_info;
-	case STK_DATA_OBJECT_TYPE_IMEI:
-		return parse_dataobj_imei;
-	case STK_DATA_OBJECT_TYPE_HELP_REQUEST:
-		return parse_dataobj_help_request;
-	case STK_DATA_OBJECT_TYPE_NETWORK_MEASUREMENT_RESULTS:
-		return parse_dataobj_network_measurement_results;
-	case STK_DATA_OBJECT_TYPE_DEFAULT_TEXT:
-		return parse_dataobj_default_text;
-	case STK_DATA_OBJECT_TYPE_ITEMS_NEXT_ACTION_INDICATOR:
-		return parse_dataobj_items_next_action_indicator;
-	case STK_DATA_OBJECT_TYPE_EVENT_LIST:
-		return parse_dataobj_event_list;
-	case STK_DATA_OBJECT_TYPE_CAUSE:
-		return parse_dataobj_cause;
-	case STK_DATA_OBJECT_TYPE_LOCATION_STATUS:
-		return parse_dataobj_location_status;
-	case STK_DATA_OBJECT_TYPE_TRANSACTION_ID:
-		return parse_dataobj_transaction_id;
-	case STK_DATA_OBJECT_TYPE_BCCH_CHANNEL_LIST:
-		return parse_dataobj_bcch_channel_list;
-	case STK_DATA_OBJECT_TYPE_CALL_CONTROL_REQUESTED_ACTION:
-		return parse_dataobj_call_control_requested_action;
-	case STK_DATA_OBJECT_TYPE_ICON_ID:
-		return parse_dataobj_icon_id;
-	case STK_DATA_OBJECT_TYPE_ITEM_ICON_ID_LIST:
-		return parse_dataobj_item_icon_id_list;
-	case STK_DATA_OBJECT_TYPE_CARD_READER_STATUS:
-		return parse_dataobj_card_reader_status;
-	case STK_DATA_OBJECT_TYPE_CARD_ATR:
-		return parse_dataobj_card_atr;
-	case STK_DATA_OBJECT_TYPE_C_APDU:
-		return parse_dataobj_c_apdu;
-	case STK_DATA_OBJECT_TYPE_R_APDU:
-		return parse_dataobj_r_apdu;
-	case STK_DATA_OBJECT_TYPE_TIMER_ID:
-		return parse_dataobj_timer_id;
-	case STK_DATA_OBJECT_TYPE_TIMER_VALUE:
-		return parse_dataobj_timer_value;
-	case STK_DATA_OBJECT_TYPE_DATETIME_TIMEZONE:
-		return parse_dataobj_datetime_timezone;
-	case STK_DATA_OBJECT_TYPE_AT_COMMAND:
-		return parse_dataobj_at_command;
-	case STK_DATA_OBJECT_TYPE_AT_RESPONSE:
-		return parse_dataobj_at_response;
-	case STK_DATA_OBJECT_TYPE_BC_REPEAT_INDICATOR:
-		return parse_dataobj_bc_repeat_indicator;
-	case STK_DATA_OBJECT_TYPE_IMMEDIATE_RESPONSE:
-		return parse_dataobj_imm_resp;
-	case STK_DATA_OBJECT_TYPE_DTMF_STRING:
-		return parse_dataobj_dtmf_string;
-	case STK_DATA_OBJECT_TYPE_LANGUAGE:
-		return parse_dataobj_language;
-	case STK_DATA_OBJECT_TYPE_BROWSER_ID:
-		return parse_dataobj_browser_id;
-	case STK_DATA_OBJECT_TYPE_TIMING_ADVANCE:
-		return parse_dataobj_timing_advance;
-	case STK_DATA_OBJECT_TYPE_URL:
-		return parse_dataobj_url;
-	case STK_DATA_OBJECT_TYPE_BEARER:
-		return parse_dataobj_bearer;
-	case STK_DATA_OBJECT_TYPE_PROVISIONING_FILE_REF:
-		return parse_dataobj_provisioning_file_reference;
-	case STK_DATA_OBJECT_TYPE_BROWSER_TERMINATION_CAUSE:
-		return parse_dataobj_browser_termination_cause;
-	case STK_DATA_OBJECT_TYPE_BEARER_DESCRIPTION:
-		return parse_dataobj_bearer_description;
-	case STK_DATA_OBJECT_TYPE_CHANNEL_DATA:
-		return parse_dataobj_channel_data;
-	case STK_DATA_OBJECT_TYPE_CHANNEL_DATA_LENGTH:
-		return parse_dataobj_channel_data_length;
-	case STK_DATA_OBJECT_TYPE_BUFFER_SIZE:
-		return parse_dataobj_buffer_size;
-	case STK_DATA_OBJECT_TYPE_CHANNEL_STATUS:
-		return parse_dataobj_channel_status;
-	case STK_DATA_OBJECT_TYPE_CARD_READER_ID:
-		return parse_dataobj_card_reader_id;
-	case STK_DATA_OBJECT_TYPE_OTHER_ADDRESS:
-		return parse_dataobj_other_address;
-	case STK_DATA_OBJECT_TYPE_UICC_TE_INTERFACE:
-		return parse_dataobj_uicc_te_interface;
-	case STK_DATA_OBJECT_TYPE_AID:
-		return parse_dataobj_aid;
-	case STK_DATA_OBJECT_TYPE_ACCESS_TECHNOLOGY:
-		return parse_dataobj_access_technology;
-	case STK_DATA_OBJECT_TYPE_DISPLAY_PARAMETERS:
-		return parse_dataobj_display_parameters;
-	case STK_DATA_OBJECT_TYPE_SERVICE_RECORD:
-		return parse_dataobj_service_record;
-	case STK_DATA_OBJECT_TYPE_DEVICE_FILTER:
-		return parse_dataobj_device_filter;
-	case STK_DATA_OBJECT_TYPE_SERVICE_SEARCH:
-		return parse_dataobj_service_search;
-	case STK_DATA_OBJECT_TYPE_ATTRIBUTE_INFO:
-		return parse_dataobj_attribute_info;
-	case STK_DATA_OBJECT_TYPE_SERVICE_AVAILABILITY:
-		return parse_dataobj_service_availability;
-	case STK_DATA_OBJECT_TYPE_REMOTE_ENTITY_ADDRESS:
-		return parse_dataobj_remote_entity_address;
-	case STK_DATA_OBJECT_TYPE_ESN:
-		return parse_dataobj_esn;
-	case STK_DATA_OBJECT_TYPE_NETWORK_ACCESS_NAME:
-		return parse_dataobj_network_access_name;
-	case STK_DATA_OBJECT_TYPE_CDMA_SMS_TPDU:
-		return parse_dataobj_cdma_sms_tpdu;
-	case STK_DATA_OBJECT_TYPE_TEXT_ATTRIBUTE:
-		return parse_dataobj_text_attr;
-	case STK_DATA_OBJECT_TYPE_PDP_ACTIVATION_PARAMETER:
-		return parse_dataobj_pdp_act_par;
-	case STK_DATA_OBJECT_TYPE_ITEM_TEXT_ATTRIBUTE_LIST:
-		return parse_dataobj_item_text_attribute_list;
-	case STK_DATA_OBJECT_TYPE_UTRAN_MEASUREMENT_QUALIFIER:
-		return parse_dataobj_utran_meas_qualifier;
-	case STK_DATA_OBJECT_TYPE_IMEISV:
-		return parse_dataobj_imeisv;
-	case STK_DATA_OBJECT_TYPE_NETWORK_SEARCH_MODE:
-		return parse_dataobj_network_search_mode;
-	case STK_DATA_OBJECT_TYPE_BATTERY_STATE:
-		return parse_dataobj_battery_state;
-	case STK_DATA_OBJECT_TYPE_BROWSING_STATUS:
-		return parse_dataobj_browsing_status;
-	case STK_DATA_OBJECT_TYPE_FRAME_LAYOUT:
-		return parse_dataobj_frame_layout;
-	case STK_DATA_OBJECT_TYPE_FRAMES_INFO:
-		return parse_dataobj_frames_info;
-	case STK_DATA_OBJECT_TYPE_FRAME_ID:
-		return parse_dataobj_frame_id;
-	case STK_DATA_OBJECT_TYPE_MEID:
-		return parse_dataobj_meid;
-	case STK_DATA_OBJECT_TYPE_MMS_REFERENCE:
-		return parse_dataobj_mms_reference;
-	case STK_DATA_OBJECT_TYPE_MMS_ID:
-		return parse_dataobj_mms_id;
-	case STK_DATA_OBJECT_TYPE_MMS_TRANSFER_STATUS:
-		return parse_dataobj_mms_transfer_status;
-	case STK_DATA_OBJECT_TYPE_MMS_CONTENT_ID:
-		return parse_dataobj_mms_content_id;
-	case STK_DATA_OBJECT_TYPE_MMS_NOTIFICATION:
-		return parse_dataobj_mms_notification;
-	case STK_DATA_OBJECT_TYPE_LAST_ENVELOPE:
-		return parse_dataobj_last_envelope;
-	case STK_DATA_OBJECT_TYPE_REGISTRY_APPLICATION_DATA:
-		return parse_dataobj_registry_application_data;
-	case STK_DATA_OBJECT_TYPE_ACTIVATE_DESCRIPTOR:
-		return parse_dataobj_activate_descriptor;
-	case STK_DATA_OBJECT_TYPE_BROADCAST_NETWORK_INFO:
-		return parse_dataobj_broadcast_network_info;
-	default:
+	if (type >= G_N_ELEMENTS(dataobj_handlers))
 		return NULL;
-	}
-}
 
-static void destroy_stk_item(gpointer pointer)
-{
-	struct stk_item *item = pointer;
-	g_free(item->text);
-	g_free(item);
+	return dataobj_handlers[type];
 }
 
 static gboolean parse_item_list(struct comprehension_tlv_iter *iter,
@@ -2281,8 +2318,8 @@ static gboolean parse_item_list(struct comprehension_tlv_iter *iter,
 				continue;
 			}
 
-			list = g_slist_prepend(list,
-						g_memdup(&item, sizeof(item)));
+			list = stk_arena_slist_prepend(list,
+					stk_arena_memdup(&item, sizeof(item)));
 		}
 	} while (comprehension_tlv_iter_next(iter) == TRUE &&
 			comprehension_tlv_iter_get_tag(iter) == tag);
@@ -2297,7 +2334,6 @@ static gboolean parse_item_list(struct comprehension_tlv_iter *iter,
 	if (count == 1)
 		return TRUE;
 
-	g_slist_free_full(list, destroy_stk_item);
 	return FALSE;
 
 }
@@ -2317,8 +2353,8 @@ static gboolean parse_provisioning_list(struct comprehension_tlv_iter *iter,
 
 		if (parse_dataobj_provisioning_file_reference(iter, &file)
 									== TRUE)
-			list = g_slist_prepend(list,
-						g_memdup(&file, sizeof(file)));
+			list = stk_arena_slist_prepend(list,
+					stk_arena_memdup(&file, sizeof(file)));
 	} while (comprehension_tlv_iter_next(iter) == TRUE &&
 			comprehension_tlv_iter_get_tag(iter) == tag);
 
@@ -2340,6 +2376,9 @@ static dataobj_handler list_handler_for_type(enum stk_data_object_type type)
 	}
 }
 
+/* The most data objects any proactive command lists is 12 (Launch Browser) */
+#define DATAOBJ_MAX_ENTRIES	16
+
 struct dataobj_handler_entry {
 	enum stk_data_object_type type;
 	int flags;
@@ -2350,8 +2389,10 @@ static enum stk_command_parse_result parse_dataobj(
 					struct comprehension_tlv_iter *iter,
 					enum stk_data_object_type type, ...)
 {
-	GSList *entries = NULL;
-	GSList *l;
+	struct dataobj_handler_entry entries[DATAOBJ_MAX_ENTRIES];
+	unsigned int n_entries = 0;
+	unsigned int next = 0;
+	unsigned int i;
 	va_list args;
 	gboolean minimum_set = TRUE;
 	gboolean parse_error = FALSE;
@@ -2361,40 +2402,39 @@ static enum stk_command_parse_result parse_dataobj(
 	while (type != STK_DATA_OBJECT_TYPE_INVALID) {
 		struct dataobj_handler_entry *entry;
 
-		entry = g_new0(struct dataobj_handler_entry, 1);
+		if (n_entries == DATAOBJ_MAX_ENTRIES) {
+			va_end(args);
+			return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
+		}
+
+		entry = &entries[n_entries++];
 
 		entry->type = type;
 		entry->flags = va_arg(args, int);
 		entry->data = va_arg(args, void *);
 
 		type = va_arg(args, enum stk_data_object_type);
-		entries = g_slist_prepend(entries, entry);
 	}
 
 	va_end(args);
 
-	entries = g_slist_reverse(entries);
-
-	l = entries;
 	while (comprehension_tlv_iter_next(iter) == TRUE) {
 		dataobj_handler handler;
-		struct dataobj_handler_entry *entry;
-		GSList *l2;
-
-		for (l2 = l; l2; l2 = l2->next) {
-			entry = l2->data;
+		struct dataobj_handler_entry *entry = NULL;
 
-			if (comprehension_tlv_iter_get_tag(iter) == entry->type)
+		for (i = next; i < n_entries; i++) {
+			if (comprehension_tlv_iter_get_tag(iter) ==
+					entries[i].type) {
+				entry = &entries[i];
 				break;
+			}
 
 			/* Can't skip over mandatory objects */
-			if (entry->flags & DATAOBJ_FLAG_MANDATORY) {
-				l2 = NULL;
+			if (entries[i].flags & DATAOBJ_FLAG_MANDATORY)
 				break;
-			}
 		}
 
-		if (l2 == NULL) {
+		if (entry == NULL) {
 			if (comprehension_tlv_get_cr(iter) == TRUE)
 				parse_error = TRUE;
 
@@ -2409,18 +2449,14 @@ static enum stk_command_parse_result parse_dataobj(
 		if (handler(iter, entry->data) == FALSE)
 			parse_error = TRUE;
 
-		l = l2->next;
+		next = i + 1;
 	}
 
-	for (; l; l = l->next) {
-		struct dataobj_handler_entry *entry = l->data;
-
-		if (entry->flags & DATAOBJ_FLAG_MANDATORY)
+	for (i = next; i < n_entries; i++) {
+		if (entries[i].flags & DATAOBJ_FLAG_MANDATORY)
 			minimum_set = FALSE;
 	}
 
-	g_slist_free_full(entries, g_free);
-
 	if (minimum_set == FALSE)
 		return STK_PARSE_RESULT_MISSING_VALUE;
 	if (parse_error == TRUE)
@@ -2429,11 +2465,6 @@ static enum stk_command_parse_result parse_dataobj(
 	return STK_PARSE_RESULT_OK;
 }
 
-static void destroy_display_text(struct stk_command *command)
-{
-	g_free(command->display_text.text);
-}
-
 static enum stk_command_parse_result parse_display_text(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2447,8 +2478,6 @@ static enum stk_command_parse_result parse_display_text(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_DISPLAY)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_display_text;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_TEXT,
 				DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
 				&obj->text,
@@ -2469,11 +2498,6 @@ static enum stk_command_parse_result parse_display_text(
 	return status;
 }
 
-static void destroy_get_inkey(struct stk_command *command)
-{
-	g_free(command->get_inkey.text);
-}
-
 static enum stk_command_parse_result parse_get_inkey(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2487,8 +2511,6 @@ static enum stk_command_parse_result parse_get_inkey(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_get_inkey;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_TEXT,
 				DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
 				&obj->text,
@@ -2507,12 +2529,6 @@ static enum stk_command_parse_result parse_get_inkey(
 	return status;
 }
 
-static void destroy_get_input(struct stk_command *command)
-{
-	g_free(command->get_input.text);
-	g_free(command->get_input.default_text);
-}
-
 static enum stk_command_parse_result parse_get_input(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2526,8 +2542,6 @@ static enum stk_command_parse_result parse_get_input(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_get_input;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_TEXT,
 				DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
 				&obj->text,
@@ -2562,11 +2576,6 @@ static enum stk_command_parse_result parse_more_time(
 	return STK_PARSE_RESULT_OK;
 }
 
-static void destroy_play_tone(struct stk_command *command)
-{
-	g_free(command->play_tone.alpha_id);
-}
-
 static enum stk_command_parse_result parse_play_tone(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2580,8 +2589,6 @@ static enum stk_command_parse_result parse_play_tone(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_EARPIECE)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_play_tone;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_TONE, 0,
@@ -2619,12 +2626,6 @@ static enum stk_command_parse_result parse_poll_interval(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_setup_menu(struct stk_command *command)
-{
-	g_free(command->setup_menu.alpha_id);
-	g_slist_free_full(command->setup_menu.items, destroy_stk_item);
-}
-
 static enum stk_command_parse_result parse_setup_menu(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2638,8 +2639,6 @@ static enum stk_command_parse_result parse_setup_menu(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_setup_menu;
-
 	status = parse_dataobj(iter,
 			STK_DATA_OBJECT_TYPE_ALPHA_ID,
 			DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
@@ -2664,12 +2663,6 @@ static enum stk_command_parse_result parse_setup_menu(
 	return status;
 }
 
-static void destroy_select_item(struct stk_command *command)
-{
-	g_free(command->select_item.alpha_id);
-	g_slist_free_full(command->select_item.items, destroy_stk_item);
-}
-
 static enum stk_command_parse_result parse_select_item(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2705,8 +2698,6 @@ static enum stk_command_parse_result parse_select_item(
 			&obj->frame_id,
 			STK_DATA_OBJECT_TYPE_INVALID);
 
-	command->destructor = destroy_select_item;
-
 	if (status == STK_PARSE_RESULT_OK && obj->items == NULL)
 		status = STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
@@ -2715,12 +2706,6 @@ static enum stk_command_parse_result parse_select_item(
 	return status;
 }
 
-static void destroy_send_sms(struct stk_command *command)
-{
-	g_free(command->send_sms.alpha_id);
-	g_free(command->send_sms.cdma_sms.array);
-}
-
 static enum stk_command_parse_result parse_send_sms(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2753,8 +2738,6 @@ static enum stk_command_parse_result parse_send_sms(
 				&obj->frame_id,
 				STK_DATA_OBJECT_TYPE_INVALID);
 
-	command->destructor = destroy_send_sms;
-
 	if (status != STK_PARSE_RESULT_OK)
 		goto out;
 
@@ -2815,17 +2798,9 @@ set_addr:
 	obj->gsm_sms.sc_addr.number_type = (sc_address.ton_npi >> 4) & 7;
 
 out:
-	g_free(sc_address.number);
-
 	return status;
 }
 
-static void destroy_send_ss(struct stk_command *command)
-{
-	g_free(command->send_ss.alpha_id);
-	g_free(command->send_ss.ss.ss);
-}
-
 static enum stk_command_parse_result parse_send_ss(struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
 {
@@ -2837,8 +2812,6 @@ static enum stk_command_parse_result parse_send_ss(struct stk_command *command,
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_NETWORK)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_send_ss;
-
 	return parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_SS_STRING,
@@ -2853,11 +2826,6 @@ static enum stk_command_parse_result parse_send_ss(struct stk_command *command,
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_send_ussd(struct stk_command *command)
-{
-	g_free(command->send_ussd.alpha_id);
-}
-
 static enum stk_command_parse_result parse_send_ussd(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2870,8 +2838,6 @@ static enum stk_command_parse_result parse_send_ussd(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_NETWORK)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_send_ussd;
-
 	return parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_USSD_STRING,
@@ -2886,13 +2852,6 @@ static enum stk_command_parse_result parse_send_ussd(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_setup_call(struct stk_command *command)
-{
-	g_free(command->setup_call.alpha_id_usr_cfm);
-	g_free(command->setup_call.addr.number);
-	g_free(command->setup_call.alpha_id_call_setup);
-}
-
 static enum stk_command_parse_result parse_setup_call(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2906,8 +2865,6 @@ static enum stk_command_parse_result parse_setup_call(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_NETWORK)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_setup_call;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id_usr_cfm,
 				STK_DATA_OBJECT_TYPE_ADDRESS,
@@ -2940,12 +2897,6 @@ static enum stk_command_parse_result parse_setup_call(
 	return status;
 }
 
-static void destroy_refresh(struct stk_command *command)
-{
-	g_slist_free_full(command->refresh.file_list, g_free);
-	g_free(command->refresh.alpha_id);
-}
-
 static enum stk_command_parse_result parse_refresh(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -2959,8 +2910,6 @@ static enum stk_command_parse_result parse_refresh(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_refresh;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_FILE_LIST, 0,
 				&obj->file_list,
 				STK_DATA_OBJECT_TYPE_AID, 0,
@@ -3120,11 +3069,6 @@ static enum stk_command_parse_result parse_timer_mgmt(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_setup_idle_mode_text(struct stk_command *command)
-{
-	g_free(command->setup_idle_mode_text.text);
-}
-
 static enum stk_command_parse_result parse_setup_idle_mode_text(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3139,8 +3083,6 @@ static enum stk_command_parse_result parse_setup_idle_mode_text(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_setup_idle_mode_text;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_TEXT,
 				DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
 				&obj->text,
@@ -3157,12 +3099,6 @@ static enum stk_command_parse_result parse_setup_idle_mode_text(
 	return status;
 }
 
-static void destroy_run_at_command(struct stk_command *command)
-{
-	g_free(command->run_at_command.alpha_id);
-	g_free(command->run_at_command.at_command);
-}
-
 static enum stk_command_parse_result parse_run_at_command(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3176,8 +3112,6 @@ static enum stk_command_parse_result parse_run_at_command(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_run_at_command;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_AT_COMMAND,
@@ -3196,12 +3130,6 @@ static enum stk_command_parse_result parse_run_at_command(
 	return status;
 }
 
-static void destroy_send_dtmf(struct stk_command *command)
-{
-	g_free(command->send_dtmf.alpha_id);
-	g_free(command->send_dtmf.dtmf);
-}
-
 static enum stk_command_parse_result parse_send_dtmf(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3215,8 +3143,6 @@ static enum stk_command_parse_result parse_send_dtmf(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_NETWORK)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_send_dtmf;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_DTMF_STRING,
@@ -3253,18 +3179,6 @@ static enum stk_command_parse_result parse_language_notification(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_launch_browser(struct stk_command *command)
-{
-	g_free(command->launch_browser.url);
-	g_free(command->launch_browser.bearer.array);
-	g_slist_free_full(command->launch_browser.prov_file_refs, g_free);
-	g_free(command->launch_browser.text_gateway_proxy_id);
-	g_free(command->launch_browser.alpha_id);
-	g_free(command->launch_browser.network_name.array);
-	g_free(command->launch_browser.text_usr);
-	g_free(command->launch_browser.text_passwd);
-}
-
 static enum stk_command_parse_result parse_launch_browser(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3280,8 +3194,6 @@ static enum stk_command_parse_result parse_launch_browser(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_launch_browser;
-
 	return parse_dataobj(iter,
 				STK_DATA_OBJECT_TYPE_BROWSER_ID, 0,
 				&obj->browser_id,
@@ -3312,14 +3224,6 @@ static enum stk_command_parse_result parse_launch_browser(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_open_channel(struct stk_command *command)
-{
-	g_free(command->open_channel.alpha_id);
-	g_free(command->open_channel.apn);
-	g_free(command->open_channel.text_usr);
-	g_free(command->open_channel.text_passwd);
-}
-
 static enum stk_command_parse_result parse_open_channel(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3336,8 +3240,6 @@ static enum stk_command_parse_result parse_open_channel(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_open_channel;
-
 	/*
 	 * parse the Open Channel data objects related to packet data service
 	 * bearer
@@ -3376,11 +3278,6 @@ static enum stk_command_parse_result parse_open_channel(
 	return status;
 }
 
-static void destroy_close_channel(struct stk_command *command)
-{
-	g_free(command->close_channel.alpha_id);
-}
-
 static enum stk_command_parse_result parse_close_channel(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3395,8 +3292,6 @@ static enum stk_command_parse_result parse_close_channel(
 			(command->dst > STK_DEVICE_IDENTITY_TYPE_CHANNEL_7))
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_close_channel;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3412,11 +3307,6 @@ static enum stk_command_parse_result parse_close_channel(
 	return status;
 }
 
-static void destroy_receive_data(struct stk_command *command)
-{
-	g_free(command->receive_data.alpha_id);
-}
-
 static enum stk_command_parse_result parse_receive_data(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3431,8 +3321,6 @@ static enum stk_command_parse_result parse_receive_data(
 			(command->dst > STK_DEVICE_IDENTITY_TYPE_CHANNEL_7))
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_receive_data;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3451,12 +3339,6 @@ static enum stk_command_parse_result parse_receive_data(
 	return status;
 }
 
-static void destroy_send_data(struct stk_command *command)
-{
-	g_free(command->send_data.alpha_id);
-	g_free(command->send_data.data.array);
-}
-
 static enum stk_command_parse_result parse_send_data(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3474,8 +3356,6 @@ static enum stk_command_parse_result parse_send_data(
 			(command->dst > STK_DEVICE_IDENTITY_TYPE_CHANNEL_7))
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_send_data;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3507,13 +3387,6 @@ static enum stk_command_parse_result parse_get_channel_status(
 	return STK_PARSE_RESULT_OK;
 }
 
-static void destroy_service_search(struct stk_command *command)
-{
-	g_free(command->service_search.alpha_id);
-	g_free(command->service_search.serv_search.ser_search);
-	g_free(command->service_search.dev_filter.dev_filter);
-}
-
 static enum stk_command_parse_result parse_service_search(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3526,8 +3399,6 @@ static enum stk_command_parse_result parse_service_search(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_service_search;
-
 	return parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3544,12 +3415,6 @@ static enum stk_command_parse_result parse_service_search(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_get_service_info(struct stk_command *command)
-{
-	g_free(command->get_service_info.alpha_id);
-	g_free(command->get_service_info.attr_info.attr_info);
-}
-
 static enum stk_command_parse_result parse_get_service_info(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3562,8 +3427,6 @@ static enum stk_command_parse_result parse_get_service_info(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_get_service_info;
-
 	return parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3578,11 +3441,6 @@ static enum stk_command_parse_result parse_get_service_info(
 				STK_DATA_OBJECT_TYPE_INVALID);
 }
 
-static void destroy_declare_service(struct stk_command *command)
-{
-	g_free(command->declare_service.serv_rec.serv_rec);
-}
-
 static enum stk_command_parse_result parse_declare_service(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3595,8 +3453,6 @@ static enum stk_command_parse_result parse_declare_service(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_declare_service;
-
 	return parse_dataobj(iter, STK_DATA_OBJECT_TYPE_SERVICE_RECORD,
 				DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
 				&obj->serv_rec,
@@ -3640,12 +3496,6 @@ static enum stk_command_parse_result parse_get_frames_status(
 	return STK_PARSE_RESULT_OK;
 }
 
-static void destroy_retrieve_mms(struct stk_command *command)
-{
-	g_free(command->retrieve_mms.alpha_id);
-	g_slist_free_full(command->retrieve_mms.mms_rec_files, g_free);
-}
-
 static enum stk_command_parse_result parse_retrieve_mms(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3659,8 +3509,6 @@ static enum stk_command_parse_result parse_retrieve_mms(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_NETWORK)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_retrieve_mms;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3687,12 +3535,6 @@ static enum stk_command_parse_result parse_retrieve_mms(
 	return status;
 }
 
-static void destroy_submit_mms(struct stk_command *command)
-{
-	g_free(command->submit_mms.alpha_id);
-	g_slist_free_full(command->submit_mms.mms_subm_files, g_free);
-}
-
 static enum stk_command_parse_result parse_submit_mms(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3706,8 +3548,6 @@ static enum stk_command_parse_result parse_submit_mms(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_NETWORK)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_submit_mms;
-
 	status = parse_dataobj(iter, STK_DATA_OBJECT_TYPE_ALPHA_ID, 0,
 				&obj->alpha_id,
 				STK_DATA_OBJECT_TYPE_ICON_ID, 0,
@@ -3728,11 +3568,6 @@ static enum stk_command_parse_result parse_submit_mms(
 	return status;
 }
 
-static void destroy_display_mms(struct stk_command *command)
-{
-	g_slist_free_full(command->display_mms.mms_subm_files, g_free);
-}
-
 static enum stk_command_parse_result parse_display_mms(
 					struct stk_command *command,
 					struct comprehension_tlv_iter *iter)
@@ -3745,8 +3580,6 @@ static enum stk_command_parse_result parse_display_mms(
 	if (command->dst != STK_DEVICE_IDENTITY_TYPE_TERMINAL)
 		return STK_PARSE_RESULT_DATA_NOT_UNDERSTOOD;
 
-	command->destructor = destroy_display_mms;
-
 	return parse_dataobj(iter, STK_DATA_OBJECT_TYPE_FILE_LIST,
 				DATAOBJ_FLAG_MANDATORY | DATAOBJ_FLAG_MINIMUM,
 				&obj->mms_subm_files,
@@ -3903,7 +3736,11 @@ struct stk_command *stk_command_new_from_pdu(const unsigned char *pdu,
 
 	data = comprehension_tlv_iter_get_data(&iter);
 
-	command = g_new0(struct stk_command, 1);
+	decode_arena = NULL;
+
+	command = stk_arena_alloc0(sizeof(struct stk_command));
+	if (command == NULL)
+		return NULL;
 
 	command->number = data[0];
 	command->type = data[1];
@@ -3933,15 +3770,16 @@ struct stk_command *stk_command_new_from_pdu(const unsigned char *pdu,
 	command->status = parse_command_body(command, &iter);
 
 out:
+	command->arena = decode_arena;
+	decode_arena = NULL;
+
 	return command;
 }
 
 void stk_command_free(struct stk_command *command)
 {
-	if (command->destructor)
-		command->destructor(command);
-
-	g_free(command);
+	/* The command itself lives in one of the blocks */
+	stk_arena_free(command->arena);
 }
 
 static gboolean stk_tlv_builder_init(struct stk_tlv_builder *iter,
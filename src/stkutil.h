@@ -1447,7 +1447,8 @@ struct stk_command {
 		struct stk_command_activate activate;
 	};
 
-	void (*destructor)(struct stk_command *command);
+	/* Owns the command along with all the strings and lists it holds */
+	struct stk_arena *arena;
 };
 
 /* TERMINAL RESPONSEs defined in TS 102.223 Section 6.8 */
@@ -159,6 +159,65 @@ error_create_dirs:
 	return r;
 }
 
+/*
+ * Settings writes are held back for a short while, so that a burst of
+ * property changes only costs a single rewrite of the file.  Keyfiles
+ * are kept by pointer, their owners always release them through
+ * storage_close() which writes out anything still pending.
+ */
+#define STORAGE_SYNC_INTERVAL 2
+
+static GHashTable *pending_syncs;
+static guint pending_source;
+static unsigned int sync_interval = STORAGE_SYNC_INTERVAL;
+static unsigned int coalesced_writes;
+
+static char *storage_path(const char *imsi, const char *store)
+{
+	if (imsi)
+		return g_strdup_printf(STORAGEDIR "/%s/%s", imsi, store);
+
+	return g_strdup_printf(STORAGEDIR "/%s", store);
+}
+
+static void write_keyfile(const char *path, GKeyFile *keyfile)
+{
+	char *data;
+	gsize length = 0;
+
+	if (create_dirs(path, S_IRUSR | S_IWUSR | S_IXUSR) != 0)
+		return;
+
+	data = g_key_file_to_data(keyfile, &length, NULL);
+
+	g_file_set_contents(path, data, length, NULL);
+
+	g_free(data);
+}
+
+static gboolean pending_sync_timeout(gpointer user_data)
+{
+	pending_source = 0;
+
+	storage_flush();
+
+	return FALSE;
+}
+
+/* Returns TRUE if a write of @keyfile to @path was pending */
+static gboolean cancel_pending_sync(const char *path, GKeyFile *keyfile)
+{
+	if (pending_syncs == NULL)
+		return FALSE;
+
+	if (g_hash_table_lookup(pending_syncs, path) != keyfile)
+		return FALSE;
+
+	g_hash_table_remove(pending_syncs, path);
+
+	return TRUE;
+}
+
 GKeyFile *storage_open(const char *imsi, const char *store)
 {
 	GKeyFile *keyfile;
@@ -167,10 +226,7 @@ GKeyFile *storage_open(const char *imsi, const char *store)
 	if (store == NULL)
 		return NULL;
 
-	if (imsi)
-		path = g_strdup_printf(STORAGEDIR "/%s/%s", imsi, store);
-	else
-		path = g_strdup_printf(STORAGEDIR "/%s", store);
+	path = storage_path(imsi, store);
 
 	keyfile = g_key_file_new();
 
@@ -185,35 +241,75 @@ GKeyFile *storage_open(const char *imsi, const char *store)
 void storage_sync(const char *imsi, const char *store, GKeyFile *keyfile)
 {
 	char *path;
-	char *data;
-	gsize length = 0;
-
-	if (imsi)
-		path = g_strdup_printf(STORAGEDIR "/%s/%s", imsi, store);
-	else
-		path = g_strdup_printf(STORAGEDIR "/%s", store);
 
+	path = storage_path(imsi, store);
 	if (path == NULL)
 		return;
 
-	if (create_dirs(path, S_IRUSR | S_IWUSR | S_IXUSR) != 0) {
+	if (sync_interval == 0) {
+		write_keyfile(path, keyfile);
 		g_free(path);
 		return;
 	}
 
-	data = g_key_file_to_data(keyfile, &length, NULL);
+	if (pending_syncs == NULL)
+		pending_syncs = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
 
-	g_file_set_contents(path, data, length, NULL);
+	if (g_hash_table_lookup(pending_syncs, path) != NULL)
+		coalesced_writes += 1;
 
-	g_free(data);
-	g_free(path);
+	/* Takes ownership of path */
+	g_hash_table_insert(pending_syncs, path, keyfile);
+
+	if (pending_source == 0)
+		pending_source = g_timeout_add_seconds(sync_interval,
+							pending_sync_timeout,
+							NULL);
 }
 
 void storage_close(const char *imsi, const char *store, GKeyFile *keyfile,
 			gboolean save)
 {
-	if (save == TRUE)
-		storage_sync(imsi, store, keyfile);
+	char *path = storage_path(imsi, store);
 
+	/* Writes already requested through storage_sync() still happen */
+	if (path && (cancel_pending_sync(path, keyfile) || save == TRUE))
+		write_keyfile(path, keyfile);
+
+	g_free(path);
 	g_key_file_free(keyfile);
 }
+
+void storage_flush(void)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	if (pending_source > 0) {
+		g_source_remove(pending_source);
+		pending_source = 0;
+	}
+
+	if (pending_syncs == NULL)
+		return;
+
+	g_hash_table_iter_init(&iter, pending_syncs);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		write_keyfile(key, value);
+		g_hash_table_iter_remove(&iter);
+	}
+}
+
+void storage_set_sync_interval(unsigned int seconds)
+{
+	storage_flush();
+
+	sync_interval = seconds;
+}
+
+unsigned int storage_get_coalesced_writes(void)
+{
+	return coalesced_writes;
+}
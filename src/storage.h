@@ -42,3 +42,7 @@ GKeyFile *storage_open(const char *imsi, const char *store);
 void storage_sync(const char *imsi, const char *store, GKeyFile *keyfile);
 void storage_close(const char *imsi, const char *store, GKeyFile *keyfile,
 			gboolean save);
+
+void storage_flush(void);
+void storage_set_sync_interval(unsigned int seconds);
+unsigned int storage_get_coalesced_writes(void);
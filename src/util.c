@@ -68,6 +68,13 @@
 #define TABLE_SIZE(t) \
 	(sizeof((t)) / sizeof(struct codepoint))
 
+/*
+ * All codepoints in the tables below, but for the Euro and infinity
+ * signs, fit in this range and are looked up in a direct table.
+ */
+#define UNICODE_DENSE_SIZE	0x0400
+#define GSM_DIALECT_COUNT	(GSM_DIALECT_PORTUGUESE + 1)
+
 struct codepoint {
 	unsigned short from;
 	unsigned short to;
@@ -88,6 +95,11 @@ struct conversion_table {
 	/* To GSM single shift table */
 	const struct codepoint *single_g;
 	unsigned int single_len_g;
+
+	/* Direct lookup versions of the above, see dense_tables_init */
+	const unsigned short *locking_dense_u;
+	const unsigned short *single_dense_u;
+	const unsigned short *single_dense_g;
 };
 
 /* GSM to Unicode extension table, for GSM sequences starting with 0x1B */
@@ -483,14 +495,20 @@ static unsigned short gsm_locking_shift_lookup(struct conversion_table *t,
 static unsigned short gsm_single_shift_lookup(struct conversion_table *t,
 						unsigned char k)
 {
-	struct codepoint key = { k, 0 };
-	return codepoint_lookup(&key, t->single_g, t->single_len_g);
+	if (k > 0x7f)
+		return GUND;
+
+	return t->single_dense_g[k];
 }
 
 static unsigned short unicode_locking_shift_lookup(struct conversion_table *t,
 							unsigned short k)
 {
 	struct codepoint key = { k, 0 };
+
+	if (k < UNICODE_DENSE_SIZE)
+		return t->locking_dense_u[k];
+
 	return codepoint_lookup(&key, t->locking_u, t->locking_len_u);
 }
 
@@ -498,9 +516,71 @@ static unsigned short unicode_single_shift_lookup(struct conversion_table *t,
 							unsigned short k)
 {
 	struct codepoint key = { k, 0 };
+
+	if (k < UNICODE_DENSE_SIZE)
+		return t->single_dense_u[k];
+
 	return codepoint_lookup(&key, t->single_u, t->single_len_u);
 }
 
+static unsigned short unicode_lookup(struct conversion_table *t,
+					unsigned short k)
+{
+	unsigned short converted = unicode_locking_shift_lookup(t, k);
+
+	if (converted == GUND)
+		converted = unicode_single_shift_lookup(t, k);
+
+	return converted;
+}
+
+static void dense_table_fill(unsigned short *dense, unsigned int size,
+				const struct codepoint *table, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		dense[i] = GUND;
+
+	for (i = 0; i < len; i++)
+		if (table[i].from < size)
+			dense[table[i].from] = table[i].to;
+}
+
+/*
+ * Every character converted used to cost a bsearch in one or two of the
+ * sorted tables.  The first conversion using a dialect expands its tables
+ * into direct lookup ones, which are then shared by all later calls.
+ */
+static void dense_tables_init(struct conversion_table *t,
+				enum gsm_dialect locking,
+				enum gsm_dialect single)
+{
+	static unsigned short locking_u[GSM_DIALECT_COUNT][UNICODE_DENSE_SIZE];
+	static unsigned short single_u[GSM_DIALECT_COUNT][UNICODE_DENSE_SIZE];
+	static unsigned short single_g[GSM_DIALECT_COUNT][0x80];
+	static gboolean locking_ready[GSM_DIALECT_COUNT];
+	static gboolean single_ready[GSM_DIALECT_COUNT];
+
+	if (locking_ready[locking] == FALSE) {
+		dense_table_fill(locking_u[locking], UNICODE_DENSE_SIZE,
+					t->locking_u, t->locking_len_u);
+		locking_ready[locking] = TRUE;
+	}
+
+	if (single_ready[single] == FALSE) {
+		dense_table_fill(single_u[single], UNICODE_DENSE_SIZE,
+					t->single_u, t->single_len_u);
+		dense_table_fill(single_g[single], 0x80,
+					t->single_g, t->single_len_g);
+		single_ready[single] = TRUE;
+	}
+
+	t->locking_dense_u = locking_u[locking];
+	t->single_dense_u = single_u[single];
+	t->single_dense_g = single_g[single];
+}
+
 static gboolean populate_locking_shift(struct conversion_table *t,
 					enum gsm_dialect lang)
 {
@@ -570,8 +650,15 @@ static gboolean conversion_table_init(struct conversion_table *t,
 {
 	memset(t, 0, sizeof(struct conversion_table));
 
-	return populate_locking_shift(t, locking) &&
-			populate_single_shift(t, single);
+	if (populate_locking_shift(t, locking) == FALSE)
+		return FALSE;
+
+	if (populate_single_shift(t, single) == FALSE)
+		return FALSE;
+
+	dense_tables_init(t, locking, single);
+
+	return TRUE;
 }
 
 /*!
@@ -623,7 +710,7 @@ char *convert_gsm_to_utf8_with_lang(const unsigned char *text, long len,
 
 		if (text[i] == 0x1b) {
 			++i;
-			if (i >= len)
+			if (i >= len || text[i] > 0x7f)
 				goto error;
 
 			c = gsm_single_shift_lookup(&t, text[i]);
@@ -666,7 +753,10 @@ char *convert_gsm_to_utf8_with_lang(const unsigned char *text, long len,
 		} else
 			c = gsm_locking_shift_lookup(&t, text[i]);
 
-		out += g_unichar_to_utf8(c, out);
+		if (c < 0x80)
+			*out++ = c;
+		else
+			out += g_unichar_to_utf8(c, out);
 
 		++i;
 	}
@@ -694,6 +784,53 @@ char *convert_gsm_to_utf8(const unsigned char *text, long len,
 						GSM_DIALECT_DEFAULT);
 }
 
+/* Second pass of the UTF-8 to GSM conversion, text is known to be valid */
+static unsigned char *utf8_to_gsm_encode(struct conversion_table *t,
+						const char *text, long nchars,
+						long res_len,
+						unsigned char terminator,
+						long *items_written)
+{
+	const char *in = text;
+	unsigned char *res;
+	unsigned char *out;
+	long i;
+
+	res = g_try_malloc(res_len + (terminator ? 1 : 0));
+	if (res == NULL)
+		return NULL;
+
+	out = res;
+
+	for (i = 0; i < nchars; i++) {
+		unsigned short converted;
+		gunichar c = (unsigned char) *in;
+
+		if (c & 0x80)
+			c = g_utf8_get_char(in);
+
+		converted = unicode_lookup(t, c);
+
+		if (converted & 0x1b00) {
+			*out = 0x1b;
+			++out;
+		}
+
+		*out = converted;
+		++out;
+
+		in = g_utf8_next_char(in);
+	}
+
+	if (terminator)
+		*out = terminator;
+
+	if (items_written)
+		*items_written = out - res;
+
+	return res;
+}
+
 /*!
  * Converts UTF-8 encoded text to GSM alphabet.  The result is unpacked,
  * with the 7th bit always 0.  If terminator is not 0, a terminator character
@@ -713,10 +850,8 @@ unsigned char *convert_utf8_to_gsm_with_lang(const char *text, long len,
 	struct conversion_table t;
 	long nchars = 0;
 	const char *in;
-	unsigned char *out;
 	unsigned char *res = NULL;
 	long res_len;
-	long i;
 
 	if (conversion_table_init(&t, locking_lang, single_lang) == FALSE)
 		return NULL;
@@ -726,8 +861,12 @@ unsigned char *convert_utf8_to_gsm_with_lang(const char *text, long len,
 
 	while ((len < 0 || text + len - in > 0) && *in) {
 		long max = len < 0 ? 6 : text + len - in;
-		gunichar c = g_utf8_get_char_validated(in, max);
 		unsigned short converted = GUND;
+		gunichar c = (unsigned char) *in;
+
+		/* ASCII is always valid, skip the validation for it */
+		if (c & 0x80)
+			c = g_utf8_get_char_validated(in, max);
 
 		if (c & 0x80000000)
 			goto err_out;
@@ -735,10 +874,7 @@ unsigned char *convert_utf8_to_gsm_with_lang(const char *text, long len,
 		if (c > 0xffff)
 			goto err_out;
 
-		converted = unicode_locking_shift_lookup(&t, c);
-
-		if (converted == GUND)
-			converted = unicode_single_shift_lookup(&t, c);
+		converted = unicode_lookup(&t, c);
 
 		if (converted == GUND)
 			goto err_out;
@@ -752,38 +888,8 @@ unsigned char *convert_utf8_to_gsm_with_lang(const char *text, long len,
 		nchars += 1;
 	}
 
-	res = g_try_malloc(res_len + (terminator ? 1 : 0));
-	if (res == NULL)
-		goto err_out;
-
-	in = text;
-	out = res;
-	for (i = 0; i < nchars; i++) {
-		unsigned short converted;
-
-		gunichar c = g_utf8_get_char(in);
-
-		converted = unicode_locking_shift_lookup(&t, c);
-
-		if (converted == GUND)
-			converted = unicode_single_shift_lookup(&t, c);
-
-		if (converted & 0x1b00) {
-			*out = 0x1b;
-			++out;
-		}
-
-		*out = converted;
-		++out;
-
-		in = g_utf8_next_char(in);
-	}
-
-	if (terminator)
-		*out = terminator;
-
-	if (items_written)
-		*items_written = out - res;
+	res = utf8_to_gsm_encode(&t, text, nchars, res_len, terminator,
+					items_written);
 
 err_out:
 	if (items_read)
@@ -803,14 +909,83 @@ unsigned char *convert_utf8_to_gsm(const char *text, long len,
 						GSM_DIALECT_DEFAULT);
 }
 
+/*
+ * The dialect pairs convert_utf8_to_gsm_best_lang tries for a hint, in
+ * order of preference, along with a per codepoint mask of the pairs able
+ * to encode it: bit n if pair n can, bit n + 4 if it needs an escape.
+ */
+struct best_lang {
+	gboolean ready;
+	unsigned int count;
+	enum gsm_dialect locking[3];
+	enum gsm_dialect single[3];
+	struct conversion_table t[3];
+	guint8 masks[UNICODE_DENSE_SIZE];
+};
+
+static guint8 best_lang_mask(struct best_lang *b, unsigned short c)
+{
+	guint8 mask = 0;
+	unsigned int k;
+
+	for (k = 0; k < b->count; k++) {
+		unsigned short converted = unicode_lookup(&b->t[k], c);
+
+		if (converted == GUND)
+			continue;
+
+		mask |= 1 << k;
+
+		if (converted & 0x1b00)
+			mask |= 0x10 << k;
+	}
+
+	return mask;
+}
+
+static struct best_lang *best_lang_get(enum gsm_dialect hint)
+{
+	static struct best_lang cache[GSM_DIALECT_COUNT];
+	struct best_lang *b = &cache[hint];
+	unsigned int k;
+
+	if (b->ready)
+		return b;
+
+	b->count = 0;
+	b->locking[b->count] = GSM_DIALECT_DEFAULT;
+	b->single[b->count++] = GSM_DIALECT_DEFAULT;
+
+	if (hint != GSM_DIALECT_DEFAULT) {
+		b->locking[b->count] = GSM_DIALECT_DEFAULT;
+		b->single[b->count++] = hint;
+	}
+
+	/* Spanish dialect uses the default locking shift table */
+	if (hint != GSM_DIALECT_DEFAULT && hint != GSM_DIALECT_SPANISH) {
+		b->locking[b->count] = hint;
+		b->single[b->count++] = hint;
+	}
+
+	for (k = 0; k < b->count; k++)
+		conversion_table_init(&b->t[k], b->locking[k], b->single[k]);
+
+	for (k = 0; k < UNICODE_DENSE_SIZE; k++)
+		b->masks[k] = best_lang_mask(b, k);
+
+	b->ready = TRUE;
+
+	return b;
+}
+
 /*!
  * Converts UTF-8 encoded text to GSM alphabet. It finds an encoding
  * that uses the minimum set of GSM dialects based on the hint given.
  *
- * It first attempts to use the default dialect's single shift and
- * locking shift tables. It then tries with only the single shift
- * table of the hinted dialect, and finally with both the single shift
- * and locking shift tables of the hinted dialect.
+ * It prefers the default dialect's single shift and locking shift
+ * tables, then only the single shift table of the hinted dialect, and
+ * finally both the single shift and locking shift tables of the hinted
+ * dialect.  The text is only scanned once to pick the tables.
  *
  * Returns the encoded data or NULL if no suitable encoding could be
  * found. The data must be freed by the caller. If items_read is not
@@ -826,44 +1001,73 @@ unsigned char *convert_utf8_to_gsm_best_lang(const char *utf8, long len,
 					enum gsm_dialect *used_locking,
 					enum gsm_dialect *used_single)
 {
-	enum gsm_dialect locking = GSM_DIALECT_DEFAULT;
-	enum gsm_dialect single = GSM_DIALECT_DEFAULT;
-	unsigned char *encoded;
-
-	encoded = convert_utf8_to_gsm_with_lang(utf8, len, items_read,
-						items_written, terminator,
-						locking, single);
-	if (encoded != NULL)
-		goto out;
+	struct best_lang *b;
+	long escapes[3] = { 0, 0, 0 };
+	unsigned char *encoded = NULL;
+	const char *in = utf8;
+	long nchars = 0;
+	unsigned int allowed;
+	unsigned int k;
 
-	if (hint == GSM_DIALECT_DEFAULT)
-		return NULL;
+	/* Unknown hints could only ever use the default tables */
+	if ((unsigned int) hint >= GSM_DIALECT_COUNT)
+		hint = GSM_DIALECT_DEFAULT;
 
-	single = hint;
-	encoded = convert_utf8_to_gsm_with_lang(utf8, len, items_read,
-						items_written, terminator,
-						locking, single);
-	if (encoded != NULL)
-		goto out;
+	b = best_lang_get(hint);
+	allowed = (1 << b->count) - 1;
 
-	/* Spanish dialect uses the default locking shift table */
-	if (hint == GSM_DIALECT_SPANISH)
-		return NULL;
+	/*
+	 * Work out which of the dialect pairs can encode the whole text,
+	 * and how long each would make it, in a single pass.
+	 */
+	while ((len < 0 || utf8 + len - in > 0) && *in) {
+		long max = len < 0 ? 6 : utf8 + len - in;
+		gunichar c = (unsigned char) *in;
+		guint8 mask;
+
+		if (c & 0x80)
+			c = g_utf8_get_char_validated(in, max);
+
+		if (c & 0x80000000)
+			goto out;
 
-	locking = hint;
-	encoded = convert_utf8_to_gsm_with_lang(utf8, len, items_read,
-						items_written, terminator,
-						locking, single);
+		if (c > 0xffff)
+			goto out;
+
+		if (c < UNICODE_DENSE_SIZE)
+			mask = b->masks[c];
+		else
+			mask = best_lang_mask(b, c);
 
+		allowed &= mask;
+		if (allowed == 0)
+			goto out;
+
+		for (k = 0; k < b->count; k++)
+			escapes[k] += (mask >> (k + 4)) & 1;
+
+		in = g_utf8_next_char(in);
+		nchars += 1;
+	}
+
+	for (k = 0; (allowed & (1 << k)) == 0; k++)
+		;
+
+	encoded = utf8_to_gsm_encode(&b->t[k], utf8, nchars,
+					nchars + escapes[k], terminator,
+					items_written);
 	if (encoded == NULL)
-		return NULL;
+		goto out;
 
-out:
 	if (used_locking != NULL)
-		*used_locking = locking;
+		*used_locking = b->locking[k];
 
 	if (used_single != NULL)
-		*used_single = single;
+		*used_single = b->single[k];
+
+out:
+	if (items_read)
+		*items_read = in - utf8;
 
 	return encoded;
 }
@@ -1013,6 +1217,33 @@ char *encode_hex(const unsigned char *in, long len, unsigned char terminator)
 	return encode_hex_own_buf(in, len, terminator, buf);
 }
 
+/* Octet aligned groups of 7 octets hold exactly 8 septets */
+static inline void unpack_7bit_group(const unsigned char *in,
+					unsigned char *out)
+{
+	guint64 v = 0;
+	int k;
+
+	for (k = 0; k < 7; k++)
+		v |= (guint64) in[k] << (8 * k);
+
+	for (k = 0; k < 8; k++)
+		out[k] = (v >> (7 * k)) & 0x7f;
+}
+
+static inline void pack_7bit_group(const unsigned char *in,
+					unsigned char *out)
+{
+	guint64 v = 0;
+	int k;
+
+	for (k = 0; k < 8; k++)
+		v |= (guint64) in[k] << (7 * k);
+
+	for (k = 0; k < 7; k++)
+		out[k] = v >> (8 * k);
+}
+
 unsigned char *unpack_7bit_own_buf(const unsigned char *in, long len,
 					int byte_offset, gboolean ussd,
 					long max_to_unpack, long *items_written,
@@ -1032,6 +1263,17 @@ unsigned char *unpack_7bit_own_buf(const unsigned char *in, long len,
 		max_to_unpack = len * 8 / 7;
 
 	for (i = 0; (i < len) && ((out-buf) < max_to_unpack); i++) {
+		/* Whole groups are done a word at a time */
+		while (bits == 7 && len - i >= 7 &&
+				max_to_unpack - (out - buf) >= 8) {
+			unpack_7bit_group(in + i, out);
+			i += 7;
+			out += 8;
+		}
+
+		if (i == len || (out - buf) == max_to_unpack)
+			break;
+
 		/* Grab what we have in the current octet */
 		*out = (in[i] & ((1 << bits) - 1)) << (7 - bits);
 
@@ -1134,6 +1376,16 @@ unsigned char *pack_7bit_own_buf(const unsigned char *in, long len,
 	}
 
 	for (i = 0; i < len; i++) {
+		/* Whole groups are done a word at a time */
+		while (bits == 7 && len - i >= 8) {
+			pack_7bit_group(in + i, out);
+			i += 8;
+			out += 7;
+		}
+
+		if (i == len)
+			break;
+
 		if (bits != 7) {
 			*out |= (in[i] & ((1 << (7 - bits)) - 1)) <<
 					(bits + 1);
@@ -1306,7 +1558,7 @@ char *sim_string_to_utf8(const unsigned char *buffer, int length)
 
 		if (buffer[i] == 0x1b) {
 			++i;
-			if (i >= length)
+			if (i >= length || buffer[i] > 0x7f)
 				return NULL;
 
 			c = gsm_single_shift_lookup(&t, buffer[i++]);
@@ -1443,10 +1695,7 @@ unsigned char *convert_ucs2_to_gsm_with_lang(const unsigned char *text,
 		if (c > 0xffff)
 			goto err_out;
 
-		converted = unicode_locking_shift_lookup(&t, c);
-
-		if (converted == GUND)
-			converted = unicode_single_shift_lookup(&t, c);
+		converted = unicode_lookup(&t, c);
 
 		if (converted == GUND)
 			goto err_out;
@@ -1468,12 +1717,7 @@ unsigned char *convert_ucs2_to_gsm_with_lang(const unsigned char *text,
 
 	for (i = 0; i < len; i += 2) {
 		gunichar c = (in[i] << 8) | in[i + 1];
-		unsigned short converted = GUND;
-
-		converted = unicode_locking_shift_lookup(&t, c);
-
-		if (converted == GUND)
-			converted = unicode_single_shift_lookup(&t, c);
+		unsigned short converted = unicode_lookup(&t, c);
 
 		if (converted & 0x1b00) {
 			*out = 0x1b;
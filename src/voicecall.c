@@ -1214,6 +1214,9 @@ static void voicecalls_emit_call_removed(struct ofono_voicecall *vc,
 	const char *atompath = __ofono_atom_get_path(vc->atom);
 	const char *path = voicecall_build_path(vc, v->call);
 
+	__ofono_dbus_invalidate_reply(atompath,
+					OFONO_VOICECALL_MANAGER_INTERFACE);
+
 	g_dbus_emit_signal(conn, atompath, OFONO_VOICECALL_MANAGER_INTERFACE,
 				"CallRemoved", DBUS_TYPE_OBJECT_PATH, &path,
 				DBUS_TYPE_INVALID);
@@ -1231,6 +1234,8 @@ static void voicecalls_emit_call_added(struct ofono_voicecall *vc,
 
 	path = __ofono_atom_get_path(vc->atom);
 
+	__ofono_dbus_invalidate_reply(path, OFONO_VOICECALL_MANAGER_INTERFACE);
+
 	signal = dbus_message_new_signal(path,
 					OFONO_VOICECALL_MANAGER_INTERFACE,
 					"CallAdded");
@@ -2103,6 +2108,10 @@ static DBusMessage *manager_get_calls(DBusConnection *conn,
 	GSList *l;
 	struct voicecall *v;
 
+	reply = __ofono_dbus_cached_reply(msg);
+	if (reply != NULL)
+		return reply;
+
 	reply = dbus_message_new_method_return(msg);
 	if (reply == NULL)
 		return NULL;
@@ -2140,7 +2149,8 @@ static DBusMessage *manager_get_calls(DBusConnection *conn,
 
 	dbus_message_iter_close_container(&iter, &array);
 
-	return reply;
+	/* Also dropped when a property of one of the calls changes */
+	return __ofono_dbus_cache_reply(msg, reply, TRUE);
 }
 
 static const GDBusMethodTable manager_methods[] = {
@@ -2785,6 +2795,7 @@ static void voicecall_unregister(struct ofono_atom *atom)
 	vc->call_list = NULL;
 
 	ofono_modem_remove_interface(modem, OFONO_VOICECALL_MANAGER_INTERFACE);
+	__ofono_dbus_invalidate_reply(path, OFONO_VOICECALL_MANAGER_INTERFACE);
 	g_dbus_unregister_interface(conn, path,
 					OFONO_VOICECALL_MANAGER_INTERFACE);
 }
@@ -0,0 +1,252 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#define OFONO_API_SUBJECT_TO_CHANGE
+#include <ofono/modem.h>
+#include <ofono/gprs-provision.h>
+
+#include "plugins/mbpi.h"
+
+struct verify_data {
+	unsigned int checked;
+	unsigned int mismatches;
+};
+
+static gboolean option_version = FALSE;
+static gboolean option_verify = FALSE;
+static gint option_benchmark = 0;
+
+static GOptionEntry options[] = {
+	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
+				"Show version information and exit" },
+	{ "verify", 0, 0, G_OPTION_ARG_NONE, &option_verify,
+				"Compare every index lookup against the XML" },
+	{ "benchmark", 0, 0, G_OPTION_ARG_INT, &option_benchmark,
+				"Time N lookups with and without the index",
+				"N" },
+	{ NULL },
+};
+
+static gboolean str_same(const char *a, const char *b)
+{
+	return g_strcmp0(a, b) == 0;
+}
+
+static gboolean ap_same(const struct ofono_gprs_provision_data *a,
+				const struct ofono_gprs_provision_data *b)
+{
+	return str_same(a->name, b->name) && str_same(a->apn, b->apn) &&
+		str_same(a->username, b->username) &&
+		str_same(a->password, b->password) &&
+		str_same(a->message_proxy, b->message_proxy) &&
+		str_same(a->message_center, b->message_center) &&
+		a->type == b->type && a->proto == b->proto &&
+		a->auth_method == b->auth_method;
+}
+
+static void free_apns(GSList *apns)
+{
+	g_slist_free_full(apns, (GDestroyNotify) mbpi_ap_free);
+}
+
+static GSList *lookup_apn(const char *mcc, const char *mnc,
+				gboolean allow_duplicates, gboolean use_index,
+				char **message)
+{
+	GError *error = NULL;
+	GSList *apns;
+
+	mbpi_index_set_enabled(use_index);
+	apns = mbpi_lookup_apn(mcc, mnc, allow_duplicates, &error);
+	mbpi_index_set_enabled(TRUE);
+
+	*message = NULL;
+
+	if (error != NULL) {
+		*message = g_strdup(error->message);
+		g_error_free(error);
+	}
+
+	return apns;
+}
+
+static void verify_network(const char *mcc, const char *mnc,
+				gpointer user_data)
+{
+	struct verify_data *vd = user_data;
+	gboolean allow_duplicates;
+
+	for (allow_duplicates = FALSE; allow_duplicates <= TRUE;
+						allow_duplicates++) {
+		char *xml_message, *index_message;
+		GSList *xml, *index, *x, *i;
+
+		xml = lookup_apn(mcc, mnc, allow_duplicates, FALSE,
+					&xml_message);
+		index = lookup_apn(mcc, mnc, allow_duplicates, TRUE,
+					&index_message);
+
+		for (x = xml, i = index; x && i; x = x->next, i = i->next)
+			if (ap_same(x->data, i->data) == FALSE)
+				break;
+
+		if (x != NULL || i != NULL ||
+				str_same(xml_message, index_message) == FALSE) {
+			g_printerr("Mismatch for %s%s%s\n", mcc, mnc,
+					allow_duplicates ?
+					" (allowing duplicates)" : "");
+			vd->mismatches += 1;
+		}
+
+		vd->checked += 1;
+
+		free_apns(xml);
+		free_apns(index);
+		g_free(xml_message);
+		g_free(index_message);
+	}
+}
+
+static void verify_sid(const char *sid, gpointer user_data)
+{
+	struct verify_data *vd = user_data;
+	char *xml, *index;
+
+	mbpi_index_set_enabled(FALSE);
+	xml = mbpi_lookup_cdma_provider_name(sid, NULL);
+	mbpi_index_set_enabled(TRUE);
+	index = mbpi_lookup_cdma_provider_name(sid, NULL);
+
+	if (str_same(xml, index) == FALSE) {
+		g_printerr("Mismatch for SID %s\n", sid);
+		vd->mismatches += 1;
+	}
+
+	vd->checked += 1;
+
+	g_free(xml);
+	g_free(index);
+}
+
+static void collect_network(const char *mcc, const char *mnc,
+				gpointer user_data)
+{
+	GPtrArray *networks = user_data;
+
+	g_ptr_array_add(networks, g_strdup(mcc));
+	g_ptr_array_add(networks, g_strdup(mnc));
+}
+
+static gdouble benchmark(GPtrArray *networks, gboolean use_index)
+{
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+	int n;
+
+	for (n = 0; n < option_benchmark; n++) {
+		guint pick = (n % (networks->len / 2)) * 2;
+		char *message;
+
+		free_apns(lookup_apn(networks->pdata[pick],
+					networks->pdata[pick + 1], TRUE,
+					use_index, &message));
+		g_free(message);
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	struct verify_data vd;
+	GPtrArray *networks;
+	gdouble xml, index;
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (g_option_context_parse(context, &argc, &argv, &error) == FALSE) {
+		if (error != NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		} else
+			g_printerr("An unknown error occurred\n");
+		exit(1);
+	}
+
+	g_option_context_free(context);
+
+	if (option_version == TRUE) {
+		g_print("%s\n", VERSION);
+		exit(0);
+	}
+
+	if (mbpi_index_rebuild(&error) == FALSE) {
+		g_printerr("Building index failed: %s\n", error->message);
+		g_error_free(error);
+		exit(1);
+	}
+
+	networks = g_ptr_array_new_with_free_func(g_free);
+	mbpi_index_foreach_network(collect_network, networks);
+
+	g_print("Indexed %u networks\n", networks->len / 2);
+
+	if (option_verify == TRUE) {
+		memset(&vd, 0, sizeof(vd));
+
+		mbpi_index_foreach_network(verify_network, &vd);
+		mbpi_index_foreach_sid(verify_sid, &vd);
+
+		g_print("Verified %u lookups, %u mismatches\n",
+				vd.checked, vd.mismatches);
+
+		if (vd.mismatches > 0)
+			exit(1);
+	}
+
+	if (option_benchmark > 0 && networks->len > 0) {
+		xml = benchmark(networks, FALSE);
+		index = benchmark(networks, TRUE);
+
+		g_print("%d lookups: XML %.3f s, index %.3f s (%.0fx)\n",
+				option_benchmark, xml, index,
+				index > 0 ? xml / index : 0);
+	}
+
+	g_ptr_array_free(networks, TRUE);
+
+	return 0;
+}
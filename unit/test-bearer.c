@@ -0,0 +1,466 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#include <glib.h>
+
+#include "gatio.h"
+#include "gatppp.h"
+#include "gatrawip.h"
+
+#define PACKET_COUNT	16
+#define TEST_TIMEOUT	10
+
+struct link {
+	GAtPPP *client;
+	GAtPPP *server;
+	char *client_iface;
+	gboolean server_up;
+	GAtPPPDisconnectReason client_reason;
+	gboolean client_dead;
+	gboolean server_dead;
+	GThread *main_thread;
+};
+
+static gboolean timeout_cb(gpointer user_data)
+{
+	g_error("timed out");
+
+	return FALSE;
+}
+
+static void client_connect(const char *iface, const char *local,
+				const char *peer, const char *dns1,
+				const char *dns2, gpointer user_data)
+{
+	struct link *link = user_data;
+
+	g_assert(g_thread_self() == link->main_thread);
+	g_assert(g_str_equal(local, "192.168.1.2"));
+	g_assert(g_str_equal(peer, "192.168.1.1"));
+
+	link->client_iface = g_strdup(iface);
+}
+
+static void client_disconnect(GAtPPPDisconnectReason reason,
+							gpointer user_data)
+{
+	struct link *link = user_data;
+
+	g_assert(g_thread_self() == link->main_thread);
+
+	link->client_reason = reason;
+	link->client_dead = TRUE;
+
+	/* Tears down the data thread from within its own event */
+	g_at_ppp_unref(link->client);
+	link->client = NULL;
+}
+
+static void server_connect(const char *iface, const char *local,
+				const char *peer, const char *dns1,
+				const char *dns2, gpointer user_data)
+{
+	struct link *link = user_data;
+
+	link->server_up = TRUE;
+}
+
+static void server_disconnect(GAtPPPDisconnectReason reason,
+							gpointer user_data)
+{
+	struct link *link = user_data;
+
+	link->server_dead = TRUE;
+}
+
+static int open_tun(char *ifname)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	strcpy(ifr.ifr_name, "pppt%d");
+
+	if (ioctl(fd, TUNSETIFF, (void *) &ifr) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	strcpy(ifname, ifr.ifr_name);
+
+	return fd;
+}
+
+/* Creating tun devices takes CAP_NET_ADMIN, skip the tests without it */
+static gboolean tun_available(void)
+{
+	char ifname[IFNAMSIZ];
+	int fd;
+
+	fd = open_tun(ifname);
+	if (fd < 0)
+		return FALSE;
+
+	close(fd);
+
+	return TRUE;
+}
+
+static void set_address(struct ifreq *ifr, int request, const char *addr)
+{
+	struct sockaddr_in *sin = (struct sockaddr_in *) &ifr->ifr_addr;
+	int sk;
+
+	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	g_assert(sk >= 0);
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	inet_pton(AF_INET, addr, &sin->sin_addr);
+
+	g_assert(ioctl(sk, request, ifr) == 0);
+
+	close(sk);
+}
+
+/* Bring up a point to point interface so we can route into it */
+static void setup_iface(const char *ifname, const char *local,
+							const char *peer)
+{
+	struct ifreq ifr;
+	int sk;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, ifname);
+
+	set_address(&ifr, SIOCSIFADDR, local);
+	set_address(&ifr, SIOCSIFDSTADDR, peer);
+
+	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	g_assert(sk >= 0);
+
+	g_assert(ioctl(sk, SIOCGIFFLAGS, &ifr) == 0);
+	ifr.ifr_flags |= IFF_UP;
+	g_assert(ioctl(sk, SIOCSIFFLAGS, &ifr) == 0);
+
+	close(sk);
+}
+
+static guint64 rx_packets(const char *ifname)
+{
+	char *path;
+	char *contents;
+	guint64 packets;
+
+	path = g_strdup_printf("/sys/class/net/%s/statistics/rx_packets",
+								ifname);
+	g_assert(g_file_get_contents(path, &contents, NULL, NULL));
+
+	packets = g_ascii_strtoull(contents, NULL, 10);
+
+	g_free(contents);
+	g_free(path);
+
+	return packets;
+}
+
+static void send_packets(const char *peer)
+{
+	struct sockaddr_in addr;
+	char payload[64];
+	int sk;
+	int i;
+
+	sk = socket(AF_INET, SOCK_DGRAM, 0);
+	g_assert(sk >= 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(9);
+	inet_pton(AF_INET, peer, &addr.sin_addr);
+
+	memset(payload, 'x', sizeof(payload));
+
+	for (i = 0; i < PACKET_COUNT; i++)
+		g_assert(sendto(sk, payload, sizeof(payload), 0,
+				(struct sockaddr *) &addr,
+				sizeof(addr)) == sizeof(payload));
+
+	close(sk);
+}
+
+static gboolean poll_cb(gpointer user_data)
+{
+	return TRUE;
+}
+
+/* Counters move from the data thread too, so keep waking up to look */
+static void wait_rx(const char *ifname, guint64 packets)
+{
+	guint poll = g_timeout_add(10, poll_cb, NULL);
+
+	while (rx_packets(ifname) < packets)
+		g_main_context_iteration(NULL, TRUE);
+
+	g_source_remove(poll);
+}
+
+static GAtIO *new_io(int fd)
+{
+	GIOChannel *channel;
+	GAtIO *io;
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	io = g_at_io_new(channel);
+	g_io_channel_unref(channel);
+
+	return io;
+}
+
+/*
+ * A client against a main loop server over a socket pair.  Traffic
+ * routed into either tun device has to cross the client, and its data
+ * thread if it has one, to show up as received on the other one.
+ */
+static void test_ppp(gconstpointer data)
+{
+	gboolean threaded = GPOINTER_TO_UINT(data);
+	struct link link;
+	char server_iface[IFNAMSIZ];
+	GAtBatchStats stats;
+	GAtIO *client_io;
+	GAtIO *server_io;
+	guint64 packets;
+	guint timeout;
+	int tun;
+	int sk[2];
+
+	tun = open_tun(server_iface);
+	if (tun < 0) {
+		g_test_message("no access to /dev/net/tun, skipping");
+		return;
+	}
+
+	memset(&link, 0, sizeof(link));
+	link.main_thread = g_thread_self();
+
+	timeout = g_timeout_add_seconds(TEST_TIMEOUT, timeout_cb, NULL);
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+
+	client_io = new_io(sk[0]);
+	server_io = new_io(sk[1]);
+
+	link.server = g_at_ppp_server_new_full("192.168.1.1", tun);
+	g_assert(link.server != NULL);
+
+	g_at_ppp_set_server_info(link.server, "192.168.1.2",
+					"10.10.10.10", "10.10.10.11");
+	g_at_ppp_set_connect_function(link.server, server_connect, &link);
+	g_at_ppp_set_disconnect_function(link.server, server_disconnect,
+									&link);
+	g_assert(g_at_ppp_listen(link.server, server_io));
+
+	link.client = g_at_ppp_new();
+	g_assert(link.client != NULL);
+
+	g_at_ppp_set_threaded(link.client, threaded);
+	g_at_ppp_set_connect_function(link.client, client_connect, &link);
+	g_at_ppp_set_disconnect_function(link.client, client_disconnect,
+									&link);
+	g_assert(g_at_ppp_open(link.client, client_io));
+
+	while (link.client_iface == NULL || link.server_up == FALSE)
+		g_main_context_iteration(NULL, TRUE);
+
+	/* Net stats belong to the data thread while it runs */
+	g_assert(g_at_ppp_get_net_stats(link.client, &stats) != threaded);
+
+	setup_iface(link.client_iface, "10.200.0.1", "10.200.0.2");
+	setup_iface(server_iface, "10.201.0.1", "10.201.0.2");
+
+	/* Client tun -> data thread -> HDLC -> server -> server tun */
+	packets = rx_packets(server_iface) + PACKET_COUNT;
+	send_packets("10.200.0.2");
+	wait_rx(server_iface, packets);
+
+	/* And back through the data thread into the client tun */
+	packets = rx_packets(link.client_iface) + PACKET_COUNT;
+	send_packets("10.201.0.2");
+	wait_rx(link.client_iface, packets);
+
+	g_at_ppp_shutdown(link.client);
+
+	while (link.client_dead == FALSE || link.server_dead == FALSE)
+		g_main_context_iteration(NULL, TRUE);
+
+	g_assert(link.client_reason == G_AT_PPP_REASON_LOCAL_CLOSE);
+
+	/* The client IO is back on the main loop and still usable */
+	g_assert(g_at_io_get_context(client_io) == NULL);
+
+	g_at_ppp_unref(link.server);
+	g_at_io_unref(client_io);
+	g_at_io_unref(server_io);
+
+	g_source_remove(timeout);
+	g_free(link.client_iface);
+}
+
+struct modem {
+	GIOChannel *channel;
+	guint watch;
+	gsize received;
+};
+
+static gboolean modem_read(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct modem *modem = user_data;
+	unsigned char buf[4096];
+	ssize_t len;
+
+	len = read(g_io_channel_unix_get_fd(channel), buf, sizeof(buf));
+	if (len <= 0)
+		return FALSE;
+
+	modem->received += len;
+
+	return TRUE;
+}
+
+/* Enough of an IPv4 header for tun to take it and count it */
+static void modem_send_packet(int fd)
+{
+	unsigned char packet[20 + 8 + 64];
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = 0x45;
+	packet[2] = sizeof(packet) >> 8;
+	packet[3] = sizeof(packet) & 0xff;
+	packet[8] = 64;
+	packet[9] = IPPROTO_UDP;
+	inet_pton(AF_INET, "10.202.0.2", packet + 12);
+	inet_pton(AF_INET, "10.202.0.1", packet + 16);
+
+	g_assert(write(fd, packet, sizeof(packet)) == sizeof(packet));
+}
+
+static void test_rawip(gconstpointer data)
+{
+	gboolean threaded = GPOINTER_TO_UINT(data);
+	struct modem modem;
+	GIOChannel *channel;
+	GAtRawIP *rawip;
+	const char *iface;
+	guint64 packets;
+	guint timeout;
+	int sk[2];
+	int i;
+
+	if (tun_available() == FALSE) {
+		g_test_message("no access to /dev/net/tun, skipping");
+		return;
+	}
+
+	timeout = g_timeout_add_seconds(TEST_TIMEOUT, timeout_cb, NULL);
+
+	/* Datagrams, so that each packet reaches tun with a write of its own */
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sk) == 0);
+
+	channel = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	rawip = g_at_rawip_new(channel);
+	g_io_channel_unref(channel);
+	g_assert(rawip != NULL);
+
+	memset(&modem, 0, sizeof(modem));
+	modem.channel = g_io_channel_unix_new(sk[1]);
+	g_io_channel_set_close_on_unref(modem.channel, TRUE);
+	modem.watch = g_io_add_watch(modem.channel, G_IO_IN, modem_read,
+								&modem);
+
+	g_at_rawip_set_threaded(rawip, threaded);
+	g_at_rawip_open(rawip);
+
+	iface = g_at_rawip_get_interface(rawip);
+	g_assert(iface != NULL);
+
+	setup_iface(iface, "10.202.0.1", "10.202.0.2");
+
+	/* tun -> modem */
+	send_packets("10.202.0.2");
+
+	while (modem.received < PACKET_COUNT * (20 + 8 + 64))
+		g_main_context_iteration(NULL, TRUE);
+
+	/* modem -> tun, one at a time as a modem would hand them over */
+	for (i = 0; i < PACKET_COUNT; i++) {
+		packets = rx_packets(iface) + 1;
+		modem_send_packet(sk[1]);
+		wait_rx(iface, packets);
+	}
+
+	g_at_rawip_shutdown(rawip);
+	g_at_rawip_unref(rawip);
+
+	g_source_remove(modem.watch);
+	g_io_channel_unref(modem.channel);
+
+	g_source_remove(timeout);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_data_func("/testbearer/ppp/main_loop",
+				GUINT_TO_POINTER(FALSE), test_ppp);
+	g_test_add_data_func("/testbearer/ppp/threaded",
+				GUINT_TO_POINTER(TRUE), test_ppp);
+	g_test_add_data_func("/testbearer/rawip/main_loop",
+				GUINT_TO_POINTER(FALSE), test_rawip);
+	g_test_add_data_func("/testbearer/rawip/threaded",
+				GUINT_TO_POINTER(TRUE), test_rawip);
+
+	return g_test_run();
+}
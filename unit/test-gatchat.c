@@ -0,0 +1,724 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "ringbuffer.h"
+#include "gatchat.h"
+#include "gatio.h"
+
+struct fake_modem {
+	GAtChat *chat;
+	int fd;
+	GString *received;
+	GString *order;
+	unsigned int completed;
+};
+
+static void fake_modem_init(struct fake_modem *modem)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	int sk[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+	g_assert(fcntl(sk[1], F_SETFL, O_NONBLOCK) == 0);
+
+	channel = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	syntax = g_at_syntax_new_gsm_permissive();
+	modem->chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	g_assert(modem->chat != NULL);
+
+	modem->fd = sk[1];
+	modem->received = g_string_new(NULL);
+	modem->order = g_string_new(NULL);
+	modem->completed = 0;
+}
+
+static void fake_modem_free(struct fake_modem *modem)
+{
+	g_at_chat_unref(modem->chat);
+	close(modem->fd);
+	g_string_free(modem->received, TRUE);
+	g_string_free(modem->order, TRUE);
+}
+
+/* Runs the main loop until it is idle and collects what the chat wrote */
+static unsigned int fake_modem_pump(struct fake_modem *modem)
+{
+	unsigned int commands = 0;
+	char buf[256];
+	ssize_t len;
+	gsize i;
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	while ((len = read(modem->fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < (gsize) len; i++)
+			if (buf[i] == '\r')
+				commands += 1;
+
+		g_string_append_len(modem->received, buf, len);
+	}
+
+	return commands;
+}
+
+static void fake_modem_reply(struct fake_modem *modem, const char *reply)
+{
+	gsize len = strlen(reply);
+
+	g_assert(write(modem->fd, reply, len) == (ssize_t) len);
+}
+
+static void result_cb(gboolean ok, GAtResult *result, gpointer user_data)
+{
+	struct fake_modem *modem = user_data;
+	GAtResultIter iter;
+	const char *line;
+
+	g_assert(ok);
+
+	g_at_result_iter_init(&iter, result);
+
+	if (g_at_result_iter_next(&iter, NULL)) {
+		line = g_at_result_iter_raw_line(&iter);
+		g_string_append(modem->order, line);
+	}
+
+	modem->completed += 1;
+}
+
+static void test_pipeline_disabled(void)
+{
+	struct fake_modem modem;
+
+	fake_modem_init(&modem);
+
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMI", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMM", NULL, result_cb,
+					&modem, NULL);
+
+	/* The default depth of one waits for each final response */
+	g_assert(fake_modem_pump(&modem) == 1);
+
+	fake_modem_reply(&modem, "\r\nA\r\n\r\nOK\r\n");
+	g_assert(fake_modem_pump(&modem) == 1);
+	g_assert(modem.completed == 1);
+
+	fake_modem_reply(&modem, "\r\nB\r\n\r\nOK\r\n");
+	fake_modem_pump(&modem);
+
+	g_assert(modem.completed == 2);
+	g_assert_cmpstr(modem.order->str, ==, "AB");
+
+	fake_modem_free(&modem);
+}
+
+static void test_pipeline_depth(void)
+{
+	struct fake_modem modem;
+
+	fake_modem_init(&modem);
+	g_assert(g_at_chat_set_pipeline_depth(modem.chat, 3));
+
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMI", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMM", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMR", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send_pipelined(modem.chat, "AT+CGSN", NULL, result_cb,
+					&modem, NULL);
+
+	g_assert(fake_modem_pump(&modem) == 3);
+	g_assert_cmpstr(modem.received->str, ==,
+				"AT+CGMI\rAT+CGMM\rAT+CGMR\r");
+
+	/* Responses are matched in order, and free a slot for the 4th */
+	fake_modem_reply(&modem, "\r\nA\r\n\r\nOK\r\n\r\nB\r\n\r\nOK\r\n");
+	g_assert(fake_modem_pump(&modem) == 1);
+	g_assert(modem.completed == 2);
+
+	fake_modem_reply(&modem, "\r\nC\r\n\r\nOK\r\n\r\nD\r\n\r\nOK\r\n");
+	fake_modem_pump(&modem);
+
+	g_assert(modem.completed == 4);
+	g_assert_cmpstr(modem.order->str, ==, "ABCD");
+
+	fake_modem_free(&modem);
+}
+
+static void test_pipeline_barrier(void)
+{
+	struct fake_modem modem;
+
+	fake_modem_init(&modem);
+	g_at_chat_set_pipeline_depth(modem.chat, 4);
+
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMI", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMM", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send(modem.chat, "AT+CFUN=1", NULL, result_cb,
+					&modem, NULL);
+	g_at_chat_send_pipelined(modem.chat, "AT+CGSN", NULL, result_cb,
+					&modem, NULL);
+
+	/* A regular command waits for everything in front of it */
+	g_assert(fake_modem_pump(&modem) == 2);
+
+	fake_modem_reply(&modem, "\r\nA\r\n\r\nOK\r\n\r\nB\r\n\r\nOK\r\n");
+	g_assert(fake_modem_pump(&modem) == 1);
+
+	/* And nothing is pipelined behind it */
+	fake_modem_reply(&modem, "\r\nC\r\n\r\nOK\r\n");
+	g_assert(fake_modem_pump(&modem) == 1);
+
+	fake_modem_reply(&modem, "\r\nD\r\n\r\nOK\r\n");
+	fake_modem_pump(&modem);
+
+	g_assert(modem.completed == 4);
+	g_assert_cmpstr(modem.order->str, ==, "ABCD");
+
+	/* Prompt commands can't be pipelined */
+	g_assert(g_at_chat_send_pipelined(modem.chat, "AT+CMGS=10\rPDU",
+					NULL, result_cb, &modem, NULL) == 0);
+
+	fake_modem_free(&modem);
+}
+
+static void test_pipeline_cancel(void)
+{
+	struct fake_modem modem;
+	guint id;
+
+	fake_modem_init(&modem);
+	g_at_chat_set_pipeline_depth(modem.chat, 2);
+
+	g_at_chat_send_pipelined(modem.chat, "AT+CGMI", NULL, result_cb,
+					&modem, NULL);
+	id = g_at_chat_send_pipelined(modem.chat, "AT+CGMM", NULL, result_cb,
+					&modem, NULL);
+
+	g_assert(fake_modem_pump(&modem) == 2);
+
+	/* Already on the wire, the response must still be consumed */
+	g_assert(g_at_chat_cancel(modem.chat, id));
+
+	g_at_chat_send(modem.chat, "AT+CGSN", NULL, result_cb, &modem, NULL);
+
+	fake_modem_reply(&modem, "\r\nA\r\n\r\nOK\r\n\r\nB\r\n\r\nOK\r\n");
+	g_assert(fake_modem_pump(&modem) == 1);
+
+	fake_modem_reply(&modem, "\r\nC\r\n\r\nOK\r\n");
+	fake_modem_pump(&modem);
+
+	g_assert(modem.completed == 2);
+	g_assert_cmpstr(modem.order->str, ==, "AC");
+
+	fake_modem_free(&modem);
+}
+
+static void latency_cb(const char *prefix, const GAtChatLatency *latency,
+			gpointer user_data)
+{
+	GHashTable *seen = user_data;
+	guint total = 0;
+	guint i;
+
+	for (i = 0; i < G_AT_CHAT_LATENCY_BUCKETS; i++)
+		total += latency->buckets[i];
+
+	g_assert(total == latency->count);
+	g_assert(latency->max_us * latency->count >= latency->total_us);
+
+	g_hash_table_insert(seen, g_strdup(prefix),
+				GUINT_TO_POINTER(latency->count));
+}
+
+static void test_latency(void)
+{
+	struct fake_modem modem;
+	GHashTable *seen;
+
+	fake_modem_init(&modem);
+
+	g_at_chat_send(modem.chat, "AT+CGMI", NULL, result_cb, &modem, NULL);
+	g_at_chat_send(modem.chat, "AT+CGMI", NULL, result_cb, &modem, NULL);
+	g_at_chat_send(modem.chat, "ATD12345;", NULL, result_cb, &modem, NULL);
+	g_at_chat_send(modem.chat, "AT+CFUN=1", NULL, result_cb, &modem, NULL);
+
+	while (modem.completed < 4) {
+		fake_modem_pump(&modem);
+		fake_modem_reply(&modem, "\r\nOK\r\n");
+		fake_modem_pump(&modem);
+	}
+
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_at_chat_foreach_latency(modem.chat, latency_cb, seen);
+
+	g_assert(g_hash_table_size(seen) == 3);
+	g_assert(GPOINTER_TO_UINT(g_hash_table_lookup(seen, "+CGMI")) == 2);
+	g_assert(GPOINTER_TO_UINT(g_hash_table_lookup(seen, "D")) == 1);
+	g_assert(GPOINTER_TO_UINT(g_hash_table_lookup(seen, "+CFUN")) == 1);
+
+	g_hash_table_destroy(seen);
+	fake_modem_free(&modem);
+}
+
+static void notify_cb(GAtResult *result, gpointer user_data)
+{
+	GString *str = user_data;
+	GAtResultIter iter;
+
+	g_at_result_iter_init(&iter, result);
+	g_assert(g_at_result_iter_next(&iter, NULL));
+
+	g_string_append(str, g_at_result_iter_raw_line(&iter));
+	g_string_append_c(str, '|');
+}
+
+static void notify_pdu_cb(GAtResult *result, gpointer user_data)
+{
+	GString *str = user_data;
+
+	g_string_append(str, "pdu:");
+	g_string_append(str, g_at_result_pdu(result));
+	g_string_append_c(str, '|');
+}
+
+static void test_notify_dispatch(void)
+{
+	struct fake_modem modem;
+	GString *creg = g_string_new(NULL);
+	GString *cre = g_string_new(NULL);
+	GString *cmt = g_string_new(NULL);
+	guint id;
+
+	fake_modem_init(&modem);
+
+	g_at_chat_register(modem.chat, "+CREG:", notify_cb, FALSE,
+				creg, NULL);
+	g_at_chat_register(modem.chat, "+CGREG:", notify_cb, FALSE,
+				creg, NULL);
+	id = g_at_chat_register(modem.chat, "+CRE", notify_cb, FALSE,
+				cre, NULL);
+	g_at_chat_register(modem.chat, "+CMT:", notify_pdu_cb, TRUE,
+				cmt, NULL);
+
+	fake_modem_reply(&modem, "\r\n+CREG: 1\r\n\r\n+CGREG: 5\r\n"
+				"\r\n+CIEV: 1,2\r\n\r\n+CR\r\n"
+				"\r\n+CMT: ,23\r\n0011\r\n");
+	fake_modem_pump(&modem);
+
+	/* Every registered prefix of a line gets it */
+	g_assert_cmpstr(creg->str, ==, "+CREG: 1|+CGREG: 5|");
+	g_assert_cmpstr(cre->str, ==, "+CREG: 1|");
+	g_assert_cmpstr(cmt->str, ==, "pdu:0011|");
+
+	g_assert(g_at_chat_unregister(modem.chat, id));
+	g_at_chat_register(modem.chat, "+CREG", notify_cb, FALSE, cre, NULL);
+
+	fake_modem_reply(&modem, "\r\n+CREG: 2\r\n");
+	fake_modem_pump(&modem);
+
+	g_assert_cmpstr(creg->str, ==, "+CREG: 1|+CGREG: 5|+CREG: 2|");
+	g_assert_cmpstr(cre->str, ==, "+CREG: 1|+CREG: 2|");
+
+	g_string_free(creg, TRUE);
+	g_string_free(cre, TRUE);
+	g_string_free(cmt, TRUE);
+	fake_modem_free(&modem);
+}
+
+static void final_cb(gboolean ok, GAtResult *result, gpointer user_data)
+{
+	GString *str = user_data;
+
+	g_string_append_printf(str, "%s:%s|", ok ? "ok" : "fail",
+				g_at_result_final_response(result));
+}
+
+static void test_terminators(void)
+{
+	struct fake_modem modem;
+	GString *str = g_string_new(NULL);
+	const char *expected;
+
+	fake_modem_init(&modem);
+
+	g_at_chat_add_terminator(modem.chat, "+EXT: DONE", -1, TRUE);
+	g_at_chat_add_terminator(modem.chat, "$ERR", 4, FALSE);
+	g_at_chat_blacklist_terminator(modem.chat,
+					G_AT_CHAT_TERMINATOR_NO_CARRIER);
+
+	g_at_chat_send(modem.chat, "AT+A", NULL, final_cb, str, NULL);
+	g_at_chat_send(modem.chat, "AT+B", NULL, final_cb, str, NULL);
+	g_at_chat_send(modem.chat, "AT+C", NULL, final_cb, str, NULL);
+	g_at_chat_send(modem.chat, "AT+D", NULL, final_cb, str, NULL);
+	g_at_chat_send(modem.chat, "AT+E", NULL, final_cb, str, NULL);
+
+	fake_modem_pump(&modem);
+
+	/* Exact terminators must not match longer lines */
+	fake_modem_reply(&modem, "\r\nOKAY\r\n\r\n+EXT: DONE!\r\n"
+				"\r\nNO CARRIER\r\n\r\nOK\r\n");
+	fake_modem_pump(&modem);
+
+	fake_modem_reply(&modem, "\r\nCONNECT 9600\r\n");
+	fake_modem_pump(&modem);
+
+	fake_modem_reply(&modem, "\r\n+EXT: DONE\r\n");
+	fake_modem_pump(&modem);
+
+	fake_modem_reply(&modem, "\r\n$ERROR 3\r\n");
+	fake_modem_pump(&modem);
+
+	fake_modem_reply(&modem, "\r\n+CME ERROR: 10\r\n");
+	fake_modem_pump(&modem);
+
+	expected = "ok:OK|ok:CONNECT 9600|ok:+EXT: DONE|fail:$ERROR 3|"
+			"fail:+CME ERROR: 10|";
+	g_assert_cmpstr(str->str, ==, expected);
+
+	g_string_free(str, TRUE);
+	fake_modem_free(&modem);
+}
+
+static void count_cb(GAtResult *result, gpointer user_data)
+{
+	unsigned int *count = user_data;
+
+	*count += 1;
+}
+
+static void test_result_scan(void)
+{
+	char clcc[] = "+CLCC: 1,0,0,0,0,\"+15551234567\",145";
+	char clcc_short[] = "+CLCC: 2,1,4,0,1";
+	char cops[] = "+COPS: (2,\"Op\",\"O\",\"00101\",7),,(0-4),(0,2)";
+	char cpbr[] = "+CPBR: 1,\"5551\",129,text,\"0A1b\"";
+	GSList *lines = NULL;
+	GAtResult result;
+	GAtResultIter iter;
+	const char *number, *name, *text;
+	const guint8 *hex;
+	gint id, dir, status, type, mpty, number_type, len;
+	gint min, max, lo, hi;
+
+	lines = g_slist_append(lines, clcc);
+	lines = g_slist_append(lines, clcc_short);
+	lines = g_slist_append(lines, cops);
+	lines = g_slist_append(lines, cpbr);
+
+	result.lines = lines;
+	result.final_or_pdu = "OK";
+
+	g_at_result_iter_init(&iter, &result);
+
+	g_assert(g_at_result_iter_scan(&iter, "+CLCC: %d,%d,%d,%d,%d,%s,%d",
+					&id, &dir, &status, &type, &mpty,
+					&number, &number_type) == 7);
+	g_assert(id == 1 && mpty == 0 && number_type == 145);
+	g_assert(g_str_equal(number, "+15551234567"));
+
+	number_type = 129;
+	g_assert(g_at_result_iter_scan(&iter, "+CLCC: %d,%d,%d,%d,%d,%s,%d",
+					&id, &dir, &status, &type, &mpty,
+					&number, &number_type) == 5);
+	g_assert(id == 2 && status == 4 && mpty == 1);
+	g_assert(number_type == 129);
+
+	g_assert(g_at_result_iter_next(&iter, "+COPS:"));
+	g_assert(g_at_result_iter_scan(&iter, "(%d,%s,%_,%_,%d)",
+					&status, &name, &type) == 3);
+	g_assert(status == 2 && type == 7);
+	g_assert(g_str_equal(name, "Op"));
+	g_assert(g_at_result_iter_scan(&iter, "%_ (%r),(%d,%d)",
+					&min, &max, &lo, &hi) == 3);
+	g_assert(min == 0 && max == 4);
+	g_assert(lo == 0 && hi == 2);
+
+	g_assert(g_at_result_iter_scan(&iter, "+CPBR: %d,%s,%d,%t,%x",
+					&id, &number, &type, &text,
+					&hex, &len) == 5);
+	g_assert(g_str_equal(text, "text"));
+	g_assert(len == 2 && hex[0] == 0x0a && hex[1] == 0x1b);
+
+	g_assert(g_at_result_iter_scan(&iter, "+CLCC: %d", &id) == -1);
+
+	g_slist_free(lines);
+}
+
+static void test_io_backlog(void)
+{
+	struct fake_modem modem;
+	GAtIO *io;
+	GAtBatchStats stats;
+	GString *burst = g_string_new(NULL);
+	unsigned int count = 0;
+	unsigned int i;
+
+	fake_modem_init(&modem);
+	io = g_at_chat_get_io(modem.chat);
+
+	g_assert(g_at_io_get_buffer_size(io) == 8192);
+
+	g_at_chat_register(modem.chat, "+CIEV:", count_cb, FALSE,
+				&count, NULL);
+
+	for (i = 0; i < 4096; i++)
+		g_string_append_printf(burst, "\r\n+CIEV: %u,1\r\n", i % 8);
+
+	fake_modem_reply(&modem, burst->str);
+	fake_modem_pump(&modem);
+
+	g_assert(count == 4096);
+	g_assert(g_at_io_get_buffer_size(io) > 8192);
+	g_assert(g_at_io_get_buffer_size(io) <= 65536);
+
+	g_at_io_get_read_stats(io, &stats);
+	g_assert(stats.bytes == burst->len);
+	g_assert(stats.reads >= stats.wakeups);
+
+	g_string_free(burst, TRUE);
+	fake_modem_free(&modem);
+}
+
+static void test_io_long_line(void)
+{
+	struct fake_modem modem;
+	GAtIO *io;
+	GString *line = g_string_new("\r\n+CUSD: 0,\"");
+	unsigned int count = 0;
+
+	fake_modem_init(&modem);
+	io = g_at_chat_get_io(modem.chat);
+
+	g_at_chat_register(modem.chat, "+CUSD:", count_cb, FALSE,
+				&count, NULL);
+
+	/* A line that does not fit the initial buffer must not drop us */
+	while (line->len < 20000)
+		g_string_append(line, "0123456789ABCDEF");
+
+	g_string_append(line, "\",15\r\n");
+
+	fake_modem_reply(&modem, line->str);
+	fake_modem_pump(&modem);
+
+	g_assert(count == 1);
+	g_assert(g_at_io_get_buffer_size(io) >= 32768);
+
+	/* Capping growth at the current size leaves the channel usable */
+	g_at_io_set_max_buffer_size(io, g_at_io_get_buffer_size(io));
+
+	count = 0;
+	fake_modem_reply(&modem, "\r\n+CUSD: 0,\"ok\",15\r\n");
+	fake_modem_pump(&modem);
+
+	g_assert(count == 1);
+
+	g_string_free(line, TRUE);
+	fake_modem_free(&modem);
+}
+
+struct packet_sink {
+	struct ring_buffer *rbuf;
+	gboolean disconnected;
+};
+
+static void packet_read_cb(struct ring_buffer *rbuf, gpointer user_data)
+{
+	struct packet_sink *sink = user_data;
+
+	sink->rbuf = rbuf;
+}
+
+static void packet_disconnect_cb(gpointer user_data)
+{
+	struct packet_sink *sink = user_data;
+
+	sink->disconnected = TRUE;
+}
+
+static void test_io_packets(void)
+{
+	struct packet_sink sink = { NULL, FALSE };
+	unsigned char packet[1000];
+	GIOChannel *channel;
+	GAtIO *io;
+	unsigned int received = 0;
+	unsigned int len;
+	unsigned char *data;
+	unsigned int i;
+	int sk[2];
+
+	/* Datagram semantics like tun, short reads lose the rest */
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sk) == 0);
+
+	channel = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	io = g_at_io_new(channel);
+	g_io_channel_unref(channel);
+
+	g_at_io_set_max_buffer_size(io, 8192);
+	g_assert(g_at_io_set_packet_size(io, 1500));
+	g_at_io_set_disconnect_function(io, packet_disconnect_cb, &sink);
+	g_at_io_set_read_handler(io, packet_read_cb, &sink);
+
+	for (i = 0; i < 20; i++) {
+		memset(packet, i, sizeof(packet));
+		g_assert(write(sk[1], packet, sizeof(packet)) ==
+						(ssize_t) sizeof(packet));
+	}
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	/* Only whole packets are queued, and a full buffer pauses reads */
+	g_assert(sink.disconnected == FALSE);
+	g_assert(ring_buffer_len(sink.rbuf) == 8000);
+
+	while (received < 20 * sizeof(packet)) {
+		len = ring_buffer_len_no_wrap(sink.rbuf);
+		g_assert(len > 0);
+
+		data = ring_buffer_read_ptr(sink.rbuf, 0);
+
+		for (i = 0; i < len; i++)
+			g_assert(data[i] == (received + i) / sizeof(packet));
+
+		received += len;
+		g_at_io_drain_ring_buffer(io, len);
+
+		while (g_main_context_iteration(NULL, FALSE))
+			;
+	}
+
+	g_assert(sink.disconnected == FALSE);
+	g_assert(ring_buffer_len(sink.rbuf) == 0);
+
+	g_at_io_unref(io);
+	close(sk[1]);
+}
+
+static void test_perf_notify(void)
+{
+	static const char *urcs[] = {
+		"+CREG: 1,\"00C3\",\"0000C2B1\",2\r\n",
+		"+CGREG: 1,\"00C3\",\"0000C2B1\",2\r\n",
+		"+CIEV: 2,3\r\n",
+		"+CLCC: 1,0,0,0,0,\"+15551234567\",145\r\n",
+		"+XYZZY: unhandled\r\n",
+	};
+	struct fake_modem modem;
+	unsigned int count = 0;
+	unsigned int expected = 0;
+	GString *burst = g_string_new(NULL);
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+	char prefix[16];
+	unsigned int i;
+
+	fake_modem_init(&modem);
+
+	/* What a fully populated modem roughly looks like */
+	for (i = 0; i < 64; i++) {
+		g_snprintf(prefix, sizeof(prefix), "+X%03u:", i);
+		g_at_chat_register(modem.chat, prefix, count_cb, FALSE,
+					&count, NULL);
+	}
+
+	g_at_chat_register(modem.chat, "+CREG:", count_cb, FALSE,
+				&count, NULL);
+	g_at_chat_register(modem.chat, "+CGREG:", count_cb, FALSE,
+				&count, NULL);
+	g_at_chat_register(modem.chat, "+CIEV:", count_cb, FALSE,
+				&count, NULL);
+	g_at_chat_register(modem.chat, "+CLCC:", count_cb, FALSE,
+				&count, NULL);
+
+	for (i = 0; i < 200; i++) {
+		g_string_append(burst, "\r\n");
+		g_string_append(burst, urcs[i % G_N_ELEMENTS(urcs)]);
+	}
+
+	g_timer_start(timer);
+
+	for (i = 0; i < 200; i++) {
+		fake_modem_reply(&modem, burst->str);
+		fake_modem_pump(&modem);
+		expected += 160;
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_assert(count == expected);
+
+	g_test_minimized_result(elapsed, "%.0f URCs/s",
+					200 * 200 / elapsed);
+
+	g_timer_destroy(timer);
+	g_string_free(burst, TRUE);
+	fake_modem_free(&modem);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testgatchat/pipeline/disabled",
+				test_pipeline_disabled);
+	g_test_add_func("/testgatchat/pipeline/depth", test_pipeline_depth);
+	g_test_add_func("/testgatchat/pipeline/barrier",
+				test_pipeline_barrier);
+	g_test_add_func("/testgatchat/pipeline/cancel", test_pipeline_cancel);
+	g_test_add_func("/testgatchat/latency", test_latency);
+	g_test_add_func("/testgatchat/notify", test_notify_dispatch);
+	g_test_add_func("/testgatchat/terminators", test_terminators);
+	g_test_add_func("/testgatchat/result/scan", test_result_scan);
+	g_test_add_func("/testgatchat/io/backlog", test_io_backlog);
+	g_test_add_func("/testgatchat/io/long_line", test_io_long_line);
+	g_test_add_func("/testgatchat/io/packets", test_io_packets);
+
+	if (g_test_perf())
+		g_test_add_func("/testgatchat/perf/notify", test_perf_notify);
+
+	return g_test_run();
+}
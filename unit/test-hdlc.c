@@ -0,0 +1,314 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "crc-ccitt.h"
+#include "gathdlc.h"
+
+#define FRAME_SIZE	1500
+#define FRAME_COUNT	64
+#define PERF_BYTES	(64 * 1024 * 1024)
+
+struct loopback {
+	GAtHDLC *tx;
+	GAtHDLC *rx;
+	GByteArray *received;
+	unsigned int frames;
+};
+
+static void fill_payload(unsigned char *buf, gsize len, unsigned int mode)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		switch (mode) {
+		case 0:
+			/* Mostly printable, rarely needs escaping */
+			buf[i] = 'a' + g_random_int_range(0, 26);
+			break;
+		case 1:
+			/* Binary, lots of control characters and flags */
+			buf[i] = g_random_int_range(0, 256);
+			break;
+		default:
+			buf[i] = i % 7 ? 'x' : 0x7e;
+			break;
+		}
+	}
+}
+
+/* Byte at a time reference encoder, the way gathdlc used to do it */
+static gsize reference_encode(const guint32 *accm, const unsigned char *data,
+				gsize size, unsigned char *out)
+{
+	guint16 fcs = 0xffff;
+	unsigned char tail[2];
+	gsize pos = 0;
+	gsize i;
+
+	for (i = 0; i < size + sizeof(tail); i++) {
+		unsigned char c;
+
+		if (i == size) {
+			fcs ^= 0xffff;
+			tail[0] = fcs & 0xff;
+			tail[1] = fcs >> 8;
+		}
+
+		if (i < size) {
+			c = data[i];
+			fcs = crc_ccitt_byte(fcs, c);
+		} else
+			c = tail[i - size];
+
+		if (accm[c >> 5] & (1 << (c & 0x1f))) {
+			out[pos++] = 0x7d;
+			out[pos++] = c ^ 0x20;
+		} else
+			out[pos++] = c;
+	}
+
+	out[pos++] = 0x7e;
+
+	return pos;
+}
+
+static void loopback_receive(const unsigned char *data, gsize size,
+							gpointer user_data)
+{
+	struct loopback *lb = user_data;
+
+	g_byte_array_append(lb->received, data, size);
+	lb->frames += 1;
+}
+
+static void loopback_init(struct loopback *lb, guint32 accm)
+{
+	GIOChannel *channel;
+	int sk[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+
+	channel = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	lb->tx = g_at_hdlc_new(channel);
+	g_io_channel_unref(channel);
+
+	channel = g_io_channel_unix_new(sk[1]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	lb->rx = g_at_hdlc_new(channel);
+	g_io_channel_unref(channel);
+
+	g_assert(lb->tx != NULL);
+	g_assert(lb->rx != NULL);
+
+	g_at_hdlc_set_xmit_accm(lb->tx, accm);
+	g_at_hdlc_set_recv_accm(lb->rx, accm);
+	g_at_hdlc_set_receive(lb->rx, loopback_receive, lb);
+
+	lb->received = g_byte_array_new();
+	lb->frames = 0;
+}
+
+static void loopback_free(struct loopback *lb)
+{
+	g_at_hdlc_unref(lb->tx);
+	g_at_hdlc_unref(lb->rx);
+	g_byte_array_free(lb->received, TRUE);
+}
+
+static void loopback_wait(struct loopback *lb, unsigned int frames)
+{
+	while (lb->frames < frames)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+static void test_crc(void)
+{
+	unsigned char buf[257];
+	guint16 expected;
+	gsize len;
+	gsize i;
+
+	fill_payload(buf, sizeof(buf), 1);
+
+	for (len = 0; len <= sizeof(buf); len++) {
+		expected = 0xffff;
+
+		for (i = 0; i < len; i++)
+			expected = crc_ccitt_byte(expected, buf[i]);
+
+		g_assert(crc_ccitt(0xffff, buf, len) == expected);
+	}
+}
+
+static void test_loopback(gconstpointer data)
+{
+	guint32 accm = GPOINTER_TO_UINT(data);
+	struct loopback lb;
+	GByteArray *sent;
+	unsigned char buf[FRAME_SIZE];
+	unsigned int i;
+
+	loopback_init(&lb, accm);
+	sent = g_byte_array_new();
+
+	for (i = 0; i < FRAME_COUNT; i++) {
+		gsize len = g_random_int_range(1, sizeof(buf));
+
+		fill_payload(buf, len, i % 3);
+		g_assert(g_at_hdlc_send(lb.tx, buf, len));
+		g_byte_array_append(sent, buf, len);
+	}
+
+	loopback_wait(&lb, FRAME_COUNT);
+
+	g_assert(lb.received->len == sent->len);
+	g_assert(memcmp(lb.received->data, sent->data, sent->len) == 0);
+
+	g_byte_array_free(sent, TRUE);
+	loopback_free(&lb);
+}
+
+static void test_perf_crc(void)
+{
+	unsigned char *buf = g_malloc(PERF_BYTES);
+	GTimer *timer = g_timer_new();
+	guint16 byte_fcs = 0xffff;
+	guint16 fcs;
+	gdouble elapsed;
+	gsize i;
+
+	fill_payload(buf, PERF_BYTES, 1);
+
+	g_timer_start(timer);
+
+	for (i = 0; i < PERF_BYTES; i++)
+		byte_fcs = crc_ccitt_byte(byte_fcs, buf[i]);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_test_message("crc_ccitt_byte: %.1f MB/s",
+				PERF_BYTES / elapsed / (1024 * 1024));
+
+	g_timer_start(timer);
+	fcs = crc_ccitt(0xffff, buf, PERF_BYTES);
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_test_minimized_result(elapsed, "crc_ccitt: %.1f MB/s",
+				PERF_BYTES / elapsed / (1024 * 1024));
+
+	g_assert(fcs == byte_fcs);
+
+	g_timer_destroy(timer);
+	g_free(buf);
+}
+
+static void test_perf_framing(gconstpointer data)
+{
+	guint32 accm = GPOINTER_TO_UINT(data);
+	guint32 xmit_accm[8] = { accm, 0, 0, 0x60000000, 0, 0, 0, 0 };
+	unsigned char buf[FRAME_SIZE];
+	unsigned char encoded[FRAME_SIZE * 2 + 8];
+	GTimer *timer = g_timer_new();
+	GTimer *encode_timer = g_timer_new();
+	struct loopback lb;
+	gsize encoded_len = 0;
+	gsize total = 0;
+	gdouble elapsed;
+	unsigned int i;
+
+	fill_payload(buf, sizeof(buf), 0);
+
+	g_timer_start(timer);
+
+	for (total = 0; total < PERF_BYTES; total += sizeof(buf))
+		encoded_len += reference_encode(xmit_accm, buf, sizeof(buf),
+								encoded);
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_assert(encoded_len >= total);
+	g_test_message("reference encode: %.1f MB/s",
+				total / elapsed / (1024 * 1024));
+
+	loopback_init(&lb, accm);
+
+	g_timer_start(encode_timer);
+	g_timer_stop(encode_timer);
+	g_timer_start(timer);
+
+	for (total = 0; total < PERF_BYTES;) {
+		g_timer_continue(encode_timer);
+
+		for (i = 0; i < FRAME_COUNT; i++)
+			g_assert(g_at_hdlc_send(lb.tx, buf, sizeof(buf)));
+
+		g_timer_stop(encode_timer);
+
+		total += FRAME_COUNT * sizeof(buf);
+		loopback_wait(&lb, total / sizeof(buf));
+	}
+
+	elapsed = g_timer_elapsed(encode_timer, NULL);
+	g_test_minimized_result(elapsed, "g_at_hdlc_send: %.1f MB/s",
+				total / elapsed / (1024 * 1024));
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_test_message("loopback send and receive: %.1f MB/s",
+				total / elapsed / (1024 * 1024));
+
+	g_assert(lb.received->len == total);
+
+	loopback_free(&lb);
+	g_timer_destroy(encode_timer);
+	g_timer_destroy(timer);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testhdlc/crc", test_crc);
+	g_test_add_data_func("/testhdlc/loopback/default_accm",
+				GUINT_TO_POINTER(~0U), test_loopback);
+	g_test_add_data_func("/testhdlc/loopback/zero_accm",
+				GUINT_TO_POINTER(0), test_loopback);
+
+	if (g_test_perf()) {
+		g_test_add_func("/testhdlc/perf/crc", test_perf_crc);
+		g_test_add_data_func("/testhdlc/perf/framing/default_accm",
+					GUINT_TO_POINTER(~0U),
+					test_perf_framing);
+		g_test_add_data_func("/testhdlc/perf/framing/zero_accm",
+					GUINT_TO_POINTER(0),
+					test_perf_framing);
+	}
+
+	return g_test_run();
+}
@@ -23,6 +23,7 @@
 #include <config.h>
 #endif
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -556,6 +557,365 @@ static void test_extract_advanced(void)
 	g_assert(total == sizeof(advanced_input2) - 1);
 }
 
+static GIOChannel *scheduler_channel(GAtMux *mux)
+{
+	GIOChannel *io = g_at_mux_create_channel(mux);
+
+	g_assert(io != NULL);
+
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_buffered(io, FALSE);
+
+	return io;
+}
+
+static void test_scheduler(void)
+{
+	static const guint8 status[] = { GSM0710_STATUS_SET, 0x03, 0x07, 0x8d };
+	guint8 bulk[4000];
+	guint8 control[16];
+	guint8 wire[16384];
+	GIOChannel *io, *dlc1, *dlc2;
+	GAtMuxStats stats;
+	GAtMux *smux;
+	gsize written;
+	int sk[2];
+	int len = 0;
+	int nread;
+	int offset;
+	int frames = 0;
+	int last_dlc2 = -1;
+	int first_data = -1;
+	int status_frame = -1;
+	guint8 dlc, ctrl;
+	guint8 *frame;
+	int frame_len;
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+
+	io = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_buffered(io, FALSE);
+	g_io_channel_set_flags(io, G_IO_FLAG_NONBLOCK, NULL);
+
+	smux = g_at_mux_new_gsm0710_basic(io, 31);
+	g_io_channel_unref(io);
+	g_assert(g_at_mux_start(smux));
+
+	dlc1 = scheduler_channel(smux);
+	dlc2 = scheduler_channel(smux);
+
+	memset(bulk, 0x55, sizeof(bulk));
+
+	/* A bulk transfer on DLC 1 queued ahead of a short command on DLC 2 */
+	g_io_channel_write_chars(dlc1, (gchar *) bulk, sizeof(bulk),
+							&written, NULL);
+	g_io_channel_write_chars(dlc2, "AT+CSQ\r", 7, &written, NULL);
+
+	g_assert(g_at_mux_get_dlc_stats(smux, 1, &stats));
+	g_assert(stats.queued_bytes > sizeof(bulk));
+	g_assert(stats.queued_frames == (sizeof(bulk) + 30) / 31);
+
+	/* Control frames overtake queued data */
+	offset = gsm0710_basic_fill_frame(control, 0, GSM0710_DATA,
+						status, sizeof(status));
+	g_at_mux_raw_write(smux, control, offset);
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	g_assert(g_at_mux_get_dlc_stats(smux, 1, &stats));
+	g_assert(stats.queued_bytes == 0);
+	g_assert(stats.tx_frames == (sizeof(bulk) + 30) / 31);
+
+	g_assert(g_at_mux_get_dlc_stats(smux, 0, &stats));
+	g_assert(stats.tx_frames == 4);
+
+	fcntl(sk[1], F_SETFL, O_NONBLOCK);
+
+	while ((nread = read(sk[1], wire + len, sizeof(wire) - len)) > 0)
+		len += nread;
+
+	for (offset = 0; offset < len; offset += nread, frames++) {
+		frame = NULL;
+		nread = gsm0710_basic_extract_frame(wire + offset,
+						len - offset, &dlc, &ctrl,
+						&frame, &frame_len);
+
+		/* Only the closing flag of the last frame may be left */
+		if (frame == NULL) {
+			g_assert(offset + nread >= len - 1);
+			break;
+		}
+
+		if (ctrl != GSM0710_DATA)
+			continue;
+
+		if (dlc == 0)
+			status_frame = frames;
+		else if (first_data < 0)
+			first_data = frames;
+
+		if (dlc == 2)
+			last_dlc2 = frames;
+	}
+
+	g_assert(status_frame >= 0 && status_frame < first_data);
+
+	/* DLC 2 gets its turn after at most one quantum of DLC 1 */
+	g_assert(last_dlc2 >= 0 && last_dlc2 - first_data < 10);
+
+	g_io_channel_unref(dlc1);
+	g_io_channel_unref(dlc2);
+	g_at_mux_unref(smux);
+	close(sk[1]);
+}
+
+static gboolean receive_read(GIOChannel *io, GIOCondition cond,
+							gpointer data)
+{
+	GByteArray *received = data;
+	gchar buf[700];
+	gsize rbytes;
+
+	/* Read in odd sized chunks so that payloads are split */
+	while (g_io_channel_read_chars(io, buf, sizeof(buf), &rbytes,
+					NULL) == G_IO_STATUS_NORMAL)
+		g_byte_array_append(received, (guint8 *) buf, rbytes);
+
+	return TRUE;
+}
+
+static void test_receive(void)
+{
+	static const int sizes[] = { 10, 1500, 31, 31, 600, 5, 1200, 300 };
+	GByteArray *received = g_byte_array_new();
+	GByteArray *sent = g_byte_array_new();
+	guint8 wire[8192];
+	guint8 payload[1500];
+	GIOChannel *io, *dlc;
+	GAtMux *rmux;
+	gsize len = 0;
+	unsigned int i;
+	int j;
+	int sk[2];
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+
+	io = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_buffered(io, FALSE);
+	g_io_channel_set_flags(io, G_IO_FLAG_NONBLOCK, NULL);
+
+	rmux = g_at_mux_new_gsm0710_basic(io, 31);
+	g_io_channel_unref(io);
+	g_assert(g_at_mux_start(rmux));
+
+	dlc = g_at_mux_create_channel(rmux);
+	g_io_channel_set_encoding(dlc, NULL, NULL);
+	g_io_channel_set_buffered(dlc, FALSE);
+	g_io_add_watch(dlc, G_IO_IN, receive_read, received);
+
+	/* Small and large payloads arriving in one read */
+	for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+		for (j = 0; j < sizes[i]; j++)
+			payload[j] = i * 31 + j;
+
+		len += gsm0710_basic_fill_frame(wire + len, 1, GSM0710_DATA,
+							payload, sizes[i]);
+		g_byte_array_append(sent, payload, sizes[i]);
+	}
+
+	g_assert(len <= 4096);
+	g_assert(write(sk[1], wire, len) == (gssize) len);
+
+	while (received->len < sent->len)
+		g_main_context_iteration(NULL, TRUE);
+
+	g_assert(received->len == sent->len);
+	g_assert(memcmp(received->data, sent->data, sent->len) == 0);
+
+	g_io_channel_unref(dlc);
+	g_at_mux_unref(rmux);
+	close(sk[1]);
+	g_byte_array_free(received, TRUE);
+	g_byte_array_free(sent, TRUE);
+}
+
+#define PERF_FRAMES 100000
+
+struct perf_reader {
+	gsize received;
+	gboolean corrupt;
+};
+
+/* Mode 0 is basic, mode 1 is advanced */
+static guint8 *perf_build_frames(guint mode, int frames, gsize *out_len)
+{
+	guint8 payload[64];
+	int payload_len = mode ? 64 : 31;
+	guint8 *buf = g_malloc(frames * (payload_len * 2 + 8));
+	gsize len = 0;
+	int i;
+
+	/* Sprinkle in bytes that need escaping in advanced mode */
+	for (i = 0; i < payload_len; i++)
+		payload[i] = i % 16 ? 'a' + i % 26 : 0x7E;
+
+	for (i = 0; i < frames; i++) {
+		if (mode == 0)
+			len += gsm0710_basic_fill_frame(buf + len, 1,
+						GSM0710_DATA, payload,
+						payload_len);
+		else
+			len += gsm0710_advanced_fill_frame(buf + len, 1,
+						GSM0710_DATA, payload,
+						payload_len);
+	}
+
+	*out_len = len;
+
+	return buf;
+}
+
+static void test_perf_extract(gconstpointer data)
+{
+	guint mode = GPOINTER_TO_UINT(data);
+	GTimer *timer = g_timer_new();
+	guint8 *frames;
+	guint8 *work;
+	gsize len;
+	gsize posn = 0;
+	int count = 0;
+	gdouble elapsed;
+
+	frames = perf_build_frames(mode, PERF_FRAMES, &len);
+	work = g_memdup(frames, len);
+
+	g_timer_start(timer);
+
+	while (posn < len) {
+		guint8 dlc, ctrl;
+		guint8 *frame = NULL;
+		int frame_len;
+		int nread;
+
+		if (mode == 0)
+			nread = gsm0710_basic_extract_frame(work + posn,
+						len - posn, &dlc, &ctrl,
+						&frame, &frame_len);
+		else
+			nread = gsm0710_advanced_extract_frame(work + posn,
+						len - posn, &dlc, &ctrl,
+						&frame, &frame_len);
+
+		if (frame == NULL)
+			break;
+
+		g_assert(dlc == 1);
+		count += 1;
+		posn += nread;
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_assert(count == PERF_FRAMES);
+
+	g_test_maximized_result(count / elapsed, "%s extract: %.0f frames/s",
+					mode ? "advanced" : "basic",
+					count / elapsed);
+
+	g_free(work);
+	g_free(frames);
+	g_timer_destroy(timer);
+}
+
+static gboolean perf_read(GIOChannel *io, GIOCondition cond, gpointer data)
+{
+	struct perf_reader *reader = data;
+	gchar buf[4096];
+	gsize rbytes;
+	gsize i;
+
+	while (g_io_channel_read_chars(io, buf, sizeof(buf), &rbytes,
+					NULL) == G_IO_STATUS_NORMAL) {
+		for (i = 0; i < rbytes; i++)
+			if (buf[i] == 0x7D)
+				reader->corrupt = TRUE;
+
+		reader->received += rbytes;
+	}
+
+	return TRUE;
+}
+
+static void test_perf_feed(gconstpointer data)
+{
+	guint mode = GPOINTER_TO_UINT(data);
+	struct perf_reader reader = { 0, FALSE };
+	GTimer *timer = g_timer_new();
+	GIOChannel *io, *dlc;
+	GAtMux *pmux;
+	guint8 *frames;
+	gsize len;
+	gsize sent = 0;
+	gsize expected = PERF_FRAMES * (mode ? 64 : 31);
+	gdouble elapsed;
+	int sk[2];
+
+	frames = perf_build_frames(mode, PERF_FRAMES, &len);
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+	fcntl(sk[1], F_SETFL, O_NONBLOCK);
+
+	io = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_buffered(io, FALSE);
+	g_io_channel_set_flags(io, G_IO_FLAG_NONBLOCK, NULL);
+
+	if (mode == 0)
+		pmux = g_at_mux_new_gsm0710_basic(io, 31);
+	else
+		pmux = g_at_mux_new_gsm0710_advanced(io, 64);
+
+	g_io_channel_unref(io);
+	g_assert(g_at_mux_start(pmux));
+
+	dlc = g_at_mux_create_channel(pmux);
+	g_io_channel_set_encoding(dlc, NULL, NULL);
+	g_io_channel_set_buffered(dlc, FALSE);
+	g_io_add_watch(dlc, G_IO_IN, perf_read, &reader);
+
+	g_timer_start(timer);
+
+	while (reader.received < expected) {
+		if (sent < len) {
+			gssize n = write(sk[1], frames + sent, len - sent);
+
+			if (n > 0)
+				sent += n;
+		}
+
+		g_main_context_iteration(NULL, sent == len);
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	g_assert(reader.received == expected);
+	g_assert(!reader.corrupt);
+
+	g_test_maximized_result(PERF_FRAMES / elapsed,
+				"%s feed: %.0f frames/s",
+				mode ? "advanced" : "basic",
+				PERF_FRAMES / elapsed);
+
+	g_io_channel_unref(dlc);
+	g_at_mux_unref(pmux);
+	close(sk[1]);
+	g_free(frames);
+	g_timer_destroy(timer);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -564,7 +924,20 @@ int main(int argc, char **argv)
 	g_test_add_func("/testmux/fill_advanced", test_fill_advanced);
 	g_test_add_func("/testmux/extract_basic", test_extract_basic);
 	g_test_add_func("/testmux/extract_advanced", test_extract_advanced);
+	g_test_add_func("/testmux/scheduler", test_scheduler);
+	g_test_add_func("/testmux/receive", test_receive);
 	g_test_add_func("/testmux/basic", test_basic);
 
+	if (g_test_perf()) {
+		g_test_add_data_func("/testmux/perf/extract_basic",
+					GUINT_TO_POINTER(0), test_perf_extract);
+		g_test_add_data_func("/testmux/perf/extract_advanced",
+					GUINT_TO_POINTER(1), test_perf_extract);
+		g_test_add_data_func("/testmux/perf/feed_basic",
+					GUINT_TO_POINTER(0), test_perf_feed);
+		g_test_add_data_func("/testmux/perf/feed_advanced",
+					GUINT_TO_POINTER(1), test_perf_feed);
+	}
+
 	return g_test_run();
 }
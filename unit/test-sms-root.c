@@ -27,13 +27,17 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
 
 #include "util.h"
+#include "storage.h"
 #include "smsutil.h"
 
+#define TX_UUID "0123456789ABCDEF0123456789ABCDEF01234567"
+
 static const char *assembly_pdu1 = "038121F340048155550119906041001222048C0500"
 					"031E0301041804420430043A002C002004100"
 					"43B0435043A04410430043D04340440002000"
@@ -115,12 +119,166 @@ static void test_serialize_assembly(void)
 	sms_assembly_free(assembly);
 }
 
+static void tx_store(const char *imsi, unsigned long id, guint8 seq)
+{
+	unsigned char pdu[176];
+	GSList *msgs;
+	int pdu_len, tpdu_len;
+
+	msgs = sms_text_prepare("+15555550123", "journal test", 0, FALSE,
+					FALSE);
+	g_assert(msgs != NULL);
+	g_assert(sms_encode(msgs->data, &pdu_len, &tpdu_len, pdu));
+
+	g_assert(sms_tx_backup_store(imsi, id, 0, TX_UUID, seq, pdu,
+					pdu_len, tpdu_len));
+
+	g_slist_free_full(msgs, g_free);
+}
+
+static unsigned int tx_queue_free(GQueue *queue, unsigned int *pdus)
+{
+	struct txq_backup_entry *entry;
+	unsigned int entries = 0;
+
+	*pdus = 0;
+
+	while ((entry = g_queue_pop_head(queue))) {
+		*pdus += g_slist_length(entry->msg_list);
+		entries += 1;
+
+		g_slist_free_full(entry->msg_list, g_free);
+		g_free(entry);
+	}
+
+	g_queue_free(queue);
+
+	return entries;
+}
+
+static void test_tx_queue_backup(void)
+{
+	const char *imsi = "1235";
+	unsigned int pdus;
+
+	tx_store(imsi, 5, 0);
+	tx_store(imsi, 5, 1);
+	tx_store(imsi, 9, 0);
+	sms_tx_backup_remove(imsi, 5, 0, TX_UUID, 0);
+
+	g_assert(tx_queue_free(sms_tx_queue_load(imsi), &pdus) == 2);
+	g_assert(pdus == 2);
+
+	/* Loading renumbers the entries to 0 and 1 */
+	sms_tx_backup_remove(imsi, 0, 0, TX_UUID, 1);
+	g_assert(tx_queue_free(sms_tx_queue_load(imsi), &pdus) == 1);
+
+	sms_tx_backup_free(imsi, 0, 0, TX_UUID);
+	g_assert(tx_queue_free(sms_tx_queue_load(imsi), &pdus) == 0);
+
+	sms_tx_queue_unload(imsi);
+}
+
+static void test_tx_queue_migrate(void)
+{
+	const char *imsi = "1236";
+	unsigned char pdu[176];
+	GSList *msgs;
+	int pdu_len, tpdu_len;
+	unsigned int pdus;
+	struct stat st;
+	char *journal;
+	gsize journal_len;
+	gsize i;
+
+	msgs = sms_text_prepare("+15555550123", "old layout", 0, FALSE,
+					FALSE);
+	g_assert(sms_encode(msgs->data, &pdu_len, &tpdu_len, pdu + 1));
+	pdu[0] = tpdu_len;
+	g_slist_free_full(msgs, g_free);
+
+	g_assert(write_file(pdu, pdu_len + 1, 0600,
+				STORAGEDIR "/%s/tx_queue/3-0-%s/000",
+				imsi, TX_UUID) == pdu_len + 1);
+
+	/* Leftover of an interrupted write_file() */
+	g_assert(write_file(pdu, pdu_len + 1, 0600,
+				STORAGEDIR "/%s/tx_queue/3-0-%s/001.a1b2c3.tmp",
+				imsi, TX_UUID) == pdu_len + 1);
+
+	/* Not a queue entry, must not swallow the real one sorted after it */
+	g_assert(write_file(pdu, pdu_len + 1, 0600,
+				STORAGEDIR "/%s/tx_queue/1", imsi) == pdu_len + 1);
+
+	g_assert(tx_queue_free(sms_tx_queue_load(imsi), &pdus) == 1);
+	g_assert(pdus == 1);
+
+	g_assert(stat(STORAGEDIR "/1236/tx_queue", &st) < 0);
+
+	/* The temporary file was never imported */
+	g_assert(g_file_get_contents(STORAGEDIR "/1236/sms_journal",
+					&journal, &journal_len, NULL));
+
+	for (i = 0; i + 4 <= journal_len; i++)
+		g_assert(memcmp(journal + i, ".tmp", 4) != 0);
+
+	g_free(journal);
+
+	sms_tx_backup_free(imsi, 0, 0, TX_UUID);
+	sms_tx_queue_unload(imsi);
+}
+
+static void test_journal_recovery(void)
+{
+	const char *imsi = "1237";
+	struct sms_assembly *assembly;
+	unsigned int pdus;
+	struct stat st;
+	FILE *f;
+	int i;
+
+	tx_store(imsi, 0, 0);
+	sms_tx_queue_unload(imsi);
+
+	/* A crash in the middle of an append leaves a partial record */
+	f = fopen(STORAGEDIR "/1237/sms_journal", "a");
+	g_assert(f != NULL);
+	fputs("torn", f);
+	fclose(f);
+
+	g_assert(tx_queue_free(sms_tx_queue_load(imsi), &pdus) == 1);
+
+	/* Keep the journal open, like the sms atom does */
+	assembly = sms_assembly_new(imsi);
+
+	for (i = 0; i < 4096; i++) {
+		tx_store(imsi, 1, 0);
+		sms_tx_backup_remove(imsi, 1, 0, TX_UUID, 0);
+	}
+
+	sms_assembly_free(assembly);
+	sms_tx_queue_unload(imsi);
+
+	g_assert(stat(STORAGEDIR "/1237/sms_journal", &st) == 0);
+	g_assert(st.st_size < 128 * 1024);
+
+	g_assert(tx_queue_free(sms_tx_queue_load(imsi), &pdus) == 1);
+	sms_tx_backup_free(imsi, 0, 0, TX_UUID);
+	sms_tx_queue_unload(imsi);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
 
 	g_test_add_func("/testsms/Test SMS Assembly Serialize",
 			test_serialize_assembly);
+	g_test_add_func("/testsms/Test TX Queue Backup",
+			test_tx_queue_backup);
+	g_test_add_func("/testsms/Test TX Queue Migration",
+			test_tx_queue_migrate);
+	g_test_add_func("/testsms/Test Journal Recovery",
+			test_journal_recovery);
 
 	return g_test_run();
 }
@@ -1470,14 +1470,14 @@ static void test_cbs_assembly(void)
 	/* Add an initial page to the assembly */
 	l = cbs_assembly_add_page(assembly, &dec1);
 	g_assert(l);
-	g_assert(g_slist_length(assembly->recv_cell) == 1);
+	g_assert(g_hash_table_size(assembly->recv_cell) == 1);
 	g_slist_free_full(l, g_free);
 
 	/* Can we receive new updates ? */
 	dec1.update_number = 8;
 	l = cbs_assembly_add_page(assembly, &dec1);
 	g_assert(l);
-	g_assert(g_slist_length(assembly->recv_cell) == 1);
+	g_assert(g_hash_table_size(assembly->recv_cell) == 1);
 	g_slist_free_full(l, g_free);
 
 	/* Do we ignore old pages ? */
@@ -1490,7 +1490,7 @@ static void test_cbs_assembly(void)
 	g_assert(l == NULL);
 
 	cbs_assembly_location_changed(assembly, TRUE, TRUE, TRUE);
-	g_assert(assembly->recv_cell == NULL);
+	g_assert(g_hash_table_size(assembly->recv_cell) == 0);
 
 	dec1.update_number = 9;
 	dec1.page = 3;
@@ -1619,6 +1619,119 @@ static void test_range_minimizer(void)
 	}
 }
 
+static void test_topic_bitmap(void)
+{
+	int i = 0;
+
+	g_assert(cbs_topic_bitmap_new(NULL) == NULL);
+	g_assert(cbs_topic_in_bitmap(NULL, 50) == FALSE);
+
+	while (ranges[i]) {
+		GSList *r = cbs_extract_topic_ranges(ranges[i]);
+		unsigned char *bitmap = cbs_topic_bitmap_new(r);
+		unsigned int topic;
+
+		for (topic = 0; topic < 65536; topic++)
+			g_assert(cbs_topic_in_bitmap(bitmap, topic) ==
+					cbs_topic_in_range(topic, r));
+
+		g_assert(cbs_topic_in_bitmap(bitmap, 65536) == FALSE);
+
+		g_free(bitmap);
+		g_slist_free_full(r, g_free);
+		i++;
+	}
+}
+
+#define FLOOD_MESSAGES	5000
+#define FLOOD_TOPICS	64
+
+/*
+ * An emergency storm: many distinct three page messages arriving
+ * interleaved, each checked against the SIM data download topics.
+ */
+static void test_perf_cbs_flood(void)
+{
+	GSList *topics = NULL;
+	unsigned char *bitmap;
+	struct cbs_assembly *assembly;
+	struct cbs page;
+	unsigned char *pdu;
+	long pdu_len;
+	GTimer *timer = g_timer_new();
+	unsigned int completed = 0;
+	unsigned int matched = 0;
+	unsigned int i, n;
+	GSList *l;
+
+	for (i = 0; i < FLOOD_TOPICS; i++) {
+		struct cbs_topic_range *range = g_new0(struct cbs_topic_range,
+							1);
+
+		range->min = 1000 + i * 100;
+		range->max = range->min;
+		topics = g_slist_append(topics, range);
+	}
+
+	pdu = decode_hex(cbs1, -1, &pdu_len, 0);
+	g_assert(cbs_decode(pdu, pdu_len, &page));
+	g_free(pdu);
+
+	page.max_pages = 3;
+
+	g_timer_start(timer);
+
+	for (i = 0; i < FLOOD_MESSAGES * 3; i++)
+		if (cbs_topic_in_range(4352 + i % 7, topics))
+			matched += 1;
+
+	g_test_message("cbs_topic_in_range: %.1f Mpages/s",
+			i / g_timer_elapsed(timer, NULL) / 1000000);
+
+	bitmap = cbs_topic_bitmap_new(topics);
+	g_timer_start(timer);
+
+	for (i = 0; i < FLOOD_MESSAGES * 3; i++)
+		if (cbs_topic_in_bitmap(bitmap, 4352 + i % 7))
+			matched += 1;
+
+	g_test_message("cbs_topic_in_bitmap: %.1f Mpages/s",
+			i / g_timer_elapsed(timer, NULL) / 1000000);
+
+	g_assert(matched == 0);
+
+	assembly = cbs_assembly_new();
+	g_timer_start(timer);
+
+	/* Deliver every message's first two pages, then all last pages */
+	for (n = 1; n <= 3; n++) {
+		for (i = 0; i < FLOOD_MESSAGES; i++) {
+			page.message_identifier = i / 1024;
+			page.message_code = i % 1024;
+			page.page = n;
+
+			l = cbs_assembly_add_page(assembly, &page);
+			if (l == NULL)
+				continue;
+
+			completed += 1;
+			g_slist_free_full(l, g_free);
+		}
+	}
+
+	g_test_minimized_result(g_timer_elapsed(timer, NULL),
+				"cbs_assembly_add_page: %.0f pages/s",
+				FLOOD_MESSAGES * 3 /
+				g_timer_elapsed(timer, NULL));
+
+	g_assert(completed == FLOOD_MESSAGES);
+
+	cbs_assembly_free(assembly);
+	g_free(bitmap);
+	g_slist_free_full(topics, g_free);
+	g_timer_destroy(timer);
+}
+
 static void test_sr_assembly(void)
 {
 	const char *sr_pdu1 = "06040D91945152991136F00160124130340A0160124130"
@@ -1875,11 +1988,16 @@ int main(int argc, char **argv)
 			test_cbs_padding_character);
 
 	g_test_add_func("/testsms/Range minimizer", test_range_minimizer);
+	g_test_add_func("/testsms/Topic bitmap", test_topic_bitmap);
 
 	g_test_add_func("/testsms/Status Report Assembly", test_sr_assembly);
 
 	g_test_add_data_func("/testsms/Test WAP Push 1", &wap_push_1,
 				test_wap_push);
 
+	if (g_test_perf())
+		g_test_add_func("/testsms/perf/CBS Flood",
+					test_perf_cbs_flood);
+
 	return g_test_run();
 }
@@ -22274,6 +22274,64 @@ static void test_img_to_xpm(gconstpointer data)
 	g_free(xpm);
 }
 
+#define PERF_DECODE_ROUNDS	20000
+#define PERF_VECTOR(name)	{ #name, name, sizeof(name) }
+
+static const struct {
+	const char *name;
+	const unsigned char *pdu;
+	unsigned int len;
+} perf_decode_vectors[] = {
+	PERF_VECTOR(display_text_111),
+	PERF_VECTOR(get_input_111),
+	PERF_VECTOR(setup_menu_111),
+	PERF_VECTOR(setup_menu_121),
+	PERF_VECTOR(select_item_121),
+	PERF_VECTOR(send_sms_111),
+	PERF_VECTOR(setup_call_111),
+	PERF_VECTOR(refresh_121),
+	PERF_VECTOR(launch_browser_111),
+	PERF_VECTOR(open_channel_211),
+};
+
+static void test_perf_decode(void)
+{
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+	gdouble total = 0;
+	unsigned int commands = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(perf_decode_vectors); i++) {
+		const unsigned char *pdu = perf_decode_vectors[i].pdu;
+		unsigned int len = perf_decode_vectors[i].len;
+
+		g_timer_start(timer);
+
+		for (j = 0; j < PERF_DECODE_ROUNDS; j++) {
+			struct stk_command *command;
+
+			command = stk_command_new_from_pdu(pdu, len);
+			g_assert(command != NULL);
+			g_assert(command->status == STK_PARSE_RESULT_OK);
+			stk_command_free(command);
+		}
+
+		elapsed = g_timer_elapsed(timer, NULL);
+		g_test_message("%s: %.0f commands/s",
+				perf_decode_vectors[i].name,
+				PERF_DECODE_ROUNDS / elapsed);
+
+		total += elapsed;
+		commands += PERF_DECODE_ROUNDS;
+	}
+
+	g_test_minimized_result(total, "stk_command_new_from_pdu: "
+					"%.0f commands/s", commands / total);
+
+	g_timer_destroy(timer);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -24386,5 +24444,8 @@ int main(int argc, char **argv)
 	g_test_add_data_func("/teststk/IMG to XPM Test 6",
 				&xpm_test_6, test_img_to_xpm);
 
+	if (g_test_perf())
+		g_test_add_func("/teststk/perf/decode", test_perf_decode);
+
 	return g_test_run();
 }
@@ -895,6 +895,11 @@ static unsigned char sim_82_1[] = { 0x82, 0x05, 0x04, 0x00, 0x2D, 0xB3, 0xB4,
 static unsigned char sim_82_2[] = { 0x82, 0x05, 0xD8, 0x00, 0x2D, 0xB3, 0xB4,
 					0x2D, 0x31 };
 static unsigned char sim_7bit_empty[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static unsigned char sim_81_escape[] = { 0x81, 0x02, 0x00, 0x1B, 0x65, 0xFF };
+static unsigned char sim_81_bad_escape[] = { 0x81, 0x02, 0x00, 0x1B, 0x80,
+						0xFF };
+static unsigned char sim_82_bad_escape[] = { 0x82, 0x02, 0x00, 0x00, 0x1B,
+						0xFF };
 
 static void test_sim(void)
 {
@@ -949,6 +954,18 @@ static void test_sim(void)
 	g_assert(utf8);
 	g_assert(strcmp(utf8, "") == 0);
 	g_free(utf8);
+
+	utf8 = sim_string_to_utf8(sim_81_escape, sizeof(sim_81_escape));
+	g_assert(utf8);
+	g_assert(strcmp(utf8, "\xe2\x82\xac") == 0);
+	g_free(utf8);
+
+	/* The single shift table only has 128 entries */
+	utf8 = sim_string_to_utf8(sim_81_bad_escape, sizeof(sim_81_bad_escape));
+	g_assert(utf8 == NULL);
+
+	utf8 = sim_string_to_utf8(sim_82_bad_escape, sizeof(sim_82_bad_escape));
+	g_assert(utf8 == NULL);
 }
 
 static void test_unicode_to_gsm(void)
@@ -1012,6 +1029,282 @@ static void test_unicode_to_gsm(void)
 	}
 }
 
+/* Bit at a time reference, septets start fill bits into the buffer */
+static void reference_pack(const unsigned char *in, long len, int fill,
+				unsigned char *out)
+{
+	long pos;
+	long i;
+	int b;
+
+	memset(out, 0, (fill + len * 7 + 7) / 8);
+
+	for (i = 0; i < len; i++)
+		for (b = 0; b < 7; b++) {
+			pos = fill + i * 7 + b;
+
+			if (in[i] & (1 << b))
+				out[pos / 8] |= 1 << (pos % 8);
+		}
+}
+
+static void test_pack_groups(void)
+{
+	unsigned char septets[64];
+	unsigned char expected[64];
+	unsigned char packed[64];
+	unsigned char unpacked[80];
+	long written;
+	long len;
+	int offset;
+	int fill;
+	long i;
+
+	for (i = 0; i < (long) sizeof(septets); i++)
+		septets[i] = g_random_int_range(0, 0x80);
+
+	for (offset = 0; offset < 7; offset++) {
+		fill = (7 - offset) % 7;
+
+		for (len = 1; len <= (long) sizeof(septets) - 8; len++) {
+			reference_pack(septets, len, fill, expected);
+
+			g_assert(pack_7bit_own_buf(septets, len, offset, FALSE,
+							&written, 0,
+							packed) != NULL);
+			g_assert(written == (fill + len * 7 + 7) / 8);
+			g_assert(memcmp(packed, expected, written) == 0);
+
+			g_assert(unpack_7bit_own_buf(packed, written, offset,
+							FALSE, len, &written,
+							0, unpacked) != NULL);
+			g_assert(written == len);
+			g_assert(memcmp(unpacked, septets, len) == 0);
+		}
+	}
+}
+
+/* The three attempts convert_utf8_to_gsm_best_lang used to make */
+static unsigned char *reference_best_lang(const char *utf8, long *written,
+						enum gsm_dialect hint,
+						enum gsm_dialect *locking,
+						enum gsm_dialect *single)
+{
+	unsigned char *res;
+
+	*locking = GSM_DIALECT_DEFAULT;
+	*single = GSM_DIALECT_DEFAULT;
+
+	res = convert_utf8_to_gsm_with_lang(utf8, -1, NULL, written, 0,
+						*locking, *single);
+	if (res != NULL || hint == GSM_DIALECT_DEFAULT)
+		return res;
+
+	*single = hint;
+	res = convert_utf8_to_gsm_with_lang(utf8, -1, NULL, written, 0,
+						*locking, *single);
+	if (res != NULL || hint == GSM_DIALECT_SPANISH)
+		return res;
+
+	*locking = hint;
+
+	return convert_utf8_to_gsm_with_lang(utf8, -1, NULL, written, 0,
+						*locking, *single);
+}
+
+static const char *best_lang_texts[] = {
+	"Plain ASCII text",
+	"Escapes {[|]} ~ and the € sign",
+	"Çağrı merkezi: ışık, şeker, İzmir",
+	"Ğğ İı Şş only in the Turkish tables",
+	"Mañana ¿qué tal? Ángel",
+	"Informação: você está à frente, Ê Õ",
+	"ΔΦΓΛΩΠΨΣΘΞ ∞",
+	"1ª e 2º lugar ∞ ç",
+	"Not encodable 漢",
+};
+
+static void test_best_lang(void)
+{
+	enum gsm_dialect hint;
+	unsigned int i;
+
+	for (hint = GSM_DIALECT_DEFAULT; hint <= GSM_DIALECT_PORTUGUESE;
+								hint++) {
+		for (i = 0; i < G_N_ELEMENTS(best_lang_texts); i++) {
+			const char *text = best_lang_texts[i];
+			enum gsm_dialect ref_locking, ref_single;
+			enum gsm_dialect locking, single;
+			unsigned char *expected;
+			unsigned char *res;
+			long expected_len, len;
+
+			expected = reference_best_lang(text, &expected_len,
+							hint, &ref_locking,
+							&ref_single);
+			res = convert_utf8_to_gsm_best_lang(text, -1, NULL,
+							&len, 0, hint,
+							&locking, &single);
+
+			if (expected == NULL) {
+				g_assert(res == NULL);
+				continue;
+			}
+
+			g_assert(res != NULL);
+			g_assert(len == expected_len);
+			g_assert(memcmp(res, expected, len) == 0);
+			g_assert(locking == ref_locking);
+			g_assert(single == ref_single);
+
+			g_free(expected);
+			g_free(res);
+		}
+	}
+}
+
+#define PERF_CHARS	(4 * 1024 * 1024)
+
+static void perf_report(GTimer *timer, const char *what, long chars)
+{
+	gdouble elapsed = g_timer_elapsed(timer, NULL);
+
+	g_test_minimized_result(elapsed, "%s: %.1f Mchars/s", what,
+					chars / elapsed / 1000000);
+}
+
+static void test_perf_gsm(void)
+{
+	static const char *text = "Hello, this is a CBS page [1/3] {ok} ~ ";
+	GTimer *timer = g_timer_new();
+	unsigned char *gsm;
+	unsigned char *packed;
+	unsigned char *unpacked;
+	char *utf8;
+	GString *in = g_string_new(NULL);
+	long gsm_len, packed_len, unpacked_len, utf8_len;
+
+	while (in->len < PERF_CHARS)
+		g_string_append(in, text);
+
+	g_timer_start(timer);
+	gsm = convert_utf8_to_gsm(in->str, in->len, NULL, &gsm_len, 0);
+	perf_report(timer, "convert_utf8_to_gsm", in->len);
+	g_assert(gsm != NULL);
+
+	g_timer_start(timer);
+	packed = pack_7bit(gsm, gsm_len, 0, FALSE, &packed_len, 0);
+	perf_report(timer, "pack_7bit", gsm_len);
+	g_assert(packed != NULL);
+
+	g_timer_start(timer);
+	unpacked = unpack_7bit(packed, packed_len, 0, FALSE, gsm_len,
+				&unpacked_len, 0);
+	perf_report(timer, "unpack_7bit", gsm_len);
+	g_assert(unpacked_len == gsm_len);
+	g_assert(memcmp(unpacked, gsm, gsm_len) == 0);
+
+	g_timer_start(timer);
+	utf8 = convert_gsm_to_utf8(unpacked, unpacked_len, NULL, &utf8_len, 0);
+	perf_report(timer, "convert_gsm_to_utf8", unpacked_len);
+	g_assert(utf8 != NULL);
+	g_assert(g_str_equal(utf8, in->str));
+
+	g_free(utf8);
+	g_free(unpacked);
+	g_free(packed);
+	g_free(gsm);
+	g_string_free(in, TRUE);
+	g_timer_destroy(timer);
+}
+
+static void test_perf_national(void)
+{
+	static const char *text = "Günaydın, İstanbul'da hava güneşli € ";
+	GTimer *timer = g_timer_new();
+	GString *in = g_string_new(NULL);
+	unsigned char *gsm;
+	unsigned char *ucs2;
+	char *utf8;
+	gsize ucs2_len;
+	long gsm_len, utf8_len, nchars;
+
+	while (in->len < PERF_CHARS)
+		g_string_append(in, text);
+
+	nchars = g_utf8_strlen(in->str, in->len);
+
+	g_timer_start(timer);
+	gsm = convert_utf8_to_gsm_with_lang(in->str, in->len, NULL, &gsm_len,
+						0, GSM_DIALECT_TURKISH,
+						GSM_DIALECT_TURKISH);
+	perf_report(timer, "convert_utf8_to_gsm turkish", nchars);
+	g_assert(gsm != NULL);
+
+	g_timer_start(timer);
+	utf8 = convert_gsm_to_utf8_with_lang(gsm, gsm_len, NULL, &utf8_len, 0,
+						GSM_DIALECT_TURKISH,
+						GSM_DIALECT_TURKISH);
+	perf_report(timer, "convert_gsm_to_utf8 turkish", nchars);
+	g_assert(g_str_equal(utf8, in->str));
+	g_free(gsm);
+
+	ucs2 = (unsigned char *) g_convert(in->str, in->len, "UCS-2BE",
+						"UTF-8", NULL, &ucs2_len, NULL);
+	g_assert(ucs2 != NULL);
+
+	g_timer_start(timer);
+	gsm = convert_ucs2_to_gsm_with_lang(ucs2, ucs2_len, NULL, &gsm_len, 0,
+						GSM_DIALECT_TURKISH,
+						GSM_DIALECT_TURKISH);
+	perf_report(timer, "convert_ucs2_to_gsm turkish", nchars);
+	g_assert(gsm != NULL);
+
+	g_free(gsm);
+	g_free(ucs2);
+	g_free(utf8);
+	g_string_free(in, TRUE);
+	g_timer_destroy(timer);
+}
+
+static void test_perf_best_lang(void)
+{
+	GTimer *timer = g_timer_new();
+	enum gsm_dialect locking, single;
+	unsigned char *res;
+	unsigned int n = G_N_ELEMENTS(best_lang_texts);
+	unsigned int i;
+	long len;
+
+	g_timer_start(timer);
+
+	for (i = 0; i < 200000; i++) {
+		res = reference_best_lang(best_lang_texts[i % n], &len,
+						GSM_DIALECT_TURKISH,
+						&locking, &single);
+		g_free(res);
+	}
+
+	g_test_message("three attempts: %.0f texts/s",
+			i / g_timer_elapsed(timer, NULL));
+
+	g_timer_start(timer);
+
+	for (i = 0; i < 200000; i++) {
+		res = convert_utf8_to_gsm_best_lang(best_lang_texts[i % n], -1,
+							NULL, &len, 0,
+							GSM_DIALECT_TURKISH,
+							&locking, &single);
+		g_free(res);
+	}
+
+	g_test_minimized_result(g_timer_elapsed(timer, NULL),
+				"convert_utf8_to_gsm_best_lang: %.0f texts/s",
+				i / g_timer_elapsed(timer, NULL));
+
+	g_timer_destroy(timer);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -1028,6 +1321,15 @@ int main(int argc, char **argv)
 	g_test_add_func("/testutil/SIM conversions", test_sim);
 	g_test_add_func("/testutil/Valid Unicode to GSM Conversion",
 			test_unicode_to_gsm);
+	g_test_add_func("/testutil/Pack Groups", test_pack_groups);
+	g_test_add_func("/testutil/Best Language", test_best_lang);
+
+	if (g_test_perf()) {
+		g_test_add_func("/testutil/perf/GSM", test_perf_gsm);
+		g_test_add_func("/testutil/perf/National", test_perf_national);
+		g_test_add_func("/testutil/perf/Best Language",
+						test_perf_best_lang);
+	}
 
 	return g_test_run();
 }